@@ -0,0 +1,572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_rom_crc.h"
+#include "authclient.h"
+#include "accessdb.h"
+
+/** TYPES **/
+
+// Streams sorted records into the inactive slot
+typedef struct {
+    int slot;
+    uint32_t count;
+    uint32_t crc;
+    uint32_t fill;
+    accessdb_record_t last;
+    esp_err_t err;
+} slot_writer_t;
+
+// Response headers captured by the HTTP event handler
+typedef struct {
+    uint32_t version;
+    bool has_version;
+    char etag[sizeof(((accessdb_header_t*)0)->etag)];
+} sync_response_t;
+
+// A pushed grant or revoke, dropped once a slot of at least version is mounted
+typedef struct {
+    accessdb_record_t rec;
+    bool allowed;
+    uint32_t version;
+} overlay_entry_t;
+
+/** GLOBALS **/
+
+static const esp_partition_t* partition;
+static SemaphoreHandle_t db_lock;
+
+// currently mounted slot
+static int active_slot = -1;
+static accessdb_header_t active_header;
+static const accessdb_record_t* records;
+static esp_partition_mmap_handle_t mmap_handle;
+
+static overlay_entry_t overlay[ACCESSDB_OVERLAY_MAX];
+static uint16_t overlay_count;
+
+static TaskHandle_t sync_handle;
+static uint32_t sync_interval_ms = ACCESSDB_SYNC_INTERVAL_MS;
+
+// flash write staging buffer, one sector
+static uint8_t write_buf[4096];
+
+static const char* TAG = "ACCESSDB";
+
+/** FUNCTIONS **/
+
+static uint32_t header_crc(const accessdb_header_t* hdr)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)hdr, offsetof(accessdb_header_t, header_crc));
+}
+
+static bool read_header(int slot, accessdb_header_t* hdr)
+{
+    if (esp_partition_read(partition, slot * ACCESSDB_SLOT_SIZE, hdr, sizeof(*hdr)) != ESP_OK) {
+        return false;
+    }
+    return hdr->magic == ACCESSDB_MAGIC
+        && hdr->format == ACCESSDB_FORMAT
+        && hdr->record_size == sizeof(accessdb_record_t)
+        && hdr->count <= ACCESSDB_MAX_RECORDS
+        && hdr->header_crc == header_crc(hdr);
+}
+
+// Forget pushed changes the mounted version already contains
+static void prune_overlay_locked(uint32_t version)
+{
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < overlay_count; i++) {
+        if (overlay[i].version > version) {
+            overlay[kept++] = overlay[i];
+        }
+    }
+    overlay_count = kept;
+}
+
+static overlay_entry_t* find_overlay_locked(const accessdb_record_t* key)
+{
+    for (uint16_t i = 0; i < overlay_count; i++) {
+        if (memcmp(&overlay[i].rec, key, sizeof(*key)) == 0) {
+            return &overlay[i];
+        }
+    }
+    return NULL;
+}
+
+// Map a slot and make it the one used by lookups
+static esp_err_t mount_slot(int slot, const accessdb_header_t* hdr)
+{
+    const void* ptr = NULL;
+    esp_partition_mmap_handle_t handle;
+    size_t size = sizeof(accessdb_header_t) + hdr->count * sizeof(accessdb_record_t);
+
+    esp_err_t err = esp_partition_mmap(partition, slot * ACCESSDB_SLOT_SIZE, size,
+        ESP_PARTITION_MMAP_DATA, &ptr, &handle);
+    if (err != ESP_OK) return err;
+
+    const accessdb_record_t* mapped = (const accessdb_record_t*)((const uint8_t*)ptr + sizeof(accessdb_header_t));
+    if (esp_rom_crc32_le(0, (const uint8_t*)mapped, hdr->count * sizeof(accessdb_record_t)) != hdr->records_crc) {
+        esp_partition_munmap(handle);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    xSemaphoreTake(db_lock, portMAX_DELAY);
+    bool had_mapping = active_slot >= 0;
+    esp_partition_mmap_handle_t old_handle = mmap_handle;
+    records = mapped;
+    mmap_handle = handle;
+    active_header = *hdr;
+    active_slot = slot;
+    prune_overlay_locked(hdr->version);
+    xSemaphoreGive(db_lock);
+
+    if (had_mapping) {
+        esp_partition_munmap(old_handle);
+    }
+
+    ESP_LOGI(TAG, "Mounted slot %d: version %lu, %lu UIDs", slot,
+        (unsigned long)hdr->version, (unsigned long)hdr->count);
+    return ESP_OK;
+}
+
+esp_err_t accessdb_init(void)
+{
+    if (db_lock == NULL) {
+        db_lock = xSemaphoreCreateMutex();
+        if (db_lock == NULL) return ESP_ERR_NO_MEM;
+    }
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        ACCESSDB_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 2 * ACCESSDB_SLOT_SIZE) {
+        ESP_LOGE(TAG, "No usable '%s' partition", ACCESSDB_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // mount the newest valid slot, falling back to the other one
+    accessdb_header_t hdr[2];
+    bool valid[2] = { read_header(0, &hdr[0]), read_header(1, &hdr[1]) };
+    int first = (valid[1] && (!valid[0] || hdr[1].generation > hdr[0].generation)) ? 1 : 0;
+
+    for (int i = 0; i < 2; i++) {
+        int slot = i == 0 ? first : 1 - first;
+        if (valid[slot] && mount_slot(slot, &hdr[slot]) == ESP_OK) {
+            return ESP_OK;
+        }
+    }
+
+    ESP_LOGI(TAG, "No database in flash yet");
+    return ESP_OK;
+}
+
+bool accessdb_is_ready(void)
+{
+    return active_slot >= 0;
+}
+
+uint32_t accessdb_version(void)
+{
+    return active_slot >= 0 ? active_header.version : 0;
+}
+
+uint32_t accessdb_count(void)
+{
+    return active_slot >= 0 ? active_header.count : 0;
+}
+
+// Binary search over the memory-mapped slot, no heap use
+bool accessdb_lookup(const uint8_t* uid, uint8_t uid_len)
+{
+    if (uid_len == 0 || uid_len > ACCESSDB_MAX_UID_LEN) {
+        return false;
+    }
+
+    accessdb_record_t key = { .len = uid_len };
+    memcpy(key.uid, uid, uid_len);
+
+    bool found = false;
+    xSemaphoreTake(db_lock, portMAX_DELAY);
+    const overlay_entry_t* pushed = find_overlay_locked(&key);
+    if (pushed != NULL) {
+        found = pushed->allowed;
+    }
+    else if (active_slot >= 0) {
+        int lo = 0;
+        int hi = (int)active_header.count - 1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            int cmp = memcmp(&records[mid], &key, sizeof(key));
+            if (cmp == 0) {
+                found = true;
+                break;
+            }
+            if (cmp < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+    }
+    xSemaphoreGive(db_lock);
+
+    return found;
+}
+
+// Record a change pushed by the server so lookups see it right away, before
+// the next sync brings a slot with that version. Versions must only grow:
+// a change the mounted slot or a pending change already covers returns
+// ESP_ERR_INVALID_VERSION and is ignored. With the overlay full a revoke
+// replaces a pending grant, whose card goes back to the mounted slot's
+// answer; ESP_ERR_NO_MEM means sync now.
+esp_err_t accessdb_apply(const uint8_t* uid, uint8_t uid_len, bool allowed, uint32_t version)
+{
+    if (uid_len == 0 || uid_len > ACCESSDB_MAX_UID_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (db_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    accessdb_record_t key = { .len = uid_len };
+    memcpy(key.uid, uid, uid_len);
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(db_lock, portMAX_DELAY);
+    overlay_entry_t* entry = find_overlay_locked(&key);
+    if ((active_slot >= 0 && version <= active_header.version) || (entry != NULL && version <= entry->version)) {
+        xSemaphoreGive(db_lock);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (entry == NULL && overlay_count < ACCESSDB_OVERLAY_MAX) {
+        entry = &overlay[overlay_count++];
+    }
+    if (entry == NULL && !allowed) {
+        for (uint16_t i = 0; i < overlay_count && entry == NULL; i++) {
+            if (overlay[i].allowed) {
+                entry = &overlay[i];
+            }
+        }
+    }
+    if (entry != NULL) {
+        entry->rec = key;
+        entry->allowed = allowed;
+        entry->version = version;
+    }
+    else {
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(db_lock);
+
+    return err;
+}
+
+/** SLOT WRITER **/
+
+static esp_err_t writer_flush(slot_writer_t* w)
+{
+    if (w->fill == 0 || w->err != ESP_OK) {
+        return w->err;
+    }
+    // records start right after the header, the header itself is written last
+    uint32_t offset = w->slot * ACCESSDB_SLOT_SIZE + sizeof(accessdb_header_t)
+        + w->count * sizeof(accessdb_record_t) - w->fill;
+    w->err = esp_partition_write(partition, offset, write_buf, w->fill);
+    w->fill = 0;
+    return w->err;
+}
+
+static esp_err_t writer_begin(slot_writer_t* w, int slot)
+{
+    memset(w, 0, sizeof(*w));
+    w->slot = slot;
+    w->err = esp_partition_erase_range(partition, slot * ACCESSDB_SLOT_SIZE, ACCESSDB_SLOT_SIZE);
+    return w->err;
+}
+
+static esp_err_t writer_add(slot_writer_t* w, const accessdb_record_t* rec)
+{
+    if (w->err != ESP_OK) {
+        return w->err;
+    }
+    if (rec->len == 0 || rec->len > ACCESSDB_MAX_UID_LEN
+        || (w->count > 0 && memcmp(rec, &w->last, sizeof(*rec)) <= 0)) {
+        ESP_LOGE(TAG, "Record %lu out of order or malformed", (unsigned long)w->count);
+        return w->err = ESP_ERR_INVALID_RESPONSE;
+    }
+    if (w->count == ACCESSDB_MAX_RECORDS) {
+        ESP_LOGE(TAG, "Database exceeds %u records", (unsigned)ACCESSDB_MAX_RECORDS);
+        return w->err = ESP_ERR_INVALID_SIZE;
+    }
+
+    if (w->fill + sizeof(*rec) > sizeof(write_buf)) {
+        if (writer_flush(w) != ESP_OK) return w->err;
+    }
+    memcpy(write_buf + w->fill, rec, sizeof(*rec));
+    w->fill += sizeof(*rec);
+    w->count++;
+    w->crc = esp_rom_crc32_le(w->crc, (const uint8_t*)rec, sizeof(*rec));
+    w->last = *rec;
+    return ESP_OK;
+}
+
+static esp_err_t writer_finish(slot_writer_t* w, uint32_t version, const char* etag)
+{
+    if (writer_flush(w) != ESP_OK) return w->err;
+
+    accessdb_header_t hdr = {
+        .magic = ACCESSDB_MAGIC,
+        .format = ACCESSDB_FORMAT,
+        .record_size = sizeof(accessdb_record_t),
+        .generation = active_slot >= 0 ? active_header.generation + 1 : 1,
+        .version = version,
+        .count = w->count,
+        .records_crc = w->crc,
+    };
+    strlcpy(hdr.etag, etag, sizeof(hdr.etag));
+    hdr.header_crc = header_crc(&hdr);
+
+    esp_err_t err = esp_partition_write(partition, w->slot * ACCESSDB_SLOT_SIZE, &hdr, sizeof(hdr));
+    if (err != ESP_OK) return err;
+
+    return mount_slot(w->slot, &hdr);
+}
+
+/** SYNC **/
+
+static esp_err_t http_event_handler(esp_http_client_event_t* evt)
+{
+    sync_response_t* resp = evt->user_data;
+    if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+        if (strcasecmp(evt->header_key, "X-Db-Version") == 0) {
+            resp->version = strtoul(evt->header_value, NULL, 10);
+            resp->has_version = true;
+        }
+        else if (strcasecmp(evt->header_key, "ETag") == 0) {
+            strlcpy(resp->etag, evt->header_value, sizeof(resp->etag));
+        }
+    }
+    return ESP_OK;
+}
+
+// Open a GET request and return the HTTP status, or a negative value on error
+static int sync_open(esp_http_client_handle_t* client, const char* url, sync_response_t* resp)
+{
+    memset(resp, 0, sizeof(*resp));
+    esp_http_client_config_t config = {
+        .url = url,
+        .method = HTTP_METHOD_GET,
+        .timeout_ms = ACCESSDB_HTTP_TIMEOUT_MS,
+        .event_handler = http_event_handler,
+        .user_data = resp,
+    };
+    authclient_apply_tls(&config);
+    *client = esp_http_client_init(&config);
+    if (*client == NULL) {
+        return -1;
+    }
+    if (active_slot >= 0 && active_header.etag[0] != '\0') {
+        esp_http_client_set_header(*client, "If-None-Match", active_header.etag);
+    }
+
+    esp_err_t err = esp_http_client_open(*client, 0);
+    if (err != ESP_OK || esp_http_client_fetch_headers(*client) < 0) {
+        ESP_LOGW(TAG, "GET %s failed: %s", url, esp_err_to_name(err));
+        return -1;
+    }
+    return esp_http_client_get_status_code(*client);
+}
+
+// Read exactly len bytes, or fewer at end of body
+static int sync_read(esp_http_client_handle_t client, uint8_t* buf, int len)
+{
+    int total = 0;
+    while (total < len) {
+        int n = esp_http_client_read(client, (char*)buf + total, len - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    return total;
+}
+
+// Download the full allow-list into the inactive slot
+static esp_err_t sync_snapshot(const char* server_url)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "%s" ACCESSDB_SNAPSHOT_PATH, server_url);
+
+    esp_http_client_handle_t client;
+    sync_response_t resp;
+    int status = sync_open(&client, url, &resp);
+    esp_err_t err = ESP_OK;
+
+    if (status == 304) {
+        ESP_LOGI(TAG, "Snapshot unchanged");
+    }
+    else if (status == 200 && resp.has_version) {
+        slot_writer_t w;
+        int slot = active_slot >= 0 ? 1 - active_slot : 0;
+        err = writer_begin(&w, slot);
+
+        accessdb_record_t rec;
+        int n;
+        while (err == ESP_OK && (n = sync_read(client, (uint8_t*)&rec, sizeof(rec))) == sizeof(rec)) {
+            err = writer_add(&w, &rec);
+        }
+        if (err == ESP_OK && (n != 0 || !esp_http_client_is_complete_data_received(client))) {
+            err = ESP_ERR_INVALID_SIZE; // truncated body
+        }
+        if (err == ESP_OK) {
+            err = writer_finish(&w, resp.version, resp.etag);
+        }
+    }
+    else {
+        ESP_LOGW(TAG, "Snapshot request returned %d", status);
+        err = ESP_FAIL;
+    }
+
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    return err;
+}
+
+// Apply an incremental update by merging it with the mounted slot.
+// Returns ESP_ERR_NOT_SUPPORTED if a full snapshot is needed instead.
+static esp_err_t sync_delta(const char* server_url)
+{
+    char url[128];
+    snprintf(url, sizeof(url), "%s" ACCESSDB_DELTA_PATH, server_url, (unsigned long)active_header.version);
+
+    esp_http_client_handle_t client;
+    sync_response_t resp;
+    int status = sync_open(&client, url, &resp);
+    esp_err_t err = ESP_OK;
+    uint8_t* ops = NULL;
+
+    if (status == 304) {
+        goto out;
+    }
+    if (status == 410 || status == 404) {
+        err = ESP_ERR_NOT_SUPPORTED;    // server no longer has this version's history
+        goto out;
+    }
+    if (status != 200 || !resp.has_version) {
+        ESP_LOGW(TAG, "Delta request returned %d", status);
+        err = ESP_FAIL;
+        goto out;
+    }
+
+    const size_t op_size = 1 + sizeof(accessdb_record_t);
+    int64_t len = esp_http_client_get_content_length(client);
+    if (len <= 0 || len % op_size != 0 || len / op_size > ACCESSDB_MAX_DELTA_OPS) {
+        err = ESP_ERR_NOT_SUPPORTED;
+        goto out;
+    }
+
+    ops = malloc(len);
+    if (ops == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto out;
+    }
+    if (sync_read(client, ops, len) != len) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto out;
+    }
+
+    // merge: both the mounted records and the delta are sorted
+    slot_writer_t w;
+    err = writer_begin(&w, 1 - active_slot);
+    uint32_t i = 0;
+    uint32_t n_ops = len / op_size;
+    uint32_t j = 0;
+    while (err == ESP_OK && (i < active_header.count || j < n_ops)) {
+        const accessdb_record_t* op_rec = j < n_ops ? (const accessdb_record_t*)&ops[j * op_size + 1] : NULL;
+        int cmp = i == active_header.count ? 1 : op_rec == NULL ? -1 : memcmp(&records[i], op_rec, sizeof(*op_rec));
+
+        if (cmp < 0) {
+            err = writer_add(&w, &records[i++]);
+            continue;
+        }
+        if (ops[j * op_size] == ACCESSDB_OP_ADD) {
+            err = writer_add(&w, op_rec);
+        }
+        if (cmp == 0) {
+            i++;    // replaced or removed
+        }
+        j++;
+    }
+    if (err == ESP_OK) {
+        err = writer_finish(&w, resp.version, resp.etag);
+    }
+
+out:
+    free(ops);
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    return err;
+}
+
+// Run one sync round: a delta when a database is mounted, otherwise a snapshot
+esp_err_t accessdb_sync(const char* server_url)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+    if (active_slot >= 0) {
+        err = sync_delta(server_url);
+    }
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        err = sync_snapshot(server_url);
+    }
+    return err;
+}
+
+static void sync_task(void* arg)
+{
+    const char* server_url = arg;
+    while (1) {
+        esp_err_t err = accessdb_sync(server_url);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Sync failed: %s", esp_err_to_name(err));
+        }
+        // woken early by accessdb_request_sync
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sync_interval_ms));
+    }
+}
+
+// Sync now instead of at the next interval; no-op before the sync task runs,
+// whose first round is about to happen anyway
+void accessdb_request_sync(void)
+{
+    if (sync_handle != NULL) {
+        xTaskNotifyGive(sync_handle);
+    }
+}
+
+// Takes effect after the current wait
+void accessdb_set_sync_interval(uint32_t interval_ms)
+{
+    sync_interval_ms = interval_ms;
+}
+
+esp_err_t accessdb_start_sync_task(const char* server_url)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreate(sync_task, "accessdb_sync", 4096, (void*)server_url, 3, &sync_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
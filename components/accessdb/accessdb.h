@@ -0,0 +1,63 @@
+#ifndef ACCESSDB_H
+#define ACCESSDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+esp_err_t accessdb_init(void);
+bool accessdb_is_ready(void);
+bool accessdb_lookup(const uint8_t* uid, uint8_t uid_len);
+esp_err_t accessdb_sync(const char* server_url);
+esp_err_t accessdb_start_sync_task(const char* server_url);
+uint32_t accessdb_version(void);
+uint32_t accessdb_count(void);
+esp_err_t accessdb_apply(const uint8_t* uid, uint8_t uid_len, bool allowed, uint32_t version);
+void accessdb_request_sync(void);
+void accessdb_set_sync_interval(uint32_t interval_ms);
+
+// Flash layout
+#define ACCESSDB_PARTITION_LABEL    "accessdb"
+#define ACCESSDB_SLOT_SIZE          0x40000     // two slots (A/B) per partition, 256 KB each
+#define ACCESSDB_MAGIC              0x31424441  // "ADB1"
+#define ACCESSDB_FORMAT             1
+#define ACCESSDB_MAX_UID_LEN        10
+
+// Sync configuration
+#define ACCESSDB_SYNC_INTERVAL_MS   (5 * 60 * 1000)
+#define ACCESSDB_PUSH_SYNC_INTERVAL_MS (60 * 60 * 1000)    // while pushed changes keep the database current
+#define ACCESSDB_HTTP_TIMEOUT_MS    10000
+#define ACCESSDB_MAX_DELTA_OPS      512         // larger deltas fall back to a full snapshot
+#define ACCESSDB_SNAPSHOT_PATH      "/uids/snapshot"
+#define ACCESSDB_DELTA_PATH         "/uids/delta?since=%lu"
+
+// Pushed changes not yet in the mounted slot, checked before it
+#define ACCESSDB_OVERLAY_MAX        128
+
+// Delta operations, one byte followed by a record
+#define ACCESSDB_OP_REMOVE          0x00
+#define ACCESSDB_OP_ADD             0x01
+
+// One allowed UID: length byte and zero-padded UID. Records are stored
+// sorted by their raw bytes so lookups are a binary search with memcmp.
+typedef struct {
+    uint8_t len;
+    uint8_t uid[ACCESSDB_MAX_UID_LEN];
+} accessdb_record_t;
+
+// Slot header, written last so a torn update never becomes active
+typedef struct {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t record_size;
+    uint32_t generation;    // bumped on every write, newest valid slot wins
+    uint32_t version;       // server database version (X-Db-Version)
+    uint32_t count;
+    uint32_t records_crc;
+    char etag[36];
+    uint32_t header_crc;    // CRC32 of all preceding fields
+} accessdb_header_t;
+
+#define ACCESSDB_MAX_RECORDS ((ACCESSDB_SLOT_SIZE - sizeof(accessdb_header_t)) / sizeof(accessdb_record_t))
+
+#endif
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "authclient.h"
+#include "wificonnection.h"
+#include "auditlog.h"
+
+/** GLOBALS **/
+
+static const esp_partition_t* partition;
+static QueueHandle_t event_queue;
+static const char* upload_url_base;
+
+// ring position: records are written in seq order, one sector erased ahead of use
+static uint32_t capacity;       // records in the partition
+static uint32_t head;           // ring index of the next write
+static uint32_t next_seq = 1;
+static uint32_t acked_seq;      // highest seq the server has acknowledged
+static uint16_t boot_count;
+
+static auditlog_stats_t stats;
+
+// one POST body, built from flash right before sending
+static uint8_t batch_buf[sizeof(auditlog_batch_header_t) + AUDITLOG_BATCH_MAX * sizeof(auditlog_record_t)];
+
+static const char* TAG = "AUDITLOG";
+
+/** FUNCTIONS **/
+
+static uint32_t record_crc(const auditlog_record_t* rec)
+{
+    return esp_rom_crc32_le(0, (const uint8_t*)rec, offsetof(auditlog_record_t, crc));
+}
+
+static bool read_record(uint32_t index, auditlog_record_t* rec)
+{
+    if (esp_partition_read(partition, index * sizeof(*rec), rec, sizeof(*rec)) != ESP_OK) {
+        return false;
+    }
+    return rec->seq != UINT32_MAX && rec->crc == record_crc(rec);
+}
+
+// Find the newest record: first the sector whose first record has the highest
+// seq, then the last valid record inside it.
+static void find_head(void)
+{
+    uint32_t sectors = capacity / AUDITLOG_RECORDS_PER_SECTOR;
+    uint32_t best_sector = 0;
+    uint32_t best_seq = 0;
+    auditlog_record_t rec;
+
+    for (uint32_t s = 0; s < sectors; s++) {
+        if (read_record(s * AUDITLOG_RECORDS_PER_SECTOR, &rec) && rec.seq > best_seq) {
+            best_seq = rec.seq;
+            best_sector = s;
+        }
+    }
+    if (best_seq == 0) {
+        head = 0;
+        next_seq = 1;
+        return;
+    }
+
+    uint32_t index = best_sector * AUDITLOG_RECORDS_PER_SECTOR;
+    uint32_t end = index + AUDITLOG_RECORDS_PER_SECTOR;
+    while (index < end && read_record(index, &rec)) {
+        next_seq = rec.seq + 1;
+        index++;
+    }
+    head = index % capacity;
+}
+
+static void load_acked(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(AUDITLOG_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_get_u32(nvs, AUDITLOG_NVS_ACKED_KEY, &acked_seq);
+    nvs_close(nvs);
+}
+
+// Count boots so the server can tell which boot a since-boot timestamp is from
+static void count_boot(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(AUDITLOG_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    uint32_t boots = 0;
+    nvs_get_u32(nvs, AUDITLOG_NVS_BOOTS_KEY, &boots);
+    boots++;
+    if (nvs_set_u32(nvs, AUDITLOG_NVS_BOOTS_KEY, boots) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    boot_count = (uint16_t)boots;
+}
+
+static void save_acked(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(AUDITLOG_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_u32(nvs, AUDITLOG_NVS_ACKED_KEY, acked_seq) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+// Oldest seq still in flash; the sector ahead of head is always erased
+static uint32_t oldest_seq(void)
+{
+    uint32_t stored = capacity - AUDITLOG_RECORDS_PER_SECTOR;
+    return next_seq > stored ? next_seq - stored : 1;
+}
+
+static esp_err_t write_record(auditlog_record_t* rec)
+{
+    if (head % AUDITLOG_RECORDS_PER_SECTOR == 0) {
+        // entering a sector: it holds the oldest records, drop them
+        esp_err_t err = esp_partition_erase_range(partition, head * sizeof(*rec), AUDITLOG_SECTOR_SIZE);
+        if (err != ESP_OK) return err;
+    }
+
+    rec->seq = next_seq;
+    rec->crc = record_crc(rec);
+    esp_err_t err = esp_partition_write(partition, head * sizeof(*rec), rec, sizeof(*rec));
+    if (err != ESP_OK) return err;
+
+    next_seq++;
+    head = (head + 1) % capacity;
+
+    // records the server never saw were erased by the ring wrapping
+    uint32_t oldest = oldest_seq();
+    if (acked_seq + 1 < oldest) {
+        stats.overwritten += oldest - (acked_seq + 1);
+        acked_seq = oldest - 1;
+    }
+    return ESP_OK;
+}
+
+// Ring index of a seq that is still stored
+static uint32_t index_of(uint32_t seq)
+{
+    return (head + capacity - (next_seq - seq)) % capacity;
+}
+
+// POST the oldest unacknowledged records; returns how many the server accepted
+static int upload_batch(void)
+{
+    auditlog_batch_header_t* hdr = (auditlog_batch_header_t*)batch_buf;
+    auditlog_record_t* out = (auditlog_record_t*)(batch_buf + sizeof(*hdr));
+    uint32_t seq = acked_seq + 1;
+    uint16_t count = 0;
+
+    while (seq < next_seq && count < AUDITLOG_BATCH_MAX) {
+        if (read_record(index_of(seq), &out[count]) && out[count].seq == seq) {
+            count++;
+        }
+        seq++;
+    }
+    if (count == 0) {
+        acked_seq = seq - 1;    // nothing readable, move past it
+        return 0;
+    }
+    hdr->magic = AUDITLOG_BATCH_MAGIC;
+    hdr->count = count;
+    hdr->record_size = sizeof(auditlog_record_t);
+    hdr->clock = wifi_time_is_set() ? (uint32_t)time(NULL) : 0;
+    hdr->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    hdr->boot = boot_count;
+    hdr->reserved = 0;
+
+    char url[160];
+    snprintf(url, sizeof(url), "%s" AUDITLOG_UPLOAD_PATH, upload_url_base);
+    esp_http_client_config_t config = {
+        .url = url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = AUDITLOG_HTTP_TIMEOUT_MS,
+    };
+    authclient_apply_tls(&config);
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return -1;
+    }
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_http_client_set_post_field(client, (const char*)batch_buf,
+        sizeof(*hdr) + count * sizeof(auditlog_record_t));
+
+    esp_err_t err = esp_http_client_perform(client);
+    int status = err == ESP_OK ? esp_http_client_get_status_code(client) : -1;
+    esp_http_client_cleanup(client);
+
+    if (status != 200 && status != 204) {
+        ESP_LOGW(TAG, "Upload of %u records failed: %s, status %d", count, esp_err_to_name(err), status);
+        return -1;
+    }
+
+    acked_seq = seq - 1;
+    save_acked();
+    stats.uploaded += count;
+    stats.batches++;
+    return count;
+}
+
+// Owns the partition: persists queued events and uploads them in batches
+static void auditlog_task(void* arg)
+{
+    int64_t next_upload_us = esp_timer_get_time() + (int64_t)AUDITLOG_UPLOAD_INTERVAL_MS * 1000;
+    auditlog_record_t rec;
+
+    while (1) {
+        int64_t wait_us = next_upload_us - esp_timer_get_time();
+        TickType_t wait = wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 0;
+
+        // write everything queued, then see whether an upload is due
+        while (xQueueReceive(event_queue, &rec, wait) == pdTRUE) {
+            esp_err_t err = write_record(&rec);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Flash write failed: %s", esp_err_to_name(err));
+            }
+            wait = 0;
+        }
+
+        uint32_t pending = next_seq - 1 - acked_seq;
+        bool due = esp_timer_get_time() >= next_upload_us;
+        if (pending == 0 || (!due && pending < AUDITLOG_BATCH_MIN)) {
+            if (due) {
+                next_upload_us = esp_timer_get_time() + (int64_t)AUDITLOG_UPLOAD_INTERVAL_MS * 1000;
+            }
+            continue;
+        }
+
+        // drain the backlog batch by batch while the server keeps accepting
+        int sent;
+        do {
+            sent = upload_batch();
+        } while (sent > 0 && next_seq - 1 > acked_seq);
+
+        uint32_t interval = sent < 0 ? AUDITLOG_RETRY_MS : AUDITLOG_UPLOAD_INTERVAL_MS;
+        next_upload_us = esp_timer_get_time() + (int64_t)interval * 1000;
+    }
+}
+
+esp_err_t auditlog_init(const char* server_url)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+        AUDITLOG_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 2 * AUDITLOG_SECTOR_SIZE) {
+        ESP_LOGE(TAG, "No usable '%s' partition", AUDITLOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    capacity = partition->size / AUDITLOG_SECTOR_SIZE * AUDITLOG_RECORDS_PER_SECTOR;
+    upload_url_base = server_url;
+
+    find_head();
+    load_acked();
+    count_boot();
+    if (acked_seq >= next_seq) {
+        acked_seq = next_seq - 1;   // log was erased since the last upload
+    }
+    if (acked_seq + 1 < oldest_seq()) {
+        acked_seq = oldest_seq() - 1;
+    }
+    ESP_LOGI(TAG, "%lu records pending upload, next seq %lu", next_seq - 1 - acked_seq, next_seq);
+
+    event_queue = xQueueCreate(AUDITLOG_QUEUE_LEN, sizeof(auditlog_record_t));
+    if (event_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(auditlog_task, "auditlog", 4096, NULL, 2, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Record an access decision. Never blocks; the flash write happens on the
+// audit task. Returns false if the event had to be dropped.
+bool auditlog_append(const uint8_t* uid, uint8_t uid_len, bool granted,
+    auditlog_source_t source, uint32_t latency_us, uint8_t reader)
+{
+    if (event_queue == NULL) {
+        return false;
+    }
+
+    // until SNTP has run time() counts from boot; the server rebases those
+    uint32_t timestamp = wifi_time_is_set() ? (uint32_t)time(NULL) : (uint32_t)(esp_timer_get_time() / 1000000);
+    auditlog_record_t rec = {
+        .timestamp = timestamp,
+        .boot = boot_count,
+        .latency_us = latency_us,
+        .uid_len = uid_len,
+        .granted = granted,
+        .source = source,
+        .reader = reader,
+    };
+    memcpy(rec.uid, uid, uid_len < sizeof(rec.uid) ? uid_len : sizeof(rec.uid));
+
+    if (xQueueSend(event_queue, &rec, 0) != pdTRUE) {
+        stats.dropped++;
+        return false;
+    }
+    stats.appended++;
+    return true;
+}
+
+void auditlog_get_stats(auditlog_stats_t* out)
+{
+    *out = stats;
+    out->pending = next_seq - 1 - acked_seq;
+}
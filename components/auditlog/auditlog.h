@@ -0,0 +1,76 @@
+#ifndef AUDITLOG_H
+#define AUDITLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// What the access decision was based on
+typedef enum {
+    AUDITLOG_SOURCE_ACCESSDB = 0,   // synced offline database
+    AUDITLOG_SOURCE_CACHE,          // UID cache
+    AUDITLOG_SOURCE_SERVER,         // live server request
+    AUDITLOG_SOURCE_OFFLINE,        // no link and no local entry
+    AUDITLOG_SOURCE_CREDENTIAL,     // card credential missing or invalid
+} auditlog_source_t;
+
+// One access event as stored in flash and uploaded, 32 bytes
+typedef struct {
+    uint32_t seq;           // 1, 2, 3... across reboots; 0xFFFFFFFF is erased flash
+    uint32_t timestamp;     // Unix time, or seconds since boot while the clock is not set yet
+    uint32_t latency_us;    // card read to decision
+    uint8_t uid[10];
+    uint8_t uid_len;
+    uint8_t granted;
+    uint8_t source;         // auditlog_source_t
+    uint8_t reader;         // index of the reader the card was presented to
+    uint16_t boot;          // boot counter, which boot a seconds-since-boot timestamp belongs to
+    uint32_t crc;           // CRC32 of all preceding fields
+} auditlog_record_t;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t dropped;       // queue full, never reached flash
+    uint32_t overwritten;   // wrapped around before being uploaded
+    uint32_t uploaded;
+    uint32_t batches;
+    uint32_t pending;       // in flash, not yet acknowledged by the server
+} auditlog_stats_t;
+
+esp_err_t auditlog_init(const char* server_url);
+bool auditlog_append(const uint8_t* uid, uint8_t uid_len, bool granted,
+    auditlog_source_t source, uint32_t latency_us, uint8_t reader);
+void auditlog_get_stats(auditlog_stats_t* out);
+
+// Flash layout
+#define AUDITLOG_PARTITION_LABEL    "auditlog"
+#define AUDITLOG_SECTOR_SIZE        4096
+#define AUDITLOG_RECORDS_PER_SECTOR (AUDITLOG_SECTOR_SIZE / sizeof(auditlog_record_t))
+
+// Upload batching
+#define AUDITLOG_QUEUE_LEN          16
+#define AUDITLOG_BATCH_MAX          64          // records per POST
+#define AUDITLOG_BATCH_MIN          32          // upload early once this many are pending
+#define AUDITLOG_UPLOAD_INTERVAL_MS (60 * 1000) // otherwise upload whatever is pending this often
+#define AUDITLOG_RETRY_MS           (5 * 60 * 1000)
+#define AUDITLOG_HTTP_TIMEOUT_MS    10000
+#define AUDITLOG_UPLOAD_PATH        "/audit"
+#define AUDITLOG_BATCH_MAGIC        0x32445541  // "AUD2"
+#define AUDITLOG_NVS_NAMESPACE      "auditlog"
+#define AUDITLOG_NVS_ACKED_KEY      "acked"
+#define AUDITLOG_NVS_BOOTS_KEY      "boots"
+
+// POST body: this header followed by count records. With clock set, the
+// server turns seconds-since-boot timestamps of this boot into wall-clock
+// time: clock - uptime_s + timestamp.
+typedef struct {
+    uint32_t magic;
+    uint16_t count;
+    uint16_t record_size;
+    uint32_t clock;         // Unix time at upload, 0 while the door's clock is not set
+    uint32_t uptime_s;      // seconds since boot at upload
+    uint16_t boot;          // boot counter at upload
+    uint16_t reserved;
+} auditlog_batch_header_t;
+
+#endif
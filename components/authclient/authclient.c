@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "metrics.h"
+#include "authclient.h"
+
+/** GLOBALS **/
+
+// single long-lived client, its TCP connection is kept open between taps
+static esp_http_client_handle_t client;
+static SemaphoreHandle_t client_lock;
+static char base_url[AUTHCLIENT_URL_LEN];
+static authclient_tls_t tls_creds;
+static TaskHandle_t warm_task;
+static int64_t last_request_us;
+
+// set by the event handler while a request is in flight
+static int64_t connected_at_us;
+static bool connected;
+
+static const char* TAG = "AUTHCLIENT";
+
+/** FUNCTIONS **/
+
+static esp_err_t http_event_handler(esp_http_client_event_t* evt)
+{
+    if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+        connected_at_us = esp_timer_get_time();
+        connected = true;
+    }
+    else if (evt->event_id == HTTP_EVENT_DISCONNECTED) {
+        connected = false;
+    }
+    return ESP_OK;
+}
+
+// One request over the persistent connection; returns the HTTP status or -1
+static int request_once(authclient_timing_t* timing)
+{
+    int64_t start = esp_timer_get_time();
+    bool was_connected = connected;
+    connected_at_us = 0;
+
+    // reuses the open socket if there is one, otherwise connects
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Open failed: %s", esp_err_to_name(err));
+        return -1;
+    }
+    if (esp_http_client_fetch_headers(client) < 0) {
+        ESP_LOGW(TAG, "No response headers");
+        return -1;
+    }
+    timing->ttfb_us = esp_timer_get_time() - start;
+
+    int status = esp_http_client_get_status_code(client);
+
+    // drain the body so the connection can carry the next request
+    int drained = 0;
+    if (esp_http_client_flush_response(client, &drained) != ESP_OK
+        || !esp_http_client_is_complete_data_received(client)) {
+        esp_http_client_close(client);
+        connected = false;
+    }
+
+    timing->total_us = esp_timer_get_time() - start;
+    timing->reused = was_connected && connected_at_us == 0;
+    timing->connect_us = connected_at_us != 0 ? connected_at_us - start : 0;
+    return status;
+}
+
+// GET path over the persistent connection, retrying once on a dead socket.
+// Returns the HTTP status or -1.
+static int perform(const char* path, authclient_timing_t* timing)
+{
+    char url[AUTHCLIENT_URL_LEN + 32];
+    snprintf(url, sizeof(url), "%s%s", base_url, path);
+
+    xSemaphoreTake(client_lock, portMAX_DELAY);
+    esp_http_client_set_url(client, url);
+
+    int status = -1;
+    while (status < 0 && timing->attempts < AUTHCLIENT_MAX_ATTEMPTS) {
+        timing->attempts++;
+        status = request_once(timing);
+        if (status < 0) {
+            // the server may have dropped an idle keep-alive socket, reconnect
+            esp_http_client_close(client);
+            connected = false;
+        }
+    }
+    last_request_us = esp_timer_get_time();
+    xSemaphoreGive(client_lock);
+    return status;
+}
+
+// Keeps the connection open and its TLS session established, so a tap never
+// pays for a handshake. Pings after AUTHCLIENT_IDLE_PING_MS without traffic,
+// or right away when authclient_prewarm is called.
+static void warm_task_fn(void* arg)
+{
+    while (1) {
+        bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AUTHCLIENT_IDLE_PING_MS)) > 0;
+        int64_t idle_us = esp_timer_get_time() - last_request_us;
+        if (!woken && connected && idle_us < (int64_t)AUTHCLIENT_IDLE_PING_MS * 1000) {
+            continue;
+        }
+
+        authclient_timing_t timing = { 0 };
+        int status = perform(AUTHCLIENT_PING_PATH, &timing);
+        if (status < 0) {
+            ESP_LOGD(TAG, "Prewarm failed");
+        }
+        else if (timing.connect_us != 0) {
+            ESP_LOGI(TAG, "Connection prewarmed, connect %lld us", timing.connect_us);
+        }
+    }
+}
+
+// Open the connection now, e.g. when the link comes up
+void authclient_prewarm(void)
+{
+    if (warm_task != NULL) {
+        xTaskNotifyGive(warm_task);
+    }
+}
+
+// Ask the server about a UID.
+// Returns ESP_OK if allowed, ESP_ERR_NOT_FOUND if the server denied it (403
+// or 404), and any other error if no decision came back: unreachable, a
+// malformed request, rate limiting, a proxy error.
+esp_err_t authclient_check_uid(const char* uid_hex, authclient_timing_t* timing)
+{
+    if (client == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    authclient_timing_t local;
+    if (timing == NULL) {
+        timing = &local;
+    }
+    memset(timing, 0, sizeof(*timing));
+
+    char path[40];
+    snprintf(path, sizeof(path), "/uid/%s", uid_hex);
+    int status = perform(path, timing);
+    if (status < 0) {
+        ESP_LOGE(TAG, "Request failed after %d attempts", timing->attempts);
+        return ESP_FAIL;
+    }
+
+    metrics_observe(METRIC_AUTH_REQUEST, (uint32_t)timing->total_us);
+    ESP_LOGI(TAG, "Status = %d (connect %lld us, ttfb %lld us, total %lld us%s)", status,
+        timing->connect_us, timing->ttfb_us, timing->total_us, timing->reused ? ", reused" : "");
+
+    if (status == 200) {
+        return ESP_OK;
+    }
+    if (status == 403 || status == 404) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    // not a decision: a revalidation must not evict the card over it
+    ESP_LOGW(TAG, "Unexpected status %d", status);
+    return ESP_FAIL;
+}
+
+// Fill the TLS fields of any client that talks to the same server
+void authclient_apply_tls(esp_http_client_config_t* config)
+{
+    if (tls_creds.ca_pem == NULL) {
+        return;
+    }
+    config->cert_pem = tls_creds.ca_pem;
+    config->client_cert_pem = tls_creds.client_cert_pem;
+    config->client_key_pem = tls_creds.client_key_pem;
+}
+
+esp_err_t authclient_init(const char* server_url, uint32_t timeout_ms, const authclient_tls_t* tls)
+{
+    if (client != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    strlcpy(base_url, server_url, sizeof(base_url));
+    if (tls != NULL) {
+        tls_creds = *tls;
+    }
+    if (strncmp(base_url, "https:", 6) == 0 && tls_creds.ca_pem == NULL) {
+        ESP_LOGW(TAG, "https server without a CA, the handshake will fail");
+    }
+
+    client_lock = xSemaphoreCreateMutex();
+    if (client_lock == NULL) return ESP_ERR_NO_MEM;
+
+    esp_http_client_config_t config = {
+        .url = base_url,
+        .method = HTTP_METHOD_GET,
+        .timeout_ms = timeout_ms,
+        .keep_alive_enable = true,
+        .event_handler = http_event_handler,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // reconnects resume the TLS session instead of a full handshake
+        .save_client_session = true,
+#endif
+    };
+    authclient_apply_tls(&config);
+    client = esp_http_client_init(&config);
+    if (client == NULL) return ESP_ERR_NO_MEM;
+
+    if (xTaskCreate(warm_task_fn, "authwarm", 4096, NULL, 3, &warm_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,72 @@
+#ifndef AUTHCLIENT_H
+#define AUTHCLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+// Per-request timing, all in microseconds
+typedef struct {
+    int64_t connect_us;     // TCP connect plus TLS handshake, 0 when the connection was reused
+    int64_t ttfb_us;        // request start to response headers
+    int64_t total_us;       // request start to body fully read
+    bool reused;            // served over an already open connection
+    uint8_t attempts;       // 2 if the first attempt hit a dead connection
+} authclient_timing_t;
+
+// Credentials for an https server, PEM strings that must outlive the client.
+// The client certificate and key are optional and go together.
+typedef struct {
+    const char* ca_pem;
+    const char* client_cert_pem;
+    const char* client_key_pem;
+} authclient_tls_t;
+
+esp_err_t authclient_init(const char* server_url, uint32_t timeout_ms, const authclient_tls_t* tls);
+esp_err_t authclient_check_uid(const char* uid_hex, authclient_timing_t* timing);
+void authclient_apply_tls(esp_http_client_config_t* config);
+void authclient_prewarm(void);
+
+// Compact binary protocol over UDP, same return contract as authclient_check_uid
+esp_err_t authclient_udp_init(const char* server_url, uint16_t port, const uint8_t* key, size_t key_len);
+esp_err_t authclient_udp_check_uid(const uint8_t* uid, uint8_t uid_len, authclient_timing_t* timing);
+
+#define AUTHCLIENT_MAX_ATTEMPTS     2       // one transparent reconnect
+#define AUTHCLIENT_URL_LEN          128
+#define AUTHCLIENT_PING_PATH        "/ping"
+#define AUTHCLIENT_IDLE_PING_MS     20000   // under the server's keep-alive idle timeout
+
+// Binary protocol: one datagram each way, authenticated with truncated HMAC-SHA256
+#define AUTHPROTO_MAGIC             0xDA
+#define AUTHPROTO_VERSION           1
+#define AUTHPROTO_CHECK_REQUEST     0x01
+#define AUTHPROTO_CHECK_RESPONSE    0x81
+#define AUTHPROTO_RESULT_DENIED     0
+#define AUTHPROTO_RESULT_ALLOWED    1
+#define AUTHPROTO_MAC_LEN           16
+#define AUTHPROTO_MAX_KEY_LEN       64
+#define AUTHPROTO_TIMEOUT_MS        300     // per attempt, a LAN round trip is a few ms
+
+// All multi-byte fields are big-endian; mac covers every byte before it
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t type;           // AUTHPROTO_CHECK_REQUEST
+    uint8_t uid_len;
+    uint32_t request_id;
+    uint8_t uid[10];
+    uint8_t reserved[2];
+    uint8_t mac[AUTHPROTO_MAC_LEN];
+} authproto_request_t;      // 36 bytes
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t type;           // AUTHPROTO_CHECK_RESPONSE
+    uint8_t result;         // AUTHPROTO_RESULT_*
+    uint32_t request_id;    // echoed from the request
+    uint8_t mac[AUTHPROTO_MAC_LEN];
+} authproto_response_t;     // 24 bytes
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/md.h"
+#include "metrics.h"
+#include "authclient.h"
+
+/** GLOBALS **/
+
+static int sock = -1;
+static SemaphoreHandle_t udp_lock;
+static char host[64];
+static uint16_t port;
+static bool resolved;
+
+// HMAC context set up once, so encoding a request never allocates
+static mbedtls_md_context_t hmac;
+static uint8_t hmac_key[AUTHPROTO_MAX_KEY_LEN];
+static size_t hmac_key_len;
+
+static uint32_t next_request_id;
+
+static const char* TAG = "AUTHPROTO";
+
+/** FUNCTIONS **/
+
+static void put_be32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Truncated HMAC-SHA256 of len bytes
+static void compute_mac(const void* data, size_t len, uint8_t* mac_out)
+{
+    uint8_t full[32];
+    mbedtls_md_hmac_starts(&hmac, hmac_key, hmac_key_len);
+    mbedtls_md_hmac_update(&hmac, data, len);
+    mbedtls_md_hmac_finish(&hmac, full);
+    memcpy(mac_out, full, AUTHPROTO_MAC_LEN);
+}
+
+static bool mac_matches(const uint8_t* a, const uint8_t* b)
+{
+    // constant time, a forged reply should not learn how many bytes matched
+    uint8_t diff = 0;
+    for (int i = 0; i < AUTHPROTO_MAC_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// Resolve the server and connect the socket; retried until it works because
+// a host name cannot be resolved before the link is up
+static esp_err_t ensure_connected(void)
+{
+    if (resolved) {
+        return ESP_OK;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo* res = NULL;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGW(TAG, "Cannot resolve %s", host);
+        return ESP_ERR_NOT_FOUND;
+    }
+    int err = connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (err != 0) {
+        return ESP_FAIL;
+    }
+    resolved = true;
+    return ESP_OK;
+}
+
+esp_err_t authclient_udp_init(const char* server_url, uint16_t server_port, const uint8_t* key, size_t key_len)
+{
+    if (sock >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (key_len == 0 || key_len > sizeof(hmac_key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the UDP server lives on the same host as the HTTP one
+    const char* start = strstr(server_url, "://");
+    start = start != NULL ? start + 3 : server_url;
+    size_t len = strcspn(start, ":/");
+    if (len == 0 || len >= sizeof(host)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(host, start, len);
+    host[len] = '\0';
+    port = server_port;
+
+    memcpy(hmac_key, key, key_len);
+    hmac_key_len = key_len;
+    mbedtls_md_init(&hmac);
+    if (mbedtls_md_setup(&hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    udp_lock = xSemaphoreCreateMutex();
+    if (udp_lock == NULL) return ESP_ERR_NO_MEM;
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        return ESP_FAIL;
+    }
+    // random start so request ids do not repeat across reboots
+    next_request_id = esp_random();
+    ESP_LOGI(TAG, "Binary authorization via %s:%u", host, port);
+    return ESP_OK;
+}
+
+// Wait for the response to request_id; stale replies to earlier attempts are skipped.
+// Returns the result byte, or -1 once AUTHPROTO_TIMEOUT_MS have passed since
+// the request went out, however many other datagrams arrived meanwhile.
+static int receive_response(uint32_t request_id)
+{
+    authproto_response_t resp;
+    int64_t deadline = esp_timer_get_time() + (int64_t)AUTHPROTO_TIMEOUT_MS * 1000;
+    while (1) {
+        int64_t remaining = deadline - esp_timer_get_time();
+        if (remaining <= 0) {
+            return -1;
+        }
+        // SO_RCVTIMEO restarts with every recv, so it gets what is left
+        struct timeval tv = {
+            .tv_sec = remaining / 1000000,
+            .tv_usec = remaining % 1000000,
+        };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int n = recv(sock, &resp, sizeof(resp), 0);
+        if (n < 0) {
+            return -1;
+        }
+        if (n != sizeof(resp) || resp.magic != AUTHPROTO_MAGIC || resp.version != AUTHPROTO_VERSION
+            || resp.type != AUTHPROTO_CHECK_RESPONSE) {
+            continue;
+        }
+        uint8_t mac[AUTHPROTO_MAC_LEN];
+        compute_mac(&resp, offsetof(authproto_response_t, mac), mac);
+        if (!mac_matches(mac, resp.mac)) {
+            ESP_LOGW(TAG, "Dropping response with bad MAC");
+            continue;
+        }
+        if (get_be32((const uint8_t*)&resp.request_id) == request_id) {
+            return resp.result;
+        }
+    }
+}
+
+// Ask the server about a UID with one datagram each way.
+// Returns ESP_OK if allowed, ESP_ERR_NOT_FOUND if denied, any other error if unreachable.
+esp_err_t authclient_udp_check_uid(const uint8_t* uid, uint8_t uid_len, authclient_timing_t* timing)
+{
+    if (sock < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (uid_len > sizeof(((authproto_request_t*)0)->uid)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    authclient_timing_t local;
+    if (timing == NULL) {
+        timing = &local;
+    }
+    memset(timing, 0, sizeof(*timing));
+
+    xSemaphoreTake(udp_lock, portMAX_DELAY);
+    esp_err_t err = ensure_connected();
+    int result = -1;
+    int64_t start = esp_timer_get_time();
+
+    while (err == ESP_OK && result < 0 && timing->attempts < AUTHCLIENT_MAX_ATTEMPTS) {
+        timing->attempts++;
+        uint32_t request_id = next_request_id++;
+
+        authproto_request_t req = {
+            .magic = AUTHPROTO_MAGIC,
+            .version = AUTHPROTO_VERSION,
+            .type = AUTHPROTO_CHECK_REQUEST,
+            .uid_len = uid_len,
+        };
+        put_be32((uint8_t*)&req.request_id, request_id);
+        memcpy(req.uid, uid, uid_len);
+        compute_mac(&req, offsetof(authproto_request_t, mac), req.mac);
+
+        if (send(sock, &req, sizeof(req), 0) != sizeof(req)) {
+            err = ESP_FAIL;
+            break;
+        }
+        result = receive_response(request_id);
+    }
+    xSemaphoreGive(udp_lock);
+
+    timing->total_us = esp_timer_get_time() - start;
+    timing->ttfb_us = timing->total_us;
+    timing->reused = true;
+
+    if (err != ESP_OK || result < 0) {
+        ESP_LOGE(TAG, "No response after %d attempts", timing->attempts);
+        return err != ESP_OK ? err : ESP_ERR_TIMEOUT;
+    }
+    metrics_observe(METRIC_AUTH_REQUEST, (uint32_t)timing->total_us);
+    ESP_LOGI(TAG, "Result %d in %lld us", result, timing->total_us);
+    return result == AUTHPROTO_RESULT_ALLOWED ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,174 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/md.h"
+#include "metrics.h"
+#include "cardcred.h"
+
+/** TYPES **/
+
+// Sector key of one card class (SAK), derived on first sight and kept
+typedef struct {
+    bool in_use;
+    uint8_t sak;
+    uint8_t key[MIFARE_KEY_LEN];
+    uint32_t taps;
+} card_class_t;
+
+/** GLOBALS **/
+
+// Only the reader task calls cardcred_verify, for every reader, so none of
+// this is locked.
+// The HMAC context is set up once so a tap never allocates.
+static mbedtls_md_context_t hmac;
+static uint8_t site_key[CARDCRED_MAX_KEY_LEN];
+static size_t site_key_len;
+static uint8_t cred_sector;
+
+static card_class_t classes[CARDCRED_CLASSES];
+static uint8_t next_evict;
+static cardcred_stats_t stats;
+
+static const char* TAG = "CARDCRED";
+
+/** FUNCTIONS **/
+
+esp_err_t cardcred_init(const uint8_t* key, size_t key_len, uint8_t sector)
+{
+    if (key_len == 0 || key_len > sizeof(site_key) || sector == 0 || sector >= 16) {
+        return ESP_ERR_INVALID_ARG;     // sector 0 holds the manufacturer block
+    }
+    memcpy(site_key, key, key_len);
+    site_key_len = key_len;
+    cred_sector = sector;
+
+    mbedtls_md_init(&hmac);
+    if (mbedtls_md_setup(&hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Card credentials required, sector %u", sector);
+    return ESP_OK;
+}
+
+static void site_hmac(uint8_t label, const uint8_t* a, size_t a_len,
+    const uint8_t* b, size_t b_len, uint8_t* out)
+{
+    mbedtls_md_hmac_starts(&hmac, site_key, site_key_len);
+    mbedtls_md_hmac_update(&hmac, &label, 1);
+    mbedtls_md_hmac_update(&hmac, a, a_len);
+    if (b_len > 0) {
+        mbedtls_md_hmac_update(&hmac, b, b_len);
+    }
+    mbedtls_md_hmac_finish(&hmac, out);
+}
+
+// Cached sector key for a SAK; the HMAC runs once per class, not per tap
+static const uint8_t* class_key(uint8_t sak)
+{
+    for (int i = 0; i < CARDCRED_CLASSES; i++) {
+        if (classes[i].in_use && classes[i].sak == sak) {
+            classes[i].taps++;
+            return classes[i].key;
+        }
+    }
+
+    card_class_t* slot = &classes[next_evict];
+    next_evict = (next_evict + 1) % CARDCRED_CLASSES;
+
+    uint8_t full[32];
+    site_hmac(CARDCRED_LABEL_SECTOR_KEY, &sak, 1, NULL, 0, full);
+    memcpy(slot->key, full, MIFARE_KEY_LEN);
+    slot->sak = sak;
+    slot->taps = 1;
+    slot->in_use = true;
+    ESP_LOGI(TAG, "Sector key derived for card class SAK %02X", sak);
+    return slot->key;
+}
+
+static bool record_valid(const mfrc522_uid_t* uid, const cardcred_record_t* rec)
+{
+    if (memcmp(rec->magic, CARDCRED_MAGIC, sizeof(rec->magic)) != 0 || rec->version != CARDCRED_VERSION) {
+        return false;
+    }
+
+    uint8_t full[32];
+    site_hmac(CARDCRED_LABEL_MAC, uid->bytes, uid->size,
+        (const uint8_t*)rec, offsetof(cardcred_record_t, mac), full);
+    // constant time, a forged card should not learn how many bytes matched
+    uint8_t diff = 0;
+    for (int i = 0; i < CARDCRED_MAC_LEN; i++) {
+        diff |= full[i] ^ rec->mac[i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+
+    // validity window only once the clock has been set
+    time_t now = time(NULL);
+    if (now >= CARDCRED_VALID_TIME) {
+        if ((uint32_t)now < rec->not_before || (rec->not_after != 0 && (uint32_t)now > rec->not_after)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Authenticate to the credential sector of a selected card, read the record
+// and check its MAC. One auth and two block reads back to back, with CRC_A
+// in hardware. Leaves the card halted in every case.
+cardcred_result_t cardcred_verify(mfrc522_t* reader, const mfrc522_uid_t* uid, uint32_t* credential_id)
+{
+    int64_t start = esp_timer_get_time();
+    cardcred_result_t result;
+    stats.checked++;
+
+    if (!(uid->sak & PICC_SAK_CLASSIC) || uid->size < 4) {
+        mfrc522_halt(reader);
+        stats.unsupported++;
+        return CARDCRED_UNSUPPORTED;
+    }
+
+    uint8_t blocks[CARDCRED_BLOCKS * MIFARE_BLOCK_SIZE];
+    mfrc522_status_t status = mfrc522_mifare_read_sector(reader, uid, PICC_AUTHENT1A, class_key(uid->sak),
+        cred_sector, CARDCRED_BLOCKS, blocks);
+    mfrc522_mifare_halt(reader);
+
+    if (status == MFRC522_ERR_AUTH) {
+        result = CARDCRED_AUTH_FAILED;
+        stats.auth_failed++;
+    }
+    else if (status != MFRC522_OK) {
+        result = CARDCRED_READ_FAILED;
+        stats.read_failed++;
+    }
+    else {
+        cardcred_record_t rec;
+        memcpy(&rec, blocks, sizeof(rec));
+        result = record_valid(uid, &rec) ? CARDCRED_VALID : CARDCRED_INVALID;
+        if (result == CARDCRED_VALID) {
+            stats.valid++;
+            if (credential_id != NULL) {
+                *credential_id = rec.credential_id;
+            }
+        }
+        else {
+            stats.invalid++;
+        }
+    }
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    stats.last_us = elapsed;
+    if (elapsed > stats.max_us) {
+        stats.max_us = elapsed;
+    }
+    metrics_observe(METRIC_CARD_CREDENTIAL, elapsed);
+    return result;
+}
+
+void cardcred_get_stats(cardcred_stats_t* out)
+{
+    *out = stats;
+}
@@ -0,0 +1,57 @@
+#ifndef CARDCRED_H
+#define CARDCRED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mfrc522.h"
+
+typedef enum {
+    CARDCRED_NOT_CHECKED = 0,   // credential mode off
+    CARDCRED_VALID,
+    CARDCRED_INVALID,           // bad format, MAC or validity window
+    CARDCRED_AUTH_FAILED,       // sector key refused: not issued by this site
+    CARDCRED_READ_FAILED,       // card left or RF error mid-read
+    CARDCRED_UNSUPPORTED,       // not a MIFARE Classic compatible card
+} cardcred_result_t;
+
+#define CARDCRED_MAGIC          "DC"
+#define CARDCRED_VERSION        1
+#define CARDCRED_MAC_LEN        16
+#define CARDCRED_BLOCKS         2       // one auth, two reads
+#define CARDCRED_MAX_KEY_LEN    64
+#define CARDCRED_CLASSES        4       // distinct SAKs whose sector key is kept
+#define CARDCRED_VALID_TIME     1577836800  // 2020-01-01, earlier clocks are not set yet
+
+// Domain separation of the two uses of the site key
+#define CARDCRED_LABEL_SECTOR_KEY   'K'     // HMAC(site key, 'K' || SAK)[0..5]
+#define CARDCRED_LABEL_MAC          'C'     // HMAC(site key, 'C' || UID || record[0..15])[0..15]
+
+// Credential in blocks 0 and 1 of the credential sector, little endian.
+// The UID is not stored: the MAC covers it, so a copied sector fails on
+// another card.
+typedef struct __attribute__((packed)) {
+    uint8_t magic[2];           // CARDCRED_MAGIC
+    uint8_t version;            // CARDCRED_VERSION
+    uint8_t flags;              // reserved, 0
+    uint32_t credential_id;     // issuer's serial, for revocation and audit
+    uint32_t not_before;        // unix seconds
+    uint32_t not_after;         // unix seconds, 0 = no expiry
+    uint8_t mac[CARDCRED_MAC_LEN];
+} cardcred_record_t;
+
+typedef struct {
+    uint32_t checked;
+    uint32_t valid;
+    uint32_t invalid;
+    uint32_t auth_failed;
+    uint32_t read_failed;
+    uint32_t unsupported;
+    uint32_t last_us;           // auth + read + verify of the last card
+    uint32_t max_us;
+} cardcred_stats_t;
+
+esp_err_t cardcred_init(const uint8_t* site_key, size_t key_len, uint8_t sector);
+cardcred_result_t cardcred_verify(mfrc522_t* reader, const mfrc522_uid_t* uid, uint32_t* credential_id);
+void cardcred_get_stats(cardcred_stats_t* out);
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "dlog.h"
+
+/** TYPES **/
+
+// seq is the ring position this slot was last written for, plus one; the
+// reader only takes a slot once seq says the writer has finished it
+typedef struct {
+    uint32_t seq;
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t hex_len;
+    const char* tag;
+    const char* fmt;
+    int64_t at_us;
+    uint32_t args[DLOG_MAX_ARGS];
+    uint8_t hex[DLOG_MAX_HEX];
+} dlog_record_t;
+
+// Many writers (any task on this core, or one that migrated here mid-call),
+// one reader: the drain task
+typedef struct {
+    uint32_t head;      // next position to reserve
+    uint32_t tail;      // next position to drain
+    dlog_record_t records[DLOG_RING_RECORDS];
+} dlog_ring_t;
+
+/** GLOBALS **/
+
+// writers only touch the ring of the core they run on
+static dlog_ring_t rings[portNUM_PROCESSORS];
+static dlog_sink_t sink;
+static void* sink_arg;
+static TaskHandle_t drain_handle;
+static uint32_t written;
+static uint32_t dropped;
+static uint32_t drained;
+
+/** FUNCTIONS **/
+
+// Lock free, never blocks: with the ring full the record is dropped.
+void dlog_write(dlog_level_t level, const char* tag, const char* fmt, const uint8_t* hex, uint8_t hex_len,
+    const uint32_t* args, uint8_t nargs)
+{
+    dlog_ring_t* ring = &rings[xPortGetCoreID()];
+
+    uint32_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    do {
+        if (pos - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= DLOG_RING_RECORDS) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    dlog_record_t* rec = &ring->records[pos % DLOG_RING_RECORDS];
+    rec->at_us = esp_timer_get_time();
+    rec->level = level;
+    rec->tag = tag;
+    rec->fmt = fmt;
+    rec->nargs = nargs;
+    memcpy(rec->args, args, nargs * sizeof(uint32_t));
+    rec->hex_len = hex_len > DLOG_MAX_HEX ? DLOG_MAX_HEX : hex_len;
+    if (hex != NULL) {
+        memcpy(rec->hex, hex, rec->hex_len);
+    }
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+}
+
+static void stdout_sink(const char* line, void* arg)
+{
+    fputs(line, stdout);
+}
+
+// Same layout as ESP_LOG: "I (1234) TAG: message"
+static void format_record(const dlog_record_t* rec, char* line, size_t size)
+{
+    static const char letters[] = { 'N', 'E', 'W', 'I', 'D' };
+    int n = snprintf(line, size, "%c (%lu) %s: ", letters[rec->level], (unsigned long)(rec->at_us / 1000), rec->tag);
+    if (n < 0 || (size_t)n >= size) {
+        return;
+    }
+
+    uint32_t a[DLOG_MAX_ARGS] = { 0 };
+    memcpy(a, rec->args, rec->nargs * sizeof(uint32_t));
+    if (rec->hex_len > 0) {
+        static const char digits[] = "0123456789ABCDEF";
+        char hex[DLOG_MAX_HEX * 2 + 1];
+        for (uint8_t i = 0; i < rec->hex_len; i++) {
+            hex[i * 2] = digits[rec->hex[i] >> 4];
+            hex[i * 2 + 1] = digits[rec->hex[i] & 0x0F];
+        }
+        hex[rec->hex_len * 2] = '\0';
+        n += snprintf(line + n, size - n, rec->fmt, hex, a[0], a[1], a[2], a[3]);
+    }
+    else {
+        n += snprintf(line + n, size - n, rec->fmt, a[0], a[1], a[2], a[3]);
+    }
+    if (n >= (int)size - 1) {
+        n = size - 2;
+    }
+    line[n] = '\n';
+    line[n + 1] = '\0';
+}
+
+// Oldest committed record over all cores, so lines come out in time order
+static dlog_record_t* next_record(dlog_ring_t** from)
+{
+    dlog_record_t* oldest = NULL;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        dlog_ring_t* ring = &rings[core];
+        uint32_t pos = ring->tail;
+        dlog_record_t* rec = &ring->records[pos % DLOG_RING_RECORDS];
+        // not written yet, or reserved and still being filled in
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            continue;
+        }
+        if (oldest == NULL || rec->at_us < oldest->at_us) {
+            oldest = rec;
+            *from = ring;
+        }
+    }
+    return oldest;
+}
+
+static void drain_task(void* arg)
+{
+    char line[DLOG_LINE_LEN];
+    uint32_t reported_drops = 0;
+    while (1) {
+        dlog_ring_t* ring;
+        dlog_record_t* rec;
+        while ((rec = next_record(&ring)) != NULL) {
+            format_record(rec, line, sizeof(line));
+            // the slot may be reused as soon as tail moves
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+            sink(line, sink_arg);
+            drained++;
+        }
+
+        uint32_t drops = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        if (drops != reported_drops) {
+            snprintf(line, sizeof(line), "W (%lu) DLOG: %lu records dropped\n",
+                (unsigned long)(esp_timer_get_time() / 1000), (unsigned long)(drops - reported_drops));
+            sink(line, sink_arg);
+            reported_drops = drops;
+        }
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS));
+    }
+}
+
+// Records written before this are kept and drained once the task runs
+esp_err_t dlog_init(void)
+{
+    if (drain_handle != NULL) {
+        return ESP_OK;
+    }
+    if (sink == NULL) {
+        sink = stdout_sink;
+    }
+    if (xTaskCreate(drain_task, "dlog", 3072, NULL, DLOG_TASK_PRIORITY, &drain_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Send lines somewhere else than the console, e.g. a network socket. The sink
+// runs on the drain task and may block.
+void dlog_set_sink(dlog_sink_t new_sink, void* arg)
+{
+    sink_arg = arg;
+    sink = new_sink != NULL ? new_sink : stdout_sink;
+}
+
+void dlog_get_stats(dlog_stats_t* out)
+{
+    out->written = __atomic_load_n(&written, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    out->drained = drained;
+}
@@ -0,0 +1,76 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// Deferred logging for timing-sensitive code. A call stores the format string
+// pointer (it lives in flash and doubles as the message ID), a timestamp and up
+// to DLOG_MAX_ARGS 32-bit arguments in a per-core ring; formatting and output
+// happen later in a low-priority task. Arguments are copied by value, so
+// format strings must only use 32-bit conversions (%d, %u, %lu, %X, %c).
+// Strings cannot be passed, except for one byte array printed as hex through
+// the first %s of a DLOG_HEX format.
+
+typedef enum {
+    DLOG_NONE = 0,
+    DLOG_ERROR,
+    DLOG_WARN,
+    DLOG_INFO,
+    DLOG_DEBUG,
+} dlog_level_t;
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;           // ring full, the drain task fell behind
+    uint32_t drained;
+} dlog_stats_t;
+
+// Receives each formatted line, newline included, on the drain task
+typedef void (*dlog_sink_t)(const char* line, void* arg);
+
+esp_err_t dlog_init(void);
+void dlog_set_sink(dlog_sink_t sink, void* arg);
+void dlog_write(dlog_level_t level, const char* tag, const char* fmt, const uint8_t* hex, uint8_t hex_len,
+    const uint32_t* args, uint8_t nargs);
+void dlog_get_stats(dlog_stats_t* out);
+
+#ifndef CONFIG_DLOG_LEVEL
+#define CONFIG_DLOG_LEVEL       DLOG_INFO
+#endif
+
+#define DLOG_MAX_ARGS           4
+#define DLOG_MAX_HEX            10      // a triple size UID
+#define DLOG_RING_RECORDS       32      // per core, power of two
+#define DLOG_DRAIN_MS           20
+#define DLOG_TASK_PRIORITY      1
+#define DLOG_LINE_LEN           160
+
+// The level test is a constant, so a disabled call and its format string
+// disappear; the arguments are still type checked.
+#define DLOG_ARGS(...)          ((const uint32_t[]){ 0, ##__VA_ARGS__ } + 1)
+#define DLOG_NARGS(...)         (sizeof((uint32_t[]){ 0, ##__VA_ARGS__ }) / sizeof(uint32_t) - 1)
+
+#define DLOG(level, tag, fmt, ...) do { \
+        if ((level) <= CONFIG_DLOG_LEVEL) { \
+            _Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "too many DLOG arguments"); \
+            dlog_write(level, tag, fmt, NULL, 0, DLOG_ARGS(__VA_ARGS__), DLOG_NARGS(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+#define DLOG_HEX(level, tag, data, len, fmt, ...) do { \
+        if ((level) <= CONFIG_DLOG_LEVEL) { \
+            _Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "too many DLOG arguments"); \
+            dlog_write(level, tag, fmt, data, len, DLOG_ARGS(__VA_ARGS__), DLOG_NARGS(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+#define DLOGE(tag, fmt, ...)    DLOG(DLOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...)    DLOG(DLOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...)    DLOG(DLOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define DLOGD(tag, fmt, ...)    DLOG(DLOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,236 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "doorconfig.h"
+
+/** TYPES **/
+
+typedef enum {
+    FIELD_STR,
+    FIELD_U32,
+} field_type_t;
+
+// one NVS key per setting, so provisioning can change a single value
+typedef struct {
+    const char* key;
+    field_type_t type;
+    size_t offset;
+    size_t size;        // buffer size for strings
+    uint32_t min;       // range for numbers
+    uint32_t max;
+} field_t;
+
+/** GLOBALS **/
+
+#define STR_FIELD(k, m) { k, FIELD_STR, offsetof(door_config_t, m), sizeof(((door_config_t*)0)->m), 0, 0 }
+#define U32_FIELD(k, m, lo, hi) { k, FIELD_U32, offsetof(door_config_t, m), sizeof(uint32_t), lo, hi }
+
+static const field_t fields[] = {
+    STR_FIELD("door_id", door_id),
+    STR_FIELD("ssid", ssid),
+    STR_FIELD("password", password),
+    STR_FIELD("server_url", server_url),
+    STR_FIELD("push_url", push_url),
+    STR_FIELD("auth_key", auth_key),
+    STR_FIELD("card_key", card_key),
+    U32_FIELD("http_timeout", http_timeout_ms, 100, 60000),
+    U32_FIELD("poll_fast", poll_fast_ms, 10, 1000),
+    U32_FIELD("poll_max", poll_max_ms, 10, 5000),
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+_Static_assert(FIELD_COUNT <= 32, "door_config_t.unsaved has one bit per field");
+
+static const char* TAG = "DOORCONFIG";
+
+/** FUNCTIONS **/
+
+static void set_defaults(door_config_t* cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    strlcpy(cfg->ssid, CONFIG_DOOR_WIFI_SSID, sizeof(cfg->ssid));
+    strlcpy(cfg->password, CONFIG_DOOR_WIFI_PASSWORD, sizeof(cfg->password));
+    strlcpy(cfg->server_url, CONFIG_DOOR_SERVER_URL, sizeof(cfg->server_url));
+    strlcpy(cfg->push_url, CONFIG_DOOR_PUSH_URL, sizeof(cfg->push_url));
+#if CONFIG_DOOR_AUTH_BINARY
+    strlcpy(cfg->auth_key, CONFIG_DOOR_AUTH_KEY, sizeof(cfg->auth_key));
+#endif
+#if CONFIG_DOOR_CARD_CREDENTIAL
+    strlcpy(cfg->card_key, CONFIG_DOOR_CARD_KEY, sizeof(cfg->card_key));
+#endif
+    cfg->http_timeout_ms = CONFIG_DOOR_HTTP_TIMEOUT_MS;
+    cfg->poll_fast_ms = CONFIG_DOOR_POLL_FAST_MS;
+    cfg->poll_max_ms = CONFIG_DOOR_POLL_MAX_MS;
+}
+
+// Fill cfg from NVS; missing keys keep their Kconfig default
+esp_err_t doorconfig_load(door_config_t* cfg)
+{
+    set_defaults(cfg);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(DOORCONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;      // never provisioned, defaults only
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        const field_t* f = &fields[i];
+        uint8_t* dst = (uint8_t*)cfg + f->offset;
+        if (f->type == FIELD_STR) {
+            size_t len = f->size;
+            err = nvs_get_str(nvs, f->key, (char*)dst, &len);
+        }
+        else {
+            uint32_t value;
+            err = nvs_get_u32(nvs, f->key, &value);
+            if (err == ESP_OK && value >= f->min && value <= f->max) {
+                *(uint32_t*)dst = value;
+            }
+        }
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Ignoring stored %s: %s", f->key, esp_err_to_name(err));
+        }
+    }
+    nvs_close(nvs);
+
+    ESP_LOGI(TAG, "Server %s, timeout %lu ms, poll %lu-%lu ms%s", cfg->server_url, cfg->http_timeout_ms,
+        cfg->poll_fast_ms, cfg->poll_max_ms, doorconfig_has_credentials(cfg) ? "" : ", no Wi-Fi credentials");
+    return ESP_OK;
+}
+
+// Persist the settings changed with doorconfig_set. The others are not
+// written, so a Kconfig default is not pinned in NVS and later firmware can
+// still change it.
+esp_err_t doorconfig_save(door_config_t* cfg)
+{
+    if (cfg->unsaved == 0) {
+        return ESP_OK;
+    }
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(DOORCONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t i = 0; i < FIELD_COUNT && err == ESP_OK; i++) {
+        const field_t* f = &fields[i];
+        if (!(cfg->unsaved & (1u << i))) {
+            continue;
+        }
+        const uint8_t* src = (const uint8_t*)cfg + f->offset;
+        if (f->type == FIELD_STR) {
+            err = nvs_set_str(nvs, f->key, (const char*)src);
+        }
+        else {
+            err = nvs_set_u32(nvs, f->key, *(const uint32_t*)src);
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err == ESP_OK) {
+        cfg->unsaved = 0;
+    }
+    return err;
+}
+
+// Change one setting by name, with the same limits as the Kconfig options.
+// Only updates cfg; call doorconfig_save to persist.
+esp_err_t doorconfig_set(door_config_t* cfg, const char* key, const char* value)
+{
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        const field_t* f = &fields[i];
+        if (strcmp(f->key, key) != 0) {
+            continue;
+        }
+        uint8_t* dst = (uint8_t*)cfg + f->offset;
+        if (f->type == FIELD_STR) {
+            if (strlen(value) >= f->size) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            strlcpy((char*)dst, value, f->size);
+            cfg->unsaved |= 1u << i;
+            return ESP_OK;
+        }
+
+        char* end;
+        unsigned long number = strtoul(value, &end, 10);
+        if (end == value || *end != '\0' || number < f->min || number > f->max) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        *(uint32_t*)dst = number;
+        cfg->unsaved |= 1u << i;
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+bool doorconfig_has_credentials(const door_config_t* cfg)
+{
+    return cfg->ssid[0] != '\0';
+}
+
+// Read one PEM string into a fresh buffer, NULL if absent
+static char* load_pem(nvs_handle_t nvs, const char* key)
+{
+    size_t len = 0;
+    esp_err_t err = nvs_get_str(nvs, key, NULL, &len);
+    if (err != ESP_OK || len == 0 || len > DOORCONFIG_PEM_MAX) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Ignoring stored %s: %s", key, esp_err_to_name(err));
+        }
+        return NULL;
+    }
+    char* pem = malloc(len);
+    if (pem != NULL && nvs_get_str(nvs, key, pem, &len) != ESP_OK) {
+        free(pem);
+        pem = NULL;
+    }
+    return pem;
+}
+
+// Returns ESP_ERR_NOT_FOUND when no CA is stored, client cert and key are
+// only returned as a pair, and only from an encrypted NVS partition
+esp_err_t doorconfig_load_tls(door_tls_t* tls)
+{
+    memset(tls, 0, sizeof(*tls));
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(DOORCONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+    }
+    tls->ca_pem = load_pem(nvs, DOORCONFIG_TLS_CA_KEY);
+    tls->client_cert_pem = load_pem(nvs, DOORCONFIG_TLS_CERT_KEY);
+#if CONFIG_NVS_ENCRYPTION
+    tls->client_key_pem = load_pem(nvs, DOORCONFIG_TLS_KEY_KEY);
+#else
+    // a private key in plain NVS can be read off the flash chip
+    if (tls->client_cert_pem != NULL) {
+        ESP_LOGW(TAG, "Client certificate ignored, its key needs CONFIG_NVS_ENCRYPTION");
+    }
+#endif
+    nvs_close(nvs);
+
+    if (tls->client_cert_pem == NULL || tls->client_key_pem == NULL) {
+        free(tls->client_cert_pem);
+        free(tls->client_key_pem);
+        tls->client_cert_pem = NULL;
+        tls->client_key_pem = NULL;
+    }
+    if (tls->ca_pem == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_LOGI(TAG, "Server CA loaded%s", tls->client_cert_pem != NULL ? ", with client certificate" : "");
+    return ESP_OK;
+}
@@ -0,0 +1,51 @@
+#ifndef DOORCONFIG_H
+#define DOORCONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define DOORCONFIG_SSID_LEN     33
+#define DOORCONFIG_PASS_LEN     65
+#define DOORCONFIG_URL_LEN      128
+#define DOORCONFIG_KEY_LEN      65
+#define DOORCONFIG_ID_LEN       32
+
+// Settings that differ per site; anything not in NVS falls back to Kconfig
+typedef struct {
+    char door_id[DOORCONFIG_ID_LEN];        // "door" label on exported metrics, empty = from the MAC
+    char ssid[DOORCONFIG_SSID_LEN];
+    char password[DOORCONFIG_PASS_LEN];
+    char server_url[DOORCONFIG_URL_LEN];
+    char push_url[DOORCONFIG_URL_LEN];      // MQTT broker for pushed grants/revocations, empty = none
+    char auth_key[DOORCONFIG_KEY_LEN];      // shared key of the binary protocol, empty = HTTP only
+    char card_key[DOORCONFIG_KEY_LEN];      // site key of card credentials, empty = UID only
+    uint32_t http_timeout_ms;
+    uint32_t poll_fast_ms;
+    uint32_t poll_max_ms;
+    uint32_t unsaved;                       // one bit per setting changed with doorconfig_set
+} door_config_t;
+
+esp_err_t doorconfig_load(door_config_t* cfg);
+esp_err_t doorconfig_save(door_config_t* cfg);
+esp_err_t doorconfig_set(door_config_t* cfg, const char* key, const char* value);
+bool doorconfig_has_credentials(const door_config_t* cfg);
+
+// PEM credentials for an https server_url, heap allocated, NULL if not stored.
+// Too large for the provisioning endpoint; written at manufacturing. The
+// client key is only used when the nvs partition is encrypted.
+typedef struct {
+    char* ca_pem;
+    char* client_cert_pem;
+    char* client_key_pem;
+} door_tls_t;
+
+esp_err_t doorconfig_load_tls(door_tls_t* tls);
+
+#define DOORCONFIG_NVS_NAMESPACE    "doorcfg"
+#define DOORCONFIG_TLS_CA_KEY       "tls_ca"
+#define DOORCONFIG_TLS_CERT_KEY     "tls_cert"
+#define DOORCONFIG_TLS_KEY_KEY      "tls_key"
+#define DOORCONFIG_PEM_MAX          4000    // NVS string limit
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "metrics.h"
+
+/** TYPES **/
+
+// Bucket counts are not cumulative; they are summed up when scraped.
+// Updates are atomic adds. The 32-bit ones are lock-free; Xtensa has no
+// 64-bit atomics, so the add to sum_us goes through libatomic's short
+// critical section. A 32-bit sum would wrap after 71 minutes of latency.
+typedef struct {
+    const char* stage;
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    uint64_t sum_us;
+} metrics_histogram_t;
+
+/** GLOBALS **/
+
+static const uint32_t bounds[METRICS_BUCKETS - 1] = METRICS_BUCKET_BOUNDS_US;
+
+static metrics_histogram_t histograms[METRIC_COUNT] = {
+    [METRIC_RFID_REQUEST] = { .stage = "rfid_request" },
+    [METRIC_RFID_ANTICOLL] = { .stage = "rfid_anticollision" },
+    [METRIC_AUTH_REQUEST] = { .stage = "auth_request" },
+    [METRIC_SERVO_OPEN] = { .stage = "servo_open" },
+    [METRIC_WIFI_RECONNECT] = { .stage = "wifi_reconnect" },
+    [METRIC_UNLOCK] = { .stage = "unlock" },
+    [METRIC_CARD_CREDENTIAL] = { .stage = "card_credential" },
+    [METRIC_POLL_CYCLE] = { .stage = "poll_cycle" },
+};
+
+static char door[METRICS_DOOR_ID_LEN] = "door";
+static httpd_handle_t server;
+
+static const char* TAG = "METRICS";
+
+/** FUNCTIONS **/
+
+// door_id becomes a label value, so it may not need escaping
+esp_err_t metrics_init(const char* door_id)
+{
+    if (door_id == NULL || door_id[0] == '\0' || strpbrk(door_id, "\"\\\n") != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strlcpy(door, door_id, sizeof(door));
+    return ESP_OK;
+}
+
+void metrics_observe(metric_id_t id, uint32_t value_us)
+{
+    if (id >= METRIC_COUNT) {
+        return;
+    }
+    metrics_histogram_t* h = &histograms[id];
+    int i = 0;
+    while (i < METRICS_BUCKETS - 1 && value_us > bounds[i]) {
+        i++;
+    }
+    __atomic_fetch_add(&h->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_us, value_us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+// Estimate a quantile (in 1/1000) from the buckets, interpolating linearly
+// inside the bucket it falls into. Returns 0 with no observations.
+uint32_t metrics_quantile(metric_id_t id, uint32_t permille)
+{
+    if (id >= METRIC_COUNT) {
+        return 0;
+    }
+    uint32_t counts[METRICS_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        counts[i] = __atomic_load_n(&histograms[id].buckets[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+        if (seen + counts[i] >= rank) {
+            uint32_t lower = i > 0 ? bounds[i - 1] : 0;
+            return lower + (uint32_t)((uint64_t)(bounds[i] - lower) * (rank - seen) / counts[i]);
+        }
+        seen += counts[i];
+    }
+    // in the +Inf bucket, the best we can say is "above the last bound"
+    return bounds[METRICS_BUCKETS - 2];
+}
+
+// Prometheus wants seconds; print microseconds as a fixed-point value
+static int format_seconds(char* buf, size_t size, uint64_t us)
+{
+    return snprintf(buf, size, "%llu.%06llu", us / 1000000, us % 1000000);
+}
+
+static esp_err_t send_line(httpd_req_t* req, const char* line)
+{
+    return httpd_resp_send_chunk(req, line, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t* req)
+{
+    char line[160];
+    char secs[24];
+    static const struct {
+        uint32_t permille;
+        const char* label;
+    } quantiles[] = { { 500, "0.5" }, { 900, "0.9" }, { 990, "0.99" } };
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    send_line(req, "# HELP door_stage_latency_seconds Latency of each access control stage.\n"
+        "# TYPE door_stage_latency_seconds histogram\n");
+
+    for (int id = 0; id < METRIC_COUNT; id++) {
+        metrics_histogram_t* h = &histograms[id];
+        uint32_t cumulative = 0;
+        for (int i = 0; i < METRICS_BUCKETS; i++) {
+            cumulative += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+            if (i < METRICS_BUCKETS - 1) {
+                format_seconds(secs, sizeof(secs), bounds[i]);
+            }
+            else {
+                strcpy(secs, "+Inf");
+            }
+            snprintf(line, sizeof(line), "door_stage_latency_seconds_bucket{door=\"%s\",stage=\"%s\",le=\"%s\"} %lu\n",
+                door, h->stage, secs, cumulative);
+            send_line(req, line);
+        }
+        format_seconds(secs, sizeof(secs), __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED));
+        snprintf(line, sizeof(line), "door_stage_latency_seconds_sum{door=\"%s\",stage=\"%s\"} %s\n",
+            door, h->stage, secs);
+        send_line(req, line);
+        snprintf(line, sizeof(line), "door_stage_latency_seconds_count{door=\"%s\",stage=\"%s\"} %lu\n",
+            door, h->stage, __atomic_load_n(&h->count, __ATOMIC_RELAXED));
+        send_line(req, line);
+    }
+
+    // on-device estimates, for dashboards that do not run histogram_quantile()
+    send_line(req, "# HELP door_stage_latency_quantile_seconds Bucket-interpolated latency quantiles since boot.\n"
+        "# TYPE door_stage_latency_quantile_seconds gauge\n");
+    for (int id = 0; id < METRIC_COUNT; id++) {
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            format_seconds(secs, sizeof(secs), metrics_quantile(id, quantiles[q].permille));
+            snprintf(line, sizeof(line), "door_stage_latency_quantile_seconds{door=\"%s\",stage=\"%s\",quantile=\"%s\"} %s\n",
+                door, histograms[id].stage, quantiles[q].label, secs);
+            send_line(req, line);
+        }
+    }
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t metrics_start_server(uint16_t port)
+{
+    if (server != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    esp_err_t err = httpd_start(&server, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start server: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_get_handler,
+    };
+    err = httpd_register_uri_handler(server, &uri);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Serving /metrics on port %u", port);
+    }
+    return err;
+}
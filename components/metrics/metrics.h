@@ -0,0 +1,34 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Latency histograms, one per instrumented stage
+typedef enum {
+    METRIC_RFID_REQUEST = 0,    // REQA/WUPA until ATQA
+    METRIC_RFID_ANTICOLL,       // anticollision and SELECT of all cascade levels
+    METRIC_AUTH_REQUEST,        // authorization request to the server
+    METRIC_SERVO_OPEN,          // door cycle start until fully open
+    METRIC_WIFI_RECONNECT,      // link lost until IP address regained
+    METRIC_UNLOCK,              // card detected until the servo is told to open
+    METRIC_CARD_CREDENTIAL,     // sector auth, read and MAC check of a card credential
+    METRIC_POLL_CYCLE,          // one pass over all readers, field wake-up excluded
+    METRIC_COUNT,
+} metric_id_t;
+
+esp_err_t metrics_init(const char* door_id);
+void metrics_observe(metric_id_t id, uint32_t value_us);
+uint32_t metrics_quantile(metric_id_t id, uint32_t permille);
+esp_err_t metrics_start_server(uint16_t port);
+
+// Upper bounds of the fixed histogram buckets in microseconds; a last +Inf
+// bucket catches everything above
+#define METRICS_BUCKET_BOUNDS_US { 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, \
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 }
+#define METRICS_BUCKETS         16      // bounds above plus +Inf
+#define METRICS_HTTP_PORT       9100
+#define METRICS_DOOR_ID_LEN     32
+
+#endif
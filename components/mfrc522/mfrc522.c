@@ -1,246 +1,992 @@
 #include "mfrc522.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "dlog.h"
+#include <stdlib.h>
 #include <string.h>
 
-
-static spi_device_handle_t spi;
-static gpio_num_t cs_pin;
-static gpio_num_t rst_pin;
-
-static void mfrc522_write(uint8_t reg, uint8_t val)
+static const char* TAG = "MFRC522";
+
+// ISO 14443-3 state of the card a reader is tracking, as far as the reader
+// knows. READY only exists inside mfrc522_poll_card.
+typedef enum {
+    MFRC522_PICC_IDLE,      // nothing tracked
+    MFRC522_PICC_READY,     // answered REQA, anticollision running
+    MFRC522_PICC_ACTIVE,    // selected, handed to the caller
+    MFRC522_PICC_HALT,      // halted, ignores REQA until it leaves the field
+} mfrc522_picc_state_t;
+
+// One reader. Every call on it must come from a single task at a time;
+// different readers can be used from different tasks, even on a shared bus.
+struct mfrc522_t {
+    mfrc522_bus_t bus;
+    spi_device_handle_t spi;
+    gpio_num_t irq_pin;
+    // task blocked in mfrc522_start_and_wait, woken by the IRQ pin
+    volatile TaskHandle_t irq_waiter;
+    // backstop for a lost edge, derived from the chip timer
+    TickType_t irq_timeout_ticks;
+    mfrc522_stats_t stats;
+    uint8_t last_error;     // ErrorReg of the last failed transceive
+    // presence tracking, see mfrc522_poll_card
+    mfrc522_picc_state_t picc_state;
+    mfrc522_uid_t tracked;
+    uint8_t presence_misses;
+    bool field_reset;       // field was off since the card was halted, it is back in IDLE
+};
+
+// SPI backend: polling transactions with hardware CS. The driver serializes
+// devices sharing a host, so readers on one bus never interleave a transfer.
+static void spi_write_reg(void* ctx, uint8_t reg, uint8_t val)
 {
-    uint8_t data[2] = { ((reg << 1) & 0x7E), val };
+    mfrc522_t* r = ctx;
     spi_transaction_t t = {
+        .flags = SPI_TRANS_USE_TXDATA,
         .length = 8 * 2,
-        .tx_buffer = data,
+        .tx_data = { ((reg << 1) & 0x7E), val },
     };
-    gpio_set_level(cs_pin, 0);
-    spi_device_transmit(spi, &t);
-    gpio_set_level(cs_pin, 1);
+    spi_device_polling_transmit(r->spi, &t);
 }
 
-static uint8_t mfrc522_read(uint8_t reg)
+static uint8_t spi_read_reg(void* ctx, uint8_t reg)
 {
-    uint8_t tx[2] = { ((reg << 1) & 0x7E) | 0x80, 0 };
-    uint8_t rx[2];
+    mfrc522_t* r = ctx;
     spi_transaction_t t = {
+        .flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA,
         .length = 8 * 2,
+        .tx_data = { ((reg << 1) & 0x7E) | 0x80, 0 },
+    };
+    spi_device_polling_transmit(r->spi, &t);
+    return t.rx_data[1];
+}
+
+// Burst write: one address byte followed by all data bytes, in one transaction
+static void spi_write_fifo(void* ctx, const uint8_t* data, uint8_t len)
+{
+    mfrc522_t* r = ctx;
+    uint8_t tx[MFRC522_FIFO_SIZE + 1];
+    tx[0] = (FIFODataReg << 1) & 0x7E;
+    memcpy(&tx[1], data, len);
+    spi_transaction_t t = {
+        .length = 8 * (len + 1),
+        .tx_buffer = tx,
+    };
+    spi_device_polling_transmit(r->spi, &t);
+}
+
+// Burst read: the address is repeated once per byte, each byte clocks out the previous read
+static void spi_read_fifo(void* ctx, uint8_t* data, uint8_t len)
+{
+    mfrc522_t* r = ctx;
+    uint8_t tx[MFRC522_FIFO_SIZE + 1];
+    uint8_t rx[MFRC522_FIFO_SIZE + 1];
+    memset(tx, ((FIFODataReg << 1) & 0x7E) | 0x80, len);
+    tx[len] = 0;
+    spi_transaction_t t = {
+        .length = 8 * (len + 1),
         .tx_buffer = tx,
         .rx_buffer = rx,
     };
-    gpio_set_level(cs_pin, 0);
-    spi_device_transmit(spi, &t);
-    gpio_set_level(cs_pin, 1);
-    return rx[1];
+    spi_device_polling_transmit(r->spi, &t);
+    memcpy(data, &rx[1], len);
 }
 
-static void mfrc522_reset()
+static const mfrc522_bus_t spi_bus = {
+    .write = spi_write_reg,
+    .read = spi_read_reg,
+    .write_fifo = spi_write_fifo,
+    .read_fifo = spi_read_fifo,
+};
+
+// All register access goes through the r->bus. Each call is one SPI transaction
+// and is counted so the cost of a read is visible in mfrc522_get_stats.
+static void mfrc522_write(mfrc522_t* r, uint8_t reg, uint8_t val)
 {
-    mfrc522_write(CommandReg, PCD_RESETPHASE);
-    uint8_t count = 0;
-    do {
-        // Wait for the PowerDown bit in CommandReg to be cleared (max 3x50ms)
-        vTaskDelay(50);
-    } while ((mfrc522_read(CommandReg << 1) & (1 << 4)) && (++count) < 3);
+    r->bus.write(r->bus.ctx, reg, val);
+    r->stats.spi_transactions++;
+}
+
+static uint8_t mfrc522_read(mfrc522_t* r, uint8_t reg)
+{
+    r->stats.spi_transactions++;
+    return r->bus.read(r->bus.ctx, reg);
+}
+
+static void mfrc522_write_fifo(mfrc522_t* r, const uint8_t* data, uint8_t len)
+{
+    r->bus.write_fifo(r->bus.ctx, data, len);
+    r->stats.spi_transactions++;
+}
 
+static void mfrc522_read_fifo(mfrc522_t* r, uint8_t* data, uint8_t len)
+{
+    r->bus.read_fifo(r->bus.ctx, data, len);
+    r->stats.spi_transactions++;
 }
 
-void mfrc522_start(uint8_t cs, uint8_t rst)
+// Soft reset. PowerDown stays set until the oscillator runs again, which
+// takes well under a millisecond with the usual 27 MHz crystal.
+static esp_err_t mfrc522_reset(mfrc522_t* r)
 {
-    cs_pin = cs;
-    rst_pin = rst;
+    mfrc522_write(r, CommandReg, PCD_RESETPHASE);
+    int64_t start = esp_timer_get_time();
+    while (mfrc522_read(r, CommandReg) & 0x10) {
+        if (esp_timer_get_time() - start > MFRC522_RESET_TIMEOUT_US) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    return ESP_OK;
+}
 
-    gpio_set_direction(rst_pin, GPIO_MODE_OUTPUT);
-    gpio_set_level(rst_pin, 1);
+// Load the chip timer (TAuto), which raises TimerIRq if the card does not
+// answer, so the host-side wait only needs to cover frame time plus that timeout.
+static void mfrc522_set_timeout(mfrc522_t* r, uint16_t reload)
+{
+    mfrc522_write(r, TReloadRegH, reload >> 8);
+    mfrc522_write(r, TReloadRegL, reload & 0xFF);
+
+    uint32_t prescaler = ((MFRC522_TMODE & 0x0F) << 8) | MFRC522_TPRESCALER;
+    uint32_t timer_us = (uint32_t)(((uint64_t)(reload + 1) * (2 * prescaler + 1) * 1000000) / MFRC522_XTAL_HZ);
+    uint32_t wait_ms = (timer_us + MFRC522_IRQ_MARGIN_US + 999) / 1000;
+    r->irq_timeout_ticks = pdMS_TO_TICKS(wait_ms) + 1;
+}
+
+// Reset the chip and set up timer, modulation and antenna
+static esp_err_t mfrc522_configure(mfrc522_t* r)
+{
+    esp_err_t err = mfrc522_reset(r);
+    if (err != ESP_OK) return err;
+
+    // a missing chip reads back as all zeros or all ones
+    uint8_t version = mfrc522_read(r, VersionReg);
+    if (version == 0x00 || version == 0xFF) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    mfrc522_write(r, TxModeReg, 0x00);
+    mfrc522_write(r, RxModeReg, 0x00);
+    mfrc522_write(r, ModWidthReg, 0x1A);
+    mfrc522_write(r, TModeReg, MFRC522_TMODE);
+    mfrc522_write(r, TPrescalerReg, MFRC522_TPRESCALER);
+    mfrc522_set_timeout(r, MFRC522_TRELOAD);
+    mfrc522_write(r, TxASKReg, 0x40);
+    mfrc522_write(r, ModeReg, 0x3D);
+    uint8_t value = mfrc522_read(r, TxControlReg);
+    if (!(value & 0x03)) {
+        mfrc522_write(r, TxControlReg, value | 0x03);
+    }
+    return ESP_OK;
+}
+
+static mfrc522_t* mfrc522_alloc(void)
+{
+    mfrc522_t* r = calloc(1, sizeof(*r));
+    if (r != NULL) {
+        r->irq_pin = GPIO_NUM_NC;
+        r->irq_timeout_ticks = 1;
+    }
+    return r;
+}
+
+// Add a reader on an SPI host. The first reader on a host initializes the
+// bus with its SCLK/MOSI/MISO pins; later ones only add their CS line.
+esp_err_t mfrc522_new(const mfrc522_config_t* config, mfrc522_t** out)
+{
+    mfrc522_t* r = mfrc522_alloc();
+    if (r == NULL) return ESP_ERR_NO_MEM;
+
+    if (config->rst_pin >= 0) {
+        gpio_set_direction(config->rst_pin, GPIO_MODE_OUTPUT);
+        gpio_set_level(config->rst_pin, 1);
+    }
 
     spi_bus_config_t buscfg = {
-        .miso_io_num = 19,
-        .mosi_io_num = 23,
-        .sclk_io_num = 18,
+        .miso_io_num = config->miso_pin,
+        .mosi_io_num = config->mosi_pin,
+        .sclk_io_num = config->sclk_pin,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
         .max_transfer_sz = 0
     };
     spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = 1*500*1000,
+        .clock_speed_hz = MFRC522_SPI_CLOCK_HZ,
         .mode = 0,
-        .spics_io_num = -1,
+        .spics_io_num = config->cs_pin,
         .queue_size = 1,
     };
 
-    spi_bus_initialize(HSPI_HOST, &buscfg, 1);
-    spi_bus_add_device(HSPI_HOST, &devcfg, &spi);
-
-    gpio_set_direction(cs_pin, GPIO_MODE_OUTPUT);
-    gpio_set_level(cs_pin, 1);
-
-    mfrc522_reset();
-    mfrc522_write(TxModeReg, 0x00);
-    mfrc522_write(RxModeReg, 0x00);
-    mfrc522_write(ModWidthReg, 0x1A);
-    mfrc522_write(TModeReg, 0x80);
-    mfrc522_write(TPrescalerReg, 0x20);
-    mfrc522_write(TReloadRegH, 0x00);
-    mfrc522_write(TReloadRegL, 0x20);
-    mfrc522_write(TxASKReg, 0x40);
-    mfrc522_write(ModeReg, 0x3D);
-    uint8_t value = mfrc522_read(TxControlReg);
-    if (!(value & 0x03)) {
-        mfrc522_write(TxControlReg, value | 0x03);
+    esp_err_t err = spi_bus_initialize(config->host, &buscfg, SPI_DMA_CH_AUTO);
+    if (err == ESP_ERR_INVALID_STATE) {
+        err = ESP_OK;   // shared host, already set up by another reader
+    }
+    if (err == ESP_OK) {
+        err = spi_bus_add_device(config->host, &devcfg, &r->spi);
+    }
+    if (err != ESP_OK) {
+        free(r);
+        return err;
+    }
+
+    r->bus = spi_bus;
+    r->bus.ctx = r;
+    err = mfrc522_configure(r);
+    if (err != ESP_OK) {
+        spi_bus_remove_device(r->spi);
+        free(r);
+        return err;
     }
+    *out = r;
+    return ESP_OK;
 }
 
-// First function: Request/Wake up card and get ATQA
-bool mfrc522_request(uint8_t* atqa_out) {
-    mfrc522_write(CommandReg, PCD_IDLE);
-    mfrc522_write(ComIrqReg, 0x7F);
-    mfrc522_write(FIFOLevelReg, 0x80);   // Flush FIFO
-    mfrc522_write(ErrorReg, 0x00);
-
-    mfrc522_write(FIFODataReg, PICC_REQALL);  // 0x52
-    mfrc522_write(BitFramingReg, 0x07); // 7 valid bits, no CRC
-    mfrc522_write(CommandReg, PCD_TRANSCEIVE);
-    mfrc522_write(BitFramingReg, 0x87);  // Start transmission
-
-    bool completed = false;
-    // Wait for response (max 25ms)
+// Run the driver on another register backend, e.g. a simulated chip in a
+// host build. No SPI or GPIO is touched.
+esp_err_t mfrc522_new_with_bus(const mfrc522_bus_t* backend, mfrc522_t** out)
+{
+    mfrc522_t* r = mfrc522_alloc();
+    if (r == NULL) return ESP_ERR_NO_MEM;
+
+    r->bus = *backend;
+    esp_err_t err = mfrc522_configure(r);
+    if (err != ESP_OK) {
+        free(r);
+        return err;
+    }
+    *out = r;
+    return ESP_OK;
+}
+
+static void IRAM_ATTR mfrc522_irq_handler(void* arg)
+{
+    mfrc522_t* r = arg;
+    BaseType_t woken = pdFALSE;
+    TaskHandle_t waiter = r->irq_waiter;
+    if (waiter != NULL) {
+        vTaskNotifyGiveFromISR(waiter, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// Route RxIRq, IdleIRq, ErrIRq and TimerIRq to the IRQ pin (active low,
+// push-pull). Each reader needs its own pin.
+esp_err_t mfrc522_enable_irq(mfrc522_t* r, uint8_t pin)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK) return err;
+
+    // the service may already be installed by another driver
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err;
+
+    err = gpio_isr_handler_add(pin, mfrc522_irq_handler, r);
+    if (err != ESP_OK) return err;
+
+    mfrc522_write(r, ComIEnReg, 0x80 | MFRC522_IRQ_MASK);  // IRqInv: pin low while an IRQ is pending
+    mfrc522_write(r, DivIEnReg, 0x80);                     // IRQPushPull
+    mfrc522_write(r, ComIrqReg, 0x7F);
+    r->irq_pin = pin;
+    return ESP_OK;
+}
+
+// Start a command with its data already in the FIFO and wait for it to finish.
+// Uses the IRQ pin when enabled, otherwise polls ComIrqReg.
+static mfrc522_wait_t mfrc522_start_and_wait(mfrc522_t* r, uint8_t cmd, uint8_t bit_framing)
+{
+    if (r->irq_pin != GPIO_NUM_NC) {
+        r->irq_waiter = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0);    // drop stale notifications
+    }
+
+    mfrc522_write(r, CommandReg, cmd);
+    if (cmd == PCD_TRANSCEIVE) {
+        mfrc522_write(r, BitFramingReg, 0x80 | bit_framing);  // Start transmission
+    }
+
+    if (r->irq_pin != GPIO_NUM_NC) {
+        mfrc522_wait_t result = MFRC522_WAIT_TIMEOUT;
+        TickType_t start = xTaskGetTickCount();
+        TickType_t waited = 0;
+        while (waited <= r->irq_timeout_ticks) {
+            ulTaskNotifyTake(pdTRUE, r->irq_timeout_ticks - waited);
+            waited = xTaskGetTickCount() - start;
+            uint8_t irq = mfrc522_read(r, ComIrqReg);
+            if (irq & 0x32) {  // RxIRq, IdleIRq or ErrIRq, caller checks ErrorReg
+                result = MFRC522_WAIT_DONE;
+                break;
+            }
+            if (irq & 0x01) {  // TimerIRq
+                result = MFRC522_WAIT_NO_CARD;
+                break;
+            }
+        }
+        r->irq_waiter = NULL;
+        return result;
+    }
+
+    // Wait for response (max 50 ticks)
     for (int i = 0; i < 50; i++) {
-        uint8_t irq = mfrc522_read(ComIrqReg);
+        uint8_t irq = mfrc522_read(r, ComIrqReg);
         if (irq & 0x30) {  // RxIRq or IdleIRq triggered
-            completed = true;
-            break;
+            return MFRC522_WAIT_DONE;
         }
         if (irq & 0x01) {  // TimerIRq
-            return false;
+            return MFRC522_WAIT_NO_CARD;
         }
         vTaskDelay(1);
     }
+    return MFRC522_WAIT_TIMEOUT;
+}
 
-    if (!completed) {
-        printf("Timeout waiting for card\n");
-        return false;
+// Transceive with RxAlign: the first received bit lands at bit rx_align of
+// rx[0], whose lower bits (already known to the caller) are preserved.
+static mfrc522_status_t mfrc522_transceive_aligned(mfrc522_t* r, uint8_t cmd, const uint8_t* tx, uint8_t tx_len,
+    uint8_t* rx, uint8_t* rx_len, uint8_t* valid_bits, uint8_t rx_align)
+{
+    if (tx_len > MFRC522_FIFO_SIZE) {
+        return MFRC522_ERR_OVERFLOW;
     }
 
-    uint8_t error = mfrc522_read(ErrorReg);
-    if (error & 0x13) {
-        printf("Error in REQALL: 0x%02X\n", error);
-        return false;
+    mfrc522_write(r, CommandReg, PCD_IDLE);
+    mfrc522_write(r, ComIrqReg, 0x7F);
+    mfrc522_write(r, FIFOLevelReg, 0x80);   // Flush FIFO
+    if (tx_len > 0) {
+        mfrc522_write_fifo(r, tx, tx_len);
     }
 
-    uint8_t len = mfrc522_read(FIFOLevelReg);
-    if (len != 2) {
-        printf("Expected 2 bytes ATQA, got %d\n", len);
-        return false;
+    uint8_t tx_last_bits = valid_bits != NULL ? (*valid_bits & 0x07) : 0;
+    mfrc522_wait_t result = mfrc522_start_and_wait(r, cmd, (rx_align << 4) | tx_last_bits);
+    if (result == MFRC522_WAIT_NO_CARD) {
+        return MFRC522_NO_CARD;
+    }
+    if (result == MFRC522_WAIT_TIMEOUT) {
+        return MFRC522_TIMEOUT;
     }
 
-    // Read ATQA (should be 2 bytes)
-    atqa_out[0] = mfrc522_read(FIFODataReg);
-    atqa_out[1] = mfrc522_read(FIFODataReg);
+    uint8_t error = mfrc522_read(r, ErrorReg);
+    if (error & 0x13) {  // BufferOvfl, ParityErr, ProtocolErr
+        r->last_error = error;
+        return MFRC522_ERR;
+    }
+    if (error & 0x04) {  // CRCErr, only raised while RxCRCEn is set
+        r->last_error = error;
+        return MFRC522_ERR_CRC;
+    }
 
-    printf("ATQA: %02X %02X\n", atqa_out[0], atqa_out[1]);
-    return true;
+    // on a collision the bits before it are still valid, so read them too
+    if (rx != NULL && rx_len != NULL) {
+        uint8_t len = mfrc522_read(r, FIFOLevelReg);
+        if (len > *rx_len) {
+            return MFRC522_ERR_OVERFLOW;
+        }
+        uint8_t known = rx[0];
+        if (len > 0) {
+            mfrc522_read_fifo(r, rx, len);
+            if (rx_align) {
+                uint8_t mask = (0xFF << rx_align) & 0xFF;
+                rx[0] = (known & ~mask) | (rx[0] & mask);
+            }
+        }
+        *rx_len = len;
+
+        if (valid_bits != NULL) {
+            *valid_bits = mfrc522_read(r, ControlReg) & 0x07;  // RxLastBits
+        }
+    }
+
+    if (error & 0x08) {  // CollErr
+        r->last_error = error;
+        return MFRC522_COLLISION;
+    }
+    return MFRC522_OK;
 }
 
-// Second function: Anticollision to get UID
-bool mfrc522_anticollision(uint8_t* uid_out, uint8_t* uid_length) {
-    mfrc522_write(CommandReg, PCD_IDLE);
-    mfrc522_write(ComIrqReg, 0x7F);
-    mfrc522_write(FIFOLevelReg, 0x80);   // Flush FIFO
-    mfrc522_write(ErrorReg, 0x00);
+// Run a PCD command with tx_len bytes of FIFO payload and collect the answer.
+// valid_bits (optional) is the number of valid bits in the last tx byte on
+// input (0 = all 8) and the number of valid bits in the last rx byte on output.
+// rx_len is the rx buffer size on input and the received byte count on output.
+mfrc522_status_t mfrc522_transceive(mfrc522_t* r, uint8_t cmd, const uint8_t* tx, uint8_t tx_len,
+    uint8_t* rx, uint8_t* rx_len, uint8_t* valid_bits)
+{
+    return mfrc522_transceive_aligned(r, cmd, tx, tx_len, rx, rx_len, valid_bits, 0);
+}
 
-    // Send ANTICOLLISION command
-    mfrc522_write(FIFODataReg, PICC_SEL_CL1);  // 0x93
-    mfrc522_write(FIFODataReg, 0x20);          // NVB (Number of Valid Bits) = 0x20
+// CRC_A over data using the coprocessor (PCD_CALCCRC), result LSB first
+mfrc522_status_t mfrc522_calc_crc(mfrc522_t* r, const uint8_t* data, uint8_t len, uint8_t* crc_out)
+{
+    if (len > MFRC522_FIFO_SIZE) {
+        return MFRC522_ERR_OVERFLOW;
+    }
 
-    mfrc522_write(BitFramingReg, 0x00);        // All bits valid, no framing
-    mfrc522_write(CommandReg, PCD_TRANSCEIVE);
-    mfrc522_write(BitFramingReg, 0x80);        // Start transmission
+    mfrc522_write(r, CommandReg, PCD_IDLE);
+    mfrc522_write(r, DivIrqReg, 0x04);      // clear CRCIRq
+    mfrc522_write(r, FIFOLevelReg, 0x80);   // Flush FIFO
+    mfrc522_write_fifo(r, data, len);
+    mfrc522_write(r, CommandReg, PCD_CALCCRC);
+
+    // a 9 byte frame takes a few microseconds, no need to sleep
+    for (int i = 0; i < MFRC522_CRC_POLLS; i++) {
+        if (mfrc522_read(r, DivIrqReg) & 0x04) {
+            mfrc522_write(r, CommandReg, PCD_IDLE);
+            crc_out[0] = mfrc522_read(r, CRCResultRegL);
+            crc_out[1] = mfrc522_read(r, CRCResultRegH);
+            return MFRC522_OK;
+        }
+    }
+    return MFRC522_TIMEOUT;
+}
 
-    bool completed = false;
-    // Wait for response (max 25ms)
-    for (int i = 0; i < 50; i++) {
-        uint8_t irq = mfrc522_read(ComIrqReg);
-        if (irq & 0x30) {  // RxIRq or IdleIRq triggered
-            completed = true;
+// Send REQA (PICC_REQIDL) or WUPA (PICC_REQALL) and return the ATQA
+static mfrc522_status_t mfrc522_request_cmd(mfrc522_t* r, uint8_t req, uint8_t* atqa_out)
+{
+    uint8_t len = 2;
+    uint8_t bits = 7;   // 7 valid bits, no CRC
+    mfrc522_status_t status = mfrc522_transceive(r, PCD_TRANSCEIVE, &req, 1, atqa_out, &len, &bits);
+    if (status == MFRC522_OK && len != 2) {
+        return MFRC522_ERR;
+    }
+    return status;
+}
+
+// ISO 14443-3 anticollision and SELECT through cascade levels 1-3.
+// Collisions are resolved bit by bit (CollReg), always following the 1 branch,
+// so exactly one card in the field ends up in the ACTIVE state.
+mfrc522_status_t mfrc522_select(mfrc522_t* r, mfrc522_uid_t* uid)
+{
+    static const uint8_t sel_cmds[3] = { PICC_SEL_CL1, PICC_SEL_CL2, PICC_SEL_CL3 };
+    mfrc522_status_t status;
+
+    memset(uid, 0, sizeof(*uid));
+    // ValuesAfterColl = 0: bits received after a collision are cleared
+    mfrc522_write(r, CollReg, mfrc522_read(r, CollReg) & ~0x80);
+
+    for (int level = 0; level < 3; level++) {
+        // SEL, NVB, 4 UID bytes (or CT + 3), BCC, CRC_A
+        uint8_t buffer[9] = { sel_cmds[level] };
+        uint8_t known_bits = 0;
+        bool selected = false;
+
+        while (!selected) {
+            if (known_bits >= 32) {
+                // all 40 bits known: SELECT
+                buffer[1] = 0x70;
+                buffer[6] = buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5];
+                status = mfrc522_calc_crc(r, buffer, 7, &buffer[7]);
+                if (status != MFRC522_OK) return status;
+
+                uint8_t sak[3];
+                uint8_t len = sizeof(sak);
+                status = mfrc522_transceive(r, PCD_TRANSCEIVE, buffer, 9, sak, &len, NULL);
+                if (status != MFRC522_OK) return status;
+                if (len != 3) return MFRC522_ERR;
+
+                uint8_t crc[2];
+                status = mfrc522_calc_crc(r, sak, 1, crc);
+                if (status != MFRC522_OK) return status;
+                if (crc[0] != sak[1] || crc[1] != sak[2]) return MFRC522_ERR_CRC;
+
+                uid->sak = sak[0];
+                selected = true;
+                break;
+            }
+
+            // ANTICOLLISION with the bits known so far
+            uint8_t index = 2 + known_bits / 8;
+            uint8_t tx_last_bits = known_bits % 8;
+            buffer[1] = (index << 4) | tx_last_bits;     // NVB
+            uint8_t tx_len = index + (tx_last_bits ? 1 : 0);
+            uint8_t rx_len = 7 - index;     // remaining UID bytes + BCC
+            uint8_t bits = tx_last_bits;
+
+            status = mfrc522_transceive_aligned(r, PCD_TRANSCEIVE, buffer, tx_len,
+                &buffer[index], &rx_len, &bits, tx_last_bits);
+
+            if (status == MFRC522_COLLISION) {
+                uint8_t coll = mfrc522_read(r, CollReg);
+                if (coll & 0x20) {  // CollPosNotValid
+                    return MFRC522_COLLISION;
+                }
+                uint8_t pos = coll & 0x1F;
+                if (pos == 0) pos = 32;
+                if (pos <= known_bits) {
+                    return MFRC522_ERR;    // no progress
+                }
+                known_bits = pos;
+                // take the branch where the colliding bit is 1
+                uint8_t bit = known_bits - 1;
+                buffer[2 + bit / 8] |= 1 << (bit % 8);
+                r->stats.collisions++;
+                continue;
+            }
+            if (status != MFRC522_OK) return status;
+
+            if ((buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5]) != buffer[6]) {
+                return MFRC522_ERR_CRC;    // BCC mismatch
+            }
+            known_bits = 32;
+        }
+
+        // cascade tag: 3 UID bytes at this level, more to come
+        if (buffer[2] == PICC_CASCADE_TAG && (uid->sak & 0x04)) {
+            memcpy(&uid->bytes[uid->size], &buffer[3], 3);
+            uid->size += 3;
+            continue;
+        }
+        memcpy(&uid->bytes[uid->size], &buffer[2], 4);
+        uid->size += 4;
+        return MFRC522_OK;
+    }
+
+    return MFRC522_ERR;    // cascade bit still set after level 3
+}
+
+// SELECT a card whose UID is already known, one frame per cascade level and
+// no anticollision. Other cards woken with it drop back to IDLE (or HALT).
+static mfrc522_status_t mfrc522_select_known(mfrc522_t* r, const mfrc522_uid_t* uid)
+{
+    static const uint8_t sel_cmds[3] = { PICC_SEL_CL1, PICC_SEL_CL2, PICC_SEL_CL3 };
+    uint8_t levels = uid->size == 4 ? 1 : uid->size == 7 ? 2 : 3;
+    uint8_t offset = 0;
+
+    for (uint8_t level = 0; level < levels; level++) {
+        uint8_t buffer[9] = { sel_cmds[level], 0x70 };
+        if (level < levels - 1) {
+            buffer[2] = PICC_CASCADE_TAG;
+            memcpy(&buffer[3], &uid->bytes[offset], 3);
+            offset += 3;
+        }
+        else {
+            memcpy(&buffer[2], &uid->bytes[offset], 4);
+        }
+        buffer[6] = buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5];
+        mfrc522_status_t status = mfrc522_calc_crc(r, buffer, 7, &buffer[7]);
+        if (status != MFRC522_OK) return status;
+
+        uint8_t sak[3];
+        uint8_t len = sizeof(sak);
+        status = mfrc522_transceive(r, PCD_TRANSCEIVE, buffer, 9, sak, &len, NULL);
+        if (status != MFRC522_OK) return status;
+        if (len != 3) return MFRC522_ERR;
+        // the cascade bit must be set on every level but the last
+        if (((sak[0] & 0x04) != 0) != (level < levels - 1)) return MFRC522_ERR;
+    }
+    return MFRC522_OK;
+}
+
+// HLTA: put the selected card into the HALT state. The card does not answer.
+mfrc522_status_t mfrc522_halt(mfrc522_t* r)
+{
+    uint8_t buffer[4] = { PICC_HALT, 0x00 };
+    mfrc522_status_t status = mfrc522_calc_crc(r, buffer, 2, &buffer[2]);
+    if (status != MFRC522_OK) return status;
+
+    status = mfrc522_transceive(r, PCD_TRANSCEIVE, buffer, sizeof(buffer), NULL, NULL, NULL);
+    // a response of any kind means the card did not halt
+    if (status != MFRC522_NO_CARD && status != MFRC522_TIMEOUT) {
+        return MFRC522_ERR;
+    }
+    if (r->picc_state == MFRC522_PICC_ACTIVE) {
+        r->picc_state = MFRC522_PICC_HALT;
+    }
+    return MFRC522_OK;
+}
+
+// Enumerate every card in the field in one pass: wake all (WUPA), then
+// repeatedly select one card and halt it until REQA gets no more answers.
+// The cards are left halted. Returns the number of UIDs written.
+uint8_t mfrc522_inventory(mfrc522_t* r, mfrc522_uid_t* uids, uint8_t max_uids)
+{
+    uint8_t count = 0;
+    uint8_t atqa[2];
+    uint8_t req = PICC_REQALL;
+
+    while (count < max_uids) {
+        mfrc522_status_t status = mfrc522_request_cmd(r, req, atqa);
+        if (status == MFRC522_NO_CARD || status == MFRC522_TIMEOUT) {
             break;
         }
-        if (irq & 0x01) {  // TimerIRq
-            return false;
+        // several ATQAs colliding is expected here, the select resolves it
+        if (status != MFRC522_OK && status != MFRC522_COLLISION) {
+            break;
+        }
+        req = PICC_REQIDL;
+
+        if (mfrc522_select(r, &uids[count]) == MFRC522_OK) {
+            mfrc522_halt(r);
+            count++;
+        }
+        else {
+            break;
         }
-        vTaskDelay(1);
     }
+    return count;
+}
 
-    if (!completed) {
-        printf("Timeout in anticollision\n");
-        return false;
+// Leave the encrypted session: Crypto1 off, plain frames, default timeout
+static void mfrc522_mifare_stop(mfrc522_t* r)
+{
+    mfrc522_write(r, Status2Reg, mfrc522_read(r, Status2Reg) & ~0x08);  // MFCrypto1On
+    mfrc522_write(r, TxModeReg, 0x00);
+    mfrc522_write(r, RxModeReg, 0x00);
+    mfrc522_set_timeout(r, MFRC522_TRELOAD);
+}
+
+// Three-pass Crypto1 authentication for the sector holding block. The UID
+// bytes fed to Crypto1 are the last four of the UID (NXP AN10927).
+// On success CRC_A is switched to the coprocessor for the rest of the session,
+// so reads and writes need no separate PCD_CALCCRC round trips.
+mfrc522_status_t mfrc522_mifare_auth(mfrc522_t* r, uint8_t auth_cmd, uint8_t block, const uint8_t* key,
+    const mfrc522_uid_t* uid)
+{
+    uint8_t buffer[2 + MIFARE_KEY_LEN + 4] = { auth_cmd, block };
+    memcpy(&buffer[2], key, MIFARE_KEY_LEN);
+    memcpy(&buffer[2 + MIFARE_KEY_LEN], &uid->bytes[uid->size - 4], 4);
+
+    mfrc522_set_timeout(r, MFRC522_MIFARE_TRELOAD);
+    mfrc522_status_t status = mfrc522_transceive(r, PCD_AUTHENT, buffer, sizeof(buffer), NULL, NULL, NULL);
+    if (status == MFRC522_OK && !(mfrc522_read(r, Status2Reg) & 0x08)) {
+        status = MFRC522_ERR_AUTH;
+    }
+    if (status != MFRC522_OK) {
+        // a wrong key leaves the card idle, it must be selected again
+        mfrc522_mifare_stop(r);
+        return status == MFRC522_NO_CARD || status == MFRC522_TIMEOUT ? MFRC522_ERR_AUTH : status;
     }
 
-    uint8_t error = mfrc522_read(ErrorReg);
-    if (error & 0x1B) {  // Check for relevant errors
-        printf("Error in anticollision: 0x%02X\n", error);
-        return false;
+    mfrc522_write(r, TxModeReg, 0x80);     // TxCRCEn
+    mfrc522_write(r, RxModeReg, 0x80);     // RxCRCEn
+    return MFRC522_OK;
+}
+
+// READ one 16 byte block in an authenticated session
+mfrc522_status_t mfrc522_mifare_read(mfrc522_t* r, uint8_t block, uint8_t* out)
+{
+    uint8_t cmd[2] = { PICC_READ, block };
+    uint8_t rx[MIFARE_BLOCK_SIZE + 2];
+    uint8_t len = sizeof(rx);
+    mfrc522_status_t status = mfrc522_transceive(r, PCD_TRANSCEIVE, cmd, sizeof(cmd), rx, &len, NULL);
+    if (status != MFRC522_OK) {
+        return status;
+    }
+    // the checked CRC may or may not be left in the FIFO
+    if (len != MIFARE_BLOCK_SIZE && len != MIFARE_BLOCK_SIZE + 2) {
+        return len <= 1 ? MFRC522_ERR_NAK : MFRC522_ERR;
     }
+    memcpy(out, rx, MIFARE_BLOCK_SIZE);
+    return MFRC522_OK;
+}
 
-    uint8_t len = mfrc522_read(FIFOLevelReg);
-    if (len < 4) {
-        printf("Expected at least 4 bytes UID response, got %d\n", len);
-        return false;
+// Send one part of a WRITE and expect the 4-bit ACK
+static mfrc522_status_t mfrc522_mifare_ack(mfrc522_t* r, const uint8_t* tx, uint8_t tx_len)
+{
+    uint8_t ack = 0;
+    uint8_t len = 1;
+    uint8_t bits = 0;
+    mfrc522_status_t status = mfrc522_transceive(r, PCD_TRANSCEIVE, tx, tx_len, &ack, &len, &bits);
+    if (status != MFRC522_OK) {
+        return status;
     }
+    return len == 1 && bits == 4 && (ack & 0x0F) == PICC_ACK ? MFRC522_OK : MFRC522_ERR_NAK;
+}
 
-    // Read UID + BCC (Block Check Character)
-    // Typically: 4 bytes UID + 1 byte BCC = 5 bytes total
-    for (uint8_t i = 0; i < len; i++) {
-        uid_out[i] = mfrc522_read(FIFODataReg);
+// WRITE one 16 byte block in an authenticated session. Writing a sector
+// trailer with bad access bits locks the sector for good.
+mfrc522_status_t mfrc522_mifare_write(mfrc522_t* r, uint8_t block, const uint8_t* data)
+{
+    uint8_t cmd[2] = { PICC_WRITE, block };
+
+    mfrc522_write(r, RxModeReg, 0x00);     // the ACK carries no CRC
+    mfrc522_status_t status = mfrc522_mifare_ack(r, cmd, sizeof(cmd));
+    if (status == MFRC522_OK) {
+        mfrc522_set_timeout(r, MFRC522_WRITE_TRELOAD);
+        status = mfrc522_mifare_ack(r, data, MIFARE_BLOCK_SIZE);
+        mfrc522_set_timeout(r, MFRC522_MIFARE_TRELOAD);
+    }
+    mfrc522_write(r, RxModeReg, 0x80);
+    return status;
+}
+
+// Authenticate to a sector (0-31) and read its first blocks back to back.
+// The session stays open; end it with mfrc522_mifare_halt.
+mfrc522_status_t mfrc522_mifare_read_sector(mfrc522_t* r, const mfrc522_uid_t* uid, uint8_t auth_cmd,
+    const uint8_t* key, uint8_t sector, uint8_t blocks, uint8_t* out)
+{
+    if (sector >= 32 || blocks >= MIFARE_BLOCKS_PER_SECTOR) {
+        return MFRC522_ERR_OVERFLOW;
+    }
+    uint8_t first = sector * MIFARE_BLOCKS_PER_SECTOR;
+    mfrc522_status_t status = mfrc522_mifare_auth(r, auth_cmd, first + MIFARE_BLOCKS_PER_SECTOR - 1, key, uid);
+    for (uint8_t i = 0; i < blocks && status == MFRC522_OK; i++) {
+        status = mfrc522_mifare_read(r, first + i, out + i * MIFARE_BLOCK_SIZE);
     }
+    return status;
+}
 
-    *uid_length = len - 1;  // Exclude BCC from UID length
+// HLTA inside the encrypted session, then back to plain frames. Without a
+// session this is mfrc522_halt.
+mfrc522_status_t mfrc522_mifare_halt(mfrc522_t* r)
+{
+    if (!(mfrc522_read(r, Status2Reg) & 0x08)) {
+        mfrc522_mifare_stop(r);
+        return mfrc522_halt(r);
+    }
 
-    // Verify BCC (XOR of UID bytes should equal BCC)
-    uint8_t bcc_calc = 0;
-    for (uint8_t i = 0; i < *uid_length; i++) {
-        bcc_calc ^= uid_out[i];
+    // no answer is the good case, do not wait the long session timeout for it
+    mfrc522_set_timeout(r, MFRC522_TRELOAD);
+    uint8_t hlta[2] = { PICC_HALT, 0x00 };
+    mfrc522_status_t status = mfrc522_transceive(r, PCD_TRANSCEIVE, hlta, sizeof(hlta), NULL, NULL, NULL);
+    mfrc522_mifare_stop(r);
+    if (status != MFRC522_NO_CARD && status != MFRC522_TIMEOUT) {
+        return MFRC522_ERR;
+    }
+    if (r->picc_state == MFRC522_PICC_ACTIVE) {
+        r->picc_state = MFRC522_PICC_HALT;
     }
+    return MFRC522_OK;
+}
+
+void mfrc522_get_stats(mfrc522_t* r, mfrc522_stats_t* out)
+{
+    *out = r->stats;
+}
 
-    if (bcc_calc != uid_out[*uid_length]) {
-        printf("BCC mismatch! Calculated: 0x%02X, Received: 0x%02X\n",
-            bcc_calc, uid_out[*uid_length]);
-        // Don't return false here - sometimes this still works
+void mfrc522_antenna_on(mfrc522_t* r)
+{
+    uint8_t value = mfrc522_read(r, TxControlReg);
+    if ((value & 0x03) != 0x03) {
+        mfrc522_write(r, TxControlReg, value | 0x03);
     }
+}
 
-    printf("(BCC: %02X)\n", uid_out[*uid_length]);
+void mfrc522_antenna_off(mfrc522_t* r)
+{
+    uint8_t value = mfrc522_read(r, TxControlReg);
+    if (value & 0x03) {
+        mfrc522_write(r, TxControlReg, value & ~0x03);
+        // an unpowered card loses its HALT state
+        r->field_reset = true;
+    }
+}
 
+// Soft power-down: oscillator and antenna drivers stop, registers are kept
+void mfrc522_power_down(mfrc522_t* r)
+{
+    mfrc522_write(r, CommandReg, 0x10 | PCD_IDLE);
+    r->field_reset = true;
+}
+
+// Leave soft power-down and wait for the oscillator to run again
+esp_err_t mfrc522_power_up(mfrc522_t* r)
+{
+    mfrc522_write(r, CommandReg, PCD_IDLE);
+    int64_t start = esp_timer_get_time();
+    while (mfrc522_read(r, CommandReg) & 0x10) {
+        if (esp_timer_get_time() - start > MFRC522_WAKE_TIMEOUT_US) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    return ESP_OK;
+}
+
+// First function: Request/Wake up card and get ATQA
+bool mfrc522_request(mfrc522_t* r, uint8_t* atqa_out) {
+    mfrc522_status_t status = mfrc522_request_cmd(r, PICC_REQALL, atqa_out);
+    if (status == MFRC522_NO_CARD) {
+        return false;
+    }
+    if (status == MFRC522_TIMEOUT) {
+        DLOGW(TAG, "Timeout waiting for card");
+        return false;
+    }
+    // several cards answering at once is fine, anticollision sorts them out
+    if (status != MFRC522_OK && status != MFRC522_COLLISION) {
+        DLOGW(TAG, "Error in REQALL: status %d, error 0x%02X", status, r->last_error);
+        return false;
+    }
+
+    DLOGD(TAG, "ATQA: %02X %02X", atqa_out[0], atqa_out[1]);
     return true;
 }
 
-// Combined function to get complete UID
-bool mfrc522_get_uid(uint8_t* uid_out, uint8_t* uid_length) {
+static bool mfrc522_select_logged(mfrc522_t* r, mfrc522_uid_t* uid) {
+    mfrc522_status_t status = mfrc522_select(r, uid);
+    if (status == MFRC522_NO_CARD) {
+        return false;
+    }
+    if (status == MFRC522_TIMEOUT) {
+        DLOGW(TAG, "Timeout in anticollision");
+        return false;
+    }
+    if (status != MFRC522_OK) {
+        DLOGW(TAG, "Error in anticollision: status %d, error 0x%02X", status, r->last_error);
+        return false;
+    }
+
+    DLOGD(TAG, "SAK: %02X", uid->sak);
+    return true;
+}
+
+// Second function: Anticollision and SELECT to get the complete UID (4, 7 or 10 bytes)
+bool mfrc522_anticollision(mfrc522_t* r, uint8_t* uid_out, uint8_t* uid_length) {
+    mfrc522_uid_t uid;
+    if (!mfrc522_select_logged(r, &uid)) {
+        return false;
+    }
+    memcpy(uid_out, uid.bytes, uid.size);
+    *uid_length = uid.size;
+    return true;
+}
+
+// card-present-to-UID latency
+static void mfrc522_record_read(mfrc522_t* r, int64_t start, uint32_t start_transactions)
+{
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    r->stats.reads++;
+    r->stats.last_read_us = elapsed;
+    r->stats.total_read_us += elapsed;
+    if (r->stats.reads == 1 || elapsed < r->stats.min_read_us) r->stats.min_read_us = elapsed;
+    if (elapsed > r->stats.max_read_us) r->stats.max_read_us = elapsed;
+    r->stats.irq_driven = r->irq_pin != GPIO_NUM_NC;
+    r->stats.last_read_transactions = r->stats.spi_transactions - start_transactions;
+}
+
+// Wake and select a card, leaving it ACTIVE so its memory can be read.
+// The caller halts it (mfrc522_halt or mfrc522_mifare_halt).
+bool mfrc522_get_card(mfrc522_t* r, mfrc522_uid_t* uid) {
     uint8_t atqa[2];
+    int64_t start = esp_timer_get_time();
+    uint32_t start_transactions = r->stats.spi_transactions;
 
     // Step 1: Wake up card and get ATQA
-    if (!mfrc522_request(atqa)) {
+    if (!mfrc522_request(r, atqa)) {
         return false;
     }
+    int64_t requested = esp_timer_get_time();
+    metrics_observe(METRIC_RFID_REQUEST, (uint32_t)(requested - start));
 
     // Step 2: Get UID through anticollision
-    if (!mfrc522_anticollision(uid_out, uid_length)) {
+    if (!mfrc522_select_logged(r, uid)) {
         return false;
     }
+    metrics_observe(METRIC_RFID_ANTICOLL, (uint32_t)(esp_timer_get_time() - requested));
 
+    mfrc522_record_read(r, start, start_transactions);
     return true;
 }
 
-// Usage example:
-/*
-uint8_t uid[10];  // Buffer for UID (max 10 bytes for larger UIDs)
-uint8_t uid_length;
+// Track one card per reader through the ISO 14443-3 states so a card left on
+// the reader is not read again every poll. REQA (PICC_REQIDL) is ignored by
+// halted cards, so while the tracked card is halted it only finds new ones;
+// when it finds none, WUPA + HLTA checks that the tracked card is still there
+// and puts it straight back to HALT. A new card replaces the tracked one.
+// If the field was off meanwhile the card lost its HALT state: WUPA and a
+// SELECT of the known UID halt it again without a full anticollision.
+// On ARRIVED the card is left ACTIVE for the caller to read and halt.
+mfrc522_presence_t mfrc522_poll_card(mfrc522_t* r, mfrc522_uid_t* uid)
+{
+    uint8_t atqa[2];
+    int64_t start = esp_timer_get_time();
+    uint32_t start_transactions = r->stats.spi_transactions;
+
+    // the caller did not halt the last arrival
+    if (r->picc_state == MFRC522_PICC_ACTIVE) {
+        mfrc522_halt(r);
+    }
+
+    mfrc522_status_t status;
+    if (r->picc_state == MFRC522_PICC_HALT && r->field_reset) {
+        r->stats.presence_checks++;
+        status = mfrc522_request_cmd(r, PICC_REQALL, atqa);
+        if ((status == MFRC522_OK || status == MFRC522_COLLISION)
+            && mfrc522_select_known(r, &r->tracked) == MFRC522_OK) {
+            r->field_reset = false;
+            r->picc_state = MFRC522_PICC_ACTIVE;
+            mfrc522_halt(r);
+            r->presence_misses = 0;
+            *uid = r->tracked;
+            return MFRC522_CARD_PRESENT;
+        }
+        // not answering by its UID, REQA and anticollision below decide
+    }
+
+    status = mfrc522_request_cmd(r, PICC_REQIDL, atqa);
+    if (status == MFRC522_OK || status == MFRC522_COLLISION) {
+        mfrc522_picc_state_t previous = r->picc_state;
+        r->picc_state = MFRC522_PICC_READY;
+        mfrc522_uid_t card;
+        if (mfrc522_select_logged(r, &card)) {
+            bool same = previous == MFRC522_PICC_HALT && card.size == r->tracked.size
+                && memcmp(card.bytes, r->tracked.bytes, card.size) == 0;
+            r->presence_misses = 0;
+            *uid = card;
+            if (same && r->field_reset) {
+                // woken by our own field cycling, not taken away and back
+                r->field_reset = false;
+                r->picc_state = MFRC522_PICC_ACTIVE;
+                mfrc522_halt(r);
+                return MFRC522_CARD_PRESENT;
+            }
+            r->tracked = card;
+            r->field_reset = false;
+            r->picc_state = MFRC522_PICC_ACTIVE;
+            r->stats.arrivals++;
+            mfrc522_record_read(r, start, start_transactions);
+            return MFRC522_CARD_ARRIVED;
+        }
+        // card still coming into the field, it answers REQA again next poll
+        r->picc_state = previous;
+    }
+
+    if (r->picc_state != MFRC522_PICC_HALT) {
+        return MFRC522_CARD_NONE;
+    }
+
+    *uid = r->tracked;
+    r->stats.presence_checks++;
+    status = mfrc522_request_cmd(r, PICC_REQALL, atqa);
+    if (status == MFRC522_OK || status == MFRC522_COLLISION) {
+        // READY*: anything but anticollision or SELECT sends it back to HALT
+        mfrc522_halt(r);
+        r->presence_misses = 0;
+        return MFRC522_CARD_PRESENT;
+    }
+    // one lost frame is not a departure
+    if (++r->presence_misses < MFRC522_PRESENCE_MISSES) {
+        return MFRC522_CARD_PRESENT;
+    }
+    r->picc_state = MFRC522_PICC_IDLE;
+    r->presence_misses = 0;
+    r->field_reset = false;
+    r->stats.departures++;
+    return MFRC522_CARD_DEPARTED;
+}
 
-if (mfrc522_get_uid(uid, &uid_length)) {
-    printf("Successfully read UID!\n");
-} else {
-    printf("Failed to read UID\n");
+// A card is tracked until it is reported DEPARTED
+bool mfrc522_card_tracked(mfrc522_t* r)
+{
+    return r->picc_state != MFRC522_PICC_IDLE;
 }
-*/
 
+// Combined function to get complete UID
+bool mfrc522_get_uid(mfrc522_t* r, uint8_t* uid_out, uint8_t* uid_length) {
+    mfrc522_uid_t uid;
+    if (!mfrc522_get_card(r, &uid)) {
+        return false;
+    }
+    memcpy(uid_out, uid.bytes, uid.size);
+    *uid_length = uid.size;
 
+    // HALT it, the next WUPA wakes it again if it is still there
+    mfrc522_halt(r);
+    return true;
+}
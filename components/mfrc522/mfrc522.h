@@ -3,13 +3,133 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "esp_err.h"
+#include "driver/spi_master.h"
 
-void mfrc522_start(uint8_t cs_pin, uint8_t rst_pin);
-bool mfrc522_request(uint8_t* atqa_out);
-bool mfrc522_get_uid(uint8_t* uid_out, uint8_t* uid_length);
-bool mfrc522_anticollision(uint8_t* uid_out, uint8_t* uid_length);
+// Outcome of waiting for a transceive to complete
+typedef enum {
+    MFRC522_WAIT_DONE,      // RxIRq or IdleIRq
+    MFRC522_WAIT_NO_CARD,   // chip timer expired, nothing answered
+    MFRC522_WAIT_TIMEOUT,   // no IRQ at all within the host-side timeout
+} mfrc522_wait_t;
+
+// Result of mfrc522_transceive
+typedef enum {
+    MFRC522_OK = 0,
+    MFRC522_NO_CARD,        // TimerIRq, no answer
+    MFRC522_TIMEOUT,        // the chip never signalled completion
+    MFRC522_ERR,            // protocol, parity or buffer overflow error
+    MFRC522_COLLISION,      // more than one card answered
+    MFRC522_ERR_OVERFLOW,   // payload does not fit the FIFO or rx buffer
+    MFRC522_ERR_CRC,        // BCC or CRC_A mismatch
+    MFRC522_ERR_AUTH,       // MIFARE Classic authentication refused
+    MFRC522_ERR_NAK,        // the card answered with a NAK
+} mfrc522_status_t;
+
+// A selected card
+typedef struct {
+    uint8_t size;           // 4, 7 or 10
+    uint8_t bytes[10];
+    uint8_t sak;            // SAK of the last cascade level
+} mfrc522_uid_t;
+
+// Result of mfrc522_poll_card
+typedef enum {
+    MFRC522_CARD_NONE,          // field empty, nothing tracked
+    MFRC522_CARD_ARRIVED,       // new card, selected (ACTIVE); handle it, then halt it
+    MFRC522_CARD_PRESENT,       // the tracked card is still in the field, halted
+    MFRC522_CARD_DEPARTED,      // the tracked card has left the field
+} mfrc522_presence_t;
+
+// Card-present-to-UID latency of the UIDs read: mfrc522_poll_card arrivals
+// and mfrc522_get_card / mfrc522_get_uid calls
+typedef struct {
+    uint32_t reads;
+    uint32_t last_read_us;
+    uint32_t min_read_us;
+    uint32_t max_read_us;
+    uint64_t total_read_us;
+    bool irq_driven;
+    uint32_t spi_transactions;          // total SPI transactions since start
+    uint32_t last_read_transactions;    // SPI transactions used by the last successful read
+    uint32_t collisions;                // collisions resolved during anticollision
+    uint32_t arrivals;                  // MFRC522_CARD_ARRIVED events
+    uint32_t departures;                // MFRC522_CARD_DEPARTED events
+    uint32_t presence_checks;           // WUPA + HLTA (+ SELECT after a field reset) on a held card
+} mfrc522_stats_t;
+
+// Register access backend. mfrc522_new uses SPI; a simulated register file
+// can be attached with mfrc522_new_with_bus to run the stack off-target.
+typedef struct {
+    void (*write)(void* ctx, uint8_t reg, uint8_t val);
+    uint8_t (*read)(void* ctx, uint8_t reg);
+    void (*write_fifo)(void* ctx, const uint8_t* data, uint8_t len);
+    void (*read_fifo)(void* ctx, uint8_t* data, uint8_t len);
+    void* ctx;
+} mfrc522_bus_t;
+
+// Wiring of one reader. Readers on the same host share SCLK/MOSI/MISO.
+typedef struct {
+    spi_host_device_t host;
+    int sclk_pin;
+    int mosi_pin;
+    int miso_pin;
+    int cs_pin;
+    int rst_pin;        // -1 if not wired; a shared reset line can be given to every reader
+} mfrc522_config_t;
+
+typedef struct mfrc522_t mfrc522_t;
+
+esp_err_t mfrc522_new(const mfrc522_config_t* config, mfrc522_t** out);
+esp_err_t mfrc522_new_with_bus(const mfrc522_bus_t* bus, mfrc522_t** out);
+esp_err_t mfrc522_enable_irq(mfrc522_t* reader, uint8_t irq_pin);
+bool mfrc522_request(mfrc522_t* reader, uint8_t* atqa_out);
+bool mfrc522_get_uid(mfrc522_t* reader, uint8_t* uid_out, uint8_t* uid_length);
+bool mfrc522_anticollision(mfrc522_t* reader, uint8_t* uid_out, uint8_t* uid_length);
+mfrc522_status_t mfrc522_transceive(mfrc522_t* reader, uint8_t cmd, const uint8_t* tx, uint8_t tx_len,
+    uint8_t* rx, uint8_t* rx_len, uint8_t* valid_bits);
+mfrc522_status_t mfrc522_calc_crc(mfrc522_t* reader, const uint8_t* data, uint8_t len, uint8_t* crc_out);
+mfrc522_status_t mfrc522_select(mfrc522_t* reader, mfrc522_uid_t* uid);
+mfrc522_status_t mfrc522_halt(mfrc522_t* reader);
+bool mfrc522_get_card(mfrc522_t* reader, mfrc522_uid_t* uid);
+mfrc522_presence_t mfrc522_poll_card(mfrc522_t* reader, mfrc522_uid_t* uid);
+bool mfrc522_card_tracked(mfrc522_t* reader);
+uint8_t mfrc522_inventory(mfrc522_t* reader, mfrc522_uid_t* uids, uint8_t max_uids);
+void mfrc522_get_stats(mfrc522_t* reader, mfrc522_stats_t* out);
+
+// MIFARE Classic on a selected card. After a successful auth the session is
+// encrypted with hardware CRC_A; end it with mfrc522_mifare_halt.
+mfrc522_status_t mfrc522_mifare_auth(mfrc522_t* reader, uint8_t auth_cmd, uint8_t block, const uint8_t* key,
+    const mfrc522_uid_t* uid);
+mfrc522_status_t mfrc522_mifare_read(mfrc522_t* reader, uint8_t block, uint8_t* out);
+mfrc522_status_t mfrc522_mifare_write(mfrc522_t* reader, uint8_t block, const uint8_t* data);
+mfrc522_status_t mfrc522_mifare_read_sector(mfrc522_t* reader, const mfrc522_uid_t* uid, uint8_t auth_cmd,
+    const uint8_t* key, uint8_t sector, uint8_t blocks, uint8_t* out);
+mfrc522_status_t mfrc522_mifare_halt(mfrc522_t* reader);
+void mfrc522_antenna_on(mfrc522_t* reader);
+void mfrc522_antenna_off(mfrc522_t* reader);
+void mfrc522_power_down(mfrc522_t* reader);
+esp_err_t mfrc522_power_up(mfrc522_t* reader);
 
 #define MFRC522_MAX_LEN 16
+#define MFRC522_FIFO_SIZE       64
+#define MFRC522_WAKE_TIMEOUT_US 5000    // oscillator start-up after soft power-down
+#define MFRC522_RESET_TIMEOUT_US 20000  // soft reset, bounded so a missing chip fails fast
+#define MFRC522_PRESENCE_MISSES 2       // unanswered WUPAs before a held card counts as gone
+#define MFRC522_CRC_POLLS       64      // DivIrqReg reads before giving up on the CRC coprocessor
+#define MFRC522_SPI_CLOCK_HZ    (5 * 1000 * 1000)   // the chip accepts up to 10 MHz
+#define MFRC522_TMODE           0x80    // TAuto, prescaler high nibble 0
+#define MFRC522_TPRESCALER      0x20
+#define MFRC522_TRELOAD         0x0020
+#define MFRC522_XTAL_HZ         13560000
+#define MFRC522_IRQ_MARGIN_US   2000    // frame transmit time + scheduling slack
+#define MFRC522_IRQ_MASK        0x33    // RxIEn | IdleIEn | ErrIEn | TimerIEn
+#define MFRC522_MIFARE_TRELOAD  0x00D0  // ~1 ms, Crypto1 auth and encrypted reads
+#define MFRC522_WRITE_TRELOAD   0x0830  // ~10 ms, the ACK follows the EEPROM write
+
+#define MIFARE_KEY_LEN          6
+#define MIFARE_BLOCK_SIZE       16
+#define MIFARE_BLOCKS_PER_SECTOR 4      // sectors 0-31; the last block is the trailer
 
 // MFRC522 commands
 #define PCD_IDLE              0x00
@@ -25,7 +145,16 @@ bool mfrc522_anticollision(uint8_t* uid_out, uint8_t* uid_length);
 #define PICC_ANTICOLL         0x93
 #define PICC_REQALL           0x52
 #define PICC_SEL_CL1          0x93
-#define PICC_SEL_CL2          0x95  
+#define PICC_SEL_CL2          0x95
+#define PICC_SEL_CL3          0x97
+#define PICC_HALT             0x50
+#define PICC_CASCADE_TAG      0x88
+#define PICC_AUTHENT1A        0x60
+#define PICC_AUTHENT1B        0x61
+#define PICC_READ             0x30
+#define PICC_WRITE            0xA0
+#define PICC_ACK              0x0A      // 4-bit answer, anything else is a NAK
+#define PICC_SAK_CLASSIC      0x08      // SAK bit of MIFARE Classic compatible cards
 
 #define CommandReg  0x01        	// starts and stops command execution
 #define ComIEnReg  0x02        	// enable and disable interrupt request control bits
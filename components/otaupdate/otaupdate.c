@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
+#include "authclient.h"
+#include "otaupdate.h"
+
+/** TYPES **/
+
+// One update being written to the other slot
+typedef struct {
+    otaupdate_header_t header;
+    const esp_partition_t* source;      // running app, base of a delta
+    esp_ota_handle_t handle;
+    mbedtls_sha256_context sha;
+    uint32_t written;
+    // delta operation being applied
+    otaupdate_op_t op;
+    uint8_t op_have;                    // header bytes of the next op collected so far
+    uint32_t op_left;
+    uint8_t scratch[OTAUPDATE_CHUNK];   // running image bytes under an ADD
+} ota_job_t;
+
+/** GLOBALS **/
+
+static const char* server;
+static otaupdate_idle_fn door_idle;
+static otaupdate_stats_t stats;
+
+static const char* TAG = "OTAUPDATE";
+
+/** FUNCTIONS **/
+
+static esp_err_t emit(ota_job_t* job, const uint8_t* data, size_t len)
+{
+    if (job->written + len > job->header.image_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mbedtls_sha256_update(&job->sha, data, len);
+    job->written += len;
+    return esp_ota_write(job->handle, data, len);
+}
+
+// Rebuild image bytes from inflated delta operations, which can be split
+// anywhere across calls
+static esp_err_t delta_feed(ota_job_t* job, const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        if (job->op_left == 0) {
+            size_t n = sizeof(job->op) - job->op_have;
+            n = n < len ? n : len;
+            memcpy((uint8_t*)&job->op + job->op_have, data, n);
+            job->op_have += n;
+            data += n;
+            len -= n;
+            if (job->op_have < sizeof(job->op)) {
+                break;
+            }
+            job->op_have = 0;
+            job->op_left = job->op.len;
+            if (job->op.op == OTAUPDATE_OP_ADD) {
+                if (job->op.src > job->source->size || job->op.len > job->source->size - job->op.src) {
+                    return ESP_ERR_INVALID_RESPONSE;
+                }
+            }
+            else if (job->op.op != OTAUPDATE_OP_DATA) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            continue;
+        }
+
+        size_t n = len < job->op_left ? len : job->op_left;
+        esp_err_t err;
+        if (job->op.op == OTAUPDATE_OP_DATA) {
+            err = emit(job, data, n);
+        }
+        else {
+            n = n < sizeof(job->scratch) ? n : sizeof(job->scratch);
+            err = esp_partition_read(job->source, job->op.src, job->scratch, n);
+            for (size_t i = 0; err == ESP_OK && i < n; i++) {
+                job->scratch[i] += data[i];
+            }
+            if (err == ESP_OK) {
+                err = emit(job, job->scratch, n);
+            }
+            job->op.src += n;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        job->op_left -= n;
+        data += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t job_feed(ota_job_t* job, const uint8_t* data, size_t len)
+{
+    if (job->header.kind == OTAUPDATE_KIND_DELTA) {
+        return delta_feed(job, data, len);
+    }
+    return emit(job, data, len);
+}
+
+// Read exactly len bytes, or fewer at end of body
+static int http_read(esp_http_client_handle_t client, uint8_t* buf, int len)
+{
+    int total = 0;
+    while (total < len) {
+        int n = esp_http_client_read(client, (char*)buf + total, len - total);
+        if (n <= 0) break;
+        total += n;
+    }
+    return total;
+}
+
+// Inflate the body into the job as it arrives. The ROM inflater needs the
+// whole 32 KB window as its output buffer, it wraps around in it.
+static esp_err_t inflate_body(esp_http_client_handle_t client, ota_job_t* job)
+{
+    tinfl_decompressor* inflator = malloc(sizeof(tinfl_decompressor));
+    uint8_t* window = malloc(TINFL_LZ_DICT_SIZE);
+    uint8_t* in = malloc(OTAUPDATE_CHUNK);
+    if (inflator == NULL || window == NULL || in == NULL) {
+        free(inflator);
+        free(window);
+        free(in);
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(inflator);
+
+    esp_err_t err = ESP_OK;
+    size_t window_ofs = 0;
+    size_t in_len = 0;
+    size_t in_ofs = 0;
+    bool body_done = false;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    while (err == ESP_OK && status != TINFL_STATUS_DONE) {
+        if (in_ofs == in_len && !body_done) {
+            int n = esp_http_client_read(client, (char*)in, OTAUPDATE_CHUNK);
+            if (n < 0) {
+                err = ESP_FAIL;
+                break;
+            }
+            body_done = n == 0;
+            stats.last_download_bytes += n;
+            in_len = n;
+            in_ofs = 0;
+        }
+
+        size_t in_bytes = in_len - in_ofs;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - window_ofs;
+        status = tinfl_decompress(inflator, in + in_ofs, &in_bytes, window, window + window_ofs, &out_bytes,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32 | (body_done ? 0 : TINFL_FLAG_HAS_MORE_INPUT));
+        in_ofs += in_bytes;
+
+        if (out_bytes > 0) {
+            err = job_feed(job, window + window_ofs, out_bytes);
+            window_ofs = (window_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+        if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_NEEDS_MORE_INPUT && body_done)) {
+            ESP_LOGE(TAG, "Corrupt or truncated update stream (%d)", status);
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    free(inflator);
+    free(window);
+    free(in);
+    return err;
+}
+
+// Check the header against the running image and the slot it goes to
+static esp_err_t job_begin(ota_job_t* job, const uint8_t* running_digest)
+{
+    const otaupdate_header_t* h = &job->header;
+    if (h->magic != OTAUPDATE_MAGIC || h->version != OTAUPDATE_VERSION
+        || (h->kind != OTAUPDATE_KIND_FULL && h->kind != OTAUPDATE_KIND_DELTA)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (h->kind == OTAUPDATE_KIND_DELTA && memcmp(h->source_digest, running_digest, 32) != 0) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    if (target == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (h->image_size > target->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // erase sector by sector as the image is written: one long erase would
+    // stall the reader task running from flash
+    esp_err_t err = esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &job->handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mbedtls_sha256_init(&job->sha);
+    mbedtls_sha256_starts(&job->sha, 0);
+    return ESP_OK;
+}
+
+// Verify the rebuilt image and make it the next boot partition
+static esp_err_t job_finish(ota_job_t* job)
+{
+    uint8_t sha[32];
+    mbedtls_sha256_finish(&job->sha, sha);
+    mbedtls_sha256_free(&job->sha);
+    if (job->written != job->header.image_size || memcmp(sha, job->header.image_sha256, sizeof(sha)) != 0) {
+        esp_ota_abort(job->handle);
+        return ESP_ERR_INVALID_CRC;
+    }
+    // esp_ota_end also checks the image structure and its appended digest
+    esp_err_t err = esp_ota_end(job->handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_ota_set_boot_partition(esp_ota_get_next_update_partition(NULL));
+}
+
+// Ask the server for an update of the running image and stage it in the
+// other slot. ESP_ERR_NOT_FOUND when there is none. The door keeps serving
+// taps throughout; the new image runs after the next restart.
+esp_err_t otaupdate_check(const char* server_url)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    uint8_t digest[32];
+    esp_err_t err = esp_partition_get_sha256(running, digest);
+    if (err != ESP_OK) {
+        return err;
+    }
+    char digest_hex[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(&digest_hex[i * 2], 3, "%02x", digest[i]);
+    }
+    char url[160];
+    snprintf(url, sizeof(url), "%s" OTAUPDATE_PATH, server_url, digest_hex);
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .method = HTTP_METHOD_GET,
+        .timeout_ms = OTAUPDATE_HTTP_TIMEOUT_MS,
+        .buffer_size = OTAUPDATE_CHUNK,
+    };
+    authclient_apply_tls(&config);
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    stats.checks++;
+
+    ota_job_t* job = NULL;
+    int64_t start = esp_timer_get_time();
+    err = esp_http_client_open(client, 0);
+    if (err != ESP_OK || esp_http_client_fetch_headers(client) < 0) {
+        err = err != ESP_OK ? err : ESP_FAIL;
+        goto out;
+    }
+    int status = esp_http_client_get_status_code(client);
+    if (status == 204 || status == 304) {
+        err = ESP_ERR_NOT_FOUND;    // running the latest image
+        goto out;
+    }
+    if (status != 200) {
+        ESP_LOGW(TAG, "Update request returned %d", status);
+        err = ESP_FAIL;
+        goto out;
+    }
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL) {
+        err = ESP_ERR_NO_MEM;
+        goto out;
+    }
+    job->source = running;
+    if (http_read(client, (uint8_t*)&job->header, sizeof(job->header)) != sizeof(job->header)) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto out;
+    }
+    stats.last_download_bytes = sizeof(job->header);
+    err = job_begin(job, digest);
+    if (err != ESP_OK) {
+        goto out;
+    }
+    ESP_LOGI(TAG, "Downloading %s update, %lu byte image",
+        job->header.kind == OTAUPDATE_KIND_DELTA ? "delta" : "full", job->header.image_size);
+
+    err = inflate_body(client, job);
+    if (err == ESP_OK) {
+        err = job_finish(job);
+    }
+    else {
+        mbedtls_sha256_free(&job->sha);
+        esp_ota_abort(job->handle);
+    }
+    if (err == ESP_OK) {
+        stats.updates++;
+        stats.last_image_bytes = job->written;
+        stats.last_duration_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+        ESP_LOGI(TAG, "Update staged: %lu bytes downloaded for a %lu byte image in %lu ms",
+            stats.last_download_bytes, stats.last_image_bytes, stats.last_duration_ms);
+    }
+
+out:
+    free(job);
+    esp_http_client_cleanup(client);
+    stats.last_error = err;
+    return err;
+}
+
+static void update_task(void* arg)
+{
+    vTaskDelay(pdMS_TO_TICKS(OTAUPDATE_FIRST_CHECK_MS));
+    while (1) {
+        esp_err_t err = otaupdate_check(server);
+        if (err == ESP_OK) {
+            // the swap is a restart; do not cut a door cycle short
+            while (door_idle != NULL && !door_idle()) {
+                vTaskDelay(pdMS_TO_TICKS(OTAUPDATE_IDLE_POLL_MS));
+            }
+            ESP_LOGI(TAG, "Restarting into the new image");
+            esp_restart();
+        }
+        if (err != ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "Update check failed: %s", esp_err_to_name(err));
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTAUPDATE_CHECK_INTERVAL_MS));
+    }
+}
+
+esp_err_t otaupdate_start_task(const char* server_url, otaupdate_idle_fn idle)
+{
+    server = server_url;
+    door_idle = idle;
+    if (xTaskCreatePinnedToCore(update_task, "otaupdate", 4096, NULL, OTAUPDATE_TASK_PRIORITY, NULL,
+        OTAUPDATE_TASK_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Call once the door works after boot. A new image stays on probation until
+// then; an unhealthy one, or a crash before this, boots the previous image.
+void otaupdate_confirm_boot(bool healthy)
+{
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK
+        || state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+    if (healthy) {
+        ESP_LOGI(TAG, "New image confirmed");
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+    else {
+        ESP_LOGE(TAG, "New image unhealthy, rolling back");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+void otaupdate_get_stats(otaupdate_stats_t* out)
+{
+    *out = stats;
+}
@@ -0,0 +1,63 @@
+#ifndef OTAUPDATE_H
+#define OTAUPDATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Whether the door can be restarted right now, e.g. no door cycle running
+typedef bool (*otaupdate_idle_fn)(void);
+
+typedef struct {
+    uint32_t checks;
+    uint32_t updates;           // images staged in the other slot
+    uint32_t last_download_bytes;
+    uint32_t last_image_bytes;
+    uint32_t last_duration_ms;
+    esp_err_t last_error;
+} otaupdate_stats_t;
+
+esp_err_t otaupdate_check(const char* server_url);
+esp_err_t otaupdate_start_task(const char* server_url, otaupdate_idle_fn idle);
+void otaupdate_confirm_boot(bool healthy);
+void otaupdate_get_stats(otaupdate_stats_t* out);
+
+#define OTAUPDATE_PATH              "/firmware/%s"  // SHA-256 digest of the running image, hex
+#define OTAUPDATE_HTTP_TIMEOUT_MS   15000
+#define OTAUPDATE_FIRST_CHECK_MS    (60 * 1000)     // leave the boot to the door
+#define OTAUPDATE_CHECK_INTERVAL_MS (60 * 60 * 1000)
+#define OTAUPDATE_IDLE_POLL_MS      1000            // waiting for a quiet moment to restart
+#define OTAUPDATE_CHUNK             1024            // download and flash write granularity
+#define OTAUPDATE_TASK_PRIORITY     2               // below the reader, auth and sync tasks
+#define OTAUPDATE_TASK_CORE         0               // the reader runs on core 1
+
+// Update file: header, then a zlib stream. For a full update the stream is
+// the image; for a delta it is a list of operations that rebuild the image
+// from the running one (tools/otadelta.py builds both).
+#define OTAUPDATE_MAGIC             0x41544F44      // "DOTA"
+#define OTAUPDATE_VERSION           1
+#define OTAUPDATE_KIND_FULL         0
+#define OTAUPDATE_KIND_DELTA        1
+
+// Delta operations: op, source offset, length, then length payload bytes
+#define OTAUPDATE_OP_ADD            1       // image byte = running image byte + payload byte
+#define OTAUPDATE_OP_DATA           2       // image byte = payload byte
+
+// All fields little endian
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t kind;
+    uint16_t reserved;
+    uint32_t image_size;
+    uint8_t image_sha256[32];   // of the whole new image file
+    uint8_t source_digest[32];  // delta: SHA-256 appended to the image it applies to
+} otaupdate_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t op;
+    uint32_t src;
+    uint32_t len;
+} otaupdate_op_t;
+
+#endif
@@ -1,11 +1,172 @@
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/ledc.h"
 #include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "metrics.h"
 #include "servo.h"
 
+/** TYPES **/
+
+typedef enum {
+    SERVO_IDLE,
+    SERVO_OPENING,
+    SERVO_HOLDING,
+    SERVO_CLOSING,
+} servo_state_t;
+
+/** GLOBALS **/
+
+// duty for every whole degree, so moving never needs float math
+static uint16_t duty_lut[SERVO_MAX_ANGLE + 1];
+
+static SemaphoreHandle_t servo_lock;
+static esp_timer_handle_t phase_timer;     // end of a move or of the hold time
+static esp_timer_handle_t step_timer;      // trapezoid profile frames
+static servo_profile_t profile = SERVO_DEFAULT_PROFILE;
+static servo_state_t state = SERVO_IDLE;
+static uint32_t hold_ms;
+static servo_done_cb_t done_cb;
+static void* done_arg;
+static int64_t open_requested_us;
+
+// trapezoid motion in progress
+static uint32_t current_duty;
+static uint32_t move_from;
+static uint32_t move_to;
+static uint32_t move_step;
+static uint32_t move_steps;
+
+static const char* TAG = "SERVO";
+
+/** FUNCTIONS **/
+
+static uint32_t pulse_to_duty(uint32_t pulse_us)
+{
+    // Period = 1/50Hz = 20ms = 20000us
+    return (pulse_us * SERVO_MAX_DUTY) / 20000;
+}
+
+static esp_err_t apply_duty(uint32_t duty)
+{
+    esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL, duty);
+    if (err != ESP_OK) return err;
+    current_duty = duty;
+    return ledc_update_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL);
+}
+
+// Trapezoidal velocity: accelerate for the first a = n/4 steps, cruise,
+// decelerate for the last a. The cruise speed 1/(n - a) makes the three
+// phases add up to the full travel whatever n is. Returns the distance
+// covered after step t of n, in 1/65536ths of the total travel.
+static uint32_t trapezoid_fraction(uint32_t t, uint32_t n)
+{
+    uint64_t a = n / 4 ? n / 4 : 1;
+    uint64_t full = 1 << 16;
+    if (t >= n) return full;
+    if (t == 0) return 0;
+    if (t <= a) {
+        return (uint32_t)(full * t * t / (2 * a * (n - a)));
+    }
+    if (t < n - a) {
+        return (uint32_t)(full * (2 * t - a) / (2 * (n - a)));
+    }
+    return (uint32_t)(full - trapezoid_fraction(n - t, n));
+}
+
+static void step_timer_cb(void* arg)
+{
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    move_step++;
+    uint32_t frac = trapezoid_fraction(move_step, move_steps);
+    int32_t span = (int32_t)move_to - (int32_t)move_from;
+    apply_duty(move_from + (int32_t)(((int64_t)span * frac) >> 16));
+    if (move_step >= move_steps) {
+        esp_timer_stop(step_timer);
+    }
+    xSemaphoreGive(servo_lock);
+}
+
+// Start moving towards angle with the current profile; phase_timer fires
+// when the move is done. Must be called with servo_lock held.
+static void start_move(uint8_t angle)
+{
+    esp_timer_stop(phase_timer);
+    esp_timer_stop(step_timer);
+    if (profile == SERVO_PROFILE_RAMP) {
+        ledc_fade_stop(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL);
+        current_duty = ledc_get_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL);
+    }
+
+    uint32_t target = duty_lut[angle];
+    uint32_t span = target > current_duty ? target - current_duty : current_duty - target;
+    uint32_t full = duty_lut[SERVO_MAX_ANGLE] - duty_lut[0];
+    // a partial move (e.g. reversing mid-close) takes proportionally less time
+    uint32_t move_ms = span * SERVO_MOVE_MS / full;
+
+    if (move_ms < SERVO_FRAME_MS || profile == SERVO_PROFILE_STEP) {
+        apply_duty(target);
+    }
+    else if (profile == SERVO_PROFILE_RAMP) {
+        // linear ramp generated by the LEDC fade hardware
+        ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL, target, move_ms);
+        ledc_fade_start(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL, LEDC_FADE_NO_WAIT);
+        current_duty = target;
+    }
+    else {
+        move_from = current_duty;
+        move_to = target;
+        move_step = 0;
+        move_steps = move_ms / SERVO_FRAME_MS;
+        esp_timer_start_periodic(step_timer, SERVO_FRAME_MS * 1000);
+    }
+
+    esp_timer_start_once(phase_timer, (uint64_t)(move_ms ? move_ms : 1) * 1000);
+}
+
+static void phase_timer_cb(void* arg)
+{
+    servo_done_cb_t cb = NULL;
+    void* cb_arg = NULL;
+
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    switch (state) {
+    case SERVO_OPENING:
+        state = SERVO_HOLDING;
+        metrics_observe(METRIC_SERVO_OPEN, (uint32_t)(esp_timer_get_time() - open_requested_us));
+        esp_timer_start_once(phase_timer, (uint64_t)hold_ms * 1000);
+        break;
+    case SERVO_HOLDING:
+        state = SERVO_CLOSING;
+        start_move(SERVO_CLOSED_ANGLE);
+        break;
+    case SERVO_CLOSING:
+        state = SERVO_IDLE;
+        cb = done_cb;
+        cb_arg = done_arg;
+        done_cb = NULL;
+        break;
+    case SERVO_IDLE:
+        break;
+    }
+    xSemaphoreGive(servo_lock);
+
+    if (cb != NULL) {
+        cb(cb_arg);
+    }
+}
+
 esp_err_t servo_init(void) {
+    // first, the channel starts out at the closed angle
+    for (uint32_t angle = 0; angle <= SERVO_MAX_ANGLE; angle++) {
+        uint32_t pulse_us = SERVO_MIN_PULSE_US
+            + angle * (SERVO_MAX_PULSE_US - SERVO_MIN_PULSE_US) / SERVO_MAX_ANGLE;
+        duty_lut[angle] = pulse_to_duty(pulse_us);
+    }
+
     // Configure timer
     ledc_timer_config_t timer_config = {
         .speed_mode = LEDC_LOW_SPEED_MODE,
@@ -24,29 +185,38 @@ esp_err_t servo_init(void) {
         .timer_sel = SERVO_TIMER,
         .intr_type = LEDC_INTR_DISABLE,
         .gpio_num = SERVO_PIN,
-        .duty = 0,
+        .duty = duty_lut[SERVO_CLOSED_ANGLE],   // no pulse below SERVO_MIN_PULSE_US, ever
         .hpoint = 0
     };
-    return ledc_channel_config(&channel_config);
-}
-esp_err_t servo_set_angle(float angle) {
-    // Clamp angle to valid range
-    if (angle < 0) angle = 0;
-    if (angle > 180) angle = 180;
+    err = ledc_channel_config(&channel_config);
+    if (err != ESP_OK) return err;
+    current_duty = duty_lut[SERVO_CLOSED_ANGLE];
 
-    // Calculate pulse width in microseconds
-    uint32_t pulse_us = SERVO_MIN_PULSE_US +
-        (angle / 180.0) * (SERVO_MAX_PULSE_US - SERVO_MIN_PULSE_US);
+    err = ledc_fade_func_install(0);
+    if (err != ESP_OK) return err;
 
-    // Calculate duty cycle
-    // Period = 1/50Hz = 20ms = 20000us
-    uint32_t duty = (pulse_us * SERVO_MAX_DUTY) / 20000;
+    servo_lock = xSemaphoreCreateMutex();
+    if (servo_lock == NULL) return ESP_ERR_NO_MEM;
 
-    // Set PWM duty cycle
-    esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL, duty);
+    esp_timer_create_args_t phase_args = {
+        .callback = phase_timer_cb,
+        .name = "servo_phase",
+    };
+    err = esp_timer_create(&phase_args, &phase_timer);
     if (err != ESP_OK) return err;
 
-    return ledc_update_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL);
+    esp_timer_create_args_t step_args = {
+        .callback = step_timer_cb,
+        .name = "servo_step",
+    };
+    return esp_timer_create(&step_args, &step_timer);
+}
+
+esp_err_t servo_set_angle(uint8_t angle) {
+    // Clamp angle to valid range
+    if (angle > SERVO_MAX_ANGLE) angle = SERVO_MAX_ANGLE;
+
+    return apply_duty(duty_lut[angle]);
 }
 
 esp_err_t servo_set_pulse_width(uint32_t pulse_us) {
@@ -54,11 +224,73 @@ esp_err_t servo_set_pulse_width(uint32_t pulse_us) {
     if (pulse_us < SERVO_MIN_PULSE_US) pulse_us = SERVO_MIN_PULSE_US;
     if (pulse_us > SERVO_MAX_PULSE_US) pulse_us = SERVO_MAX_PULSE_US;
 
-    // Calculate duty cycle
-    uint32_t duty = (pulse_us * SERVO_MAX_DUTY) / 20000;
+    return apply_duty(pulse_to_duty(pulse_us));
+}
 
-    esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL, duty);
-    if (err != ESP_OK) return err;
+void servo_set_profile(servo_profile_t new_profile)
+{
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    profile = new_profile;
+    xSemaphoreGive(servo_lock);
+}
 
-    return ledc_update_duty(LEDC_LOW_SPEED_MODE, SERVO_CHANNEL);
+// Open, hold for hold_time_ms, close, then call cb (from the esp_timer task).
+// Calling again while a cycle runs extends it: during the hold the hold time
+// restarts, while closing the door reopens from where it is.
+esp_err_t servo_open_for(uint32_t hold_time_ms, servo_done_cb_t cb, void* arg)
+{
+    if (servo_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    hold_ms = hold_time_ms;
+    done_cb = cb;
+    done_arg = arg;
+
+    switch (state) {
+    case SERVO_IDLE:
+    case SERVO_CLOSING:
+        state = SERVO_OPENING;
+        open_requested_us = esp_timer_get_time();
+        start_move(SERVO_OPEN_ANGLE);
+        break;
+    case SERVO_OPENING:
+        break;  // the new hold time applies once open
+    case SERVO_HOLDING:
+        esp_timer_stop(phase_timer);
+        esp_timer_start_once(phase_timer, (uint64_t)hold_ms * 1000);
+        ESP_LOGI(TAG, "Hold extended by %lu ms", hold_ms);
+        break;
+    }
+    xSemaphoreGive(servo_lock);
+    return ESP_OK;
+}
+
+// Cut the current cycle short and close now; the completion callback still runs
+esp_err_t servo_cancel(void)
+{
+    if (servo_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    if (state == SERVO_OPENING || state == SERVO_HOLDING) {
+        state = SERVO_CLOSING;
+        start_move(SERVO_CLOSED_ANGLE);
+    }
+    xSemaphoreGive(servo_lock);
+    return ESP_OK;
+}
+
+bool servo_is_busy(void)
+{
+    if (servo_lock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(servo_lock, portMAX_DELAY);
+    bool busy = state != SERVO_IDLE;
+    xSemaphoreGive(servo_lock);
+    return busy;
 }
@@ -3,10 +3,24 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "esp_err.h"
+
+typedef enum {
+    SERVO_PROFILE_STEP,         // jump straight to the target
+    SERVO_PROFILE_RAMP,         // constant speed, run by the LEDC fade hardware
+    SERVO_PROFILE_TRAPEZOID,    // accelerate/cruise/decelerate, stepped by an esp_timer
+} servo_profile_t;
+
+// Called from the esp_timer task once the door is closed again
+typedef void (*servo_done_cb_t)(void* arg);
 
 esp_err_t servo_init(void);
-esp_err_t servo_set_angle(float angle);
+esp_err_t servo_set_angle(uint8_t angle);
 esp_err_t servo_set_pulse_width(uint32_t pulse_us);
+void servo_set_profile(servo_profile_t profile);
+esp_err_t servo_open_for(uint32_t hold_time_ms, servo_done_cb_t cb, void* arg);
+esp_err_t servo_cancel(void);
+bool servo_is_busy(void);
 
 // Servo configuration
 #define SERVO_PIN           21     // GPIO pin connected to servo signal wire
@@ -18,6 +32,14 @@ esp_err_t servo_set_pulse_width(uint32_t pulse_us);
 #define SERVO_MIN_PULSE_US  500    // 0 degrees (0.5ms pulse)
 #define SERVO_MAX_PULSE_US  2500   // 180 degrees (2.5ms pulse)
 #define SERVO_MID_PULSE_US  1500   // 90 degrees (1.5ms pulse)
+#define SERVO_MAX_ANGLE     180
+
+// Door cycle
+#define SERVO_OPEN_ANGLE        180
+#define SERVO_CLOSED_ANGLE      0
+#define SERVO_MOVE_MS           400    // full 0-180 travel
+#define SERVO_FRAME_MS          20     // one PWM period, trapezoid step size
+#define SERVO_DEFAULT_PROFILE   SERVO_PROFILE_TRAPEZOID
 
 // PWM resolution
 #define SERVO_RESOLUTION    LEDC_TIMER_16_BIT
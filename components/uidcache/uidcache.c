@@ -0,0 +1,347 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "uidcache.h"
+
+/** TYPES **/
+
+// Key layout is also the persisted layout: length byte followed by the
+// zero-padded UID, so entries compare with a single memcmp.
+typedef struct {
+    uint8_t len;
+    uint8_t uid[UIDCACHE_MAX_UID_LEN];
+} uidcache_key_t;
+
+typedef struct {
+    uidcache_key_t key;
+    int64_t validated_us;   // esp_timer time of last server confirmation; set back a TTL when only known to be stale
+} uidcache_entry_t;
+
+/** GLOBALS **/
+
+// sorted by key
+static uidcache_entry_t entries[UIDCACHE_MAX_ENTRIES];
+static uint16_t entry_count = 0;
+static SemaphoreHandle_t cache_lock;
+static int64_t ttl_us = (int64_t)UIDCACHE_TTL_MS * 1000;
+static const int64_t max_stale_us = (int64_t)UIDCACHE_MAX_STALE_MS * 1000;
+// writers of the NVS copy, so an older snapshot never lands after a newer one
+static SemaphoreHandle_t save_lock;
+static esp_timer_handle_t flush_timer;
+static bool dirty = false;  // RAM holds entries NVS does not
+// bumped by every remove and flush, so a server answer that raced one is not cached
+static uint32_t generation = 0;
+
+static const char* TAG = "UIDCACHE";
+
+/** FUNCTIONS **/
+
+static bool make_key(const uint8_t* uid, uint8_t uid_len, uidcache_key_t* key)
+{
+    if (uid_len == 0 || uid_len > UIDCACHE_MAX_UID_LEN) {
+        return false;
+    }
+    memset(key, 0, sizeof(*key));
+    key->len = uid_len;
+    memcpy(key->uid, uid, uid_len);
+    return true;
+}
+
+// Binary search; returns true if found, otherwise *pos is the insertion point
+static bool find(const uidcache_key_t* key, uint16_t* pos)
+{
+    int lo = 0;
+    int hi = (int)entry_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = memcmp(&entries[mid].key, key, sizeof(*key));
+        if (cmp == 0) {
+            *pos = mid;
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *pos = lo;
+    return false;
+}
+
+// Snapshot the keys under the cache lock, write them with only the save lock
+// held: lookups never wait for flash. only_if_dirty skips a write nothing needs.
+static esp_err_t save(bool only_if_dirty)
+{
+    static uidcache_key_t keys[UIDCACHE_MAX_ENTRIES];
+
+    xSemaphoreTake(save_lock, portMAX_DELAY);
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (only_if_dirty && !dirty) {
+        xSemaphoreGive(cache_lock);
+        xSemaphoreGive(save_lock);
+        return ESP_OK;
+    }
+    uint16_t count = entry_count;
+    for (uint16_t i = 0; i < count; i++) {
+        keys[i] = entries[i].key;
+    }
+    dirty = false;
+    xSemaphoreGive(cache_lock);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(UIDCACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, UIDCACHE_NVS_KEY, keys, count * sizeof(uidcache_key_t));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        // try again with the next flush
+        xSemaphoreTake(cache_lock, portMAX_DELAY);
+        dirty = true;
+        xSemaphoreGive(cache_lock);
+        ESP_LOGW(TAG, "Failed to persist cache: %s", esp_err_to_name(err));
+    }
+    xSemaphoreGive(save_lock);
+    return err;
+}
+
+static void flush_timer_cb(void* arg)
+{
+    if (save(true) != ESP_OK) {
+        esp_timer_start_once(flush_timer, (uint64_t)UIDCACHE_FLUSH_DELAY_MS * 1000);
+    }
+}
+
+// Called with cache_lock held: NVS catches up within UIDCACHE_FLUSH_DELAY_MS,
+// and a burst of new cards costs a single write
+static void mark_dirty_locked(void)
+{
+    dirty = true;
+    if (!esp_timer_is_active(flush_timer)) {
+        esp_timer_start_once(flush_timer, (uint64_t)UIDCACHE_FLUSH_DELAY_MS * 1000);
+    }
+}
+
+// Load the persisted allow-list. NVS must already be initialized.
+esp_err_t uidcache_init(void)
+{
+    if (cache_lock == NULL) {
+        cache_lock = xSemaphoreCreateMutex();
+        save_lock = xSemaphoreCreateMutex();
+        if (cache_lock == NULL || save_lock == NULL) return ESP_ERR_NO_MEM;
+
+        esp_timer_create_args_t flush_args = {
+            .callback = flush_timer_cb,
+            .name = "uidcache_flush",
+        };
+        esp_err_t err = esp_timer_create(&flush_args, &flush_timer);
+        if (err != ESP_OK) return err;
+    }
+
+    static uidcache_key_t keys[UIDCACHE_MAX_ENTRIES];
+    size_t size = sizeof(keys);
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(UIDCACHE_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK; // nothing persisted yet
+    }
+    if (err != ESP_OK) return err;
+
+    err = nvs_get_blob(nvs, UIDCACHE_NVS_KEY, keys, &size);
+    nvs_close(nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    entry_count = 0;
+    // when these were last confirmed is unknown: stale from now on, until
+    // revalidated or UIDCACHE_MAX_STALE_MS from now
+    int64_t loaded_us = esp_timer_get_time() - ttl_us;
+    for (size_t i = 0; i < size / sizeof(uidcache_key_t); i++) {
+        uint16_t pos;
+        // re-insert rather than trust the stored order
+        if (keys[i].len == 0 || keys[i].len > UIDCACHE_MAX_UID_LEN || find(&keys[i], &pos)) {
+            continue;
+        }
+        memmove(&entries[pos + 1], &entries[pos], (entry_count - pos) * sizeof(uidcache_entry_t));
+        entries[pos].key = keys[i];
+        entries[pos].validated_us = loaded_us;
+        entry_count++;
+    }
+    xSemaphoreGive(cache_lock);
+
+    ESP_LOGI(TAG, "Loaded %d allowed UIDs from NVS", entry_count);
+    return ESP_OK;
+}
+
+uidcache_result_t uidcache_lookup(const uint8_t* uid, uint8_t uid_len)
+{
+    uidcache_key_t key;
+    if (!make_key(uid, uid_len, &key)) {
+        return UIDCACHE_MISS;
+    }
+
+    uidcache_result_t result = UIDCACHE_MISS;
+    uint16_t pos;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (find(&key, &pos)) {
+        int64_t age = esp_timer_get_time() - entries[pos].validated_us;
+        if (age < ttl_us) {
+            result = UIDCACHE_FRESH;
+        } else if (age < max_stale_us) {
+            result = UIDCACHE_STALE;
+        }
+        // past the stale limit the entry no longer grants on its own, only the server can
+    }
+    xSemaphoreGive(cache_lock);
+
+    return result;
+}
+
+// Called with cache_lock held
+static void insert_locked(const uidcache_key_t* key)
+{
+    uint16_t pos;
+    if (find(key, &pos)) {
+        entries[pos].validated_us = esp_timer_get_time();
+        return;
+    }
+
+    if (entry_count == UIDCACHE_MAX_ENTRIES) {
+        // evict the entry that was confirmed longest ago
+        uint16_t oldest = 0;
+        for (uint16_t i = 1; i < entry_count; i++) {
+            if (entries[i].validated_us < entries[oldest].validated_us) {
+                oldest = i;
+            }
+        }
+        memmove(&entries[oldest], &entries[oldest + 1], (entry_count - oldest - 1) * sizeof(uidcache_entry_t));
+        entry_count--;
+        find(key, &pos);
+    }
+
+    memmove(&entries[pos + 1], &entries[pos], (entry_count - pos) * sizeof(uidcache_entry_t));
+    entries[pos].key = *key;
+    entries[pos].validated_us = esp_timer_get_time();
+    entry_count++;
+    mark_dirty_locked();
+}
+
+// Add a UID confirmed by the server, or refresh its validation time
+esp_err_t uidcache_insert(const uint8_t* uid, uint8_t uid_len)
+{
+    uidcache_key_t key;
+    if (!make_key(uid, uid_len, &key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    insert_locked(&key);
+    xSemaphoreGive(cache_lock);
+
+    return ESP_OK;
+}
+
+// Taken before asking the server, passed to uidcache_insert_if with its answer
+uint32_t uidcache_generation(void)
+{
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    uint32_t current = generation;
+    xSemaphoreGive(cache_lock);
+    return current;
+}
+
+// uidcache_insert, unless a remove or flush ran after uidcache_generation
+// returned since: the answer may predate a revoke, ESP_ERR_INVALID_STATE
+esp_err_t uidcache_insert_if(const uint8_t* uid, uint8_t uid_len, uint32_t since)
+{
+    uidcache_key_t key;
+    if (!make_key(uid, uid_len, &key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    if (generation == since) {
+        insert_locked(&key);
+        err = ESP_OK;
+    }
+    xSemaphoreGive(cache_lock);
+
+    return err;
+}
+
+// Drop a UID the server no longer allows
+esp_err_t uidcache_remove(const uint8_t* uid, uint8_t uid_len)
+{
+    uidcache_key_t key;
+    if (!make_key(uid, uid_len, &key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t pos;
+    bool found;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    // also when not cached: the UID may be on its way in
+    generation++;
+    found = find(&key, &pos);
+    if (found) {
+        memmove(&entries[pos], &entries[pos + 1], (entry_count - pos - 1) * sizeof(uidcache_entry_t));
+        entry_count--;
+        dirty = true;
+    }
+    xSemaphoreGive(cache_lock);
+
+    // a revocation must survive a reboot: written now, not on the timer
+    return found ? save(true) : ESP_OK;
+}
+
+esp_err_t uidcache_flush(void)
+{
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    generation++;
+    entry_count = 0;
+    dirty = true;
+    xSemaphoreGive(cache_lock);
+    return save(true);
+}
+
+// Keep the entries but have every one revalidated on its next hit, e.g. after
+// revocations may have been missed
+void uidcache_expire_all(void)
+{
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    int64_t expired_us = esp_timer_get_time() - ttl_us;
+    for (uint16_t i = 0; i < entry_count; i++) {
+        if (entries[i].validated_us > expired_us) {
+            entries[i].validated_us = expired_us;
+        }
+    }
+    xSemaphoreGive(cache_lock);
+}
+
+// How long a server confirmation stays fresh
+void uidcache_set_ttl(uint32_t ttl_ms)
+{
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    ttl_us = (int64_t)ttl_ms * 1000;
+    xSemaphoreGive(cache_lock);
+}
+
+uint16_t uidcache_count(void)
+{
+    return entry_count;
+}
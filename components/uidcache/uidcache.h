@@ -0,0 +1,36 @@
+#ifndef UIDCACHE_H
+#define UIDCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Result of a cache lookup
+typedef enum {
+    UIDCACHE_MISS = 0,      // UID not known locally, ask the server
+    UIDCACHE_FRESH,         // UID allowed and validated within the TTL
+    UIDCACHE_STALE,         // UID allowed but needs background revalidation
+} uidcache_result_t;
+
+esp_err_t uidcache_init(void);
+uidcache_result_t uidcache_lookup(const uint8_t* uid, uint8_t uid_len);
+esp_err_t uidcache_insert(const uint8_t* uid, uint8_t uid_len);
+uint32_t uidcache_generation(void);
+esp_err_t uidcache_insert_if(const uint8_t* uid, uint8_t uid_len, uint32_t since);
+esp_err_t uidcache_remove(const uint8_t* uid, uint8_t uid_len);
+esp_err_t uidcache_flush(void);
+void uidcache_expire_all(void);
+void uidcache_set_ttl(uint32_t ttl_ms);
+uint16_t uidcache_count(void);
+
+// Cache configuration
+#define UIDCACHE_MAX_ENTRIES    256                 // allowed UIDs kept in RAM / NVS
+#define UIDCACHE_MAX_UID_LEN    10                  // 4, 7 or 10 byte UIDs
+#define UIDCACHE_TTL_MS         (10 * 60 * 1000)    // entries older than this are revalidated
+#define UIDCACHE_PUSH_TTL_MS    (24 * 60 * 60 * 1000)   // while revocations are pushed to the door
+#define UIDCACHE_MAX_STALE_MS   (72 * 60 * 60 * 1000)   // unconfirmed this long, an entry no longer grants
+#define UIDCACHE_FLUSH_DELAY_MS 5000                // new entries reach NVS this long after the first one
+#define UIDCACHE_NVS_NAMESPACE  "uidcache"
+#define UIDCACHE_NVS_KEY        "allow"
+
+#endif
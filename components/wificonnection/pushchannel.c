@@ -0,0 +1,256 @@
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#include "mbedtls/md.h"
+#include "dlog.h"
+#include "wificonnection.h"
+#include "pushchannel.h"
+
+/** GLOBALS **/
+
+static esp_mqtt_client_handle_t client;
+static pushchannel_config_t cfg;
+static bool started;
+
+// HMAC context set up once, checking an event never allocates
+static mbedtls_md_context_t hmac;
+static uint8_t hmac_key[PUSHPROTO_MAX_KEY_LEN];
+static size_t hmac_key_len;
+
+// sequence state, only touched on the MQTT task
+static bool have_seq;
+static uint32_t last_seq;
+static pushchannel_stats_t stats;
+
+static const char* TAG = "PUSH";
+
+/** FUNCTIONS **/
+
+static uint32_t get_be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Truncated HMAC-SHA256 of len bytes
+static void compute_mac(const void* data, size_t len, uint8_t* mac_out)
+{
+    uint8_t full[32];
+    mbedtls_md_hmac_starts(&hmac, hmac_key, hmac_key_len);
+    mbedtls_md_hmac_update(&hmac, data, len);
+    mbedtls_md_hmac_finish(&hmac, full);
+    memcpy(mac_out, full, PUSHPROTO_MAC_LEN);
+}
+
+static bool mac_matches(const uint8_t* a, const uint8_t* b)
+{
+    // constant time, a forged event should not learn how many bytes matched
+    uint8_t diff = 0;
+    for (int i = 0; i < PUSHPROTO_MAC_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static void emit(push_event_type_t type, uint32_t seq)
+{
+    push_event_t event = { .type = type, .seq = seq };
+    cfg.cb(&event, cfg.arg);
+}
+
+// Only checkable once SNTP has set the clock
+static bool is_fresh(uint32_t issued_at)
+{
+    int64_t age = (int64_t)time(NULL) - issued_at;
+    return age <= PUSHCHANNEL_MAX_AGE_S && age >= -PUSHCHANNEL_MAX_AGE_S;
+}
+
+static void handle_message(const uint8_t* data, int len)
+{
+    int64_t start = esp_timer_get_time();
+    const pushproto_event_t* msg = (const pushproto_event_t*)data;
+    uint8_t mac[PUSHPROTO_MAC_LEN];
+
+    if (len != sizeof(pushproto_event_t)) {
+        stats.rejected++;
+        return;
+    }
+    compute_mac(msg, offsetof(pushproto_event_t, mac), mac);
+    if (!mac_matches(mac, msg->mac) || msg->magic != PUSHPROTO_MAGIC || msg->version != PUSHPROTO_VERSION
+        || msg->op < PUSHPROTO_OP_GRANT || msg->op > PUSHPROTO_OP_HEARTBEAT || msg->uid_len > sizeof(msg->uid)) {
+        stats.rejected++;
+        return;
+    }
+
+    bool clock_set = wifi_time_is_set();
+    if (clock_set && !is_fresh(get_be32((const uint8_t*)&msg->issued_at))) {
+        stats.stale++;
+        return;
+    }
+
+    uint32_t seq = get_be32((const uint8_t*)&msg->seq);
+    bool heartbeat = msg->op == PUSHPROTO_OP_HEARTBEAT;
+    if (have_seq && !heartbeat && seq == last_seq) {
+        stats.duplicates++;     // QoS 1 redelivery
+        return;
+    }
+    if (!have_seq || seq != (heartbeat ? last_seq : last_seq + 1)) {
+        // first message since subscribing, missed events, or the server started
+        // a new sequence: nothing vouches for this event, resync instead
+        if (have_seq) {
+            stats.gaps++;
+            ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, resyncing", last_seq, seq);
+        }
+        bool adopt_only = !have_seq && heartbeat;
+        have_seq = true;
+        last_seq = seq;
+        stats.last_seq = seq;
+        if (!adopt_only) {
+            emit(PUSH_EVENT_RESYNC, seq);
+        }
+        return;
+    }
+    last_seq = seq;
+    stats.last_seq = seq;
+    if (heartbeat) {
+        return;
+    }
+    if (msg->op == PUSHPROTO_OP_GRANT && !clock_set) {
+        // cannot rule out a replay; the sync brings the grant instead
+        stats.stale++;
+        emit(PUSH_EVENT_RESYNC, seq);
+        return;
+    }
+
+    push_event_t event = {
+        .type = msg->op == PUSHPROTO_OP_GRANT ? PUSH_EVENT_GRANT
+              : msg->op == PUSHPROTO_OP_REVOKE ? PUSH_EVENT_REVOKE : PUSH_EVENT_FLUSH,
+        .seq = seq,
+        .db_version = get_be32((const uint8_t*)&msg->db_version),
+        .uid_len = msg->uid_len,
+    };
+    memcpy(event.uid, msg->uid, msg->uid_len);
+    cfg.cb(&event, cfg.arg);
+    stats.events++;
+    DLOGI(TAG, "Event %lu (op %u) applied in %lu us", seq, msg->op, (uint32_t)(esp_timer_get_time() - start));
+}
+
+static void mqtt_event_handler(void* arg, esp_event_base_t base, int32_t event_id, void* event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        stats.connects++;
+        if (esp_mqtt_client_subscribe(client, PUSHCHANNEL_TOPIC, 1) < 0) {
+            ESP_LOGW(TAG, "Subscribe to %s failed", PUSHCHANNEL_TOPIC);
+        }
+        break;
+    case MQTT_EVENT_SUBSCRIBED:
+        // clean session: whatever was published while we were away is gone
+        ESP_LOGI(TAG, "Subscribed to %s", PUSHCHANNEL_TOPIC);
+        stats.subscribed = true;
+        have_seq = false;
+        emit(PUSH_EVENT_RESYNC, 0);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        if (stats.subscribed) {
+            ESP_LOGW(TAG, "Subscription lost");
+            stats.subscribed = false;
+            emit(PUSH_EVENT_LOST, last_seq);
+        }
+        break;
+    case MQTT_EVENT_DATA:
+        // events are far below the receive buffer, never split
+        if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+            handle_message((const uint8_t*)event->data, event->data_len);
+        }
+        else {
+            stats.rejected++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Follow the Wi-Fi link instead of letting the client retry into a dead network
+static void on_link_change(bool up, void* arg)
+{
+    if (!up) {
+        if (started) {
+            esp_mqtt_client_disconnect(client);
+        }
+        return;
+    }
+    if (!__atomic_test_and_set(&started, __ATOMIC_ACQ_REL)) {
+        esp_mqtt_client_start(client);
+    }
+    else {
+        // skip the rest of the reconnect timeout, the broker is reachable again
+        esp_mqtt_client_reconnect(client);
+    }
+}
+
+// Subscribe to server-pushed grant/revoke/flush events for as long as the
+// firmware runs; connects whenever the Wi-Fi link is up.
+esp_err_t pushchannel_start(const pushchannel_config_t* config)
+{
+    if (client != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->broker_url == NULL || config->broker_url[0] == '\0' || config->cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->key_len == 0 || config->key_len > sizeof(hmac_key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cfg = *config;
+
+    memcpy(hmac_key, config->key, config->key_len);
+    hmac_key_len = config->key_len;
+    mbedtls_md_init(&hmac);
+    if (mbedtls_md_setup(&hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_mqtt_client_config_t mqtt_cfg = {
+        .broker.address.uri = config->broker_url,
+        .broker.verification.certificate = config->ca_pem,
+        .credentials.client_id = config->client_id,
+        .credentials.authentication.certificate = config->client_cert_pem,
+        .credentials.authentication.key = config->client_key_pem,
+        .session.keepalive = PUSHCHANNEL_KEEPALIVE_S,
+        .network.reconnect_timeout_ms = PUSHCHANNEL_RECONNECT_MS,
+        .task.priority = PUSHCHANNEL_TASK_PRIORITY,
+    };
+    client = esp_mqtt_client_init(&mqtt_cfg);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+
+    esp_err_t err = wifi_register_link_cb(on_link_change, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // a link that is already up will not be announced again
+    if (wifi_is_connected()) {
+        on_link_change(true, NULL);
+    }
+    ESP_LOGI(TAG, "Push channel via %s", config->broker_url);
+    return ESP_OK;
+}
+
+bool pushchannel_is_subscribed(void)
+{
+    return stats.subscribed;
+}
+
+void pushchannel_get_stats(pushchannel_stats_t* out)
+{
+    *out = stats;
+}
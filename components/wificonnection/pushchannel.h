@@ -0,0 +1,92 @@
+#ifndef PUSHCHANNEL_H
+#define PUSHCHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// What the server changed, or what the door has to do to catch up
+typedef enum {
+    PUSH_EVENT_GRANT = 0,   // UID allowed from db_version on
+    PUSH_EVENT_REVOKE,      // UID refused from db_version on
+    PUSH_EVENT_FLUSH,       // drop cached decisions and resync
+    PUSH_EVENT_RESYNC,      // (re)subscribed or a gap in the sequence: events may have been missed
+    PUSH_EVENT_LOST,        // subscription gone, changes are no longer pushed
+} push_event_type_t;
+
+typedef struct {
+    push_event_type_t type;
+    uint32_t seq;
+    uint32_t db_version;    // first server database version (X-Db-Version) containing the change
+    uint8_t uid_len;
+    uint8_t uid[10];
+} push_event_t;
+
+// Runs on the MQTT client task; keep it short, the next event waits for it
+typedef void (*push_event_cb_t)(const push_event_t* event, void* arg);
+
+// Strings must outlive the channel. The PEM credentials are only used with an
+// mqtts:// broker and may be NULL.
+typedef struct {
+    const char* broker_url;     // mqtt://host:1883 or mqtts://host:8883
+    const char* client_id;
+    const uint8_t* key;         // events are authenticated like the binary protocol
+    size_t key_len;
+    const char* ca_pem;
+    const char* client_cert_pem;
+    const char* client_key_pem;
+    push_event_cb_t cb;
+    void* arg;
+} pushchannel_config_t;
+
+typedef struct {
+    uint32_t connects;
+    uint32_t events;            // grant, revoke and flush events delivered
+    uint32_t duplicates;        // redelivered events, dropped
+    uint32_t gaps;              // sequence jumps that forced a resync
+    uint32_t stale;             // too old, or a grant that could not be checked for age
+    uint32_t rejected;          // bad size, version or MAC
+    uint32_t last_seq;
+    bool subscribed;
+} pushchannel_stats_t;
+
+esp_err_t pushchannel_start(const pushchannel_config_t* config);
+bool pushchannel_is_subscribed(void);
+void pushchannel_get_stats(pushchannel_stats_t* out);
+
+#define PUSHCHANNEL_TOPIC           "door/acl"
+#define PUSHCHANNEL_KEEPALIVE_S     30      // a dead broker connection is noticed within 1.5x this
+#define PUSHCHANNEL_RECONNECT_MS    5000
+#define PUSHCHANNEL_TASK_PRIORITY   5       // same as revalidation, above sync and OTA
+#define PUSHCHANNEL_MAX_AGE_S       60      // issued_at window either side of the door's clock
+
+// Wire format of one event, the MQTT payload. Sequence numbers increase by one
+// per grant/revoke/flush; a heartbeat repeats the latest one so a lost last
+// event is noticed too. An event that does not continue the sequence is never
+// applied, the door resyncs instead. issued_at keeps a recorded event from
+// being replayed later. All multi-byte fields big-endian, mac covers every
+// byte before it.
+#define PUSHPROTO_MAGIC             0xDB
+#define PUSHPROTO_VERSION           2
+#define PUSHPROTO_OP_GRANT          0x01
+#define PUSHPROTO_OP_REVOKE         0x02
+#define PUSHPROTO_OP_FLUSH          0x03
+#define PUSHPROTO_OP_HEARTBEAT      0x04
+#define PUSHPROTO_MAC_LEN           16
+#define PUSHPROTO_MAX_KEY_LEN       64
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t op;             // PUSHPROTO_OP_*
+    uint8_t uid_len;
+    uint32_t seq;
+    uint32_t db_version;
+    uint32_t issued_at;     // server Unix time
+    uint8_t uid[10];
+    uint8_t reserved[2];
+    uint8_t mac[PUSHPROTO_MAC_LEN];
+} pushproto_event_t;        // 44 bytes
+
+#endif
@@ -1,4 +1,6 @@
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -6,49 +8,141 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif_sntp.h"
 #include "nvs_flash.h"
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-#include "lwip/sys.h"
-#include "lwip/netdb.h"
-#include "lwip/dns.h"
+#include "nvs.h"
+#include "wifi_provisioning/manager.h"
+#include "wifi_provisioning/scheme_softap.h"
+#include "metrics.h"
 #include "wificonnection.h"
-#include "cJSON.h"
 /** DEFINES **/
 
+#define WIFI_CONNECTED_BIT  (1 << 0)
+#define WIFI_RECONNECT_BIT  (1 << 1)   // link is down, manager should try again
+
+/** TYPES **/
+
+// last AP we got an address from, lets the next connect skip the full scan
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_cached_ap_t;
+
+typedef struct {
+    wifi_link_cb_t cb;
+    void* arg;
+} wifi_link_sub_t;
 
 /** GLOBALS **/
 
 // event group to contain status information
 static EventGroupHandle_t wifi_event_group;
 
-// retry tracker
-static int s_retry_num = 0;
+// connect attempts since the link was last up
+static uint32_t s_retry_num = 0;
+
+// when the link was lost, 0 while connected
+static int64_t disconnected_at_us = 0;
+
+static wifi_cached_ap_t cached_ap;
+static bool using_cached_ap = false;
+
+static wifi_link_sub_t link_subs[WIFI_MAX_LINK_CBS];
+static int link_sub_count = 0;
+
+// provisioning session, see wifi_provision_start
+static wifi_provision_config_t prov;
+static wifi_config_t prov_sta;
+static bool prov_succeeded = false;
 
 // task tag
 static const char* TAG = "WIFI";
 /** FUNCTIONS **/
 
+static void publish_link(bool up)
+{
+    int count = __atomic_load_n(&link_sub_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        link_subs[i].cb(up, link_subs[i].arg);
+    }
+}
+
+static void link_down(void)
+{
+    bool was_up = xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT;
+    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    if (disconnected_at_us == 0) {
+        disconnected_at_us = esp_timer_get_time();
+    }
+    if (was_up) {
+        ESP_LOGW(TAG, "Link down");
+        publish_link(false);
+    }
+    xEventGroupSetBits(wifi_event_group, WIFI_RECONNECT_BIT);
+}
+
+static void load_cached_ap(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t size = sizeof(cached_ap);
+    if (nvs_get_blob(nvs, WIFI_NVS_AP_KEY, &cached_ap, &size) == ESP_OK && size == sizeof(cached_ap)) {
+        using_cached_ap = true;
+    }
+    nvs_close(nvs);
+}
+
+static void save_cached_ap(void)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    if (memcmp(cached_ap.bssid, ap.bssid, sizeof(ap.bssid)) == 0 && cached_ap.channel == ap.primary) {
+        return;     // unchanged, spare the flash
+    }
+    memcpy(cached_ap.bssid, ap.bssid, sizeof(ap.bssid));
+    cached_ap.channel = ap.primary;
+
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, WIFI_NVS_AP_KEY, &cached_ap, sizeof(cached_ap)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+// the cached AP did not answer, go back to scanning every channel for the SSID
+static void forget_cached_ap(void)
+{
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK) {
+        return;
+    }
+    config.sta.bssid_set = false;
+    config.sta.channel = 0;
+    config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+    using_cached_ap = false;
+    ESP_LOGI(TAG, "Cached AP unreachable, scanning all channels");
+}
+
 //event handler for wifi events
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
-        ESP_LOGI(TAG, "Connecting to AP...");
-        esp_wifi_connect();
+        xEventGroupSetBits(wifi_event_group, WIFI_RECONNECT_BIT);
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
-        if (s_retry_num < MAX_FAILURES)
-        {
-            ESP_LOGI(TAG, "Reconnecting to AP...");
-            esp_wifi_connect();
-            s_retry_num++;
-        }
-        else {
-            xEventGroupSetBits(wifi_event_group, WIFI_FAILURE);
-        }
+        link_down();
     }
 }
 
@@ -59,18 +153,62 @@ static void ip_event_handler(void* arg, esp_event_base_t event_base,
     if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
-        ESP_LOGI(TAG, "STA IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "STA IP: " IPSTR " after %lu attempts", IP2STR(&event->ip_info.ip), s_retry_num);
         s_retry_num = 0;
-        xEventGroupSetBits(wifi_event_group, WIFI_SUCCESS);
+        if (disconnected_at_us != 0) {
+            metrics_observe(METRIC_WIFI_RECONNECT, (uint32_t)(esp_timer_get_time() - disconnected_at_us));
+            disconnected_at_us = 0;
+        }
+        save_cached_ap();
+        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        publish_link(true);
     }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP)
+    {
+        link_down();
+    }
+}
 
+// Exponential backoff with equal jitter: half the delay is fixed, the other
+// half random, so a fleet of doors does not hammer a rebooted AP in lockstep.
+static uint32_t backoff_ms(uint32_t attempt)
+{
+    uint32_t delay = WIFI_BACKOFF_MAX_MS;
+    if (attempt < 16) {
+        delay = WIFI_BACKOFF_BASE_MS << attempt;
+        if (delay > WIFI_BACKOFF_MAX_MS) {
+            delay = WIFI_BACKOFF_MAX_MS;
+        }
+    }
+    return delay / 2 + esp_random() % (delay / 2 + 1);
 }
 
-// connect to wifi and return the result
-esp_err_t connect_wifi()
+// Owns all reconnect attempts, forever; the event handlers only report
+static void wifi_manager_task(void* arg)
 {
-    int status = WIFI_FAILURE;
+    while (1) {
+        xEventGroupWaitBits(wifi_event_group, WIFI_RECONNECT_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        if (s_retry_num > 0) {
+            uint32_t delay = backoff_ms(s_retry_num - 1);
+            ESP_LOGI(TAG, "Reconnecting in %lu ms (attempt %lu)", delay, s_retry_num + 1);
+            vTaskDelay(pdMS_TO_TICKS(delay));
+        }
+        if (using_cached_ap && s_retry_num >= WIFI_CACHED_AP_ATTEMPTS) {
+            forget_cached_ap();
+        }
+
+        s_retry_num++;
+        if (esp_wifi_connect() != ESP_OK) {
+            // no disconnect event will follow, schedule the next attempt ourselves
+            xEventGroupSetBits(wifi_event_group, WIFI_RECONNECT_BIT);
+        }
+    }
+}
 
+// Driver, netif and event plumbing shared by normal operation and provisioning
+static esp_err_t wifi_driver_init(void)
+{
     /** INITIALIZE ALL THE THINGS **/
     //initialize the esp network interface
     ESP_ERROR_CHECK(esp_netif_init());
@@ -87,26 +225,33 @@ esp_err_t connect_wifi()
 
     /** EVENT LOOP CRAZINESS **/
     wifi_event_group = xEventGroupCreate();
+    if (wifi_event_group == NULL) return ESP_ERR_NO_MEM;
 
-    esp_event_handler_instance_t wifi_handler_event_instance;
+    // handlers stay registered for the lifetime of the firmware
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
         ESP_EVENT_ANY_ID,
         &wifi_event_handler,
         NULL,
-        &wifi_handler_event_instance));
+        NULL));
 
-    esp_event_handler_instance_t got_ip_event_instance;
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
-        IP_EVENT_STA_GOT_IP,
+        ESP_EVENT_ANY_ID,
         &ip_event_handler,
         NULL,
-        &got_ip_event_instance));
+        NULL));
+    return ESP_OK;
+}
+
+// Start the Wi-Fi driver and the connection manager; returns immediately.
+// The link comes up (and comes back after drops) in the background.
+esp_err_t wifi_manager_start(const char* ssid, const char* password)
+{
+    esp_err_t err = wifi_driver_init();
+    if (err != ESP_OK) return err;
 
     /** START THE WIFI DRIVER **/
     wifi_config_t wifi_config = {
         .sta = {
-            .ssid = "DIGI-mJz9",
-            .password = "uHrCuzah3F",
          .threshold.authmode = WIFI_AUTH_WPA2_PSK,
             .pmf_cfg = {
                 .capable = true,
@@ -114,6 +259,17 @@ esp_err_t connect_wifi()
             },
         },
     };
+    strlcpy((char*)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
+    strlcpy((char*)wifi_config.sta.password, password, sizeof(wifi_config.sta.password));
+
+    // go straight to the AP we used last time instead of scanning
+    load_cached_ap();
+    if (using_cached_ap) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, cached_ap.bssid, sizeof(cached_ap.bssid));
+        wifi_config.sta.channel = cached_ap.channel;
+        ESP_LOGI(TAG, "Using cached AP on channel %u", cached_ap.channel);
+    }
 
     // set the wifi controller to be a station
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
@@ -121,37 +277,130 @@ esp_err_t connect_wifi()
     // set the wifi config
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
 
+    if (xTaskCreate(wifi_manager_task, "wifi_mgr", 3072, NULL, 4, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
     // start the wifi driver
     ESP_ERROR_CHECK(esp_wifi_start());
 
     ESP_LOGI(TAG, "STA initialization complete");
+    return ESP_OK;
+}
+
+static void prov_event_handler(void* arg, esp_event_base_t event_base,
+    int32_t event_id, void* event_data)
+{
+    if (event_id == WIFI_PROV_CRED_RECV) {
+        prov_sta.sta = *(wifi_sta_config_t*)event_data;
+        ESP_LOGI(TAG, "Received credentials for %s", (const char*)prov_sta.sta.ssid);
+    }
+    else if (event_id == WIFI_PROV_CRED_FAIL) {
+        ESP_LOGW(TAG, "Provisioned credentials did not work, waiting for new ones");
+    }
+    else if (event_id == WIFI_PROV_CRED_SUCCESS) {
+        prov_succeeded = true;
+    }
+    else if (event_id == WIFI_PROV_END) {
+        // the manager stops itself once the app confirmed success
+        wifi_prov_mgr_deinit();
+        if (prov_succeeded && prov.done != NULL) {
+            prov.done((const char*)prov_sta.sta.ssid, (const char*)prov_sta.sta.password, prov.arg);
+        }
+    }
+}
+
+// No credentials yet: open a SoftAP provisioning session instead of connecting.
+// The optional extra endpoint lets the app push other settings in the same session.
+esp_err_t wifi_provision_start(const wifi_provision_config_t* config)
+{
+    prov = *config;
+
+    esp_err_t err = wifi_driver_init();
+    if (err != ESP_OK) return err;
+    esp_netif_create_default_wifi_ap();
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_PROV_EVENT,
+        ESP_EVENT_ANY_ID,
+        &prov_event_handler,
+        NULL,
+        NULL));
+
+    wifi_prov_mgr_config_t prov_config = {
+        .scheme = wifi_prov_scheme_softap,
+        .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE,
+    };
+    err = wifi_prov_mgr_init(prov_config);
+    if (err != ESP_OK) return err;
+
+    if (prov.endpoint != NULL) {
+        err = wifi_prov_mgr_endpoint_create(prov.endpoint);
+        if (err != ESP_OK) return err;
+    }
 
-    /** NOW WE WAIT **/
-    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
-        WIFI_SUCCESS | WIFI_FAILURE,
-        pdFALSE,
-        pdFALSE,
-        portMAX_DELAY);
+    err = wifi_prov_mgr_start_provisioning(WIFI_PROV_SECURITY_1, prov.pop, prov.service_name, NULL);
+    if (err != ESP_OK) return err;
 
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_SUCCESS) {
-        ESP_LOGI(TAG, "Connected to ap");
-        status = WIFI_SUCCESS;
+    // endpoints can only be registered once the session is running
+    if (prov.endpoint != NULL) {
+        err = wifi_prov_mgr_endpoint_register(prov.endpoint, prov.endpoint_handler, prov.arg);
+        if (err != ESP_OK) return err;
     }
-    else if (bits & WIFI_FAILURE) {
-        ESP_LOGI(TAG, "Failed to connect to ap");
-        status = WIFI_FAILURE;
+
+    ESP_LOGI(TAG, "Provisioning started, SoftAP %s", prov.service_name);
+    return ESP_OK;
+}
+
+bool wifi_is_connected(void)
+{
+    return wifi_event_group != NULL && (xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT);
+}
+
+// Block until the link is up or the timeout expires
+bool wifi_wait_connected(TickType_t timeout)
+{
+    if (wifi_event_group == NULL) {
+        return false;
     }
-    else {
-        ESP_LOGE(TAG, "UNEXPECTED EVENT");
-        status = WIFI_FAILURE;
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE, timeout);
+    return bits & WIFI_CONNECTED_BIT;
+}
+
+static void on_time_sync(struct timeval* tv)
+{
+    ESP_LOGI(TAG, "Clock set by SNTP");
+}
+
+// Keep the wall clock set from an NTP server; call after wifi_manager_start.
+// lwIP retries on its own, so the server may be unreachable until the link
+// is up. server must outlive the firmware.
+esp_err_t wifi_time_sync_start(const char* server)
+{
+    if (server == NULL || server[0] == '\0') {
+        return ESP_ERR_INVALID_ARG;
     }
+    esp_sntp_config_t sntp = ESP_NETIF_SNTP_DEFAULT_CONFIG(server);
+    sntp.sync_cb = on_time_sync;
+    return esp_netif_sntp_init(&sntp);
+}
 
-    /* The event will not be processed after unregister */
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_event_instance));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_handler_event_instance));
-    vEventGroupDelete(wifi_event_group);
+// Whether time() is wall-clock time rather than seconds since boot
+bool wifi_time_is_set(void)
+{
+    return time(NULL) >= WIFI_TIME_VALID_AFTER;
+}
 
-    return status;
+// cb runs on the event loop task whenever the link goes up or down. Register
+// before wifi_manager_start to see the first link up; later subscribers check
+// wifi_is_connected themselves.
+esp_err_t wifi_register_link_cb(wifi_link_cb_t cb, void* arg)
+{
+    if (link_sub_count >= WIFI_MAX_LINK_CBS) {
+        return ESP_ERR_NO_MEM;
+    }
+    link_subs[link_sub_count].cb = cb;
+    link_subs[link_sub_count].arg = arg;
+    // publish_link may be running; it must not see the slot before it is filled
+    __atomic_store_n(&link_sub_count, link_sub_count + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
 }
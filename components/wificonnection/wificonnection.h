@@ -1,22 +1,42 @@
 #ifndef WIFICONNECTION_H
 #define WIFICONNECTION_H
+#include "freertos/FreeRTOS.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "wifi_provisioning/manager.h"
 #include <stdint.h>
 #include <stdbool.h>
 
-#define WIFI_SUCCESS 1 << 0
-#define WIFI_FAILURE 1 << 1
-#define TCP_SUCCESS 1 << 0
-#define TCP_FAILURE 1 << 1
-#define MAX_FAILURES 10
+// Called with the new link state (IP address held or not)
+typedef void (*wifi_link_cb_t)(bool up, void* arg);
 
-static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
-static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
-esp_err_t connect_wifi();
-esp_err_t send_sql_query(const char* server_ip, int port, const char* query, char* response, size_t response_size);
+// Called once provisioned credentials have been confirmed to work
+typedef void (*wifi_provisioned_cb_t)(const char* ssid, const char* password, void* arg);
 
+typedef struct {
+    const char* service_name;                   // SoftAP SSID
+    const char* pop;                            // proof of possession (security 1)
+    const char* endpoint;                       // extra protocomm endpoint, NULL for none
+    protocomm_req_handler_t endpoint_handler;
+    wifi_provisioned_cb_t done;
+    void* arg;                                  // passed to endpoint_handler and done
+} wifi_provision_config_t;
 
+esp_err_t wifi_manager_start(const char* ssid, const char* password);
+esp_err_t wifi_provision_start(const wifi_provision_config_t* config);
+bool wifi_is_connected(void);
+bool wifi_wait_connected(TickType_t timeout);
+esp_err_t wifi_register_link_cb(wifi_link_cb_t cb, void* arg);
+esp_err_t wifi_time_sync_start(const char* server);
+bool wifi_time_is_set(void);
+esp_err_t send_sql_query(const char* server_ip, int port, const char* query, char* response, size_t response_size);
 
+#define WIFI_BACKOFF_BASE_MS        500
+#define WIFI_BACKOFF_MAX_MS         (60 * 1000)
+#define WIFI_CACHED_AP_ATTEMPTS     2       // failed tries on the cached BSSID before a full scan
+#define WIFI_MAX_LINK_CBS           4
+#define WIFI_NVS_NAMESPACE          "wifi"
+#define WIFI_NVS_AP_KEY             "ap"
+#define WIFI_TIME_VALID_AFTER       1704067200  // 2024-01-01; earlier means the clock was never set
 
 #endif
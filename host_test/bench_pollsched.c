@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "pipeline.h"
+#include "pollsched.h"
+#include "servo.h"
+#include "rc522sim.h"
+#include "sim.h"
+
+// Poll scheduler on a simulated RC522: the pipeline of main/pipeline.c
+// over two hours of door traffic, built once per CONFIG_DOOR_POLL_IDLE_*
+// mode. Reports the measured time from a card entering the field to its
+// UID reaching authorization, next to pollsched's own estimate, and the reader's
+// average supply current from the time it spent field-on, awake and in
+// soft power-down, and what a card left on the reader costs per poll.
+// Optional arguments: fast_ms max_ms.
+
+#define IRQ_PIN         4
+#define TAPS            120
+#define MEAN_GAP_S      60          // between visitors, exponentially distributed
+#define FOLLOW_PERCENT  30          // a visitor followed by another 2-6 s later
+#define TAP_HOLD_MS     600
+#define LEFT_MS         300000      // a card forgotten on the reader
+
+// MFRC522 datasheet typicals at 3.3 V, for a current proxy
+#define FIELD_MA        60.0        // ITVDD, antenna drivers with the field on
+#define AWAKE_MA        13.5        // IDDD + IDDA, oscillator and receiver running
+#define POWER_DOWN_MA   0.01        // soft power-down
+
+static rc522sim_t* sim;
+static mfrc522_t* reader;
+static int64_t tap_enter_us;        // card of the current tap enters the field
+static bool tap_detected;
+static uint32_t detect_us[TAPS * 2];
+static uint32_t detections;
+
+#if CONFIG_DOOR_POLL_IDLE_FIELD_ON
+static const char* mode = "field on";
+#elif CONFIG_DOOR_POLL_IDLE_ANTENNA_OFF
+static const char* mode = "antenna off";
+#else
+static const char* mode = "power down";
+#endif
+
+static void drop_line(const char* line, void* arg)
+{
+}
+
+// The decision stage of the pipeline: the first UID of a tap to reach it
+// marks the tap detected, every card is let in
+static bool authorize(uint8_t* uid, uint8_t uid_size, const char* uid_hex, auditlog_source_t* source)
+{
+    if (!tap_detected) {
+        tap_detected = true;
+        detect_us[detections++] = (uint32_t)(esp_timer_get_time() - tap_enter_us);
+    }
+    *source = AUDITLOG_SOURCE_CACHE;
+    return true;
+}
+
+static void tap(uint32_t gap_ms, int card)
+{
+    rc522sim_card_t c = { .uid = { 0x04, 0x10, (uint8_t)card, 0x33 }, .uid_size = 4, .sak = 0x08 };
+    rc522sim_remove_cards(sim);
+    c.enter_us = esp_timer_get_time() + (int64_t)gap_ms * 1000;
+    c.leave_us = c.enter_us + TAP_HOLD_MS * 1000;
+    tap_enter_us = c.enter_us;
+    tap_detected = false;
+    rc522sim_add_card(sim, &c);
+    vTaskDelay(pdMS_TO_TICKS(gap_ms + TAP_HOLD_MS + 100));
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t fast_ms = CONFIG_DOOR_POLL_FAST_MS;
+    uint32_t max_ms = CONFIG_DOOR_POLL_MAX_MS;
+    if (argc == 3) {
+        fast_ms = atoi(argv[1]);
+        max_ms = atoi(argv[2]);
+        pollsched_configure(fast_ms, max_ms);
+    }
+    sim = rc522sim_new(IRQ_PIN);
+    mfrc522_bus_t bus;
+    rc522sim_get_bus(sim, &bus);
+    HOST_CHECK(mfrc522_new_with_bus(&bus, &reader) == ESP_OK);
+    HOST_CHECK(mfrc522_enable_irq(reader, IRQ_PIN) == ESP_OK);
+    dlog_init();
+    dlog_set_sink(drop_line, NULL);
+    metrics_init("bench");
+    HOST_CHECK(servo_init() == ESP_OK);
+    pipeline_config_t config = { .readers = { reader }, .reader_count = 1, .authorize = authorize };
+    HOST_CHECK(pipeline_start(&config) == ESP_OK);
+
+    srand(8);
+    uint32_t taps = 0;
+    for (int i = 0; i < TAPS; i++) {
+        double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+        tap((uint32_t)(-log(u) * MEAN_GAP_S * 1000), i);
+        taps++;
+        if (rand() % 100 < FOLLOW_PERCENT) {
+            tap(2000 + rand() % 4000, i + TAPS);
+            taps++;
+        }
+    }
+
+    pollsched_stats_t ps;
+    pollsched_get_stats(&ps);
+    rc522sim_stats_t rs;
+    rc522sim_get_stats(sim, &rs);
+    double elapsed = (double)ps.elapsed_us;
+    double field = rs.field_on_us / elapsed;
+    double down = rs.power_down_us / elapsed;
+    double current_ma = field * FIELD_MA + (1.0 - down) * AWAKE_MA + down * POWER_DOWN_MA;
+    host_percentiles_t p;
+    host_percentiles(detect_us, detections, &p);
+
+    printf("idle mode %s, poll %lu-%lu ms, %lu taps over %.0f min:\n", mode, (unsigned long)fast_ms,
+        (unsigned long)max_ms, (unsigned long)taps, elapsed / 60e6);
+    printf("  time-to-detect mean %.1f ms (pollsched estimate %.1f ms), p50 %.1f ms, p90 %.1f ms, max %.1f ms; "
+        "%lu taps missed\n",
+        p.count ? p.sum / 1000.0 / p.count : 0.0, ps.detections ? ps.total_detect_us / 1000.0 / ps.detections : 0.0,
+        p.p50 / 1000.0, p.p90 / 1000.0, p.max / 1000.0, (unsigned long)(taps - detections));
+    printf("  field on %.2f%%, powered down %.2f%%, %lu polls: reader current %.2f mA average\n",
+        field * 100, down * 100, (unsigned long)ps.polls, current_ma);
+
+    // a card left lying on the reader once polling has backed off
+    mfrc522_stats_t before;
+    mfrc522_get_stats(reader, &before);
+    uint32_t polls = ps.polls;
+    uint64_t field_on_us = rs.field_on_us;
+    tap_detected = true;
+    rc522sim_card_t left = { .uid = { 0x04, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 }, .uid_size = 7, .sak = 0x08 };
+    left.enter_us = esp_timer_get_time();
+    rc522sim_add_card(sim, &left);
+    vTaskDelay(pdMS_TO_TICKS(LEFT_MS));
+    rc522sim_remove_cards(sim);
+    vTaskDelay(pdMS_TO_TICKS(2 * max_ms + 100));
+    mfrc522_stats_t held;
+    mfrc522_get_stats(reader, &held);
+    pollsched_get_stats(&ps);
+    rc522sim_get_stats(sim, &rs);
+    polls = ps.polls - polls;
+    printf("  card left on the reader %d s: %lu polls, %.1f SPI transactions per poll, field on %.1f s, "
+        "%lu arrival(s)\n", LEFT_MS / 1000, (unsigned long)polls,
+        (double)(held.spi_transactions - before.spi_transactions) / polls, (rs.field_on_us - field_on_us) / 1e6,
+        (unsigned long)(held.arrivals - before.arrivals));
+
+    // a poll interval shorter than a tap reads every card while it is held;
+    // a longer one misses some
+    if (max_ms + POLLSCHED_FIELD_SETTLE_MS + 10 < TAP_HOLD_MS) {
+        HOST_CHECK(detections == taps);
+        HOST_CHECK(p.max < TAP_HOLD_MS * 1000);
+    }
+    // read once, then only presence checks until it is taken away
+    HOST_CHECK(held.arrivals == before.arrivals + 1 && held.departures == before.departures + 1);
+    // the field is not on all the time
+#if !CONFIG_DOOR_POLL_IDLE_FIELD_ON
+    HOST_CHECK(field < 0.5);
+#endif
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
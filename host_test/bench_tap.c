@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "driver/ledc.h"
+#include "authclient.h"
+#include "authorize.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "pipeline.h"
+#include "servo.h"
+#include "uidcache.h"
+#include "rc522sim.h"
+#include "sim.h"
+
+// Tap-to-unlock benchmark: the reader task, authorization and actuator of
+// main/pipeline.c with authorize_uid and the HTTP client, against a
+// simulated RC522 and tools/authserver.py. A tap is a card held in the field
+// for TAP_HOLD_MS; its latency runs from the card entering the field to the
+// servo output starting to move. On an idle door, round 0 taps every card for
+// the first time (cache misses, one server request each) and later rounds hit
+// the cache; then the same cards are tapped on a busy door.
+
+#define HTTP_PORT       18300
+#define IRQ_PIN         4
+#define CARDS           20
+#define ROUNDS          5
+#define TAP_HOLD_MS     600
+#define IDLE_SPACING_MS 8000        // the door is idle again: polling backed off, RC522 powered down
+#define BUSY_SPACING_MS 4000        // a queue at the door: still inside the fast poll window
+#define WIFI_RTT_US     3000        // added per request: a Wi-Fi hop the loopback lacks
+
+static void drop_line(const char* line, void* arg)
+{
+}
+
+static void make_card(int i, rc522sim_card_t* card)
+{
+    memset(card, 0, sizeof(*card));
+    // alternate 4 and 7 byte UIDs, like a mixed badge fleet
+    card->uid_size = i % 2 ? 7 : 4;
+    card->uid[0] = 0x04;
+    for (int b = 1; b < card->uid_size; b++) {
+        card->uid[b] = (uint8_t)(i * 37 + b * 11);
+    }
+    card->sak = 0x08;
+}
+
+static uint32_t taps;
+static uint32_t read_transactions;
+
+// Holds a card to the reader at a random point of the poll period; returns
+// the time from the card entering the field to the servo starting to move
+static uint32_t tap(rc522sim_t* sim, mfrc522_t* reader, const rc522sim_card_t* template, uint32_t spacing_ms)
+{
+    rc522sim_remove_cards(sim);
+    rc522sim_card_t card = *template;
+    card.enter_us = esp_timer_get_time() + rand() % (CONFIG_DOOR_POLL_MAX_MS * 1000);
+    card.leave_us = card.enter_us + TAP_HOLD_MS * 1000;
+    rc522sim_add_card(sim, &card);
+    host_ledc_arm(SERVO_CHANNEL);
+    vTaskDelay(pdMS_TO_TICKS(spacing_ms));
+    taps++;
+
+    mfrc522_stats_t rs;
+    mfrc522_get_stats(reader, &rs);
+    read_transactions += rs.last_read_transactions;
+
+    int64_t unlocked = host_ledc_first_change_us(SERVO_CHANNEL);
+    HOST_CHECK(unlocked > card.enter_us);
+    return unlocked > card.enter_us ? (uint32_t)(unlocked - card.enter_us) : 0;
+}
+
+static uint32_t print_percentiles(const char* name, uint32_t* samples, uint32_t count)
+{
+    host_percentiles_t p;
+    host_percentiles(samples, count, &p);
+    printf("  %-22s n=%-4lu p50 %6.1f ms  p90 %6.1f ms  p99 %6.1f ms  max %6.1f ms\n", name,
+        (unsigned long)p.count, p.p50 / 1000.0, p.p90 / 1000.0, p.p99 / 1000.0, p.max / 1000.0);
+    return p.p50;
+}
+
+int main(void)
+{
+    rc522sim_card_t cards[CARDS];
+    char hex[CARDS][32];
+    const char* allow[CARDS];
+    for (int i = 0; i < CARDS; i++) {
+        make_card(i, &cards[i]);
+        uid_to_hex_string(cards[i].uid, cards[i].uid_size, hex[i]);
+        allow[i] = hex[i];
+    }
+    esp_err_t err = host_authserver_start(HTTP_PORT, allow, CARDS);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        printf("SKIP: no python3 to run tools/authserver.py\n");
+        return 77;
+    }
+    HOST_CHECK(err == ESP_OK);
+    host_http_set_extra_rtt_us(WIFI_RTT_US);
+    host_http_match("/uid/");
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", HTTP_PORT);
+    dlog_init();
+    if (getenv("HOST_LOG") == NULL) {
+        dlog_set_sink(drop_line, NULL);
+    }
+    metrics_init("bench");
+    HOST_CHECK(servo_init() == ESP_OK);
+    HOST_CHECK(uidcache_init() == ESP_OK);
+    HOST_CHECK(authclient_init(url, 1000, NULL) == ESP_OK);
+    HOST_CHECK(authorize_init(false) == ESP_OK);
+
+    rc522sim_t* sim = rc522sim_new(IRQ_PIN);
+    mfrc522_bus_t bus;
+    rc522sim_get_bus(sim, &bus);
+    mfrc522_t* reader = NULL;
+    HOST_CHECK(mfrc522_new_with_bus(&bus, &reader) == ESP_OK);
+    HOST_CHECK(mfrc522_enable_irq(reader, IRQ_PIN) == ESP_OK);
+    pipeline_config_t config = { .readers = { reader }, .reader_count = 1, .authorize = authorize_uid };
+    HOST_CHECK(pipeline_start(&config) == ESP_OK);
+    // a door nobody used for a while: polling has backed off to its idle interval
+    vTaskDelay(pdMS_TO_TICKS(10000));
+
+    static uint32_t miss_us[CARDS];
+    static uint32_t hit_us[CARDS * (ROUNDS - 1)];
+    static uint32_t busy_us[CARDS];
+    uint32_t misses = 0;
+    uint32_t hits = 0;
+    uint32_t busy = 0;
+    host_http_stats_t http_before;
+    host_http_get_stats(&http_before);
+    mfrc522_stats_t reader_before;
+    mfrc522_get_stats(reader, &reader_before);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < CARDS; i++) {
+            uint32_t latency = tap(sim, reader, &cards[i], IDLE_SPACING_MS);
+            if (round == 0) {
+                miss_us[misses++] = latency;
+            }
+            else {
+                hit_us[hits++] = latency;
+            }
+        }
+    }
+    for (int i = 0; i < CARDS; i++) {
+        busy_us[busy++] = tap(sim, reader, &cards[i], BUSY_SPACING_MS);
+    }
+
+    host_http_stats_t http;
+    host_http_get_stats(&http);
+    mfrc522_stats_t rs;
+    mfrc522_get_stats(reader, &rs);
+    uint32_t lookups = http.matched - http_before.matched;
+    uint32_t requests = http.requests - http_before.requests;
+    uint32_t reads = rs.reads - reader_before.reads;
+
+    printf("tap-to-unlock, card entering the field to servo moving (IRQ reader, +%d us RTT):\n", WIFI_RTT_US);
+    print_percentiles("idle door, cache miss", miss_us, misses);
+    print_percentiles("idle door, cache hit", hit_us, hits);
+    uint32_t busy_p50 = print_percentiles("busy door, cache hit", busy_us, busy);
+    printf("  UID reads %lu, %.1f SPI transactions per read, read %lu us avg; %lu SPI transactions in all\n",
+        (unsigned long)reads, (double)read_transactions / taps, reads ? (unsigned long)(rs.total_read_us / rs.reads) : 0UL,
+        (unsigned long)(rs.spi_transactions - reader_before.spi_transactions));
+    printf("  server lookups %lu for %lu taps: %.2f per tap; %lu keep-alive pings, %lu connects, %lu failures\n",
+        (unsigned long)lookups, (unsigned long)taps, (double)lookups / taps, (unsigned long)(requests - lookups),
+        (unsigned long)(http.connects - http_before.connects), (unsigned long)(http.failures - http_before.failures));
+
+    HOST_CHECK(misses == CARDS);
+    HOST_CHECK(hits == CARDS * (ROUNDS - 1));
+    // fast polling: a tap never waits for a backed-off poll
+    HOST_CHECK(busy_p50 < 2 * CONFIG_DOOR_POLL_FAST_MS * 1000);
+    // one request per first tap; a hit past UIDCACHE_TTL_MS is revalidated
+    // once in the background, it does not wait for the server
+    HOST_CHECK(lookups >= CARDS && lookups <= 2 * CARDS);
+
+    host_authserver_stop();
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,642 @@
+#include <getopt.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "authclient.h"
+#include "authorize.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "pipeline.h"
+#include "rc522sim.h"
+#include "servo.h"
+#include "tapfilter.h"
+#include "uidcache.h"
+#include "sim.h"
+
+// Fleet load generator for the authorization server. Every door is a process
+// running the firmware's reader pipeline, tap filter, UID cache and
+// authorize.c against a simulated RC522, asking the server through
+// authclient (HTTP) or authclient_udp (binary protocol) over real sockets, on
+// the wall clock. Reports throughput, latency percentiles and error rates.
+//
+// Traffic model, per door:
+//   - taps arrive as a Poisson process at --rate taps per minute
+//   - every --shift-period seconds all doors see a shift change: for
+//     --burst-seconds the rate is multiplied by --burst-factor
+//   - a --held fraction of taps are badges held on the reader for
+//     --held-seconds instead of a quick tap
+//   - an --unknown fraction of taps are cards the server does not know
+//
+// Usage:
+//   fleetload --local --doors 200 --seconds 60
+//   fleetload --host 10.0.0.5 --http-port 8000 --doors 300 --badges 5000 --json result.json
+//   fleetload --local --protocol udp --doors 500
+//
+// --local starts tools/authserver.py on the given HTTP port (UDP on the next
+// one) allowing the generated badge population, and stops it afterwards.
+// --print-badges lists that population, as an --allow-file for a remote server.
+
+#define IRQ_PIN         4
+#define TAP_HOLD_MS     600
+#define LATE_US         50000       // a tap this far behind schedule: generator overloaded
+#define MAX_SAMPLES     16384       // server answers timed per door and phase
+
+enum { STEADY, BURST, PHASES };
+static const char* phase_names[PHASES] = { "steady", "burst" };
+
+typedef struct {
+    uint32_t taps;              // cards brought to the reader
+    uint32_t skipped;           // no free card slot in the simulated field
+    uint32_t late;
+    uint32_t max_lag_us;
+    uint32_t reads;             // arrivals the reader reported
+    uint32_t passed;            // taps the tap filter passed on
+    uint32_t filtered;          // duplicates, coalesced and rate limited
+    uint32_t local;             // decided from the cache (or offline)
+    uint32_t server;            // decided by the server on the tap path
+    uint32_t requests;          // server requests, tap path and revalidation
+    uint32_t revalidations;
+    uint32_t granted;
+    uint32_t denied;
+    uint32_t timeouts;
+    uint32_t errors;
+    uint32_t retries;
+    uint32_t samples[PHASES];
+} door_result_t;
+
+typedef struct {
+    const char* host;
+    int http_port;
+    int udp_port;
+    bool udp;
+    const char* key;
+    bool local;
+    int doors;
+    double seconds;
+    int badges;
+    double rate;
+    double shift_period;
+    double burst_seconds;
+    double burst_factor;
+    double held;
+    double held_seconds;
+    double unknown;
+    int timeout_ms;
+    double cache_ttl;
+    unsigned seed;
+    const char* json;
+    bool print_badges;
+} options_t;
+
+/** GLOBALS **/
+
+static options_t opt = {
+    .host = "127.0.0.1",
+    .http_port = 8000,
+    .udp_port = 8001,
+    .key = "secret",
+    .doors = 100,
+    .seconds = 30,
+    .badges = 2000,
+    .rate = 2,
+    .shift_period = 30,
+    .burst_seconds = 5,
+    .burst_factor = 20,
+    .held = 0.05,
+    .held_seconds = 3,
+    .unknown = 0.05,
+    .timeout_ms = 3000,
+    .cache_ttl = 600,
+    .seed = 1,
+};
+
+static rc522sim_card_t* population;
+
+// one door, in its own process
+static uint64_t rng_state;
+static door_result_t result;
+static uint32_t samples[PHASES][MAX_SAMPLES];
+static TaskHandle_t auth_task;      // requests from any other task are revalidations
+static int64_t start_us;            // virtual time the door's schedule starts
+static double offset_s;
+static int in_flight;
+
+/** FUNCTIONS **/
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// splitmix64: the same schedule for a seed on every host
+static uint64_t next_random(void)
+{
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double uniform(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Mostly 7 byte NXP UIDs, some 4 byte ones
+static void random_card(rc522sim_card_t* card, bool nxp)
+{
+    memset(card, 0, sizeof(*card));
+    card->uid_size = nxp ? 7 : 4;
+    for (int i = 0; i < card->uid_size; i++) {
+        card->uid[i] = (uint8_t)next_random();
+    }
+    if (nxp) {
+        card->uid[0] = 0x04;
+    }
+    card->sak = 0x08;
+}
+
+static bool in_burst(double t)
+{
+    return opt.shift_period > 0 && fmod(t, opt.shift_period) < opt.burst_seconds;
+}
+
+static void drop_line(const char* line, void* arg)
+{
+}
+
+// The door's decision stage: authorize.c, with where the decision came from counted
+static bool door_authorize(uint8_t* uid, uint8_t uid_size, const char* uid_hex, auditlog_source_t* source)
+{
+    auth_task = xTaskGetCurrentTaskHandle();
+    bool granted = authorize_uid(uid, uid_size, uid_hex, source);
+    if (*source == AUDITLOG_SOURCE_SERVER) {
+        result.server++;
+    }
+    else {
+        result.local++;
+    }
+    return granted;
+}
+
+// Classify one server request: authclient reports 403 and 404 alike as ESP_ERR_NOT_FOUND
+static void record_request(esp_err_t err, int64_t begin_us, const authclient_timing_t* timing)
+{
+    uint32_t us = (uint32_t)(esp_timer_get_time() - begin_us);
+    result.requests++;
+    if (xTaskGetCurrentTaskHandle() != auth_task) {
+        result.revalidations++;
+    }
+    if (timing->attempts > 1) {
+        result.retries += timing->attempts - 1;
+    }
+    if (err == ESP_OK || err == ESP_ERR_NOT_FOUND) {
+        if (err == ESP_OK) {
+            result.granted++;
+        }
+        else {
+            result.denied++;
+        }
+        int phase = in_burst((begin_us - start_us) / 1e6 - offset_s) ? BURST : STEADY;
+        if (result.samples[phase] < MAX_SAMPLES) {
+            samples[phase][result.samples[phase]++] = us;
+        }
+    }
+    else if (err == ESP_ERR_TIMEOUT || us >= (uint32_t)opt.timeout_ms * 1000) {
+        result.timeouts++;
+    }
+    else {
+        result.errors++;
+    }
+}
+
+// Linked with --wrap: every request authorize.c makes passes through here
+esp_err_t __real_authclient_check_uid(const char* uid_hex, authclient_timing_t* timing);
+esp_err_t __real_authclient_udp_check_uid(const uint8_t* uid, uint8_t uid_len, authclient_timing_t* timing);
+
+esp_err_t __wrap_authclient_check_uid(const char* uid_hex, authclient_timing_t* timing)
+{
+    authclient_timing_t t = { .attempts = 1 };
+    int64_t begin = esp_timer_get_time();
+    in_flight++;
+    esp_err_t err = __real_authclient_check_uid(uid_hex, &t);
+    in_flight--;
+    record_request(err, begin, &t);
+    if (timing != NULL) {
+        *timing = t;
+    }
+    return err;
+}
+
+esp_err_t __wrap_authclient_udp_check_uid(const uint8_t* uid, uint8_t uid_len, authclient_timing_t* timing)
+{
+    authclient_timing_t t = { .attempts = 1 };
+    int64_t begin = esp_timer_get_time();
+    in_flight++;
+    esp_err_t err = __real_authclient_udp_check_uid(uid, uid_len, &t);
+    in_flight--;
+    record_request(err, begin, &t);
+    if (timing != NULL) {
+        *timing = t;
+    }
+    return err;
+}
+
+// Bring a card to the reader now, in a slot whose card has left the field
+static void tap(rc522sim_t* sim, const rc522sim_card_t* card, uint32_t hold_ms)
+{
+    rc522sim_card_t c = *card;
+    c.enter_us = esp_timer_get_time();
+    c.leave_us = c.enter_us + (int64_t)hold_ms * 1000;
+    for (int i = 0; i < RC522SIM_MAX_CARDS; i++) {
+        rc522sim_card_t* slot = rc522sim_card(sim, i);
+        if (slot == NULL) {
+            rc522sim_add_card(sim, &c);
+            return;
+        }
+        if (slot->leave_us != 0 && slot->leave_us <= c.enter_us) {
+            *slot = c;
+            return;
+        }
+    }
+    result.skipped++;
+}
+
+static int run_door(int index, int64_t start_wall_us, int fd)
+{
+    rng_state = (uint64_t)opt.seed * 100003 + index;
+    char url[128];
+    snprintf(url, sizeof(url), "http://%s:%d", opt.host, opt.http_port);
+
+    rc522sim_t* sim = rc522sim_new(IRQ_PIN);
+    mfrc522_bus_t bus;
+    rc522sim_get_bus(sim, &bus);
+    mfrc522_t* reader = NULL;
+    HOST_CHECK(mfrc522_new_with_bus(&bus, &reader) == ESP_OK);
+    HOST_CHECK(mfrc522_enable_irq(reader, IRQ_PIN) == ESP_OK);
+    dlog_init();
+    if (getenv("HOST_LOG") == NULL) {
+        dlog_set_sink(drop_line, NULL);
+    }
+    metrics_init("fleetload");
+    HOST_CHECK(servo_init() == ESP_OK);
+    HOST_CHECK(uidcache_init() == ESP_OK);
+    uidcache_set_ttl((uint32_t)(opt.cache_ttl * 1000));
+    HOST_CHECK(authclient_init(url, opt.timeout_ms, NULL) == ESP_OK);
+    if (opt.udp) {
+        HOST_CHECK(authclient_udp_init(url, opt.udp_port, (const uint8_t*)opt.key, strlen(opt.key)) == ESP_OK);
+    }
+    HOST_CHECK(authorize_init(opt.udp) == ESP_OK);
+    pipeline_config_t config = { .readers = { reader }, .reader_count = 1, .authorize = door_authorize };
+    HOST_CHECK(pipeline_start(&config) == ESP_OK);
+    if (host_failures > 0) {
+        return 1;
+    }
+
+    // doors do not start in lock step
+    offset_s = uniform() * fmin(1.0, opt.seconds / 10);
+    int64_t wait = start_wall_us - wall_us();
+    if (wait > 0) {
+        usleep(wait);
+    }
+    host_set_realtime(true);
+    start_us = esp_timer_get_time();
+    int64_t start_wall = wall_us();
+
+    double base = opt.rate / 60.0;
+    double t = 0;
+    while (true) {
+        double rate = base * (in_burst(t) ? opt.burst_factor : 1.0);
+        t += rate > 0 ? -log(1.0 - uniform()) / rate : opt.seconds;
+        if (t >= opt.seconds) {
+            break;
+        }
+        rc522sim_card_t card;
+        if (uniform() < opt.unknown) {
+            random_card(&card, false);
+        }
+        else {
+            card = population[next_random() % opt.badges];
+        }
+        uint32_t hold_ms = uniform() < opt.held ? (uint32_t)(opt.held_seconds * 1000) : TAP_HOLD_MS;
+
+        int64_t due = start_us + (int64_t)((offset_s + t) * 1e6);
+        int64_t now = esp_timer_get_time();
+        if (due > now) {
+            host_sleep_us(due - now);
+        }
+        // virtual time runs on the wall clock, unless this process falls behind
+        int64_t lag = (wall_us() - start_wall) - (due - start_us);
+        if (lag > LATE_US) {
+            result.late++;
+        }
+        if (lag > (int64_t)result.max_lag_us) {
+            result.max_lag_us = (uint32_t)lag;
+        }
+        result.taps++;
+        tap(sim, &card, hold_ms);
+    }
+    // let the last taps and revalidations finish
+    vTaskDelay(pdMS_TO_TICKS(TAP_HOLD_MS + 200));
+    while (in_flight > 0) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    mfrc522_stats_t rs;
+    mfrc522_get_stats(reader, &rs);
+    tapfilter_stats_t fs;
+    tapfilter_get_stats(&fs);
+    result.reads = rs.arrivals;
+    result.passed = fs.passed;
+    result.filtered = fs.suppressed + fs.coalesced + fs.rate_limited;
+    if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+        return 1;
+    }
+    for (int p = 0; p < PHASES; p++) {
+        size_t len = result.samples[p] * sizeof(uint32_t);
+        if (write(fd, samples[p], len) != (ssize_t)len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static bool read_all(int fd, void* buf, size_t len)
+{
+    uint8_t* p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: fleetload [--host H] [--http-port P] [--udp-port P] [--protocol http|udp] [--key K]\n"
+        "                 [--local] [--doors N] [--seconds S] [--badges N] [--rate PER_MIN]\n"
+        "                 [--shift-period S] [--burst-seconds S] [--burst-factor F] [--held FRACTION]\n"
+        "                 [--held-seconds S] [--unknown FRACTION] [--timeout-ms MS] [--cache-ttl S]\n"
+        "                 [--seed N] [--json FILE] [--print-badges]\n");
+    exit(2);
+}
+
+static void parse_options(int argc, char** argv)
+{
+    static const struct option longopts[] = {
+        { "host", required_argument, NULL, 'H' },
+        { "http-port", required_argument, NULL, 'p' },
+        { "udp-port", required_argument, NULL, 'u' },
+        { "protocol", required_argument, NULL, 'P' },
+        { "key", required_argument, NULL, 'k' },
+        { "local", no_argument, NULL, 'l' },
+        { "doors", required_argument, NULL, 'd' },
+        { "seconds", required_argument, NULL, 's' },
+        { "badges", required_argument, NULL, 'b' },
+        { "rate", required_argument, NULL, 'r' },
+        { "shift-period", required_argument, NULL, 'S' },
+        { "burst-seconds", required_argument, NULL, 'B' },
+        { "burst-factor", required_argument, NULL, 'F' },
+        { "held", required_argument, NULL, 'h' },
+        { "held-seconds", required_argument, NULL, 'e' },
+        { "unknown", required_argument, NULL, 'U' },
+        { "timeout-ms", required_argument, NULL, 't' },
+        { "cache-ttl", required_argument, NULL, 'c' },
+        { "seed", required_argument, NULL, 'x' },
+        { "json", required_argument, NULL, 'j' },
+        { "print-badges", no_argument, NULL, 'L' },
+        { NULL, 0, NULL, 0 },
+    };
+    bool udp_port_set = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+        switch (c) {
+        case 'H': opt.host = optarg; break;
+        case 'p': opt.http_port = atoi(optarg); break;
+        case 'u': opt.udp_port = atoi(optarg); udp_port_set = true; break;
+        case 'k': opt.key = optarg; break;
+        case 'l': opt.local = true; break;
+        case 'd': opt.doors = atoi(optarg); break;
+        case 's': opt.seconds = atof(optarg); break;
+        case 'b': opt.badges = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'S': opt.shift_period = atof(optarg); break;
+        case 'B': opt.burst_seconds = atof(optarg); break;
+        case 'F': opt.burst_factor = atof(optarg); break;
+        case 'h': opt.held = atof(optarg); break;
+        case 'e': opt.held_seconds = atof(optarg); break;
+        case 'U': opt.unknown = atof(optarg); break;
+        case 't': opt.timeout_ms = atoi(optarg); break;
+        case 'c': opt.cache_ttl = atof(optarg); break;
+        case 'x': opt.seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'j': opt.json = optarg; break;
+        case 'L': opt.print_badges = true; break;
+        case 'P':
+            if (strcmp(optarg, "udp") != 0 && strcmp(optarg, "http") != 0) {
+                usage();
+            }
+            opt.udp = strcmp(optarg, "udp") == 0;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || opt.doors <= 0 || opt.badges <= 0 || opt.seconds <= 0) {
+        usage();
+    }
+    if (opt.local) {
+        // authserver.py under sim/authserver.c: UDP on the port after HTTP, its own key
+        opt.host = "127.0.0.1";
+        opt.key = HOST_AUTHSERVER_KEY;
+        if (!udp_port_set) {
+            opt.udp_port = opt.http_port + 1;
+        }
+    }
+}
+
+static void print_latency(FILE* f, const char* name, const host_percentiles_t* p, bool json)
+{
+    if (json) {
+        fprintf(f, "    \"%s\": {\"count\": %lu, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, "
+            "\"max_ms\": %.3f}", name, (unsigned long)p->count, p->p50 / 1000.0, p->p90 / 1000.0,
+            p->p99 / 1000.0, p->max / 1000.0);
+        return;
+    }
+    printf("%-6s %6lu  p50 %7.2f ms  p90 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", name, (unsigned long)p->count,
+        p->p50 / 1000.0, p->p90 / 1000.0, p->p99 / 1000.0, p->max / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    parse_options(argc, argv);
+
+    rng_state = opt.seed;
+    population = calloc(opt.badges, sizeof(*population));
+    char (*hex)[32] = calloc(opt.badges, sizeof(*hex));
+    const char** allow = calloc(opt.badges, sizeof(*allow));
+    for (int i = 0; i < opt.badges; i++) {
+        random_card(&population[i], uniform() < 0.8);
+        uid_to_hex_string(population[i].uid, population[i].uid_size, hex[i]);
+        allow[i] = hex[i];
+    }
+    if (opt.print_badges) {
+        for (int i = 0; i < opt.badges; i++) {
+            printf("%s\n", hex[i]);
+        }
+        return 0;
+    }
+    if (opt.local) {
+        esp_err_t err = host_authserver_start(opt.http_port, allow, opt.badges);
+        if (err == ESP_ERR_NOT_SUPPORTED) {
+            printf("SKIP: no python3 to run tools/authserver.py\n");
+            return 77;
+        }
+        if (err != ESP_OK) {
+            fprintf(stderr, "local server did not start\n");
+            return 1;
+        }
+    }
+
+    // the kernel is left untouched here: every door starts its own in its process
+    fflush(stdout);
+    int64_t start_wall = wall_us() + 500000;
+    int* fds = calloc(opt.doors, sizeof(*fds));
+    pid_t* pids = calloc(opt.doors, sizeof(*pids));
+    for (int i = 0; i < opt.doors; i++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) {
+            perror("pipe");
+            return 1;
+        }
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            close(pipefd[0]);
+            _exit(run_door(i, start_wall, pipefd[1]));
+        }
+        close(pipefd[1]);
+        fds[i] = pipefd[0];
+        if (pids[i] < 0) {
+            perror("fork");
+            return 1;
+        }
+    }
+
+    door_result_t total = { 0 };
+    uint32_t* latencies[PHASES];
+    for (int p = 0; p < PHASES; p++) {
+        latencies[p] = malloc((size_t)opt.doors * MAX_SAMPLES * sizeof(uint32_t));
+    }
+    int failed = 0;
+    for (int i = 0; i < opt.doors; i++) {
+        door_result_t r;
+        bool ok = read_all(fds[i], &r, sizeof(r));
+        for (int p = 0; ok && p < PHASES; p++) {
+            ok = read_all(fds[i], latencies[p] + total.samples[p], r.samples[p] * sizeof(uint32_t));
+        }
+        close(fds[i]);
+        int status;
+        waitpid(pids[i], &status, 0);
+        if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+            continue;
+        }
+        uint32_t max_lag_us = r.max_lag_us > total.max_lag_us ? r.max_lag_us : total.max_lag_us;
+        uint32_t* in = &r.taps;
+        uint32_t* out = &total.taps;
+        for (size_t f = 0; f < offsetof(door_result_t, samples) / sizeof(uint32_t); f++) {
+            out[f] += in[f];
+        }
+        total.max_lag_us = max_lag_us;
+        for (int p = 0; p < PHASES; p++) {
+            total.samples[p] += r.samples[p];
+        }
+    }
+    double elapsed = (wall_us() - start_wall) / 1e6;
+    if (opt.local) {
+        host_authserver_stop();
+    }
+    host_percentiles_t lat[PHASES];
+    for (int p = 0; p < PHASES; p++) {
+        host_percentiles(latencies[p], total.samples[p], &lat[p]);
+    }
+    double throughput = total.requests / elapsed;
+    double error_rate = total.requests ? (double)(total.timeouts + total.errors) / total.requests : 0.0;
+
+    const char* protocol = opt.udp ? "udp" : "http";
+    printf("%d doors, %s, %.1f s\n", opt.doors, protocol, elapsed);
+    printf("taps %lu: %lu read, %lu passed the tap filter, %lu filtered; %lu decided locally, %lu by the server\n",
+        (unsigned long)total.taps, (unsigned long)total.reads, (unsigned long)total.passed,
+        (unsigned long)total.filtered, (unsigned long)total.local, (unsigned long)total.server);
+    printf("requests %lu (%lu revalidations): %lu granted, %lu denied; %lu timeouts, %lu errors, %lu retries\n",
+        (unsigned long)total.requests, (unsigned long)total.revalidations, (unsigned long)total.granted,
+        (unsigned long)total.denied, (unsigned long)total.timeouts, (unsigned long)total.errors,
+        (unsigned long)total.retries);
+    printf("throughput %.1f req/s, error rate %.2f%%\n", throughput, error_rate * 100);
+    for (int p = 0; p < PHASES; p++) {
+        if (lat[p].count > 0) {
+            print_latency(stdout, phase_names[p], &lat[p], false);
+        }
+    }
+    if (total.late > 0) {
+        // the numbers above understate the offered load
+        printf("warning: %lu taps started over %d ms late (max %.0f ms), generator overloaded\n",
+            (unsigned long)total.late, LATE_US / 1000, total.max_lag_us / 1000.0);
+    }
+    if (total.skipped > 0) {
+        printf("warning: %lu taps skipped, more than %d cards in one door's field\n", (unsigned long)total.skipped,
+            RC522SIM_MAX_CARDS);
+    }
+    if (failed > 0) {
+        printf("warning: %d doors failed to start or report\n", failed);
+    }
+
+    if (opt.json != NULL) {
+        FILE* f = fopen(opt.json, "w");
+        if (f == NULL) {
+            perror(opt.json);
+            return 1;
+        }
+        fprintf(f, "{\n  \"protocol\": \"%s\",\n  \"doors\": %d,\n  \"seconds\": %.3f,\n", protocol, opt.doors,
+            elapsed);
+        fprintf(f, "  \"counts\": {\"taps\": %lu, \"reads\": %lu, \"passed\": %lu, \"filtered\": %lu, "
+            "\"local\": %lu, \"server\": %lu, \"requests\": %lu, \"revalidations\": %lu, \"granted\": %lu, "
+            "\"denied\": %lu, \"timeouts\": %lu, \"errors\": %lu, \"retries\": %lu, \"late\": %lu, "
+            "\"skipped\": %lu},\n",
+            (unsigned long)total.taps, (unsigned long)total.reads, (unsigned long)total.passed,
+            (unsigned long)total.filtered, (unsigned long)total.local, (unsigned long)total.server,
+            (unsigned long)total.requests, (unsigned long)total.revalidations, (unsigned long)total.granted,
+            (unsigned long)total.denied, (unsigned long)total.timeouts, (unsigned long)total.errors,
+            (unsigned long)total.retries, (unsigned long)total.late, (unsigned long)total.skipped);
+        fprintf(f, "  \"requests_per_s\": %.3f,\n  \"error_rate\": %.5f,\n  \"latency\": {\n", throughput,
+            error_rate);
+        for (int p = 0; p < PHASES; p++) {
+            if (lat[p].count > 0) {
+                print_latency(f, phase_names[p], &lat[p], true);
+            }
+            else {
+                fprintf(f, "    \"%s\": null", phase_names[p]);
+            }
+            fprintf(f, p + 1 < PHASES ? ",\n" : "\n");
+        }
+        fprintf(f, "  },\n  \"max_schedule_lag_ms\": %.3f,\n  \"failed_doors\": %d\n}\n",
+            total.max_lag_us / 1000.0, failed);
+        fclose(f);
+    }
+    return total.requests == 0 || failed > 0 ? 1 : 0;
+}
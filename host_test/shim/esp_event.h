@@ -0,0 +1,6 @@
+#ifndef ESP_EVENT_H
+#define ESP_EVENT_H
+
+// Host build: no event loop, wificonnection.h only needs the header
+
+#endif
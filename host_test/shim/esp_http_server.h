@@ -0,0 +1,49 @@
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+#include <sys/types.h>
+#include "esp_err.h"
+
+// Host build: types only, httpd_start fails with ESP_ERR_NOT_SUPPORTED
+
+typedef void* httpd_handle_t;
+
+typedef enum {
+    HTTP_GET = 1,
+    HTTP_POST = 3,
+} httpd_method_t;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char* uri;
+    size_t content_len;
+    void* user_ctx;
+} httpd_req_t;
+
+typedef struct {
+    const char* uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t* req);
+    void* user_ctx;
+} httpd_uri_t;
+
+typedef struct {
+    uint16_t server_port;
+    uint16_t ctrl_port;
+    uint16_t max_uri_handlers;
+    size_t stack_size;
+    unsigned task_priority;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80, .ctrl_port = 32768, .max_uri_handlers = 8, \
+    .stack_size = 4096, .task_priority = 5 }
+#define HTTPD_RESP_USE_STRLEN   -1
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri);
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type);
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t len);
+
+#endif
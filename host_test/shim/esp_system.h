@@ -0,0 +1,11 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+
+// Host build: a restart is counted by sim/ota.c, the program goes on
+void esp_restart(void);
+// the host's entropy, see sim/socket.c
+uint32_t esp_random(void);
+
+#endif
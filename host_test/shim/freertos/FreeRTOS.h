@@ -0,0 +1,47 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// Host build: FreeRTOS on virtual time, see host_test/sim/freertos.c.
+// One core; tasks run as coroutines and are only switched when they block,
+// yield, or wake a task of higher priority.
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  1
+#define pdFAIL                  0
+#define errQUEUE_FULL           0
+#define errQUEUE_EMPTY          0
+#define portMAX_DELAY           ((TickType_t)0xFFFFFFFF)
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks)    ((uint32_t)(ticks) * portTICK_PERIOD_MS)
+#define portNUM_PROCESSORS      1
+#define tskNO_AFFINITY          0x7FFFFFFF
+
+void host_yield_from_isr(BaseType_t woken);
+#define portYIELD_FROM_ISR(woken)   host_yield_from_isr(woken)
+
+// nothing preempts a coroutine, a critical section is a no-op
+typedef struct {
+    int owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define portENTER_CRITICAL(mux)         (void)(mux)
+#define portEXIT_CRITICAL(mux)          (void)(mux)
+#define portENTER_CRITICAL_ISR(mux)     (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux)      (void)(mux)
+#define configASSERT(x)                 do { if (!(x)) abort(); } while (0)
+
+BaseType_t xPortGetCoreID(void);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef LWIP_NETDB_H
+#define LWIP_NETDB_H
+
+// Host build: the host's resolver
+#include <netdb.h>
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+// Host build: the host's sockets. recv is sim/socket.c's, which spends the
+// time it blocked again in virtual time, like the HTTP client.
+ssize_t host_recv(int sock, void* buf, size_t len, int flags);
+#define recv(sock, buf, len, flags)     host_recv(sock, buf, len, flags)
+
+#endif
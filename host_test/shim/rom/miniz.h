@@ -0,0 +1,36 @@
+#ifndef ROM_MINIZ_H
+#define ROM_MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+// Host build: the ROM tinfl inflater API on top of zlib, see sim/miniz.c
+
+#define TINFL_LZ_DICT_SIZE                  32768
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER        1
+#define TINFL_FLAG_HAS_MORE_INPUT           2
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+#define TINFL_FLAG_COMPUTE_ADLER32          8
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    z_stream z;
+    bool started;
+} tinfl_decompressor;
+
+void tinfl_init(tinfl_decompressor* r);
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in_buf_next, size_t* in_buf_size,
+    uint8_t* out_buf_start, uint8_t* out_buf_next, size_t* out_buf_size, uint32_t flags);
+
+#endif
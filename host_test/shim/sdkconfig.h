@@ -0,0 +1,50 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host build: Kconfig defaults from main/Kconfig.projbuild and
+// components/dlog/Kconfig. A target can override any of them with -D.
+
+#include <string.h>
+
+// newlib has it, glibc before 2.38 does not
+size_t strlcpy(char* dst, const char* src, size_t size);
+
+#define CONFIG_FREERTOS_HZ                  100
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ     160
+
+#define CONFIG_DOOR_WIFI_SSID               ""
+#define CONFIG_DOOR_WIFI_PASSWORD           ""
+#define CONFIG_DOOR_SERVER_URL              "http://127.0.0.1:8000"
+#define CONFIG_DOOR_HTTP_TIMEOUT_MS         3000
+#define CONFIG_DOOR_SNTP_SERVER             "pool.ntp.org"
+#define CONFIG_DOOR_PUSH_URL                ""
+#define CONFIG_DOOR_PROV_POP                "door-setup"
+
+#ifndef CONFIG_DOOR_POLL_FAST_MS
+#define CONFIG_DOOR_POLL_FAST_MS            50
+#endif
+#ifndef CONFIG_DOOR_POLL_ACTIVE_WINDOW_MS
+#define CONFIG_DOOR_POLL_ACTIVE_WINDOW_MS   5000
+#endif
+#ifndef CONFIG_DOOR_POLL_MAX_MS
+#define CONFIG_DOOR_POLL_MAX_MS             500
+#endif
+#ifndef CONFIG_DOOR_POLL_BACKOFF_PERCENT
+#define CONFIG_DOOR_POLL_BACKOFF_PERCENT    150
+#endif
+#if !defined(CONFIG_DOOR_POLL_IDLE_FIELD_ON) && !defined(CONFIG_DOOR_POLL_IDLE_ANTENNA_OFF)
+#define CONFIG_DOOR_POLL_IDLE_POWER_DOWN    1
+#endif
+#ifndef CONFIG_DOOR_POLL_POWER_SAVE_MIN_MS
+#define CONFIG_DOOR_POLL_POWER_SAVE_MIN_MS  200
+#endif
+
+#define CONFIG_DOOR_TAP_DEBOUNCE_MS         3000
+#define CONFIG_DOOR_TAP_DENY_LIMIT          3
+#define CONFIG_DOOR_TAP_DENY_BLOCK_MS       10000
+
+#ifndef CONFIG_DLOG_LEVEL
+#define CONFIG_DLOG_LEVEL                   3
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef WIFI_PROV_MANAGER_H
+#define WIFI_PROV_MANAGER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+// Host build: the protocomm handler type of wifi_provision_config_t
+typedef esp_err_t (*protocomm_req_handler_t)(uint32_t session_id, const uint8_t* inbuf, ssize_t inlen,
+    uint8_t** outbuf, ssize_t* outlen, void* priv_data);
+
+#endif
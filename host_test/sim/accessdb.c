@@ -0,0 +1,14 @@
+#include "accessdb.h"
+
+// Host build: an offline database that has not synced yet, so decisions come
+// from the UID cache and the server
+
+bool accessdb_is_ready(void)
+{
+    return false;
+}
+
+bool accessdb_lookup(const uint8_t* uid, uint8_t uid_len)
+{
+    return false;
+}
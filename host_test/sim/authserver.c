@@ -0,0 +1,168 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "sim.h"
+
+/** GLOBALS **/
+
+#define MAX_ALLOW       32          // on the command line, more go through a file
+
+static pid_t server_pid = -1;
+static char allow_file[64];
+static int blackhole = -1;
+static const char* firmware_image;
+static const char* firmware_base;
+
+/** FUNCTIONS **/
+
+static bool port_open(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    bool open = connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    close(sock);
+    return open;
+}
+
+void host_authserver_set_firmware(const char* image_path, const char* base_path)
+{
+    firmware_image = image_path;
+    firmware_base = base_path;
+}
+
+// ESP_ERR_NOT_SUPPORTED when there is no python to run it; tests skip then
+esp_err_t host_authserver_start(uint16_t http_port, const char* const* allow, int allow_count)
+{
+    if (access(HOST_PYTHON, X_OK) != 0 || access(AUTHSERVER_PY, R_OK) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    char ports[3][8];
+    for (int i = 0; i < 3; i++) {
+        snprintf(ports[i], sizeof(ports[i]), "%u", http_port + i);
+    }
+    const char* argv[20 + 2 * MAX_ALLOW];
+    int argc = 0;
+    argv[argc++] = HOST_PYTHON;
+    argv[argc++] = AUTHSERVER_PY;
+    argv[argc++] = "serve";
+    argv[argc++] = "--bind";
+    argv[argc++] = "127.0.0.1";
+    argv[argc++] = "--key";
+    argv[argc++] = HOST_AUTHSERVER_KEY;
+    argv[argc++] = "--http-port";
+    argv[argc++] = ports[0];
+    argv[argc++] = "--udp-port";
+    argv[argc++] = ports[1];
+    argv[argc++] = "--mqtt-port";
+    argv[argc++] = ports[2];
+    if (firmware_image != NULL) {
+        argv[argc++] = "--firmware";
+        argv[argc++] = firmware_image;
+    }
+    if (firmware_base != NULL) {
+        argv[argc++] = "--firmware-base";
+        argv[argc++] = firmware_base;
+    }
+    if (allow_count > MAX_ALLOW) {
+        strlcpy(allow_file, "/tmp/authserver-allow-XXXXXX", sizeof(allow_file));
+        int fd = mkstemp(allow_file);
+        FILE* f = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (f == NULL) {
+            return ESP_FAIL;
+        }
+        for (int i = 0; i < allow_count; i++) {
+            fprintf(f, "%s\n", allow[i]);
+        }
+        fclose(f);
+        argv[argc++] = "--allow-file";
+        argv[argc++] = allow_file;
+    }
+    else {
+        for (int i = 0; i < allow_count; i++) {
+            argv[argc++] = "--allow";
+            argv[argc++] = allow[i];
+        }
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return ESP_FAIL;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        setenv("PYTHONDONTWRITEBYTECODE", "1", 1);
+        execv(HOST_PYTHON, (char* const*)argv);
+        _exit(127);
+    }
+    server_pid = pid;
+
+    // up to 5 s for the interpreter to start listening
+    for (int i = 0; i < 500; i++) {
+        if (port_open(http_port)) {
+            return ESP_OK;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            server_pid = -1;
+            return ESP_FAIL;
+        }
+        nanosleep(&(struct timespec){ .tv_nsec = 10 * 1000 * 1000 }, NULL);
+    }
+    host_authserver_stop();
+    return ESP_ERR_TIMEOUT;
+}
+
+void host_authserver_stop(void)
+{
+    if (server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+        server_pid = -1;
+    }
+    if (allow_file[0] != '\0') {
+        unlink(allow_file);
+        allow_file[0] = '\0';
+    }
+}
+
+// Listening but never accepting: the kernel completes the handshake, then nothing
+esp_err_t host_blackhole_start(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 16) != 0) {
+        close(sock);
+        return ESP_FAIL;
+    }
+    blackhole = sock;
+    return ESP_OK;
+}
+
+void host_blackhole_stop(void)
+{
+    if (blackhole >= 0) {
+        close(blackhole);
+        blackhole = -1;
+    }
+}
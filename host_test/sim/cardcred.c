@@ -0,0 +1,10 @@
+#include "cardcred.h"
+
+// Host build: rc522sim has no MIFARE Classic sectors, every card carries a
+// valid credential
+
+cardcred_result_t cardcred_verify(mfrc522_t* reader, const mfrc522_uid_t* uid, uint32_t* credential_id)
+{
+    mfrc522_halt(reader);
+    return CARDCRED_VALID;
+}
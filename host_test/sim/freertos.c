@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "sim.h"
+
+/** TYPES **/
+
+typedef enum {
+    TASK_READY,
+    TASK_RUNNING,
+    TASK_BLOCKED,
+    TASK_DELETED,
+} task_state_t;
+
+struct host_task {
+    ucontext_t ctx;
+    void* stack;
+    TaskFunction_t fn;
+    void* arg;
+    const char* name;
+    UBaseType_t priority;
+    task_state_t state;
+    uint64_t seq;               // FIFO order among equal priorities, ready or blocked
+    const void* wait_obj;       // what a blocked task waits for
+    int64_t deadline_us;        // INT64_MAX = forever
+    bool signalled;             // woken through wait_obj rather than by the deadline
+    uint32_t notify;
+    struct host_task* next;
+};
+
+struct host_queue {
+    uint8_t* items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    char can_receive;           // wait objects, only their addresses matter
+    char can_send;
+};
+
+typedef struct {
+    int64_t at_us;
+    host_event_fn fn;
+    void* arg;
+} host_event_t;
+
+struct esp_timer {
+    esp_timer_cb_t cb;
+    void* arg;
+    const char* name;
+    int64_t expires_us;         // INT64_MAX = stopped
+    uint64_t period_us;
+    struct esp_timer* next;
+};
+
+/** GLOBALS **/
+
+#define TICK_US         (1000000 / configTICK_RATE_HZ)
+#define MAX_EVENTS      64
+
+static int64_t now_us;
+static bool realtime;
+static int64_t wall_offset_us;      // wall clock minus virtual time, while realtime
+static struct host_task main_task;
+static struct host_task* tasks;
+static struct host_task* current;
+static ucontext_t sched_ctx;
+static bool in_isr;
+static uint64_t seq_counter;
+static char sleep_obj;
+
+static host_event_t events[MAX_EVENTS];
+static int event_count;
+
+static struct esp_timer* timers;
+static TaskHandle_t timer_task;
+static char timer_wake;
+
+/** FUNCTIONS **/
+
+static void scheduler_loop(void);
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// main() becomes a task the first time anything touches the kernel
+static void ensure_started(void)
+{
+    if (current != NULL) {
+        return;
+    }
+    main_task.name = "main";
+    main_task.priority = HOST_MAIN_PRIORITY;
+    main_task.state = TASK_RUNNING;
+    main_task.deadline_us = INT64_MAX;
+    tasks = &main_task;
+    current = &main_task;
+
+    static void* sched_stack;
+    sched_stack = malloc(HOST_TASK_STACK);
+    getcontext(&sched_ctx);
+    sched_ctx.uc_stack.ss_sp = sched_stack;
+    sched_ctx.uc_stack.ss_size = HOST_TASK_STACK;
+    sched_ctx.uc_link = NULL;
+    makecontext(&sched_ctx, scheduler_loop, 0);
+}
+
+static void make_ready(struct host_task* t)
+{
+    t->state = TASK_READY;
+    t->seq = seq_counter++;
+}
+
+static struct host_task* pick_ready(void)
+{
+    struct host_task* best = NULL;
+    for (struct host_task* t = tasks; t != NULL; t = t->next) {
+        if (t->state == TASK_READY && (best == NULL || t->priority > best->priority
+            || (t->priority == best->priority && t->seq < best->seq))) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+static int earliest_event(void)
+{
+    int found = -1;
+    for (int i = 0; i < event_count; i++) {
+        if (found < 0 || events[i].at_us < events[found].at_us) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+// Move time forward to end_us, running interrupt events on the way and
+// timing out blocked tasks whose deadline has passed
+static void advance_to(int64_t end_us)
+{
+    for (;;) {
+        int i = earliest_event();
+        if (i < 0 || events[i].at_us > end_us) {
+            break;
+        }
+        host_event_t ev = events[i];
+        events[i] = events[--event_count];
+        if (ev.at_us > now_us) {
+            now_us = ev.at_us;
+        }
+        bool was_isr = in_isr;
+        in_isr = true;
+        ev.fn(ev.arg);
+        in_isr = was_isr;
+    }
+    if (end_us > now_us) {
+        now_us = end_us;
+    }
+    for (struct host_task* t = tasks; t != NULL; t = t->next) {
+        if (t->state == TASK_BLOCKED && t->deadline_us <= now_us) {
+            t->signalled = false;
+            make_ready(t);
+        }
+    }
+}
+
+static int64_t next_wakeup(void)
+{
+    int64_t next = INT64_MAX;
+    int i = earliest_event();
+    if (i >= 0) {
+        next = events[i].at_us;
+    }
+    for (struct host_task* t = tasks; t != NULL; t = t->next) {
+        if (t->state == TASK_BLOCKED && t->deadline_us < next) {
+            next = t->deadline_us;
+        }
+    }
+    return next;
+}
+
+static void scheduler_loop(void)
+{
+    for (;;) {
+        advance_to(now_us);
+        struct host_task* t = pick_ready();
+        if (t != NULL) {
+            current = t;
+            t->state = TASK_RUNNING;
+            swapcontext(&sched_ctx, &t->ctx);
+            continue;
+        }
+        int64_t next = next_wakeup();
+        if (next == INT64_MAX) {
+            fprintf(stderr, "host: every task is blocked for good at %lld us\n", (long long)now_us);
+            abort();
+        }
+        if (realtime) {
+            int64_t wait = next - (wall_us() - wall_offset_us);
+            if (wait > 0) {
+                nanosleep(&(struct timespec){ .tv_sec = wait / 1000000, .tv_nsec = wait % 1000000 * 1000 }, NULL);
+            }
+        }
+        advance_to(next);
+    }
+}
+
+// The running task has changed its state; let the scheduler pick the next one
+static void switch_out(void)
+{
+    struct host_task* self = current;
+    swapcontext(&self->ctx, &sched_ctx);
+}
+
+// Block until obj is signalled (true) or the deadline passes (false)
+static bool block_on(const void* obj, int64_t deadline_us)
+{
+    ensure_started();
+    if (in_isr) {
+        fprintf(stderr, "host: blocking call in interrupt context\n");
+        abort();
+    }
+    struct host_task* self = current;
+    self->state = TASK_BLOCKED;
+    self->seq = seq_counter++;
+    self->wait_obj = obj;
+    self->deadline_us = deadline_us;
+    self->signalled = false;
+    switch_out();
+    self->wait_obj = NULL;
+    return self->signalled;
+}
+
+// Wake the highest priority task waiting on obj, the longest waiting first
+static struct host_task* wake_one(const void* obj)
+{
+    struct host_task* best = NULL;
+    for (struct host_task* t = tasks; t != NULL; t = t->next) {
+        if (t->state == TASK_BLOCKED && t->wait_obj == obj && (best == NULL || t->priority > best->priority
+            || (t->priority == best->priority && t->seq < best->seq))) {
+            best = t;
+        }
+    }
+    if (best != NULL) {
+        best->signalled = true;
+        make_ready(best);
+    }
+    return best;
+}
+
+// A task woken by the running one runs right away if its priority is higher
+static void preempt_check(void)
+{
+    if (in_isr || current == NULL) {
+        return;
+    }
+    struct host_task* t = pick_ready();
+    if (t != NULL && t->priority > current->priority) {
+        make_ready(current);
+        switch_out();
+    }
+}
+
+// A delay ends on a tick interrupt, like the real kernel
+static int64_t tick_deadline(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return INT64_MAX;
+    }
+    return (now_us / TICK_US + ticks) * TICK_US;
+}
+
+int64_t host_now_us(void)
+{
+    return now_us;
+}
+
+void host_set_realtime(bool on)
+{
+    realtime = on;
+    wall_offset_us = wall_us() - now_us;
+}
+
+void host_busy_us(int64_t us)
+{
+    ensure_started();
+    advance_to(now_us + us);
+    preempt_check();
+}
+
+void host_sleep_us(int64_t us)
+{
+    block_on(&sleep_obj, now_us + us);
+}
+
+void host_event_at(int64_t at_us, host_event_fn fn, void* arg)
+{
+    if (event_count == MAX_EVENTS) {
+        fprintf(stderr, "host: too many pending events\n");
+        abort();
+    }
+    events[event_count++] = (host_event_t){ .at_us = at_us, .fn = fn, .arg = arg };
+}
+
+void host_event_cancel(host_event_fn fn, void* arg)
+{
+    for (int i = 0; i < event_count; i++) {
+        if (events[i].fn == fn && events[i].arg == arg) {
+            events[i--] = events[--event_count];
+        }
+    }
+}
+
+void host_yield_from_isr(BaseType_t woken)
+{
+    // the woken task runs once the interrupted code yields or blocks
+    (void)woken;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+static void task_entry(void)
+{
+    struct host_task* self = current;
+    self->fn(self->arg);
+    vTaskDelete(NULL);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, TaskHandle_t* out)
+{
+    ensure_started();
+    struct host_task* t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return pdFAIL;
+    }
+    // host code needs far more stack than the firmware asks for
+    size_t stack_size = stack_depth > HOST_TASK_STACK ? stack_depth : HOST_TASK_STACK;
+    t->stack = malloc(stack_size);
+    if (t->stack == NULL) {
+        free(t);
+        return pdFAIL;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    t->name = name;
+    t->priority = priority;
+    t->deadline_us = INT64_MAX;
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->stack;
+    t->ctx.uc_stack.ss_size = stack_size;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, task_entry, 0);
+
+    t->next = tasks;
+    tasks = t;
+    make_ready(t);
+    if (out != NULL) {
+        *out = t;
+    }
+    preempt_check();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* arg,
+    UBaseType_t priority, TaskHandle_t* out, BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(fn, name, stack_depth, arg, priority, out);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    ensure_started();
+    if (task == NULL || task == current) {
+        current->state = TASK_DELETED;
+        switch_out();
+        abort();    // a deleted task is never resumed
+    }
+    task->state = TASK_DELETED;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        taskYIELD();
+        return;
+    }
+    block_on(&sleep_obj, tick_deadline(ticks));
+}
+
+void taskYIELD(void)
+{
+    ensure_started();
+    make_ready(current);
+    switch_out();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now_us / TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    ensure_started();
+    return current;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    ensure_started();
+    struct host_task* self = current;
+    if (self->notify == 0 && ticks > 0) {
+        block_on(&self->notify, tick_deadline(ticks));
+    }
+    uint32_t value = self->notify;
+    if (value > 0) {
+        self->notify = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+static bool notify_give(TaskHandle_t task)
+{
+    task->notify++;
+    if (task->state == TASK_BLOCKED && task->wait_obj == &task->notify) {
+        task->signalled = true;
+        make_ready(task);
+        return true;
+    }
+    return false;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    ensure_started();
+    notify_give(task);
+    preempt_check();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken)
+{
+    if (notify_give(task) && woken != NULL && task->priority > current->priority) {
+        *woken = pdTRUE;
+    }
+}
+
+static QueueHandle_t queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count)
+{
+    struct host_queue* q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    if (item_size > 0) {
+        q->items = calloc(length, item_size);
+        if (q->items == NULL) {
+            free(q);
+            return NULL;
+        }
+    }
+    q->length = length;
+    q->item_size = item_size;
+    q->count = count;
+    return q;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return queue_create(length, item_size, 0);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+static void queue_put(QueueHandle_t q, const void* item)
+{
+    if (q->item_size > 0) {
+        memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    wake_one(&q->can_receive);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks)
+{
+    ensure_started();
+    int64_t deadline = tick_deadline(ticks);
+    while (q->count == q->length) {
+        if (ticks == 0 || !block_on(&q->can_send, deadline)) {
+            return errQUEUE_FULL;
+        }
+    }
+    queue_put(q, item);
+    preempt_check();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken)
+{
+    if (q->count == q->length) {
+        return errQUEUE_FULL;
+    }
+    queue_put(q, item);
+    if (woken != NULL) {
+        *woken = pdTRUE;
+    }
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks)
+{
+    ensure_started();
+    int64_t deadline = tick_deadline(ticks);
+    while (q->count == 0) {
+        if (ticks == 0 || !block_on(&q->can_receive, deadline)) {
+            return pdFALSE;
+        }
+    }
+    if (q->item_size > 0 && item != NULL) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    }
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    wake_one(&q->can_send);
+    preempt_check();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    return q->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    q->count = 0;
+    q->head = 0;
+    while (wake_one(&q->can_send) != NULL) {
+    }
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_create(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    return queue_create(max, 0, initial);
+}
+
+// Runs the callbacks of expired esp_timers in order, like the esp_timer task
+static void timer_task_fn(void* arg)
+{
+    for (;;) {
+        struct esp_timer* next = NULL;
+        for (struct esp_timer* t = timers; t != NULL; t = t->next) {
+            if (next == NULL || t->expires_us < next->expires_us) {
+                next = t;
+            }
+        }
+        if (next == NULL || next->expires_us > now_us) {
+            block_on(&timer_wake, next != NULL ? next->expires_us : INT64_MAX);
+            continue;
+        }
+        if (next->period_us > 0) {
+            next->expires_us += next->period_us;
+        }
+        else {
+            next->expires_us = INT64_MAX;
+        }
+        next->cb(next->arg);
+    }
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out)
+{
+    if (args == NULL || args->callback == NULL || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer_task == NULL && xTaskCreate(timer_task_fn, "esp_timer", 0, NULL, HOST_TIMER_PRIORITY,
+        &timer_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    struct esp_timer* t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->cb = args->callback;
+    t->arg = args->arg;
+    t->name = args->name;
+    t->expires_us = INT64_MAX;
+    t->next = timers;
+    timers = t;
+    *out = t;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer->expires_us != INT64_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expires_us = now_us + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    wake_one(&timer_wake);
+    preempt_check();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer->expires_us == INT64_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expires_us = INT64_MAX;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer->expires_us != INT64_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer** p = &timers; *p != NULL; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            free(timer);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer->expires_us != INT64_MAX;
+}
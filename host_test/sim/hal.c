@@ -0,0 +1,364 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/spi_master.h"
+#include "nvs.h"
+#include "sim.h"
+
+/** TYPES **/
+
+typedef struct {
+    gpio_isr_t handler;
+    void* arg;
+} gpio_slot_t;
+
+typedef struct {
+    uint32_t duty;              // output since the last update or fade end
+    uint32_t pending;           // set, waiting for ledc_update_duty
+    uint32_t fade_from;
+    uint32_t fade_to;
+    int64_t fade_start_us;
+    int64_t fade_end_us;        // 0 = no fade running
+    uint32_t target;            // set with ledc_set_fade_with_time
+    int fade_ms;
+    bool armed;
+    int64_t first_change_us;    // see host_ledc_arm
+} ledc_slot_t;
+
+/** GLOBALS **/
+
+int host_failures;
+
+static gpio_slot_t gpio_slots[GPIO_NUM_MAX];
+static bool isr_service;
+static ledc_slot_t ledc_slots[LEDC_CHANNEL_MAX];
+static bool fade_installed;
+static int log_level = -1;
+static int64_t uart_empty_at_ns;    // console UART FIFO has sent everything
+
+/** FUNCTIONS **/
+
+size_t strlcpy(char* dst, const char* src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+// HOST_LOG=<0-5> picks the level, unset means errors only
+void host_log(esp_log_level_t level, const char* tag, const char* fmt, ...)
+{
+    if (log_level < 0) {
+        const char* env = getenv("HOST_LOG");
+        log_level = env != NULL ? atoi(env) : ESP_LOG_ERROR;
+    }
+    if ((int)level > log_level) {
+        return;
+    }
+    static const char letters[] = "NEWIDV";
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(host_now_us() / 1000), tag);
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+// The console without a UART driver: a write spins while the FIFO is full
+void host_uart_write(const char* data, size_t len)
+{
+    (void)data;
+    int64_t now_ns = host_now_us() * 1000;
+    if (uart_empty_at_ns < now_ns) {
+        uart_empty_at_ns = now_ns;
+    }
+    uart_empty_at_ns += (int64_t)len * HOST_UART_BYTE_NS;
+    // the last byte is in the FIFO once all but HOST_UART_FIFO bytes have gone out
+    int64_t fits_ns = uart_empty_at_ns - (int64_t)HOST_UART_FIFO * HOST_UART_BYTE_NS;
+    if (fits_ns > now_ns) {
+        host_busy_us((fits_ns - now_ns + 999) / 1000);
+    }
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    (void)tag;
+    log_level = level;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentiles; sorts the samples in place
+void host_percentiles(uint32_t* samples, uint32_t count, host_percentiles_t* out)
+{
+    memset(out, 0, sizeof(*out));
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(uint32_t), compare_u32);
+    out->count = count;
+    out->min = samples[0];
+    out->max = samples[count - 1];
+    out->p50 = samples[(count * 50 + 99) / 100 - 1];
+    out->p90 = samples[(count * 90 + 99) / 100 - 1];
+    out->p99 = samples[(count * 99 + 99) / 100 - 1];
+    for (uint32_t i = 0; i < count; i++) {
+        out->sum += samples[i];
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t* config)
+{
+    return config->pin_bit_mask >> GPIO_NUM_MAX ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+    return pin >= 0 && pin < GPIO_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    return pin >= 0 && pin < GPIO_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    if (isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    isr_service = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void* arg)
+{
+    if (!isr_service) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (pin < 0 || pin >= GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_slots[pin] = (gpio_slot_t){ .handler = handler, .arg = arg };
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin)
+{
+    if (pin < 0 || pin >= GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_slots[pin].handler = NULL;
+    return ESP_OK;
+}
+
+void host_gpio_raise(int pin)
+{
+    if (pin >= 0 && pin < GPIO_NUM_MAX && gpio_slots[pin].handler != NULL) {
+        gpio_slots[pin].handler(gpio_slots[pin].arg);
+    }
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t* config, int dma_chan)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t* config,
+    spi_device_handle_t* out)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t dev)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t dev, spi_transaction_t* trans)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t* config)
+{
+    return config->duty_resolution <= 20 && config->freq_hz > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t* config)
+{
+    if (config->channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_slots[config->channel] = (ledc_slot_t){ .duty = config->duty, .pending = config->duty };
+    return ESP_OK;
+}
+
+void host_ledc_arm(int channel)
+{
+    ledc_slots[channel].armed = true;
+    ledc_slots[channel].first_change_us = 0;
+}
+
+int64_t host_ledc_first_change_us(int channel)
+{
+    return ledc_slots[channel].first_change_us;
+}
+
+static void changed(ledc_slot_t* s)
+{
+    if (s->armed) {
+        s->armed = false;
+        s->first_change_us = host_now_us();
+    }
+}
+
+// Duty right now, a running fade interpolated like the hardware steps it
+static uint32_t current_duty(ledc_slot_t* s)
+{
+    if (s->fade_end_us == 0) {
+        return s->duty;
+    }
+    int64_t now = host_now_us();
+    if (now >= s->fade_end_us) {
+        s->duty = s->fade_to;
+        s->fade_end_us = 0;
+        return s->duty;
+    }
+    int64_t span = s->fade_end_us - s->fade_start_us;
+    int64_t delta = (int64_t)s->fade_to - (int64_t)s->fade_from;
+    return (uint32_t)((int64_t)s->fade_from + delta * (now - s->fade_start_us) / span);
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty)
+{
+    if (channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_slots[channel].pending = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel)
+{
+    if (channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_slot_t* s = &ledc_slots[channel];
+    s->duty = s->pending;
+    s->fade_end_us = 0;
+    changed(s);
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t mode, ledc_channel_t channel)
+{
+    return channel < LEDC_CHANNEL_MAX ? current_duty(&ledc_slots[channel]) : 0;
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    if (fade_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    fade_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    if (channel >= LEDC_CHANNEL_MAX || !fade_installed) {
+        return channel >= LEDC_CHANNEL_MAX ? ESP_ERR_INVALID_ARG : ESP_ERR_INVALID_STATE;
+    }
+    ledc_slots[channel].target = target_duty;
+    ledc_slots[channel].fade_ms = max_fade_time_ms;
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    if (channel >= LEDC_CHANNEL_MAX || !fade_installed) {
+        return channel >= LEDC_CHANNEL_MAX ? ESP_ERR_INVALID_ARG : ESP_ERR_INVALID_STATE;
+    }
+    ledc_slot_t* s = &ledc_slots[channel];
+    s->fade_from = current_duty(s);
+    s->fade_to = s->target;
+    s->fade_start_us = host_now_us();
+    s->fade_end_us = s->fade_start_us + (int64_t)(s->fade_ms > 0 ? s->fade_ms : 1) * 1000;
+    changed(s);
+    if (fade_mode == LEDC_FADE_WAIT_DONE) {
+        host_sleep_us(s->fade_end_us - s->fade_start_us);
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t mode, ledc_channel_t channel)
+{
+    if (channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_slot_t* s = &ledc_slots[channel];
+    s->duty = current_duty(s);
+    s->fade_end_us = 0;
+    return ESP_OK;
+}
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t len)
+{
+    return ESP_OK;
+}
@@ -0,0 +1,342 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "esp_http_client.h"
+#include "sim.h"
+
+/** TYPES **/
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    esp_http_client_method_t method;
+    char host[64];
+    uint16_t port;
+    char path[256];
+    int sock;
+    int status;
+    int64_t content_length;
+    int64_t body_read;
+    char buf[2048];             // received past the headers, not yet read
+    size_t buf_len;
+};
+
+/** GLOBALS **/
+
+static host_http_stats_t stats;
+static int64_t extra_rtt_us;
+static char match_prefix[64];
+
+/** FUNCTIONS **/
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Network time really spent is spent again in virtual time, by blocking
+static void charge(int64_t since_wall_us, int64_t extra_us)
+{
+    host_sleep_us(wall_us() - since_wall_us + extra_us);
+}
+
+void host_http_get_stats(host_http_stats_t* out)
+{
+    *out = stats;
+}
+
+void host_http_set_extra_rtt_us(int64_t us)
+{
+    extra_rtt_us = us;
+}
+
+void host_http_match(const char* path_prefix)
+{
+    strlcpy(match_prefix, path_prefix, sizeof(match_prefix));
+}
+
+static void fire(esp_http_client_handle_t client, esp_http_client_event_id_t id)
+{
+    if (client->config.event_handler != NULL) {
+        esp_http_client_event_t evt = {
+            .event_id = id,
+            .client = client,
+            .user_data = client->config.user_data,
+        };
+        client->config.event_handler(&evt);
+    }
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url)
+{
+    if (strncmp(url, "http://", 7) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;   // no TLS on the host
+    }
+    const char* host = url + 7;
+    const char* path = strchr(host, '/');
+    size_t host_len = path != NULL ? (size_t)(path - host) : strlen(host);
+    char hostport[96];
+    if (host_len >= sizeof(hostport)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(hostport, host, host_len);
+    hostport[host_len] = '\0';
+
+    uint16_t port = 80;
+    char* colon = strchr(hostport, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        port = (uint16_t)atoi(colon + 1);
+    }
+    // another server means another connection
+    if (client->sock >= 0 && (strcmp(client->host, hostport) != 0 || client->port != port)) {
+        esp_http_client_close(client);
+    }
+    strlcpy(client->host, hostport, sizeof(client->host));
+    client->port = port;
+    strlcpy(client->path, path != NULL ? path : "/", sizeof(client->path));
+    return ESP_OK;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->config = *config;
+    client->method = config->method;
+    client->sock = -1;
+    if (client->config.timeout_ms <= 0) {
+        client->config.timeout_ms = 5000;
+    }
+    if (esp_http_client_set_url(client, config->url) != ESP_OK) {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    client->method = method;
+    return ESP_OK;
+}
+
+static esp_err_t connect_socket(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* res;
+    char port[8];
+    snprintf(port, sizeof(port), "%u", client->port);
+    if (getaddrinfo(client->host, port, &hints, &res) != 0) {
+        return ESP_FAIL;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        freeaddrinfo(res);
+        return ESP_FAIL;
+    }
+    // connect with the request timeout, like esp-tls
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    int rc = connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+        int error = ETIMEDOUT;
+        socklen_t len = sizeof(error);
+        if (poll(&pfd, 1, client->config.timeout_ms) == 1) {
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len);
+        }
+        rc = error == 0 ? 0 : -1;
+    }
+    if (rc < 0) {
+        close(sock);
+        return ESP_FAIL;
+    }
+    fcntl(sock, F_SETFL, 0);
+    struct timeval tv = {
+        .tv_sec = client->config.timeout_ms / 1000,
+        .tv_usec = (client->config.timeout_ms % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    client->sock = sock;
+    stats.connects++;
+    return ESP_OK;
+}
+
+// Reuses an open connection, otherwise connects; then sends the request headers
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    int64_t start = wall_us();
+    if (client->sock < 0) {
+        if (connect_socket(client) != ESP_OK) {
+            stats.failures++;
+            charge(start, 0);
+            return ESP_FAIL;
+        }
+        charge(start, extra_rtt_us);
+        fire(client, HTTP_EVENT_ON_CONNECTED);
+        start = wall_us();
+    }
+
+    static const char* const methods[] = { "GET", "POST", "PUT", "HEAD" };
+    char req[512];
+    int len = snprintf(req, sizeof(req), "%s %s HTTP/1.1\r\nHost: %s:%u\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+        methods[client->method], client->path, client->host, client->port);
+    if (write_len > 0 || client->method == HTTP_METHOD_POST || client->method == HTTP_METHOD_PUT) {
+        len += snprintf(req + len, sizeof(req) - len, "Content-Length: %d\r\n", write_len);
+    }
+    if (!client->config.keep_alive_enable) {
+        len += snprintf(req + len, sizeof(req) - len, "Connection: close\r\n");
+    }
+    len += snprintf(req + len, sizeof(req) - len, "\r\n");
+
+    client->status = 0;
+    client->content_length = 0;
+    client->body_read = 0;
+    client->buf_len = 0;
+    stats.requests++;
+    if (match_prefix[0] != '\0' && strncmp(client->path, match_prefix, strlen(match_prefix)) == 0) {
+        stats.matched++;
+    }
+    if (send(client->sock, req, len, MSG_NOSIGNAL) != len) {
+        stats.failures++;
+        esp_http_client_close(client);
+        charge(start, 0);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char* data, int len)
+{
+    if (client->sock < 0) {
+        return -1;
+    }
+    return (int)send(client->sock, data, len, MSG_NOSIGNAL);
+}
+
+// Returns the content length, or -1 when the server did not answer
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    int64_t start = wall_us();
+    if (client->sock < 0) {
+        return -1;
+    }
+    char head[2048];
+    size_t len = 0;
+    char* end = NULL;
+    while (end == NULL) {
+        if (len == sizeof(head) - 1) {
+            break;
+        }
+        ssize_t n = recv(client->sock, head + len, sizeof(head) - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        head[len] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+    if (end == NULL) {
+        stats.failures++;
+        esp_http_client_close(client);
+        charge(start, 0);
+        return -1;
+    }
+
+    size_t header_len = end + 4 - head;
+    client->buf_len = len - header_len;
+    memcpy(client->buf, head + header_len, client->buf_len);
+    *end = '\0';
+    client->status = 0;
+    sscanf(head, "HTTP/1.%*d %d", &client->status);
+    client->content_length = 0;
+    for (char* line = strstr(head, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            client->content_length = atoll(line + 17);
+        }
+    }
+    charge(start, extra_rtt_us);
+    return client->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len)
+{
+    int64_t remaining = client->content_length - client->body_read;
+    if (len > remaining) {
+        len = (int)remaining;
+    }
+    int done = 0;
+    if (client->buf_len > 0 && len > 0) {
+        done = len < (int)client->buf_len ? len : (int)client->buf_len;
+        memcpy(buffer, client->buf, done);
+        memmove(client->buf, client->buf + done, client->buf_len - done);
+        client->buf_len -= done;
+    }
+    while (done < len && client->sock >= 0) {
+        ssize_t n = recv(client->sock, buffer + done, len - done, 0);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    client->body_read += done;
+    return done;
+}
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client, int* len)
+{
+    char scratch[512];
+    int total = 0;
+    int n;
+    while ((n = esp_http_client_read(client, scratch, sizeof(scratch))) > 0) {
+        total += n;
+    }
+    if (len != NULL) {
+        *len = total;
+    }
+    return ESP_OK;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->body_read == client->content_length;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->sock >= 0) {
+        close(client->sock);
+        client->sock = -1;
+        fire(client, HTTP_EVENT_DISCONNECTED);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
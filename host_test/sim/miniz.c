@@ -0,0 +1,50 @@
+#include <string.h>
+#include "rom/miniz.h"
+
+// tinfl on zlib: zlib keeps its own window, so the caller's wrapping 32 KB
+// output buffer works unchanged. The stream is released once it ends or
+// fails, as the firmware never tears a tinfl_decompressor down.
+
+void tinfl_init(tinfl_decompressor* r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const uint8_t* in_buf_next, size_t* in_buf_size,
+    uint8_t* out_buf_start, uint8_t* out_buf_next, size_t* out_buf_size, uint32_t flags)
+{
+    if (!r->started) {
+        int window_bits = flags & TINFL_FLAG_PARSE_ZLIB_HEADER ? 15 : -15;
+        if (inflateInit2(&r->z, window_bits) != Z_OK) {
+            return TINFL_STATUS_BAD_PARAM;
+        }
+        r->started = true;
+    }
+    r->z.next_in = (Bytef*)in_buf_next;
+    r->z.avail_in = (uInt)*in_buf_size;
+    r->z.next_out = out_buf_next;
+    r->z.avail_out = (uInt)*out_buf_size;
+    int ret = inflate(&r->z, Z_NO_FLUSH);
+    *in_buf_size -= r->z.avail_in;
+    *out_buf_size -= r->z.avail_out;
+
+    tinfl_status status;
+    if (ret == Z_STREAM_END) {
+        status = TINFL_STATUS_DONE;
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        status = ret == Z_DATA_ERROR && r->z.msg != NULL && strstr(r->z.msg, "check") != NULL
+            ? TINFL_STATUS_ADLER32_MISMATCH : TINFL_STATUS_FAILED;
+    }
+    else if (r->z.avail_out == 0) {
+        status = TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    else {
+        status = flags & TINFL_FLAG_HAS_MORE_INPUT ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+    }
+    if (status <= TINFL_STATUS_DONE) {
+        inflateEnd(&r->z);
+        r->started = false;
+    }
+    return status;
+}
@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+/** TYPES **/
+
+typedef enum {
+    ITEM_U8,
+    ITEM_U16,
+    ITEM_U32,
+    ITEM_STR,
+    ITEM_BLOB,
+} item_type_t;
+
+typedef struct item {
+    char ns[16];
+    char key[16];
+    item_type_t type;
+    size_t len;
+    uint8_t* data;
+    struct item* next;
+} item_t;
+
+typedef struct {
+    bool used;
+    char ns[16];
+    nvs_open_mode_t mode;
+} handle_t;
+
+/** GLOBALS **/
+
+#define MAX_HANDLES     16
+
+static item_t* items;
+static handle_t handles[MAX_HANDLES];
+static host_nvs_stats_t stats;
+
+/** FUNCTIONS **/
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    host_nvs_reset();
+    return ESP_OK;
+}
+
+void host_nvs_reset(void)
+{
+    while (items != NULL) {
+        item_t* next = items->next;
+        free(items->data);
+        free(items);
+        items = next;
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+void host_nvs_get_stats(host_nvs_stats_t* out)
+{
+    *out = stats;
+}
+
+static handle_t* get_handle(nvs_handle_t handle)
+{
+    if (handle == 0 || handle > MAX_HANDLES || !handles[handle - 1].used) {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+static item_t* find(const char* ns, const char* key)
+{
+    for (item_t* it = items; it != NULL; it = it->next) {
+        if (strcmp(it->ns, ns) == 0 && strcmp(it->key, key) == 0) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static bool ns_exists(const char* ns)
+{
+    for (item_t* it = items; it != NULL; it = it->next) {
+        if (strcmp(it->ns, ns) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t mode, nvs_handle_t* out)
+{
+    if (strlen(name) >= sizeof(handles[0].ns)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // like the real thing, a namespace only exists once something was written to it
+    if (mode == NVS_READONLY && !ns_exists(name)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (int i = 0; i < MAX_HANDLES; i++) {
+        if (!handles[i].used) {
+            handles[i].used = true;
+            handles[i].mode = mode;
+            strlcpy(handles[i].ns, name, sizeof(handles[i].ns));
+            *out = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    handle_t* h = get_handle(handle);
+    if (h != NULL) {
+        h->used = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    if (get_handle(handle) == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    stats.commits++;
+    return ESP_OK;
+}
+
+static esp_err_t set_item(nvs_handle_t handle, const char* key, item_type_t type, const void* value, size_t len)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (h->mode == NVS_READONLY) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= sizeof(items->key)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    item_t* it = find(h->ns, key);
+    if (it == NULL) {
+        it = calloc(1, sizeof(*it));
+        if (it == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        strlcpy(it->ns, h->ns, sizeof(it->ns));
+        strlcpy(it->key, key, sizeof(it->key));
+        it->next = items;
+        items = it;
+    }
+    uint8_t* data = malloc(len > 0 ? len : 1);
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(data, value, len);
+    free(it->data);
+    it->data = data;
+    it->len = len;
+    it->type = type;
+
+    // a new copy of every 32 byte entry goes to flash before the old one is erased
+    stats.writes++;
+    stats.bytes_written += len;
+    host_busy_us(HOST_NVS_WRITE_US + (int64_t)((len + 31) / 32 + 1) * HOST_NVS_ENTRY_US);
+    return ESP_OK;
+}
+
+static esp_err_t get_item(nvs_handle_t handle, const char* key, item_type_t type, item_t** out)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    item_t* it = find(h->ns, key);
+    if (it == NULL || it->type != type) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *out = it;
+    return ESP_OK;
+}
+
+// Blobs and strings: a NULL buffer asks for the length
+static esp_err_t get_bytes(nvs_handle_t handle, const char* key, item_type_t type, void* out, size_t* length)
+{
+    item_t* it;
+    esp_err_t err = get_item(handle, key, type, &it);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (out == NULL) {
+        *length = it->len;
+        return ESP_OK;
+    }
+    if (*length < it->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, it->data, it->len);
+    *length = it->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    return set_item(handle, key, ITEM_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out, size_t* length)
+{
+    return get_bytes(handle, key, ITEM_BLOB, out, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    return set_item(handle, key, ITEM_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out, size_t* length)
+{
+    return get_bytes(handle, key, ITEM_STR, out, length);
+}
+
+#define NVS_INT(suffix, ctype, item) \
+    esp_err_t nvs_set_##suffix(nvs_handle_t handle, const char* key, ctype value) \
+    { \
+        return set_item(handle, key, item, &value, sizeof(value)); \
+    } \
+    esp_err_t nvs_get_##suffix(nvs_handle_t handle, const char* key, ctype* out) \
+    { \
+        item_t* it; \
+        esp_err_t err = get_item(handle, key, item, &it); \
+        if (err == ESP_OK) { \
+            memcpy(out, it->data, sizeof(*out)); \
+        } \
+        return err; \
+    }
+
+NVS_INT(u8, uint8_t, ITEM_U8)
+NVS_INT(u16, uint16_t, ITEM_U16)
+NVS_INT(u32, uint32_t, ITEM_U32)
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    for (item_t** p = &items; *p != NULL; p = &(*p)->next) {
+        if (strcmp((*p)->ns, h->ns) == 0 && strcmp((*p)->key, key) == 0) {
+            item_t* it = *p;
+            *p = it->next;
+            free(it->data);
+            free(it);
+            stats.writes++;
+            host_busy_us(HOST_NVS_WRITE_US);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    handle_t* h = get_handle(handle);
+    if (h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    for (item_t** p = &items; *p != NULL;) {
+        if (strcmp((*p)->ns, h->ns) == 0) {
+            item_t* it = *p;
+            *p = it->next;
+            free(it->data);
+            free(it);
+        }
+        else {
+            p = &(*p)->next;
+        }
+    }
+    stats.writes++;
+    host_busy_us(HOST_NVS_WRITE_US);
+    return ESP_OK;
+}
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+#include "sim.h"
+
+/** TYPES **/
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t* data;
+    size_t image_len;           // of the last image written or loaded
+    esp_ota_img_states_t state;
+} slot_t;
+
+/** GLOBALS **/
+
+#define ESP_IMAGE_MAGIC     0xE9
+
+static slot_t slots[2] = {
+    { .partition = { ESP_PARTITION_TYPE_APP, 0x10, 0x20000, HOST_OTA_SLOT_SIZE, "ota_0" } },
+    { .partition = { ESP_PARTITION_TYPE_APP, 0x11, 0x1a0000, HOST_OTA_SLOT_SIZE, "ota_1" } },
+};
+static host_ota_stats_t stats;
+static int writing = -1;        // slot of the open handle
+static size_t write_pos;
+
+/** FUNCTIONS **/
+
+static slot_t* slot_of(const esp_partition_t* partition)
+{
+    for (int i = 0; i < 2; i++) {
+        if (partition == &slots[i].partition) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+void host_ota_reset(const uint8_t* image, size_t len, esp_ota_img_states_t state)
+{
+    for (int i = 0; i < 2; i++) {
+        if (slots[i].data == NULL) {
+            slots[i].data = malloc(HOST_OTA_SLOT_SIZE);
+        }
+        memset(slots[i].data, 0xFF, HOST_OTA_SLOT_SIZE);
+        slots[i].image_len = 0;
+        slots[i].state = ESP_OTA_IMG_UNDEFINED;
+    }
+    memcpy(slots[0].data, image, len);
+    slots[0].image_len = len;
+    slots[0].state = state;
+    memset(&stats, 0, sizeof(stats));
+    writing = -1;
+}
+
+uint8_t* host_ota_image(int slot, size_t* len)
+{
+    *len = slots[slot].image_len;
+    return slots[slot].data;
+}
+
+void host_ota_get_stats(host_ota_stats_t* out)
+{
+    *out = stats;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    slot_t* slot = slot_of(partition);
+    if (slot == NULL || src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, slot->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_get_sha256(const esp_partition_t* partition, uint8_t* sha_256)
+{
+    slot_t* slot = slot_of(partition);
+    if (slot == NULL || slot->image_len < 32) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(sha_256, slot->data + slot->image_len - 32, 32);
+    return ESP_OK;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return &slots[stats.running].partition;
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    return &slots[!stats.running].partition;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle)
+{
+    slot_t* slot = slot_of(partition);
+    if (slot == NULL || partition == esp_ota_get_running_partition()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    writing = slot - slots;
+    write_pos = 0;
+    slot->image_len = 0;
+    slot->state = ESP_OTA_IMG_UNDEFINED;
+    memset(slot->data, 0xFF, HOST_OTA_SLOT_SIZE);
+    stats.begins++;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    if (writing < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (size > HOST_OTA_SLOT_SIZE - write_pos) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(slots[writing].data + write_pos, data, size);
+    write_pos += size;
+    return ESP_OK;
+}
+
+// Like the real one: the image must start with the ESP image magic and end
+// with the SHA-256 of everything before it
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    if (writing < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    slot_t* slot = &slots[writing];
+    writing = -1;
+    stats.ends++;
+    uint8_t digest[32];
+    if (write_pos <= 32 || slot->data[0] != ESP_IMAGE_MAGIC
+        || mbedtls_sha256(slot->data, write_pos - 32, digest, 0) != 0
+        || memcmp(digest, slot->data + write_pos - 32, 32) != 0) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    slot->image_len = write_pos;
+    slot->state = ESP_OTA_IMG_NEW;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    writing = -1;
+    stats.aborts++;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    slot_t* slot = slot_of(partition);
+    if (slot == NULL || slot->image_len == 0) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    stats.boot = slot - slots;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state)
+{
+    slot_t* slot = slot_of(partition);
+    if (slot == NULL || slot->state == ESP_OTA_IMG_UNDEFINED) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *ota_state = slot->state;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    slots[stats.running].state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    slots[stats.running].state = ESP_OTA_IMG_INVALID;
+    stats.rollbacks++;
+    stats.boot = !stats.running;
+    esp_restart();
+    return ESP_OK;
+}
+
+// Boots the boot slot; a new image starts on probation, as with rollback enabled
+void esp_restart(void)
+{
+    stats.restarts++;
+    stats.running = stats.boot;
+    if (slots[stats.running].state == ESP_OTA_IMG_NEW) {
+        slots[stats.running].state = ESP_OTA_IMG_PENDING_VERIFY;
+    }
+}
@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rc522sim.h"
+#include "sim.h"
+
+/** TYPES **/
+
+// ISO 14443-3 card states
+typedef enum {
+    CARD_IDLE,
+    CARD_READY,
+    CARD_ACTIVE,
+    CARD_HALT,
+} card_state_t;
+
+typedef struct {
+    bool used;
+    rc522sim_card_t card;
+    card_state_t state;
+    bool star;              // woken from HALT by WUPA: falls back to HALT, not IDLE
+    uint8_t level;          // cascade level being resolved
+    int64_t session_us;     // power session the state belongs to
+} slot_t;
+
+// One card's answer to a frame, bits [start, end) of data
+typedef struct {
+    uint8_t data[18];
+    uint16_t start;
+    uint16_t end;
+    uint32_t delay_us;
+} answer_t;
+
+// What the chip shows once the running transceive completes
+typedef struct {
+    bool pending;
+    bool answered;
+    int64_t done_at;
+    uint8_t irq;
+    uint8_t error;
+    uint8_t coll;
+    uint8_t last_bits;
+    uint8_t data[MFRC522_FIFO_SIZE];
+    uint8_t len;
+} result_t;
+
+struct rc522sim {
+    uint8_t regs[64];
+    uint8_t fifo[MFRC522_FIFO_SIZE];
+    uint8_t fifo_len;
+    int irq_pin;
+    bool absent;
+    bool power_down;
+    int64_t awake_at;       // oscillator running again from
+    int64_t field_since;    // -1 = field off
+    int64_t down_since;     // soft power-down entered at
+    uint32_t spi_ns;        // SPI time not yet charged, below a microsecond
+    result_t result;
+    slot_t slots[RC522SIM_MAX_CARDS];
+    rc522sim_stats_t stats;
+};
+
+/** FUNCTIONS **/
+
+// CRC_A of ISO 14443-3, preset 0x6363, LSB first
+static uint16_t crc_a(const uint8_t* data, size_t len)
+{
+    uint16_t crc = 0x6363;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t ch = data[i] ^ (uint8_t)(crc & 0xFF);
+        ch ^= ch << 4;
+        crc = (crc >> 8) ^ ((uint16_t)ch << 8) ^ ((uint16_t)ch << 3) ^ (ch >> 4);
+    }
+    return crc;
+}
+
+static bool crc_ok(const uint8_t* frame, size_t len)
+{
+    uint16_t crc = crc_a(frame, len - 2);
+    return frame[len - 2] == (crc & 0xFF) && frame[len - 1] == (crc >> 8);
+}
+
+// Air time of a frame: each byte carries a parity bit
+static int64_t air_us(uint32_t bits)
+{
+    return ((int64_t)(bits + (bits + 7) / 8) * RC522SIM_BIT_NS + 999) / 1000;
+}
+
+static void charge_spi(rc522sim_t* sim, uint32_t bytes)
+{
+    sim->stats.transactions++;
+    sim->spi_ns += RC522SIM_SPI_OVERHEAD_US * 1000 + bytes * RC522SIM_SPI_BYTE_NS;
+    host_busy_us(sim->spi_ns / 1000);
+    sim->spi_ns %= 1000;
+}
+
+static void update_field(rc522sim_t* sim)
+{
+    int64_t now = host_now_us();
+    bool on = !sim->power_down && (sim->regs[TxControlReg] & 0x03);
+    if (on && sim->field_since < 0) {
+        sim->field_since = now > sim->awake_at ? now : sim->awake_at;
+    }
+    else if (!on && sim->field_since >= 0) {
+        if (now > sim->field_since) {
+            sim->stats.field_on_us += now - sim->field_since;
+        }
+        sim->field_since = -1;
+    }
+}
+
+// Whether a card can answer at time t; a new power session starts it over in IDLE
+static bool card_powered(rc522sim_t* sim, slot_t* s, int64_t t)
+{
+    const rc522sim_card_t* c = &s->card;
+    if (sim->field_since < 0 || t < sim->field_since || t < c->enter_us || (c->leave_us != 0 && t >= c->leave_us)) {
+        return false;
+    }
+    int64_t session = c->enter_us > sim->field_since ? c->enter_us : sim->field_since;
+    if (s->session_us != session) {
+        s->session_us = session;
+        s->state = CARD_IDLE;
+        s->star = false;
+        s->level = 0;
+    }
+    return t - session >= RC522SIM_CARD_POWER_UP_US;
+}
+
+// Cascade level data: 4 UID bytes (or CT + 3) and BCC; returns whether more levels follow
+static bool level_data(const rc522sim_card_t* c, uint8_t level, uint8_t out[5])
+{
+    uint8_t levels = c->uid_size == 4 ? 1 : c->uid_size == 7 ? 2 : 3;
+    bool more = level < levels - 1;
+    if (more) {
+        out[0] = PICC_CASCADE_TAG;
+        memcpy(&out[1], &c->uid[3 * level], 3);
+    }
+    else {
+        memcpy(out, &c->uid[3 * level], 4);
+    }
+    out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+    return more;
+}
+
+static int get_bit(const uint8_t* data, int bit)
+{
+    return (data[bit / 8] >> (bit % 8)) & 1;
+}
+
+// Anything unexpected sends a READY or ACTIVE card back to IDLE (HALT if woken by WUPA)
+static void drop(slot_t* s)
+{
+    if (s->state == CARD_READY || s->state == CARD_ACTIVE) {
+        s->state = s->star ? CARD_HALT : CARD_IDLE;
+        s->level = 0;
+    }
+}
+
+// One card receiving a frame; returns whether it answers
+static bool card_receive(slot_t* s, const uint8_t* tx, uint8_t tx_len, uint32_t bits, answer_t* answer)
+{
+    memset(answer, 0, sizeof(*answer));
+    answer->delay_us = s->card.extra_delay_us;
+
+    if (bits == 7 && tx_len == 1) {
+        uint8_t cmd = tx[0] & 0x7F;
+        bool wake = (cmd == PICC_REQIDL && s->state == CARD_IDLE)
+            || (cmd == PICC_REQALL && (s->state == CARD_IDLE || s->state == CARD_HALT));
+        if (!wake) {
+            drop(s);
+            return false;
+        }
+        s->star = s->state == CARD_HALT;
+        s->state = CARD_READY;
+        s->level = 0;
+        uint8_t size_code = s->card.uid_size == 4 ? 0 : s->card.uid_size == 7 ? 1 : 2;
+        answer->data[0] = 0x04 | (size_code << 6);     // bit frame anticollision
+        answer->data[1] = 0x00;
+        answer->end = 16;
+        return true;
+    }
+    if (s->state == CARD_IDLE || s->state == CARD_HALT) {
+        return false;
+    }
+
+    if (s->state == CARD_ACTIVE) {
+        if (tx_len == 4 && bits == 32 && tx[0] == PICC_HALT && tx[1] == 0x00 && crc_ok(tx, 4)) {
+            s->state = CARD_HALT;
+            s->level = 0;
+            return false;
+        }
+        drop(s);
+        return false;
+    }
+
+    // READY: anticollision or SELECT at the current cascade level
+    static const uint8_t sel_cmds[3] = { PICC_SEL_CL1, PICC_SEL_CL2, PICC_SEL_CL3 };
+    if (tx_len < 2 || tx[0] != sel_cmds[s->level]) {
+        drop(s);
+        return false;
+    }
+    uint8_t data[5];
+    bool more = level_data(&s->card, s->level, data);
+    uint8_t nvb = tx[1];
+
+    if (nvb == 0x70) {
+        if (tx_len != 9 || bits != 72 || !crc_ok(tx, 9) || memcmp(&tx[2], data, 5) != 0) {
+            drop(s);
+            return false;
+        }
+        answer->data[0] = more ? 0x04 : (s->card.sak & ~0x04);
+        uint16_t crc = crc_a(answer->data, 1);
+        answer->data[1] = crc & 0xFF;
+        answer->data[2] = crc >> 8;
+        if (s->card.crc_errors > 0) {
+            s->card.crc_errors--;
+            answer->data[2] ^= 0x5A;
+        }
+        answer->end = 24;
+        if (more) {
+            s->level++;
+        }
+        else {
+            s->state = CARD_ACTIVE;
+        }
+        return true;
+    }
+
+    uint32_t known = ((nvb >> 4) - 2) * 8 + (nvb & 0x0F);
+    if ((nvb >> 4) < 2 || known >= 40 || bits != 16 + known) {
+        drop(s);
+        return false;
+    }
+    for (uint32_t b = 0; b < known; b++) {
+        if (get_bit(&tx[2], b) != get_bit(data, b)) {
+            return false;   // not this card, it stays READY
+        }
+    }
+    memcpy(answer->data, data, 5);
+    answer->start = known;
+    answer->end = 40;
+    return true;
+}
+
+// Bitwise OR of the answers as seen by the receiver, stopping at the first collision
+static void merge(rc522sim_t* sim, const answer_t* answers, int count)
+{
+    result_t* r = &sim->result;
+    uint16_t start = answers[0].start;
+    uint16_t end = answers[0].end;
+    uint16_t first_byte = start / 8;
+    r->len = (end + 7) / 8 - first_byte;
+    memset(r->data, 0, r->len);
+    r->last_bits = end % 8;
+
+    for (int b = start; b < end; b++) {
+        int ones = 0;
+        for (int i = 0; i < count; i++) {
+            ones += get_bit(answers[i].data, b);
+        }
+        if (ones != 0 && ones != count) {
+            // ValuesAfterColl is cleared by the driver: everything after reads 0
+            uint32_t pos = b - first_byte * 8 + 1;
+            r->error |= 0x08;       // CollErr
+            r->irq |= 0x02;         // ErrIRq
+            r->coll = pos > 32 ? 0x20 : (pos & 0x1F);
+            break;
+        }
+        if (ones != 0) {
+            r->data[b / 8 - first_byte] |= 1 << (b % 8);
+        }
+    }
+}
+
+static void raise_irq(rc522sim_t* sim)
+{
+    if (sim->irq_pin >= 0 && (sim->regs[ComIrqReg] & sim->regs[ComIEnReg] & 0x7F)) {
+        host_gpio_raise(sim->irq_pin);
+    }
+}
+
+// Show the result of a finished transceive in the registers
+static bool settle(rc522sim_t* sim)
+{
+    result_t* r = &sim->result;
+    if (!r->pending || host_now_us() < r->done_at) {
+        return false;
+    }
+    r->pending = false;
+    sim->regs[ComIrqReg] |= r->irq;
+    sim->regs[ErrorReg] = r->error;
+    sim->regs[ControlReg] = (sim->regs[ControlReg] & ~0x07) | r->last_bits;
+    if (r->error & 0x08) {
+        sim->regs[CollReg] = (sim->regs[CollReg] & 0x80) | r->coll;
+    }
+    memcpy(sim->fifo, r->data, r->len);
+    sim->fifo_len = r->len;
+    if (r->answered) {
+        sim->stats.responses++;
+    }
+    return true;
+}
+
+static void on_done(void* arg)
+{
+    rc522sim_t* sim = arg;
+    if (settle(sim)) {
+        raise_irq(sim);
+    }
+}
+
+static void cancel(rc522sim_t* sim)
+{
+    if (sim->result.pending) {
+        sim->result.pending = false;
+        host_event_cancel(on_done, sim);
+    }
+}
+
+static uint32_t timer_us(rc522sim_t* sim)
+{
+    uint32_t prescaler = ((sim->regs[TModeReg] & 0x0F) << 8) | sim->regs[TPrescalerReg];
+    uint32_t reload = (sim->regs[TReloadRegH] << 8) | sim->regs[TReloadRegL];
+    return (uint32_t)((uint64_t)(reload + 1) * (2 * prescaler + 1) * 1000000 / MFRC522_XTAL_HZ);
+}
+
+// StartSend: the FIFO goes out, the cards answer or the chip timer runs out
+static void start_transceive(rc522sim_t* sim, uint8_t bit_framing)
+{
+    uint8_t tx[MFRC522_FIFO_SIZE];
+    uint8_t tx_len = sim->fifo_len;
+    memcpy(tx, sim->fifo, tx_len);
+    sim->fifo_len = 0;
+    uint8_t tx_last_bits = bit_framing & 0x07;
+    uint32_t bits = tx_len * 8 - (tx_last_bits ? 8 - tx_last_bits : 0);
+
+    int64_t now = host_now_us();
+    int64_t tx_end = now + air_us(bits);
+    int64_t timer_end = tx_end + timer_us(sim);
+    sim->stats.frames++;
+
+    result_t* r = &sim->result;
+    memset(r, 0, sizeof(*r));
+    r->pending = true;
+
+    answer_t answers[RC522SIM_MAX_CARDS];
+    int count = 0;
+    int64_t last_answer = 0;
+    bool field = sim->field_since >= 0 && now >= sim->field_since;
+    for (int i = 0; i < RC522SIM_MAX_CARDS && field; i++) {
+        slot_t* s = &sim->slots[i];
+        if (!s->used || !card_powered(sim, s, tx_end)) {
+            continue;
+        }
+        answer_t answer;
+        if (!card_receive(s, tx, tx_len, bits, &answer)) {
+            continue;
+        }
+        // an answer after the timer ran out is never seen
+        int64_t at = tx_end + RC522SIM_FDT_US + answer.delay_us;
+        if (at > timer_end) {
+            continue;
+        }
+        int64_t end = at + air_us(answer.end - answer.start);
+        if (end > last_answer) {
+            last_answer = end;
+        }
+        answers[count++] = answer;
+    }
+
+    if (count == 0) {
+        r->done_at = timer_end;
+        r->irq = 0x01;      // TimerIRq
+    }
+    else {
+        r->done_at = last_answer;
+        r->irq = 0x20;      // RxIRq
+        r->answered = true;
+        merge(sim, answers, count);
+    }
+    host_event_at(r->done_at, on_done, sim);
+}
+
+static void reset(rc522sim_t* sim)
+{
+    cancel(sim);
+    memset(sim->regs, 0, sizeof(sim->regs));
+    sim->regs[CommandReg] = 0x20;
+    sim->regs[ComIEnReg] = 0x80;
+    sim->regs[ComIrqReg] = 0x14;
+    sim->regs[ControlReg] = 0x10;
+    sim->regs[CollReg] = 0x80;
+    sim->regs[ModeReg] = 0x3F;
+    sim->regs[TxControlReg] = 0x80;     // antenna off
+    sim->regs[VersionReg] = RC522SIM_VERSION;
+    sim->fifo_len = 0;
+    if (sim->power_down) {
+        sim->stats.power_down_us += host_now_us() - sim->down_since;
+    }
+    sim->power_down = false;
+    sim->awake_at = host_now_us() + RC522SIM_RESET_US;
+    update_field(sim);
+}
+
+static void write_command(rc522sim_t* sim, uint8_t val)
+{
+    if (val & 0x10) {
+        // soft power-down: oscillator and antenna drivers stop
+        cancel(sim);
+        if (!sim->power_down) {
+            sim->down_since = host_now_us();
+        }
+        sim->power_down = true;
+        sim->regs[CommandReg] = (sim->regs[CommandReg] & 0x20) | PCD_IDLE;
+        update_field(sim);
+        return;
+    }
+    if (sim->power_down) {
+        sim->power_down = false;
+        sim->stats.power_down_us += host_now_us() - sim->down_since;
+        sim->awake_at = host_now_us() + RC522SIM_WAKE_US;
+        update_field(sim);
+    }
+
+    uint8_t cmd = val & 0x0F;
+    sim->regs[CommandReg] = (sim->regs[CommandReg] & 0x20) | cmd;
+    switch (cmd) {
+    case PCD_IDLE:
+        cancel(sim);
+        break;
+    case PCD_RESETPHASE:
+        reset(sim);
+        break;
+    case PCD_CALCCRC: {
+        // a few bytes take a few microseconds, done before the next SPI access
+        uint16_t crc = crc_a(sim->fifo, sim->fifo_len);
+        sim->regs[CRCResultRegL] = crc & 0xFF;
+        sim->regs[CRCResultRegH] = crc >> 8;
+        sim->regs[DivIrqReg] |= 0x04;
+        sim->fifo_len = 0;
+        break;
+    }
+    case PCD_AUTHENT:
+        // Crypto1 is not simulated: nobody answers, the timer runs out
+        cancel(sim);
+        memset(&sim->result, 0, sizeof(sim->result));
+        sim->fifo_len = 0;
+        sim->result.pending = true;
+        sim->result.done_at = host_now_us() + timer_us(sim);
+        sim->result.irq = 0x01;
+        host_event_at(sim->result.done_at, on_done, sim);
+        break;
+    default:
+        break;  // PCD_TRANSCEIVE waits for StartSend
+    }
+}
+
+static void sim_write(void* ctx, uint8_t reg, uint8_t val)
+{
+    rc522sim_t* sim = ctx;
+    charge_spi(sim, 2);
+    settle(sim);
+    if (sim->absent) {
+        return;
+    }
+    reg &= 0x3F;
+    switch (reg) {
+    case CommandReg:
+        write_command(sim, val);
+        break;
+    case ComIrqReg:
+    case DivIrqReg:
+        // Set1: the marked bits are set, otherwise cleared
+        if (val & 0x80) {
+            sim->regs[reg] |= val & 0x7F;
+        }
+        else {
+            sim->regs[reg] &= ~val;
+        }
+        break;
+    case FIFODataReg:
+        if (sim->fifo_len < MFRC522_FIFO_SIZE) {
+            sim->fifo[sim->fifo_len++] = val;
+        }
+        break;
+    case FIFOLevelReg:
+        if (val & 0x80) {
+            sim->fifo_len = 0;
+        }
+        break;
+    case BitFramingReg:
+        sim->regs[reg] = val & 0x7F;
+        if ((val & 0x80) && (sim->regs[CommandReg] & 0x0F) == PCD_TRANSCEIVE && !sim->power_down) {
+            start_transceive(sim, val);
+        }
+        break;
+    case TxControlReg:
+        sim->regs[reg] = val;
+        update_field(sim);
+        break;
+    case VersionReg:
+    case ErrorReg:
+    case Status1Reg:
+        break;  // read only
+    default:
+        sim->regs[reg] = val;
+        break;
+    }
+}
+
+static uint8_t sim_read(void* ctx, uint8_t reg)
+{
+    rc522sim_t* sim = ctx;
+    charge_spi(sim, 2);
+    settle(sim);
+    if (sim->absent) {
+        return 0x00;
+    }
+    reg &= 0x3F;
+    switch (reg) {
+    case CommandReg: {
+        bool asleep = sim->power_down || host_now_us() < sim->awake_at;
+        return (sim->regs[CommandReg] & ~0x10) | (asleep ? 0x10 : 0);
+    }
+    case FIFOLevelReg:
+        return sim->fifo_len;
+    case FIFODataReg: {
+        if (sim->fifo_len == 0) {
+            return 0;
+        }
+        uint8_t val = sim->fifo[0];
+        memmove(sim->fifo, sim->fifo + 1, --sim->fifo_len);
+        return val;
+    }
+    default:
+        return sim->regs[reg];
+    }
+}
+
+static void sim_write_fifo(void* ctx, const uint8_t* data, uint8_t len)
+{
+    rc522sim_t* sim = ctx;
+    charge_spi(sim, len + 1);
+    settle(sim);
+    if (sim->absent) {
+        return;
+    }
+    for (uint8_t i = 0; i < len && sim->fifo_len < MFRC522_FIFO_SIZE; i++) {
+        sim->fifo[sim->fifo_len++] = data[i];
+    }
+}
+
+static void sim_read_fifo(void* ctx, uint8_t* data, uint8_t len)
+{
+    rc522sim_t* sim = ctx;
+    charge_spi(sim, len + 1);
+    settle(sim);
+    memset(data, 0, len);
+    if (sim->absent) {
+        return;
+    }
+    uint8_t n = len < sim->fifo_len ? len : sim->fifo_len;
+    memcpy(data, sim->fifo, n);
+    memmove(sim->fifo, sim->fifo + n, sim->fifo_len - n);
+    sim->fifo_len -= n;
+}
+
+rc522sim_t* rc522sim_new(int irq_pin)
+{
+    rc522sim_t* sim = calloc(1, sizeof(*sim));
+    if (sim == NULL) {
+        return NULL;
+    }
+    sim->irq_pin = irq_pin;
+    sim->field_since = -1;
+    reset(sim);
+    sim->awake_at = 0;
+    return sim;
+}
+
+void rc522sim_free(rc522sim_t* sim)
+{
+    cancel(sim);
+    free(sim);
+}
+
+void rc522sim_get_bus(rc522sim_t* sim, mfrc522_bus_t* out)
+{
+    *out = (mfrc522_bus_t){
+        .write = sim_write,
+        .read = sim_read,
+        .write_fifo = sim_write_fifo,
+        .read_fifo = sim_read_fifo,
+        .ctx = sim,
+    };
+}
+
+int rc522sim_add_card(rc522sim_t* sim, const rc522sim_card_t* card)
+{
+    for (int i = 0; i < RC522SIM_MAX_CARDS; i++) {
+        if (!sim->slots[i].used) {
+            sim->slots[i] = (slot_t){ .used = true, .card = *card, .state = CARD_IDLE, .session_us = -1 };
+            return i;
+        }
+    }
+    return -1;
+}
+
+rc522sim_card_t* rc522sim_card(rc522sim_t* sim, int slot)
+{
+    return slot >= 0 && slot < RC522SIM_MAX_CARDS && sim->slots[slot].used ? &sim->slots[slot].card : NULL;
+}
+
+void rc522sim_remove_cards(rc522sim_t* sim)
+{
+    memset(sim->slots, 0, sizeof(sim->slots));
+}
+
+void rc522sim_set_absent(rc522sim_t* sim, bool absent)
+{
+    sim->absent = absent;
+}
+
+void rc522sim_get_stats(rc522sim_t* sim, rc522sim_stats_t* out)
+{
+    *out = sim->stats;
+    int64_t now = host_now_us();
+    if (sim->field_since >= 0 && now > sim->field_since) {
+        out->field_on_us += now - sim->field_since;
+    }
+    if (sim->power_down) {
+        out->power_down_us += now - sim->down_since;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef RC522SIM_H
+#define RC522SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mfrc522.h"
+
+// Simulated MFRC522 register file behind an mfrc522_bus_t, with ISO 14443-3
+// cards walking in and out of its field on virtual time. Frames take their
+// air time at 106 kbit/s, the chip timer (TReloadReg, TPrescaler) ends a
+// transceive nobody answers, and the IRQ pin fires through gpio_isr_handler_add.
+// Covered: REQA, WUPA, anticollision and SELECT on cascade levels 1-3, HLTA,
+// CALCCRC, soft reset and soft power-down. MIFARE Classic commands are not
+// answered, so mfrc522_mifare_auth fails with MFRC522_ERR_AUTH.
+
+#define RC522SIM_MAX_CARDS          8
+#define RC522SIM_VERSION            0x92    // VersionReg of an MFRC522 v2.0
+#define RC522SIM_WAKE_US            200     // oscillator start after soft power-down
+#define RC522SIM_RESET_US           50
+#define RC522SIM_SPI_OVERHEAD_US    10      // per transaction: CS, driver, queueing
+#define RC522SIM_SPI_BYTE_NS        1600    // 5 MHz SCLK
+#define RC522SIM_BIT_NS             9440    // one bit at 106 kbit/s
+#define RC522SIM_FDT_US             90      // PCD frame end to PICC frame start
+#define RC522SIM_CARD_POWER_UP_US   2500    // field time a card needs before it answers
+
+typedef struct {
+    uint8_t uid[10];
+    uint8_t uid_size;           // 4, 7 or 10
+    uint8_t sak;                // SAK of the last cascade level
+    int64_t enter_us;           // in the field from
+    int64_t leave_us;           // until; 0 = stays
+    uint32_t extra_delay_us;    // answers this much late; past the chip timer the answer is lost
+    uint32_t crc_errors;        // this many SELECT answers arrive with a bad CRC_A
+} rc522sim_card_t;
+
+typedef struct {
+    uint32_t transactions;      // SPI transactions
+    uint32_t frames;            // frames sent to the cards
+    uint32_t responses;         // frames the cards answered
+    uint64_t field_on_us;       // time the antenna field was up
+    uint64_t power_down_us;     // time in soft power-down
+} rc522sim_stats_t;
+
+typedef struct rc522sim rc522sim_t;
+
+// irq_pin < 0: the IRQ line is not wired
+rc522sim_t* rc522sim_new(int irq_pin);
+void rc522sim_free(rc522sim_t* sim);
+void rc522sim_get_bus(rc522sim_t* sim, mfrc522_bus_t* out);
+// Returns the card slot, or -1 when all slots are taken
+int rc522sim_add_card(rc522sim_t* sim, const rc522sim_card_t* card);
+// The card in a slot, to script it further (e.g. set leave_us)
+rc522sim_card_t* rc522sim_card(rc522sim_t* sim, int slot);
+void rc522sim_remove_cards(rc522sim_t* sim);
+// A chip that is not there: every register reads back 0x00
+void rc522sim_set_absent(rc522sim_t* sim, bool absent);
+void rc522sim_get_stats(rc522sim_t* sim, rc522sim_stats_t* out);
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+
+// Discrete-event simulation the host build runs on. Time is virtual: it only
+// moves when code spends it (host_busy_us, an SPI transfer, a network round
+// trip) or when every task is blocked and the scheduler skips to the next
+// deadline. main() is itself a task, at HOST_MAIN_PRIORITY.
+
+#define HOST_MAIN_PRIORITY      1
+#define HOST_TIMER_PRIORITY     22      // esp_timer task, as in ESP-IDF
+#define HOST_TASK_STACK         (256 * 1024)
+
+typedef void (*host_event_fn)(void* arg);
+
+int64_t host_now_us(void);
+// The running task keeps the CPU (or a bus) for this long
+void host_busy_us(int64_t us);
+// The running task blocks for this long, other tasks and timers run meanwhile
+void host_sleep_us(int64_t us);
+// Called at a virtual time in interrupt context: it may only wake tasks
+void host_event_at(int64_t at_us, host_event_fn fn, void* arg);
+void host_event_cancel(host_event_fn fn, void* arg);
+// From now on, wait for the wall clock to reach the next deadline instead of
+// skipping to it: for running against a real server at its real pace
+void host_set_realtime(bool on);
+// Fire the interrupt handler registered for a pin with gpio_isr_handler_add
+void host_gpio_raise(int pin);
+
+// Latency percentiles over a set of samples
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+    uint64_t sum;
+} host_percentiles_t;
+
+void host_percentiles(uint32_t* samples, uint32_t count, host_percentiles_t* out);
+
+// Console UART without a driver, as ESP-IDF leaves it: a 128 byte TX FIFO at
+// 115200 baud 8N1, and a writer that spins while the FIFO is full
+#define HOST_UART_FIFO          128
+#define HOST_UART_BYTE_NS       86806   // 10 bits at 115200 baud
+
+void host_uart_write(const char* data, size_t len);
+
+// Fake LEDC: time a channel's output first changed after arming it, 0 = not yet
+void host_ledc_arm(int channel);
+int64_t host_ledc_first_change_us(int channel);
+
+// Checks for tests: report and count a failure, keep going
+extern int host_failures;
+#define HOST_CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            host_failures++; \
+        } \
+    } while (0)
+
+// NVS cost model: writes are charged to the caller in virtual time
+typedef struct {
+    uint32_t writes;            // nvs_set_* calls
+    uint32_t bytes_written;
+    uint32_t commits;
+} host_nvs_stats_t;
+
+void host_nvs_get_stats(host_nvs_stats_t* out);
+void host_nvs_reset(void);
+
+#define HOST_NVS_WRITE_US       300     // per nvs_set_* call: entry lookup, header and state writes
+#define HOST_NVS_ENTRY_US       60      // per 32 byte entry programmed
+
+// HTTP client over real sockets; its round trips are added to virtual time
+typedef struct {
+    uint32_t requests;
+    uint32_t connects;
+    uint32_t failures;          // open or read failed
+    uint32_t matched;           // requests whose path starts with the host_http_match prefix
+} host_http_stats_t;
+
+void host_http_get_stats(host_http_stats_t* out);
+// Extra round trip time per request, e.g. a Wi-Fi hop the loopback does not have
+void host_http_set_extra_rtt_us(int64_t us);
+// Count requests to paths starting with this prefix in host_http_stats_t.matched
+void host_http_match(const char* path_prefix);
+
+// Wi-Fi link state wifi_is_connected reports
+void host_wifi_set_connected(bool up);
+
+// tools/authserver.py serve on 127.0.0.1, started as a child process.
+// Listens on http_port (UDP and MQTT on the two ports after it).
+#define HOST_AUTHSERVER_KEY     "host-test"     // its auth_key
+esp_err_t host_authserver_start(uint16_t http_port, const char* const* allow, int allow_count);
+// Files for the /firmware endpoint of the next start: image to run, NULL = none;
+// base a delta is made against, NULL = full updates only
+void host_authserver_set_firmware(const char* image_path, const char* base_path);
+void host_authserver_stop(void);
+// A port that accepts connections and never answers, for the server-down case
+esp_err_t host_blackhole_start(uint16_t port);
+void host_blackhole_stop(void);
+
+// The two app slots of partitions.csv and their otadata states
+typedef struct {
+    int running;                // slot the program runs from
+    int boot;                   // slot the next restart boots
+    uint32_t begins;            // esp_ota_begin calls
+    uint32_t ends;
+    uint32_t aborts;
+    uint32_t restarts;
+    uint32_t rollbacks;
+} host_ota_stats_t;
+
+#define HOST_OTA_SLOT_SIZE      0x180000
+
+// Run image from slot 0, in an otadata state; slot 1 is empty
+void host_ota_reset(const uint8_t* image, size_t len, esp_ota_img_states_t state);
+// A slot's contents, e.g. to check or corrupt them; *len = its image size
+uint8_t* host_ota_image(int slot, size_t* len);
+void host_ota_get_stats(host_ota_stats_t* out);
+
+#endif
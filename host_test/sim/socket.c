@@ -0,0 +1,33 @@
+#include <time.h>
+#include "lwip/sockets.h"
+#include "esp_system.h"
+#include "sim.h"
+
+// Host build: the datagram sockets of authclient_udp are the host's; time
+// blocked in recv is spent again in virtual time, as in sim/http_client.c
+
+#undef recv
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+ssize_t host_recv(int sock, void* buf, size_t len, int flags)
+{
+    int64_t start = wall_us();
+    ssize_t n = recv(sock, buf, len, flags);
+    host_sleep_us(wall_us() - start);
+    return n;
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t value;
+    if (getentropy(&value, sizeof(value)) != 0) {
+        value = (uint32_t)wall_us();
+    }
+    return value;
+}
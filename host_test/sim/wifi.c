@@ -0,0 +1,16 @@
+#include "wificonnection.h"
+#include "sim.h"
+
+// Host build: the link state is whatever the test sets, up by default
+
+static bool link_up = true;
+
+bool wifi_is_connected(void)
+{
+    return link_up;
+}
+
+void host_wifi_set_connected(bool up)
+{
+    link_up = up;
+}
@@ -0,0 +1,149 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "sim.h"
+
+// Deferred logging against the console it replaced. One tap's output from
+// the reader and auth tasks is written the old way (printf and ESP_LOGI on
+// the console UART, from the tap path) and through DLOG (the drain task
+// writes the same UART). Reports the time the tap path spends logging, and
+// the host CPU time of formatting a line versus recording it.
+
+#define TAPS            40
+#define IDLE_SPACING_MS 1000        // one tap at a time
+#define BURST           4           // taps back to back: a queue, or several readers
+#define READ_US         5196        // 7-byte UID read with the IRQ pin, see test_mfrc522
+#define AUTH_US         14
+#define CPU_BATCHES     200
+
+static const uint8_t uid[7] = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+static const char* uid_hex = "04112233445566";
+static char last_tap_line[DLOG_LINE_LEN];
+
+static void console_printf(const char* fmt, ...)
+{
+    char line[DLOG_LINE_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    host_uart_write(line, len);
+}
+
+// The lines printed per granted cache hit before DLOG, ESP_LOG colours on
+static void tap_console(void)
+{
+    console_printf("ATQA: %02X %02X\n", 0x44, 0x00);
+    console_printf("(SAK: %02X)\n", 0x00);
+    console_printf("Card detected on reader %u! UID: %s (read in %lu us)\n", 0, uid_hex, (unsigned long)READ_US);
+    console_printf("\033[0;32mI (%lu) %s: Cache hit (fresh) in %lld us\033[0m\n",
+        (unsigned long)(esp_timer_get_time() / 1000), "AUTHORIZE", (long long)AUTH_US);
+    console_printf("Access granted!\n");
+}
+
+// The same tap now, at the default CONFIG_DLOG_LEVEL
+static void tap_dlog(void)
+{
+    DLOGD("MFRC522", "ATQA: %02X %02X", 0x44, 0x00);
+    DLOGD("MFRC522", "SAK: %02X", 0x00);
+    DLOG_HEX(DLOG_INFO, "PIPELINE", uid, sizeof(uid), "Card %s detected on reader %u (read in %lu us)",
+        0, READ_US);
+    DLOGI("AUTHORIZE", "Cache hit (fresh) in %lu us", AUTH_US);
+    DLOG_HEX(DLOG_INFO, "PIPELINE", uid, sizeof(uid), "UID %s granted in %lu us", AUTH_US);
+}
+
+static void uart_sink(const char* line, void* arg)
+{
+    if (strstr(line, "detected") != NULL) {
+        strlcpy(last_tap_line, line, sizeof(last_tap_line));
+    }
+    host_uart_write(line, strlen(line));
+}
+
+// Time the tap path spends in its log calls, per tap
+static host_percentiles_t run(const char* name, void (*tap)(void), uint32_t spacing_ms, uint32_t burst)
+{
+    uint32_t samples[TAPS];
+    for (int i = 0; i < TAPS; i++) {
+        int64_t start = esp_timer_get_time();
+        tap();
+        samples[i] = (uint32_t)(esp_timer_get_time() - start);
+        if ((i + 1) % burst == 0) {
+            vTaskDelay(pdMS_TO_TICKS(spacing_ms));
+        }
+    }
+    host_percentiles_t p;
+    host_percentiles(samples, TAPS, &p);
+    printf("  %-34s p50 %6.2f ms  max %6.2f ms\n", name, p.p50 / 1000.0, p.max / 1000.0);
+    return p;
+}
+
+static int64_t wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Host CPU per line, a batch at a time so the drain task keeps the ring from filling
+static void cpu_cost(void)
+{
+    char line[DLOG_LINE_LEN];
+    int64_t format_ns = 0;
+    int64_t record_ns = 0;
+    for (int b = 0; b < CPU_BATCHES; b++) {
+        int64_t start = wall_ns();
+        for (int i = 0; i < DLOG_RING_RECORDS; i++) {
+            snprintf(line, sizeof(line), "Card detected on reader %u! UID: %s (read in %lu us)\n", 0, uid_hex,
+                (unsigned long)READ_US);
+        }
+        format_ns += wall_ns() - start;
+        start = wall_ns();
+        for (int i = 0; i < DLOG_RING_RECORDS; i++) {
+            DLOG_HEX(DLOG_INFO, "PIPELINE", uid, sizeof(uid), "Card %s detected on reader %u (read in %lu us)",
+                0, READ_US);
+        }
+        record_ns += wall_ns() - start;
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_MS * 10));
+    }
+    uint32_t lines = CPU_BATCHES * DLOG_RING_RECORDS;
+    printf("host CPU per line: snprintf %.0f ns, DLOG record %.0f ns\n", (double)format_ns / lines,
+        (double)record_ns / lines);
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    dlog_set_sink(uart_sink, NULL);
+    HOST_CHECK(dlog_init() == ESP_OK);
+
+    printf("tap path time in log calls, console UART at 115200 baud with a %d byte FIFO:\n", HOST_UART_FIFO);
+    host_percentiles_t console_idle = run("console, one tap at a time", tap_console, IDLE_SPACING_MS, 1);
+    host_percentiles_t console_burst = run("console, 4 taps back to back", tap_console, IDLE_SPACING_MS, BURST);
+    host_percentiles_t dlog_idle = run("DLOG, one tap at a time", tap_dlog, IDLE_SPACING_MS, 1);
+    host_percentiles_t dlog_burst = run("DLOG, 4 taps back to back", tap_dlog, IDLE_SPACING_MS, BURST);
+    vTaskDelay(pdMS_TO_TICKS(IDLE_SPACING_MS));
+    cpu_cost();
+
+    dlog_stats_t stats;
+    dlog_get_stats(&stats);
+    printf("DLOG: %lu records, %lu drained, %lu dropped\n", (unsigned long)stats.written,
+        (unsigned long)stats.drained, (unsigned long)stats.dropped);
+
+    // a tap's lines overflow the FIFO, a burst waits for the taps before it
+    HOST_CHECK(console_idle.p50 > 1000);
+    HOST_CHECK(console_burst.max > 4 * console_idle.p50);
+    HOST_CHECK(dlog_idle.max == 0 && dlog_burst.max == 0);
+    HOST_CHECK(stats.dropped == 0 && stats.drained == stats.written);
+    // ESP_LOG layout, the UID printed as hex
+    HOST_CHECK(strncmp(last_tap_line, "I (", 3) == 0);
+    HOST_CHECK(strstr(last_tap_line, ") PIPELINE: Card 04112233445566 detected on reader 0 (read in 5196 us)\n")
+        != NULL);
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
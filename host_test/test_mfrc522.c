@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "mfrc522.h"
+#include "rc522sim.h"
+#include "sim.h"
+
+// Driver against the simulated register file: cascade levels, collisions,
+// CRC errors, late answers, presence tracking, and IRQ versus polled waits.
+
+#define IRQ_PIN     4
+
+static const rc522sim_card_t card4 = { .uid = { 0x04, 0xA1, 0xB2, 0xC3 }, .uid_size = 4, .sak = 0x08 };
+static const rc522sim_card_t card7 = {
+    .uid = { 0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 }, .uid_size = 7, .sak = 0x00,
+};
+static const rc522sim_card_t card10 = {
+    .uid = { 0x04, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90 }, .uid_size = 10, .sak = 0x20,
+};
+
+static mfrc522_t* new_reader(rc522sim_t** sim_out, int irq_pin)
+{
+    rc522sim_t* sim = rc522sim_new(irq_pin);
+    mfrc522_bus_t bus;
+    rc522sim_get_bus(sim, &bus);
+    mfrc522_t* reader = NULL;
+    HOST_CHECK(mfrc522_new_with_bus(&bus, &reader) == ESP_OK);
+    if (irq_pin >= 0) {
+        HOST_CHECK(mfrc522_enable_irq(reader, irq_pin) == ESP_OK);
+    }
+    *sim_out = sim;
+    return reader;
+}
+
+// Card placed now, read once it had time to power up
+static int place(rc522sim_t* sim, const rc522sim_card_t* card)
+{
+    rc522sim_card_t c = *card;
+    c.enter_us = esp_timer_get_time();
+    int slot = rc522sim_add_card(sim, &c);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    return slot;
+}
+
+static void test_absent_chip(void)
+{
+    rc522sim_t* sim = rc522sim_new(-1);
+    rc522sim_set_absent(sim, true);
+    mfrc522_bus_t bus;
+    rc522sim_get_bus(sim, &bus);
+    mfrc522_t* reader = NULL;
+    HOST_CHECK(mfrc522_new_with_bus(&bus, &reader) == ESP_ERR_NOT_FOUND);
+    rc522sim_free(sim);
+}
+
+static void test_cascade_levels(void)
+{
+    const rc522sim_card_t* cards[] = { &card4, &card7, &card10 };
+    for (int i = 0; i < 3; i++) {
+        rc522sim_t* sim;
+        mfrc522_t* reader = new_reader(&sim, -1);
+        place(sim, cards[i]);
+        mfrc522_uid_t uid;
+        HOST_CHECK(mfrc522_get_card(reader, &uid));
+        HOST_CHECK(uid.size == cards[i]->uid_size);
+        HOST_CHECK(memcmp(uid.bytes, cards[i]->uid, uid.size) == 0);
+        HOST_CHECK(uid.sak == cards[i]->sak);
+        HOST_CHECK(mfrc522_halt(reader) == MFRC522_OK);
+        // halted: REQA is ignored, WUPA wakes it
+        uint8_t atqa[2];
+        HOST_CHECK(mfrc522_transceive(reader, PCD_TRANSCEIVE, (uint8_t[]){ PICC_REQIDL }, 1, atqa,
+            &(uint8_t){ 2 }, &(uint8_t){ 7 }) == MFRC522_NO_CARD);
+        HOST_CHECK(mfrc522_request(reader, atqa));
+        HOST_CHECK(atqa[0] == (0x04 | (i << 6)));
+        rc522sim_free(sim);
+    }
+}
+
+static void test_collision(void)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, -1);
+    rc522sim_add_card(sim, &card4);
+    // differs from card4 in the first UID byte, bit 0
+    rc522sim_card_t other = { .uid = { 0x05, 0x01, 0x02, 0x03 }, .uid_size = 4, .sak = 0x08 };
+    place(sim, &other);
+
+    mfrc522_uid_t uids[4];
+    uint8_t count = mfrc522_inventory(reader, uids, 4);
+    HOST_CHECK(count == 2);
+    bool seen4 = false;
+    bool seen_other = false;
+    for (int i = 0; i < count; i++) {
+        seen4 |= memcmp(uids[i].bytes, card4.uid, 4) == 0;
+        seen_other |= memcmp(uids[i].bytes, other.uid, 4) == 0;
+    }
+    HOST_CHECK(seen4 && seen_other);
+    mfrc522_stats_t stats;
+    mfrc522_get_stats(reader, &stats);
+    HOST_CHECK(stats.collisions >= 1);
+    rc522sim_free(sim);
+}
+
+// A bad CRC_A on SAK fails the read; the card recovers on a later poll
+static void test_crc_error(void)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, -1);
+    rc522sim_card_t c = card4;
+    c.crc_errors = 1;
+    place(sim, &c);
+
+    mfrc522_uid_t uid;
+    HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_NONE);
+    int polls = 1;
+    mfrc522_presence_t presence = MFRC522_CARD_NONE;
+    while (presence != MFRC522_CARD_ARRIVED && polls < 5) {
+        presence = mfrc522_poll_card(reader, &uid);
+        polls++;
+    }
+    HOST_CHECK(presence == MFRC522_CARD_ARRIVED);
+    HOST_CHECK(polls <= 3);
+    rc522sim_free(sim);
+}
+
+// An answer later than the chip timer (~158 us) is never seen
+static void test_slow_card(void)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, -1);
+    rc522sim_card_t c = card4;
+    c.extra_delay_us = 400;
+    int slot = place(sim, &c);
+    mfrc522_uid_t uid;
+    HOST_CHECK(!mfrc522_get_card(reader, &uid));
+
+    // the lost answer left it READY: the next WUPA sends it back to IDLE, the one after wakes it
+    rc522sim_card(sim, slot)->extra_delay_us = 40;
+    HOST_CHECK(!mfrc522_get_card(reader, &uid));
+    HOST_CHECK(mfrc522_get_card(reader, &uid));
+    rc522sim_free(sim);
+}
+
+static void test_presence(void)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, -1);
+    mfrc522_uid_t uid;
+    HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_NONE);
+
+    int slot = place(sim, &card7);
+    HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_ARRIVED);
+    HOST_CHECK(uid.size == 7);
+    HOST_CHECK(mfrc522_halt(reader) == MFRC522_OK);
+    for (int i = 0; i < 5; i++) {
+        HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_PRESENT);
+    }
+
+    rc522sim_card(sim, slot)->leave_us = esp_timer_get_time();
+    mfrc522_presence_t presence = MFRC522_CARD_PRESENT;
+    int polls = 0;
+    while (presence == MFRC522_CARD_PRESENT && polls < 5) {
+        presence = mfrc522_poll_card(reader, &uid);
+        polls++;
+    }
+    HOST_CHECK(presence == MFRC522_CARD_DEPARTED);
+    HOST_CHECK(polls == MFRC522_PRESENCE_MISSES);
+
+    mfrc522_stats_t stats;
+    mfrc522_get_stats(reader, &stats);
+    HOST_CHECK(stats.arrivals == 1 && stats.departures == 1);
+    rc522sim_free(sim);
+}
+
+// A held card whose field was cycled answers WUPA and a SELECT of its known
+// UID; it is neither reported as a new arrival nor anticollided again
+static void test_presence_after_power_down(void)
+{
+    const rc522sim_card_t* cards[] = { &card4, &card7, &card10 };
+    for (int i = 0; i < 3; i++) {
+        rc522sim_t* sim;
+        mfrc522_t* reader = new_reader(&sim, IRQ_PIN);
+        mfrc522_uid_t uid;
+        place(sim, cards[i]);
+        HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_ARRIVED);
+        HOST_CHECK(mfrc522_halt(reader) == MFRC522_OK);
+
+        mfrc522_stats_t before;
+        mfrc522_get_stats(reader, &before);
+        HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_PRESENT);
+        mfrc522_stats_t stats;
+        mfrc522_get_stats(reader, &stats);
+        uint32_t field_on = stats.spi_transactions - before.spi_transactions;
+
+        mfrc522_power_down(reader);
+        vTaskDelay(pdMS_TO_TICKS(100));
+        HOST_CHECK(mfrc522_power_up(reader) == ESP_OK);
+        vTaskDelay(pdMS_TO_TICKS(10));
+        mfrc522_get_stats(reader, &before);
+        HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_PRESENT);
+        HOST_CHECK(uid.size == cards[i]->uid_size && memcmp(uid.bytes, cards[i]->uid, uid.size) == 0);
+        mfrc522_get_stats(reader, &stats);
+        uint32_t cycled = stats.spi_transactions - before.spi_transactions;
+        HOST_CHECK(stats.arrivals == 1);
+
+        // halted again: the next poll is the plain presence check
+        mfrc522_get_stats(reader, &before);
+        HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_PRESENT);
+        mfrc522_get_stats(reader, &stats);
+        HOST_CHECK(stats.spi_transactions - before.spi_transactions == field_on);
+        printf("%d-byte UID held: %lu SPI transactions per poll, %lu after a power-down\n", cards[i]->uid_size,
+            (unsigned long)field_on, (unsigned long)cycled);
+        rc522sim_free(sim);
+    }
+}
+
+// Card present to UID read, waiting on the IRQ pin versus polling ComIrqReg every tick
+static uint32_t read_latency(int irq_pin, uint32_t* transactions)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, irq_pin);
+    place(sim, &card7);
+    mfrc522_uid_t uid;
+    HOST_CHECK(mfrc522_get_card(reader, &uid));
+    mfrc522_stats_t stats;
+    mfrc522_get_stats(reader, &stats);
+    HOST_CHECK(stats.irq_driven == (irq_pin >= 0));
+    *transactions = stats.last_read_transactions;
+    rc522sim_free(sim);
+    return stats.last_read_us;
+}
+
+// One poll of an empty field: REQA until the RC522 timer gives up
+static uint32_t empty_poll_latency(int irq_pin)
+{
+    rc522sim_t* sim;
+    mfrc522_t* reader = new_reader(&sim, irq_pin);
+    mfrc522_uid_t uid;
+    int64_t start = esp_timer_get_time();
+    HOST_CHECK(mfrc522_poll_card(reader, &uid) == MFRC522_CARD_NONE);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    rc522sim_free(sim);
+    return elapsed;
+}
+
+static void test_irq_versus_polling(void)
+{
+    uint32_t irq_transactions;
+    uint32_t polled_transactions;
+    uint32_t irq_us = read_latency(IRQ_PIN, &irq_transactions);
+    uint32_t polled_us = read_latency(-1, &polled_transactions);
+    uint32_t irq_empty_us = empty_poll_latency(IRQ_PIN);
+    uint32_t polled_empty_us = empty_poll_latency(-1);
+    printf("7-byte UID read: IRQ %lu us / %lu SPI transactions, polled %lu us / %lu SPI transactions\n",
+        (unsigned long)irq_us, (unsigned long)irq_transactions,
+        (unsigned long)polled_us, (unsigned long)polled_transactions);
+    printf("empty field poll: IRQ %lu us, polled %lu us\n", (unsigned long)irq_empty_us,
+        (unsigned long)polled_empty_us);
+    // five frames at 106 kbit/s take about 4 ms on air
+    HOST_CHECK(irq_us < 8000);
+    HOST_CHECK(polled_us > 2 * irq_us);
+    // the chip's timer ends an unanswered REQA, polling waits for the next tick
+    HOST_CHECK(irq_empty_us < 2000);
+    HOST_CHECK(polled_empty_us > 10 * irq_empty_us);
+}
+
+int main(void)
+{
+    test_absent_chip();
+    test_cascade_levels();
+    test_collision();
+    test_crc_error();
+    test_slow_card();
+    test_presence();
+    test_presence_after_power_down();
+    test_irq_versus_polling();
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+#include "otaupdate.h"
+#include "sim.h"
+
+// Updates end to end: tools/authserver.py builds full and delta files with
+// tools/otadelta.py, otaupdate inflates and applies them into the other slot
+// through the fake OTA partitions, and a new image is confirmed or rolled back.
+
+#define HTTP_PORT       18320
+#define IMAGE_SIZE      (192 * 1024)
+#define INSERT_AT       (80 * 1024)
+#define INSERT_SIZE     2048
+
+static uint8_t old_image[IMAGE_SIZE];
+static uint8_t new_image[IMAGE_SIZE + INSERT_SIZE];
+static uint8_t other_image[IMAGE_SIZE];
+static char url[64];
+
+// Image bytes with the repetition of machine code, ESP magic in front and
+// the SHA-256 the build appends at the end
+static void fill_image(uint8_t* image, size_t len, uint32_t seed)
+{
+    static const uint8_t opcodes[8] = { 0x36, 0x41, 0x0c, 0x1d, 0xf0, 0x81, 0xe5, 0x22 };
+    image[0] = 0xE9;
+    uint32_t x = seed;
+    for (size_t i = 1; i < len - 32; i++) {
+        x = x * 1103515245 + 12345;
+        image[i] = (x >> 16) % 7 == 0 ? (uint8_t)(x >> 24) : opcodes[(x >> 20) & 7];
+    }
+}
+
+static void seal_image(uint8_t* image, size_t len)
+{
+    mbedtls_sha256(image, len - 32, image + len - 32, 0);
+}
+
+// The next build: code inserted in the middle, a word in every thousand bytes recompiled
+static void next_build(void)
+{
+    memcpy(new_image, old_image, INSERT_AT);
+    fill_image(new_image + INSERT_AT, INSERT_SIZE + 32, 99);
+    memcpy(new_image + INSERT_AT + INSERT_SIZE, old_image + INSERT_AT, IMAGE_SIZE - INSERT_AT);
+    for (size_t i = 1000; i < sizeof(new_image) - 32; i += 1000) {
+        new_image[i] ^= 0x5A;
+    }
+    seal_image(new_image, sizeof(new_image));
+}
+
+static bool write_file(const char* path, const uint8_t* data, size_t len)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fwrite(data, 1, len, f) == len;
+    return fclose(f) == 0 && ok;
+}
+
+static bool slot_holds(int slot, const uint8_t* image, size_t len)
+{
+    size_t have;
+    uint8_t* data = host_ota_image(slot, &have);
+    return have == len && memcmp(data, image, len) == 0;
+}
+
+static void test_delta(void)
+{
+    host_ota_reset(old_image, sizeof(old_image), ESP_OTA_IMG_VALID);
+    HOST_CHECK(otaupdate_check(url) == ESP_OK);
+    HOST_CHECK(slot_holds(1, new_image, sizeof(new_image)));
+    otaupdate_stats_t stats;
+    otaupdate_get_stats(&stats);
+    printf("delta update: %lu bytes downloaded for a %lu byte image\n",
+        (unsigned long)stats.last_download_bytes, (unsigned long)stats.last_image_bytes);
+    HOST_CHECK(stats.last_image_bytes == sizeof(new_image));
+    HOST_CHECK(stats.last_download_bytes < sizeof(new_image) / 4);
+
+    // the new image boots on probation and is kept once confirmed
+    host_ota_stats_t ota;
+    host_ota_get_stats(&ota);
+    HOST_CHECK(ota.boot == 1);
+    esp_restart();
+    esp_ota_img_states_t state;
+    HOST_CHECK(esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK);
+    HOST_CHECK(state == ESP_OTA_IMG_PENDING_VERIFY);
+    otaupdate_confirm_boot(true);
+    HOST_CHECK(esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK);
+    HOST_CHECK(state == ESP_OTA_IMG_VALID);
+}
+
+static void test_full(void)
+{
+    host_ota_reset(other_image, sizeof(other_image), ESP_OTA_IMG_VALID);
+    HOST_CHECK(otaupdate_check(url) == ESP_OK);
+    HOST_CHECK(slot_holds(1, new_image, sizeof(new_image)));
+    otaupdate_stats_t stats;
+    otaupdate_get_stats(&stats);
+    printf("full update:  %lu bytes downloaded for a %lu byte image\n",
+        (unsigned long)stats.last_download_bytes, (unsigned long)stats.last_image_bytes);
+}
+
+static void test_up_to_date(void)
+{
+    host_ota_reset(new_image, sizeof(new_image), ESP_OTA_IMG_VALID);
+    HOST_CHECK(otaupdate_check(url) == ESP_ERR_NOT_FOUND);
+    host_ota_stats_t ota;
+    host_ota_get_stats(&ota);
+    HOST_CHECK(ota.begins == 0);
+}
+
+// Running bytes that no longer match their digest rebuild a wrong image:
+// it is caught before the slot is made bootable
+static void test_corrupt_base(void)
+{
+    host_ota_reset(old_image, sizeof(old_image), ESP_OTA_IMG_VALID);
+    size_t len;
+    host_ota_image(0, &len)[INSERT_AT / 2] ^= 0x01;
+    HOST_CHECK(otaupdate_check(url) == ESP_ERR_INVALID_CRC);
+    host_ota_stats_t ota;
+    host_ota_get_stats(&ota);
+    HOST_CHECK(ota.aborts == 1 && ota.boot == 0);
+}
+
+static void test_rollback(void)
+{
+    host_ota_reset(old_image, sizeof(old_image), ESP_OTA_IMG_VALID);
+    HOST_CHECK(otaupdate_check(url) == ESP_OK);
+    esp_restart();
+    otaupdate_confirm_boot(false);
+    host_ota_stats_t ota;
+    host_ota_get_stats(&ota);
+    HOST_CHECK(ota.rollbacks == 1 && ota.running == 0);
+    esp_ota_img_states_t state;
+    HOST_CHECK(esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK);
+    HOST_CHECK(state == ESP_OTA_IMG_VALID);
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    fill_image(old_image, sizeof(old_image), 1);
+    seal_image(old_image, sizeof(old_image));
+    fill_image(other_image, sizeof(other_image), 2);
+    seal_image(other_image, sizeof(other_image));
+    next_build();
+    char old_path[4096];
+    char new_path[4096];
+    HOST_CHECK(write_file("ota_old.bin", old_image, sizeof(old_image)));
+    HOST_CHECK(write_file("ota_new.bin", new_image, sizeof(new_image)));
+    HOST_CHECK(realpath("ota_old.bin", old_path) != NULL && realpath("ota_new.bin", new_path) != NULL);
+
+    host_authserver_set_firmware(new_path, old_path);
+    esp_err_t err = host_authserver_start(HTTP_PORT, NULL, 0);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        printf("SKIP: no python3 to run tools/authserver.py\n");
+        return 77;
+    }
+    HOST_CHECK(err == ESP_OK);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", HTTP_PORT);
+
+    test_delta();
+    test_full();
+    test_up_to_date();
+    test_corrupt_base();
+    test_rollback();
+
+    host_authserver_stop();
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
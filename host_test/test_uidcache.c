@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "authclient.h"
+#include "authorize.h"
+#include "uidcache.h"
+#include "sim.h"
+
+// UID cache: NVS writes leave the tap path, stale entries age out, and the
+// decision latency of authorize_uid on a hit, a miss and a server that is
+// down, against tools/authserver.py.
+
+#define HTTP_PORT       18310
+#define TIMEOUT_MS      500
+#define SAMPLES         12
+#define SILENT_SAMPLES  4           // each waits out real timeouts
+#define WIFI_RTT_US     3000        // added per request: a Wi-Fi hop the loopback lacks
+
+static void make_uid(int i, uint8_t* uid, uint8_t* len)
+{
+    *len = i % 2 ? 7 : 4;
+    uid[0] = 0x04;
+    for (int b = 1; b < *len; b++) {
+        uid[b] = (uint8_t)(i * 53 + b * 7);
+    }
+}
+
+// New entries cost no flash time on the tap path; a burst reaches NVS in one write
+static void test_deferred_save(void)
+{
+    host_nvs_reset();
+    HOST_CHECK(uidcache_init() == ESP_OK);
+    uidcache_flush();
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    host_nvs_stats_t before;
+    host_nvs_get_stats(&before);
+    int64_t slowest = 0;
+    for (int i = 0; i < 10; i++) {
+        uint8_t uid[10];
+        uint8_t len;
+        make_uid(i, uid, &len);
+        int64_t start = esp_timer_get_time();
+        HOST_CHECK(uidcache_insert(uid, len) == ESP_OK);
+        int64_t spent = esp_timer_get_time() - start;
+        slowest = spent > slowest ? spent : slowest;
+    }
+    host_nvs_stats_t stats;
+    host_nvs_get_stats(&stats);
+    HOST_CHECK(stats.writes == before.writes);
+    HOST_CHECK(slowest < HOST_NVS_WRITE_US);
+
+    vTaskDelay(pdMS_TO_TICKS(UIDCACHE_FLUSH_DELAY_MS + 100));
+    host_nvs_get_stats(&stats);
+    printf("10 inserts: slowest %lld us, %lu NVS write(s) after the flush delay\n",
+        (long long)slowest, (unsigned long)(stats.writes - before.writes));
+    HOST_CHECK(stats.writes == before.writes + 1);
+
+    // a revocation is written at once
+    uint8_t uid[10];
+    uint8_t len;
+    make_uid(3, uid, &len);
+    HOST_CHECK(uidcache_remove(uid, len) == ESP_OK);
+    host_nvs_get_stats(&stats);
+    HOST_CHECK(stats.writes == before.writes + 2);
+}
+
+// Entries loaded after a reboot grant while stale, but only for UIDCACHE_MAX_STALE_MS
+static void test_stale_age(void)
+{
+    HOST_CHECK(uidcache_init() == ESP_OK);
+    HOST_CHECK(uidcache_count() == 9);
+    uint8_t uid[10];
+    uint8_t len;
+    make_uid(0, uid, &len);
+    uint8_t other[10];
+    uint8_t other_len;
+    make_uid(1, other, &other_len);
+    HOST_CHECK(uidcache_lookup(uid, len) == UIDCACHE_STALE);
+
+    vTaskDelay(pdMS_TO_TICKS(UIDCACHE_MAX_STALE_MS - UIDCACHE_TTL_MS - 1000));
+    HOST_CHECK(uidcache_lookup(uid, len) == UIDCACHE_STALE);
+    // the server confirmed one of them meanwhile
+    HOST_CHECK(uidcache_insert(other, other_len) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    HOST_CHECK(uidcache_lookup(uid, len) == UIDCACHE_MISS);
+    HOST_CHECK(uidcache_lookup(other, other_len) == UIDCACHE_FRESH);
+
+    uidcache_expire_all();
+    HOST_CHECK(uidcache_lookup(other, other_len) == UIDCACHE_STALE);
+    uidcache_flush();
+}
+
+// A server answer that raced a revoke is not cached, whichever runs first
+static void test_insert_after_revoke(void)
+{
+    uint8_t uid[10];
+    uint8_t len;
+    make_uid(5, uid, &len);
+    uint32_t generation = uidcache_generation();
+    // pushed while the server was answering
+    HOST_CHECK(uidcache_remove(uid, len) == ESP_OK);
+    HOST_CHECK(uidcache_insert_if(uid, len, generation) == ESP_ERR_INVALID_STATE);
+    HOST_CHECK(uidcache_lookup(uid, len) == UIDCACHE_MISS);
+
+    generation = uidcache_generation();
+    HOST_CHECK(uidcache_insert_if(uid, len, generation) == ESP_OK);
+    HOST_CHECK(uidcache_lookup(uid, len) == UIDCACHE_FRESH);
+    uidcache_flush();
+}
+
+// authorize_uid of main/authorize.c, before the offline database has synced
+static bool decide(int i, uint32_t* latency_us)
+{
+    uint8_t uid[10];
+    uint8_t len;
+    char hex[24];
+    make_uid(i, uid, &len);
+    uid_to_hex_string(uid, len, hex);
+
+    auditlog_source_t source;
+    int64_t start = esp_timer_get_time();
+    bool allowed = authorize_uid(uid, len, hex, &source);
+    *latency_us = (uint32_t)(esp_timer_get_time() - start);
+    return allowed;
+}
+
+// The simulation charges no CPU time, so a hit decides in 0 us: it never
+// waits for the network or flash
+static host_percentiles_t run(const char* name, int first, int count, bool expect)
+{
+    uint32_t samples[SAMPLES];
+    for (int i = 0; i < count; i++) {
+        HOST_CHECK(decide(first + i, &samples[i]) == expect);
+        vTaskDelay(pdMS_TO_TICKS(200));
+    }
+    host_percentiles_t p;
+    host_percentiles(samples, count, &p);
+    printf("  %-28s p50 %9.3f ms  p99 %9.3f ms\n", name, p.p50 / 1000.0, p.p99 / 1000.0);
+    return p;
+}
+
+static int test_decision_latency(void)
+{
+    // cards 0..SAMPLES-1 are allowed, SAMPLES.. are not
+    char hex[SAMPLES][24];
+    const char* allow[SAMPLES];
+    for (int i = 0; i < SAMPLES; i++) {
+        uint8_t uid[10];
+        uint8_t len;
+        make_uid(i, uid, &len);
+        uid_to_hex_string(uid, len, hex[i]);
+        allow[i] = hex[i];
+    }
+    esp_err_t err = host_authserver_start(HTTP_PORT, allow, SAMPLES);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        printf("SKIP: no python3 to run tools/authserver.py\n");
+        return 77;
+    }
+    HOST_CHECK(err == ESP_OK);
+    host_http_set_extra_rtt_us(WIFI_RTT_US);
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", HTTP_PORT);
+    HOST_CHECK(authclient_init(url, TIMEOUT_MS, NULL) == ESP_OK);
+    HOST_CHECK(authorize_init(false) == ESP_OK);
+    authclient_prewarm();
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    printf("authorization decision (+%d us RTT, %d ms timeout):\n", WIFI_RTT_US, TIMEOUT_MS);
+    host_percentiles_t miss = run("miss, server allows", 0, SAMPLES, true);
+    host_percentiles_t denied = run("miss, server denies", SAMPLES, SAMPLES, false);
+    host_percentiles_t hit = run("hit", 0, SAMPLES, true);
+    // no link: unknown cards are refused without waiting for a timeout
+    host_wifi_set_connected(false);
+    host_percentiles_t offline = run("miss, offline", 4 * SAMPLES, SAMPLES, false);
+    host_wifi_set_connected(true);
+    // only 403 and 404 deny; a 400 is no decision about the card
+    HOST_CHECK(authclient_check_uid(hex[SAMPLES - 1], NULL) == ESP_OK);
+    HOST_CHECK(authclient_check_uid("04ZZ", NULL) == ESP_FAIL);
+    HOST_CHECK(authclient_check_uid("04FFFFFF", NULL) == ESP_ERR_NOT_FOUND);
+
+    host_authserver_stop();
+    host_percentiles_t hit_down = run("hit, server down", 0, SAMPLES, true);
+    host_percentiles_t refused = run("miss, connection refused", 2 * SAMPLES, SAMPLES, false);
+    HOST_CHECK(host_blackhole_start(HTTP_PORT) == ESP_OK);
+    host_percentiles_t silent = run("miss, server not answering", 3 * SAMPLES, SILENT_SAMPLES, false);
+    host_blackhole_stop();
+
+    HOST_CHECK(hit.p99 < 1000 && hit_down.p99 < 1000 && offline.p99 < 1000);
+    HOST_CHECK(miss.p50 > WIFI_RTT_US && miss.p50 < 50 * 1000);
+    HOST_CHECK(denied.p50 < 50 * 1000);
+    HOST_CHECK(refused.p99 < 50 * 1000);
+    // one attempt and the reconnect, each a connect and a read bounded by the timeout
+    HOST_CHECK(silent.p50 >= TIMEOUT_MS * 1000);
+    HOST_CHECK(silent.max < AUTHCLIENT_MAX_ATTEMPTS * 2 * (TIMEOUT_MS + 100) * 1000);
+    return 0;
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    test_deferred_save();
+    test_stale_age();
+    test_insert_after_revoke();
+    int ret = test_decision_latency();
+    if (ret != 0) {
+        return ret;
+    }
+    printf("%s\n", host_failures == 0 ? "PASS" : "FAILED");
+    return host_failures == 0 ? 0 : 1;
+}
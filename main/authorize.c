@@ -0,0 +1,121 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "accessdb.h"
+#include "authclient.h"
+#include "dlog.h"
+#include "uidcache.h"
+#include "wificonnection.h"
+#include "authorize.h"
+
+static const char* TAG = "AUTHORIZE";
+
+static QueueHandle_t revalidate_queue;
+static bool use_binary_auth = false;
+
+
+// Server lookup over whichever protocol is configured
+static esp_err_t ask_server(const uint8_t* uid, uint8_t uid_size, const char* uid_hex) {
+#if CONFIG_DOOR_AUTH_BINARY
+    if (use_binary_auth) {
+        return authclient_udp_check_uid(uid, uid_size, NULL);
+    }
+#endif
+    return authclient_check_uid(uid_hex, NULL);
+}
+
+// Background revalidation of cached UIDs, so a cache hit never waits on the server
+static void revalidate_task(void* arg) {
+    revalidate_request_t req;
+    while (1) {
+        if (xQueueReceive(revalidate_queue, &req, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        char uid_hex[32];
+        uid_to_hex_string(req.uid, req.uid_size, uid_hex);
+
+        uint32_t generation = uidcache_generation();
+        esp_err_t err = ask_server(req.uid, req.uid_size, uid_hex);
+        if (err == ESP_OK) {
+            uidcache_insert_if(req.uid, req.uid_size, generation);
+        }
+        else if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGI(TAG, "UID %s revoked, removing from cache", uid_hex);
+            uidcache_remove(req.uid, req.uid_size);
+        }
+        // server unreachable: keep the entry, it will be retried on the next tap
+    }
+}
+
+esp_err_t authorize_init(bool binary_auth) {
+    use_binary_auth = binary_auth;
+    revalidate_queue = xQueueCreate(REVALIDATE_QUEUE_LEN, sizeof(revalidate_request_t));
+    if (revalidate_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(revalidate_task, "revalidate", 4096, NULL, 5, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Decide locally if possible; only a cache miss waits for the server
+bool authorize_uid(uint8_t* uid, uint8_t uid_size, const char* uid_hex, auditlog_source_t* source) {
+    int64_t start = esp_timer_get_time();
+
+    // a synced offline database is authoritative, no server round trip
+    if (accessdb_is_ready()) {
+        *source = AUDITLOG_SOURCE_ACCESSDB;
+        bool allowed = accessdb_lookup(uid, uid_size);
+        DLOGI(TAG, "Offline database decision in %lu us", (uint32_t)(esp_timer_get_time() - start));
+        return allowed;
+    }
+
+    uidcache_result_t cached = uidcache_lookup(uid, uid_size);
+
+    if (cached != UIDCACHE_MISS) {
+        *source = AUDITLOG_SOURCE_CACHE;
+        if (cached == UIDCACHE_STALE && wifi_is_connected()) {
+            revalidate_request_t req = { .uid_size = uid_size };
+            memcpy(req.uid, uid, uid_size);
+            xQueueSend(revalidate_queue, &req, 0);
+        }
+        if (cached == UIDCACHE_FRESH) {
+            DLOGI(TAG, "Cache hit (fresh) in %lu us", (uint32_t)(esp_timer_get_time() - start));
+        }
+        else {
+            DLOGI(TAG, "Cache hit (stale) in %lu us", (uint32_t)(esp_timer_get_time() - start));
+        }
+        return true;
+    }
+
+    // offline: no point waiting for a timeout, unknown cards are refused
+    if (!wifi_is_connected()) {
+        *source = AUDITLOG_SOURCE_OFFLINE;
+        DLOGW(TAG, "Offline, unknown UID denied");
+        return false;
+    }
+
+    *source = AUDITLOG_SOURCE_SERVER;
+    // a revoke pushed while the server answers wins over the answer
+    uint32_t generation = uidcache_generation();
+    esp_err_t err = ask_server(uid, uid_size, uid_hex);
+    if (err == ESP_OK) {
+        uidcache_insert_if(uid, uid_size, generation);
+    }
+    DLOGI(TAG, "Cache miss, server decision in %lu us", (uint32_t)(esp_timer_get_time() - start));
+    return err == ESP_OK;
+}
+
+void uid_to_hex_string(uint8_t* uid, uint8_t uid_size, char* hex_string) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 0; i < uid_size; i++) {
+        hex_string[i * 2] = digits[uid[i] >> 4];
+        hex_string[i * 2 + 1] = digits[uid[i] & 0x0F];
+    }
+    hex_string[uid_size * 2] = '\0';
+}
@@ -0,0 +1,24 @@
+#ifndef AUTHORIZE_H
+#define AUTHORIZE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "auditlog.h"
+
+#define REVALIDATE_QUEUE_LEN    8
+
+typedef struct {
+    uint8_t uid[10];
+    uint8_t uid_size;
+} revalidate_request_t;
+
+// Starts background revalidation of stale cache entries; binary_auth asks the
+// server over authclient_udp instead of HTTP
+esp_err_t authorize_init(bool binary_auth);
+// pipeline_authorize_fn of the door: offline database, UID cache, then server
+bool authorize_uid(uint8_t* uid, uint8_t uid_size, const char* uid_hex, auditlog_source_t* source);
+
+void uid_to_hex_string(uint8_t* uid, uint8_t uid_size, char* hex_string);
+
+#endif
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boottrace.h"
+
+/** TYPES **/
+
+typedef struct {
+    const char* stage;
+    int64_t at_us;
+} boottrace_mark_t;
+
+/** GLOBALS **/
+
+// marks come from app_main and the hardware bring-up task at the same time
+static boottrace_mark_t marks[BOOTTRACE_MAX_MARKS];
+static uint32_t mark_count;
+static int64_t first_scan_us;
+
+static const char* TAG = "BOOT";
+
+/** FUNCTIONS **/
+
+void boottrace_mark(const char* stage)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t slot = __atomic_fetch_add(&mark_count, 1, __ATOMIC_RELAXED);
+    if (slot < BOOTTRACE_MAX_MARKS) {
+        marks[slot].at_us = now;
+        marks[slot].stage = stage;
+    }
+}
+
+// Called by the reader task after each pass over the readers; reports the
+// boot trace once, after the first one
+void boottrace_first_scan(void)
+{
+    if (first_scan_us != 0) {
+        return;
+    }
+    first_scan_us = esp_timer_get_time();
+
+    uint32_t count = mark_count < BOOTTRACE_MAX_MARKS ? mark_count : BOOTTRACE_MAX_MARKS;
+    for (uint32_t i = 0; i < count; i++) {
+        if (marks[i].stage != NULL) {
+            ESP_LOGI(TAG, "%-10s %6lld us", marks[i].stage, marks[i].at_us);
+        }
+    }
+    ESP_LOGI(TAG, "time-to-first-scan %lld us", first_scan_us);
+}
@@ -0,0 +1,13 @@
+#ifndef BOOTTRACE_H
+#define BOOTTRACE_H
+
+#include <stdint.h>
+
+// Boot milestones, in microseconds of esp_timer time (starts with the app,
+// after ROM and bootloader)
+void boottrace_mark(const char* stage);
+void boottrace_first_scan(void);
+
+#define BOOTTRACE_MAX_MARKS     12
+
+#endif
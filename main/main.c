@@ -1,55 +1,279 @@
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
 #include "mfrc522.h"
 #include "driver/ledc.h"
 #include "esp_err.h"
 #include "servo.h"
 #include "wificonnection.h"
 #include "main.h"
-#include "esp_http_client.h"
+#include "authorize.h"
 #include "cJSON.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "uidcache.h"
+#include "accessdb.h"
+#include "authclient.h"
+#include "pipeline.h"
+#include "metrics.h"
+#include "doorconfig.h"
+#include "auditlog.h"
+#include "pollsched.h"
+#include "cardcred.h"
+#include "boottrace.h"
+#include "dlog.h"
+#include "otaupdate.h"
+#include "pushchannel.h"
+#include "esp_system.h"
+#include "esp_mac.h"
 
 static const char* TAG = "MAIN";
 
+static bool sync_started = false;
+static volatile bool storage_ready = false;
+static door_config_t config;
+static bool use_binary_auth = false;
+static door_tls_t tls;
+static char push_client_id[20];
 
-esp_err_t http_get_uid(const char* uid) {
-    char url[128];
-    sprintf(url, "http://192.168.1.139:8000/uid/%s", uid);
+// filled by hardware_init_task while app_main brings up storage and network
+static pipeline_config_t pipeline;
+static EventGroupHandle_t boot_events;
+static esp_err_t hardware_err;
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_GET,
+// entry reader first; its index is what the audit log records
+static const struct {
+    int cs_pin;
+    int irq_pin;
+} reader_pins[] = {
+    { MFRC522_CS_PIN, MFRC522_IRQ_PIN },
+#if CONFIG_DOOR_EXIT_READER
+    { MFRC522_EXIT_CS_PIN, MFRC522_EXIT_IRQ_PIN },
+#endif
+};
+
+
+// Server-pushed changes, applied on the MQTT task as they arrive
+static void on_push_event(const push_event_t* event, void* arg) {
+    esp_err_t err;
+    switch (event->type) {
+    case PUSH_EVENT_GRANT:
+        // the cache only holds UIDs seen at this door, a newly allowed one is a miss anyway
+        err = accessdb_apply(event->uid, event->uid_len, true, event->db_version);
+        if (err == ESP_ERR_NO_MEM) {
+            accessdb_request_sync();
+        }
+        break;
+    case PUSH_EVENT_REVOKE:
+        err = accessdb_apply(event->uid, event->uid_len, false, event->db_version);
+        if (err == ESP_ERR_INVALID_VERSION) {
+            break;      // older than what the door already has
+        }
+        if (err == ESP_ERR_NO_MEM) {
+            accessdb_request_sync();
+        }
+        uidcache_remove(event->uid, event->uid_len);
+        break;
+    case PUSH_EVENT_FLUSH:
+        // pushed revocations stay in effect until the sync replaces them
+        uidcache_flush();
+        accessdb_request_sync();
+        break;
+    case PUSH_EVENT_RESYNC:
+        // revocations may have been missed: recheck everything, then trust the channel
+        uidcache_expire_all();
+        accessdb_request_sync();
+        uidcache_set_ttl(UIDCACHE_PUSH_TTL_MS);
+        accessdb_set_sync_interval(ACCESSDB_PUSH_SYNC_INTERVAL_MS);
+        break;
+    case PUSH_EVENT_LOST:
+        uidcache_set_ttl(UIDCACHE_TTL_MS);
+        accessdb_set_sync_interval(ACCESSDB_SYNC_INTERVAL_MS);
+        break;
+    }
+}
+
+static void start_push_channel(void) {
+    if (config.push_url[0] == '\0') {
+        return;
+    }
+    if (config.auth_key[0] == '\0') {
+        ESP_LOGW(TAG, "No auth_key configured, push channel disabled");
+        return;
+    }
+
+    // the broker drops a session when another one logs in with the same id
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(push_client_id, sizeof(push_client_id), "door-%02x%02x%02x%02x%02x%02x",
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    pushchannel_config_t push = {
+        .broker_url = config.push_url,
+        .client_id = push_client_id,
+        .key = (const uint8_t*)config.auth_key,
+        .key_len = strlen(config.auth_key),
+        .ca_pem = tls.ca_pem,
+        .client_cert_pem = tls.client_cert_pem,
+        .client_key_pem = tls.client_key_pem,
+        .cb = on_push_event,
     };
+    esp_err_t ret = pushchannel_start(&push);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Push channel unavailable: %s", esp_err_to_name(ret));
+    }
+}
+
+// Runs on the event loop task whenever the Wi-Fi link changes
+// Also called from app_main if the link came up before storage was ready.
+static void on_link_change(bool up, void* arg) {
+    if (!up || !storage_ready) {
+        return;
+    }
+    // first time online, fetch the offline database
+    if (!__atomic_test_and_set(&sync_started, __ATOMIC_ACQ_REL)
+        && accessdb_start_sync_task(config.server_url) != ESP_OK) {
+        __atomic_clear(&sync_started, __ATOMIC_RELEASE);
+    }
+    if (!use_binary_auth) {
+        // have the TLS session ready before the first tap
+        authclient_prewarm();
+    }
+}
 
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_err_t err = esp_http_client_perform(client);
-    if (err == ESP_OK) {
-        int status = esp_http_client_get_status_code(client);
-        ESP_LOGI("HTTP", "Status = %d", status);
+// Provisioning endpoint: "key=value" lines, one per setting. Replies "ok" or
+// the first key that was rejected.
+static esp_err_t config_endpoint_handler(uint32_t session_id, const uint8_t* inbuf, ssize_t inlen,
+    uint8_t** outbuf, ssize_t* outlen, void* priv_data) {
+    char request[256];
+    char reply[64] = "ok";
+    if (inbuf == NULL || inlen <= 0 || inlen >= (ssize_t)sizeof(request)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(request, inbuf, inlen);
+    request[inlen] = '\0';
 
-        if (status == 200) {
-            return ESP_OK;
+    char* save = NULL;
+    for (char* line = strtok_r(request, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        char* eq = strchr(line, '=');
+        if (eq == NULL) {
+            continue;
         }
-        else {
-            ESP_LOGW("HTTP", "Server returned status %d", status);
-            esp_http_client_cleanup(client);
-            return ESP_FAIL;
+        *eq = '\0';
+        if (doorconfig_set(&config, line, eq + 1) != ESP_OK) {
+            snprintf(reply, sizeof(reply), "rejected %s", line);
+            break;
         }
     }
-    else {
-        ESP_LOGE("HTTP", "HTTP GET failed: %s", esp_err_to_name(err));
+    if (strcmp(reply, "ok") == 0 && doorconfig_save(&config) != ESP_OK) {
+        strlcpy(reply, "save failed", sizeof(reply));
     }
 
+    // protocomm frees the reply
+    *outbuf = (uint8_t*)strdup(reply);
+    if (*outbuf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    *outlen = strlen(reply) + 1;
+    return ESP_OK;
+}
+
+// Credentials confirmed by the provisioning session; reboot into normal operation
+static void on_provisioned(const char* ssid, const char* password, void* arg) {
+    doorconfig_set(&config, "ssid", ssid);
+    doorconfig_set(&config, "password", password);
+    esp_err_t err = doorconfig_save(&config);
+    ESP_LOGI(TAG, "Provisioned for %s (%s), restarting", ssid, esp_err_to_name(err));
+    esp_restart();
+}
+
+static esp_err_t start_network(void) {
+    if (doorconfig_has_credentials(&config)) {
+        return wifi_manager_start(config.ssid, config.password);
+    }
+
+    uint8_t mac[6];
+    char service_name[16];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(service_name, sizeof(service_name), "DOOR_%02X%02X%02X", mac[3], mac[4], mac[5]);
+    wifi_provision_config_t prov = {
+        .service_name = service_name,
+        .pop = CONFIG_DOOR_PROV_POP,
+        .endpoint = PROV_CONFIG_ENDPOINT,
+        .endpoint_handler = config_endpoint_handler,
+        .done = on_provisioned,
+    };
+    return wifi_provision_start(&prov);
+}
+
+// Label of this door's metrics: provisioned, or unique from the MAC
+static void set_door_id(void) {
+    if (config.door_id[0] != '\0' && metrics_init(config.door_id) == ESP_OK) {
+        return;
+    }
+    if (config.door_id[0] != '\0') {
+        ESP_LOGW(TAG, "Unusable door_id \"%s\", naming the door after its MAC", config.door_id);
+    }
+    uint8_t mac[6];
+    char door_id[DOORCONFIG_ID_LEN];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(door_id, sizeof(door_id), "door-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    metrics_init(door_id);
+}
 
-    esp_http_client_cleanup(client);
-    return 0;
+// Firmware updates restart the door only between door cycles
+static bool door_idle(void) {
+    return !servo_is_busy();
 }
+
+// Readers and servo, on the reader core while app_main does storage and network
+static void hardware_init_task(void* arg) {
+    printf("Initializing RC522 RFID reader...\n");
+
+    for (size_t i = 0; i < sizeof(reader_pins) / sizeof(reader_pins[0]); i++) {
+        mfrc522_config_t reader_config = {
+            .host = MFRC522_SPI_HOST,
+            .sclk_pin = MFRC522_SCLK_PIN,
+            .mosi_pin = MFRC522_MOSI_PIN,
+            .miso_pin = MFRC522_MISO_PIN,
+            .cs_pin = reader_pins[i].cs_pin,
+            .rst_pin = MFRC522_RST_PIN,
+        };
+        mfrc522_t* reader;
+        esp_err_t ret = mfrc522_new(&reader_config, &reader);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "RC522 reader %d unavailable: %s", (int)i, esp_err_to_name(ret));
+            continue;
+        }
+        if (mfrc522_enable_irq(reader, reader_pins[i].irq_pin) != ESP_OK) {
+            ESP_LOGW(TAG, "RC522 reader %d IRQ unavailable, polling instead", (int)i);
+        }
+        pipeline.readers[pipeline.reader_count++] = reader;
+    }
+    boottrace_mark("readers");
+
+    hardware_err = servo_init();
+    if (hardware_err != ESP_OK) {
+        printf("Servo initialization failed: %s\n", esp_err_to_name(hardware_err));
+    }
+    boottrace_mark("servo");
+
+    xEventGroupSetBits(boot_events, BOOT_HARDWARE_READY);
+    vTaskDelete(NULL);
+}
+
 void app_main(void)
 {
-    esp_err_t status = WIFI_FAILURE;
+    boottrace_mark("app_main");
+    dlog_init();
+
+    boot_events = xEventGroupCreate();
+    xTaskCreatePinnedToCore(hardware_init_task, "hwinit", 4096, NULL, PIPELINE_READER_PRIORITY, NULL,
+        PIPELINE_READER_CORE);
 
     //initialize storage
     esp_err_t ret = nvs_flash_init();
@@ -59,49 +283,108 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    status = connect_wifi();
-    if (WIFI_SUCCESS != status)
-    {
-        ESP_LOGI(TAG, "Failed to associate to AP, dying...");
-        return;
+    ret = doorconfig_load(&config);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Stored configuration unreadable, using defaults: %s", esp_err_to_name(ret));
     }
 
-    printf("Initializing RC522 RFID reader...\n");
+    set_door_id();
 
-    mfrc522_start(MFRC522_CS_PIN, MFRC522_RST_PIN);
-    esp_err_t rett = servo_init();
-    if (rett != ESP_OK) {
-        printf("Servo initialization failed: %s\n", esp_err_to_name(rett));
-        return;
+    ret = doorconfig_load_tls(&tls);
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "TLS credentials unreadable: %s", esp_err_to_name(ret));
     }
-    while (1) {
-        uint8_t uid[10];
-        uint8_t uid_size = 0;
-        if (mfrc522_get_uid(uid, &uid_size)) {
-            if (uid_size > 0) {
-                char uid_hex[32];
-                uid_to_hex_string(uid, uid_size, uid_hex);
-
-                printf("Card detected! UID: %s\n", uid_hex);
-
-                if (http_get_uid(uid_hex) == ESP_OK) {
-                    printf("Access granted!\n");
-                    servo_set_angle(180);
-                    vTaskDelay(pdMS_TO_TICKS(2000));
-                    servo_set_angle(0);
-                }
-                else {
-                    printf("Access denied!\n");
-                }
-            }
+    boottrace_mark("config");
+
+    // association runs in the background from here on; the door works from
+    // the local database and cache until the link is up
+    wifi_register_link_cb(on_link_change, NULL);
+    ESP_ERROR_CHECK(start_network());
+    // audit records and pushed events need wall-clock time
+    if (wifi_time_sync_start(CONFIG_DOOR_SNTP_SERVER) != ESP_OK) {
+        ESP_LOGW(TAG, "SNTP unavailable, audit times are relative to boot");
+    }
+    boottrace_mark("network");
+
+    // sync and audit uploads use the same server credentials
+    authclient_tls_t server_tls = {
+        .ca_pem = tls.ca_pem,
+        .client_cert_pem = tls.client_cert_pem,
+        .client_key_pem = tls.client_key_pem,
+    };
+    ESP_ERROR_CHECK(authclient_init(config.server_url, config.http_timeout_ms, &server_tls));
+#if CONFIG_DOOR_AUTH_BINARY
+    if (config.auth_key[0] != '\0') {
+        ret = authclient_udp_init(config.server_url, CONFIG_DOOR_AUTH_UDP_PORT,
+            (const uint8_t*)config.auth_key, strlen(config.auth_key));
+        use_binary_auth = ret == ESP_OK;
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Binary protocol unavailable, using HTTP: %s", esp_err_to_name(ret));
         }
-        vTaskDelay(pdMS_TO_TICKS(500));
     }
-}
+    else {
+        ESP_LOGW(TAG, "No auth_key configured, using HTTP");
+    }
+#endif
+
+    ret = uidcache_init();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "UID cache load failed: %s", esp_err_to_name(ret));
+    }
+    ret = accessdb_init();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Access database unavailable: %s", esp_err_to_name(ret));
+    }
+    ret = auditlog_init(config.server_url);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Audit log unavailable: %s", esp_err_to_name(ret));
+    }
+    ret = authorize_init(use_binary_auth);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Cache revalidation unavailable: %s", esp_err_to_name(ret));
+    }
+    boottrace_mark("storage");
+
+    // a link that came up while storage was loading was ignored, catch up
+    storage_ready = true;
+    on_link_change(wifi_is_connected(), NULL);
+    start_push_channel();
 
-void uid_to_hex_string(uint8_t* uid, uint8_t uid_size, char* hex_string) {
-    for (int i = 0; i < uid_size; i++) {
-        sprintf(hex_string + (i * 2), "%02X", uid[i]);
+#if CONFIG_DOOR_CARD_CREDENTIAL
+    if (config.card_key[0] != '\0') {
+        ret = cardcred_init((const uint8_t*)config.card_key, strlen(config.card_key), CONFIG_DOOR_CARD_SECTOR);
+        pipeline.require_credential = ret == ESP_OK;
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Card credentials unavailable: %s", esp_err_to_name(ret));
+        }
+    }
+    else {
+        ESP_LOGW(TAG, "No card_key configured, authorizing on UID only");
+    }
+#endif
+
+    xEventGroupWaitBits(boot_events, BOOT_HARDWARE_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    bool door_ok = hardware_err == ESP_OK;
+    if (door_ok) {
+        pollsched_configure(config.poll_fast_ms, config.poll_max_ms);
+        pipeline.authorize = authorize_uid;
+        ret = pipeline_start(&pipeline);
+        door_ok = ret == ESP_OK;
+        if (!door_ok) {
+            // e.g. no RC522 answered
+            ESP_LOGE(TAG, "Door pipeline not started: %s", esp_err_to_name(ret));
+        }
+    }
+    boottrace_mark("pipeline");
+    // a freshly updated image that cannot drive the door goes back; a
+    // confirmed one keeps the network, push and updates up so a fix can arrive
+    otaupdate_confirm_boot(door_ok);
+
+    // not needed for the first tap
+    if (metrics_start_server(METRICS_HTTP_PORT) != ESP_OK) {
+        ESP_LOGW(TAG, "Metrics endpoint unavailable");
+    }
+    if (otaupdate_start_task(config.server_url, door_idle) != ESP_OK) {
+        ESP_LOGW(TAG, "Firmware updates unavailable");
     }
-    hex_string[uid_size * 2] = '\0';
 }
@@ -1,9 +1,17 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#define MFRC522_RST_PIN 5
-#define MFRC522_CS_PIN  22
+#define MFRC522_SPI_HOST    SPI2_HOST
+#define MFRC522_SCLK_PIN    18
+#define MFRC522_MOSI_PIN    23
+#define MFRC522_MISO_PIN    19
+#define MFRC522_RST_PIN     5       // shared by all readers
+#define MFRC522_CS_PIN      22
+#define MFRC522_IRQ_PIN     4
+#define MFRC522_EXIT_CS_PIN     25  // second reader on the same bus
+#define MFRC522_EXIT_IRQ_PIN    26
 
+#define PROV_CONFIG_ENDPOINT    "door-config"   // provisioning endpoint for door_config_t fields
+#define BOOT_HARDWARE_READY     (1 << 0)   // readers and servo initialized
 
-void uid_to_hex_string(uint8_t* uid, uint8_t uid_size, char* hex_string);
 #endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "mfrc522.h"
+#include "servo.h"
+#include "authorize.h"
+#include "pipeline.h"
+#include "pollsched.h"
+#include "tapfilter.h"
+#include "boottrace.h"
+#include "dlog.h"
+
+/** GLOBALS **/
+
+static QueueHandle_t scan_queue;       // reader -> auth
+static QueueHandle_t actuate_queue;    // auth -> actuator
+static pipeline_config_t cfg;
+static pipeline_stats_t stats;
+
+static const char* TAG = "PIPELINE";
+
+/** FUNCTIONS **/
+
+static void record_latency(pipeline_stage_stats_t* stage, int64_t since_us)
+{
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - since_us);
+    stage->processed++;
+    stage->last_latency_us = latency;
+    stage->total_latency_us += latency;
+    if (latency > stage->max_latency_us) {
+        stage->max_latency_us = latency;
+    }
+}
+
+// Hand an event to the next stage without ever blocking the current one
+static bool forward(QueueHandle_t queue, const access_event_t* event,
+    pipeline_stage_stats_t* from, pipeline_stage_stats_t* to)
+{
+    if (xQueueSend(queue, event, 0) != pdTRUE) {
+        from->dropped++;
+        return false;
+    }
+    uint32_t depth = uxQueueMessagesWaiting(queue);
+    if (depth > to->max_queue_depth) {
+        to->max_queue_depth = depth;
+    }
+    return true;
+}
+
+// Poll one reader; returns whether a new card arrived. A card left on the
+// reader is only checked for presence, it is not read or authorized again.
+static bool scan_reader(uint8_t index)
+{
+    mfrc522_t* reader = cfg.readers[index];
+    access_event_t event = { .reader = index };
+    mfrc522_uid_t card;
+    int64_t start = esp_timer_get_time();
+    mfrc522_presence_t presence = mfrc522_poll_card(reader, &card);
+    if (presence == MFRC522_CARD_DEPARTED) {
+        DLOGD(TAG, "Card removed from reader %u", index);
+        stats.reader_departures[index]++;
+    }
+    if (presence != MFRC522_CARD_ARRIVED || card.size == 0) {
+        return false;
+    }
+    event.uid_size = card.size;
+    memcpy(event.uid, card.bytes, card.size);
+    event.detected_us = esp_timer_get_time();
+    record_latency(&stats.reader, start);
+
+    // held badges and repeated taps never reach the server
+    bool pass = tapfilter_check(event.uid, event.uid_size) == TAPFILTER_PASS;
+
+    // the credential is read while the card is still selected; either way it ends halted
+    if (pass && cfg.require_credential) {
+        event.credential = cardcred_verify(reader, &card, NULL);
+    }
+    else {
+        mfrc522_halt(reader);
+    }
+
+    if (pass) {
+        DLOG_HEX(DLOG_INFO, TAG, event.uid, event.uid_size, "Card %s detected on reader %u (read in %lu us)",
+            index, stats.reader.last_latency_us);
+
+        stats.reader_taps[index]++;
+        if (!forward(scan_queue, &event, &stats.reader, &stats.auth)) {
+            tapfilter_abort(event.uid, event.uid_size);
+        }
+    }
+    return true;
+}
+
+// Scans continuously, even while a lookup or a door cycle is in progress.
+// Every reader is polled once per interval: an empty field costs one REQA
+// timeout (well under a millisecond), so more readers barely add latency.
+static void reader_task(void* arg)
+{
+    uint8_t first = 0;
+    pollsched_init(cfg.readers, cfg.reader_count);
+    while (1) {
+        pollsched_wake();
+        int64_t cycle_start = esp_timer_get_time();
+        bool card_seen = false;
+        // rotate the starting reader so none is always served last
+        for (uint8_t n = 0; n < cfg.reader_count; n++) {
+            card_seen |= scan_reader((first + n) % cfg.reader_count);
+        }
+        first = (first + 1) % cfg.reader_count;
+        metrics_observe(METRIC_POLL_CYCLE, (uint32_t)(esp_timer_get_time() - cycle_start));
+        boottrace_first_scan();
+        vTaskDelay(pdMS_TO_TICKS(pollsched_sleep(card_seen)));
+    }
+}
+
+static void auth_task(void* arg)
+{
+    access_event_t event;
+    while (1) {
+        if (xQueueReceive(scan_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        char uid_hex[32];
+        uid_to_hex_string(event.uid, event.uid_size, uid_hex);
+
+        auditlog_source_t source = AUDITLOG_SOURCE_SERVER;
+        bool granted;
+        if (cfg.require_credential && event.credential != CARDCRED_VALID) {
+            // a cloned UID without the signed sector stops here
+            DLOG_HEX(DLOG_WARN, TAG, event.uid, event.uid_size, "UID %s has no valid card credential (%d)",
+                event.credential);
+            source = AUDITLOG_SOURCE_CREDENTIAL;
+            granted = false;
+        }
+        else {
+            granted = cfg.authorize(event.uid, event.uid_size, uid_hex, &source);
+        }
+        event.decided_us = esp_timer_get_time();
+        record_latency(&stats.auth, event.detected_us);
+        tapfilter_complete(event.uid, event.uid_size, granted);
+        auditlog_append(event.uid, event.uid_size, granted, source, stats.auth.last_latency_us, event.reader);
+
+        if (granted) {
+            DLOG_HEX(DLOG_INFO, TAG, event.uid, event.uid_size, "UID %s granted in %lu us",
+                stats.auth.last_latency_us);
+            forward(actuate_queue, &event, &stats.auth, &stats.actuator);
+        }
+        else {
+            DLOG_HEX(DLOG_INFO, TAG, event.uid, event.uid_size, "UID %s denied in %lu us",
+                stats.auth.last_latency_us);
+        }
+    }
+}
+
+// Runs on the esp_timer task once the door has swung shut
+static void door_closed(void* arg)
+{
+    tapfilter_stats_t filter;
+    tapfilter_get_stats(&filter);
+    DLOGI(TAG, "Door closed; taps passed %lu, suppressed %lu, coalesced %lu, rate limited %lu",
+        filter.passed, filter.suppressed, filter.coalesced, filter.rate_limited);
+
+    // DLOG takes up to DLOG_MAX_ARGS values a line
+    for (uint8_t i = 0; i < cfg.reader_count; i++) {
+        mfrc522_stats_t rs;
+        mfrc522_get_stats(cfg.readers[i], &rs);
+        DLOGI(TAG, "Reader %u: %lu taps, %lu reads, %lu collisions", i, stats.reader_taps[i], rs.reads,
+            rs.collisions);
+        DLOGI(TAG, "Reader %u: read %lu us avg / %lu us max", i,
+            rs.reads ? (uint32_t)(rs.total_read_us / rs.reads) : 0, rs.max_read_us);
+        DLOGI(TAG, "Reader %u: %lu departures, %lu presence checks", i, rs.departures, rs.presence_checks);
+    }
+}
+
+// Starts a door cycle; a grant arriving mid-cycle just extends the hold.
+// The servo runs the cycle on its own timers, so this never blocks.
+static void actuator_task(void* arg)
+{
+    access_event_t event;
+    while (1) {
+        if (xQueueReceive(actuate_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        servo_open_for(PIPELINE_DOOR_OPEN_MS, door_closed, NULL);
+        record_latency(&stats.actuator, event.detected_us);
+        metrics_observe(METRIC_UNLOCK, stats.actuator.last_latency_us);
+
+        DLOGI(TAG, "tap-to-unlock %lu us (avg %lu, max %lu), auth %lu us", stats.actuator.last_latency_us,
+            (uint32_t)(stats.actuator.total_latency_us / stats.actuator.processed),
+            stats.actuator.max_latency_us, stats.auth.last_latency_us);
+        DLOGI(TAG, "max depth scan %lu / actuate %lu, dropped %lu", stats.auth.max_queue_depth,
+            stats.actuator.max_queue_depth, stats.reader.dropped + stats.auth.dropped);
+    }
+}
+
+esp_err_t pipeline_start(const pipeline_config_t* config)
+{
+    if (config->reader_count == 0 || config->reader_count > PIPELINE_MAX_READERS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cfg = *config;
+
+    esp_err_t err = tapfilter_init();
+    if (err != ESP_OK) return err;
+
+    scan_queue = xQueueCreate(PIPELINE_SCAN_QUEUE_LEN, sizeof(access_event_t));
+    actuate_queue = xQueueCreate(PIPELINE_ACTUATE_QUEUE_LEN, sizeof(access_event_t));
+    if (scan_queue == NULL || actuate_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(actuator_task, "actuator", 3072, NULL, PIPELINE_ACTUATOR_PRIORITY, NULL) != pdPASS
+        || xTaskCreate(auth_task, "auth", 4096, NULL, PIPELINE_AUTH_PRIORITY, NULL) != pdPASS
+        || xTaskCreatePinnedToCore(reader_task, "reader", 4096, NULL, PIPELINE_READER_PRIORITY, NULL,
+            PIPELINE_READER_CORE) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void pipeline_get_stats(pipeline_stats_t* out)
+{
+    *out = stats;
+}
@@ -0,0 +1,65 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "auditlog.h"
+#include "cardcred.h"
+#include "mfrc522.h"
+
+#define PIPELINE_MAX_READERS        4
+
+// A card tap travelling through reader -> authorization -> actuator
+typedef struct {
+    uint8_t uid[10];
+    uint8_t uid_size;
+    uint8_t reader;         // index into pipeline_config_t.readers
+    uint8_t credential;     // cardcred_result_t, read while the card was selected
+    int64_t detected_us;    // UID read complete
+    int64_t decided_us;     // authorization decision made
+} access_event_t;
+
+// Counters for one stage; latency is measured from detected_us
+typedef struct {
+    uint32_t processed;
+    uint32_t dropped;           // input queue of the next stage was full
+    uint32_t max_queue_depth;   // high watermark of this stage's input queue
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+    uint64_t total_latency_us;
+} pipeline_stage_stats_t;
+
+typedef struct {
+    pipeline_stage_stats_t reader;
+    pipeline_stage_stats_t auth;
+    pipeline_stage_stats_t actuator;
+    uint32_t reader_taps[PIPELINE_MAX_READERS];     // taps passed on per reader
+    uint32_t reader_departures[PIPELINE_MAX_READERS];   // held cards taken off the reader
+} pipeline_stats_t;
+
+// Returns the decision and reports what it was based on in *source
+typedef bool (*pipeline_authorize_fn)(uint8_t* uid, uint8_t uid_size, const char* uid_hex,
+    auditlog_source_t* source);
+
+typedef struct {
+    mfrc522_t* readers[PIPELINE_MAX_READERS];   // all scanned by one task, round robin
+    uint8_t reader_count;
+    pipeline_authorize_fn authorize;
+    // cards are also checked with cardcred_verify and refused without a
+    // valid credential (cardcred_init must have succeeded)
+    bool require_credential;
+} pipeline_config_t;
+
+esp_err_t pipeline_start(const pipeline_config_t* config);
+void pipeline_get_stats(pipeline_stats_t* out);
+
+#define PIPELINE_SCAN_QUEUE_LEN     4       // taps waiting for a decision
+#define PIPELINE_ACTUATE_QUEUE_LEN  2       // grants waiting for the door
+#define PIPELINE_DOOR_OPEN_MS       2000
+#define PIPELINE_READER_CORE        1       // keep the reader off the Wi-Fi core
+#define PIPELINE_READER_PRIORITY    6
+#define PIPELINE_AUTH_PRIORITY      5
+#define PIPELINE_ACTUATOR_PRIORITY  7
+
+#endif
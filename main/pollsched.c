@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#if CONFIG_DOOR_POLL_LIGHT_SLEEP
+#include "esp_pm.h"
+#endif
+#include "mfrc522.h"
+#include "pollsched.h"
+
+/** GLOBALS **/
+
+static mfrc522_t* const* readers;     // all switched to their idle state together
+static uint8_t reader_count;
+static uint32_t interval_ms;
+static uint32_t fast_ms = CONFIG_DOOR_POLL_FAST_MS;
+static uint32_t max_ms = CONFIG_DOOR_POLL_MAX_MS;
+static int64_t last_activity_us;
+static int64_t poll_start_us;       // current poll began (reader awake)
+static int64_t field_on_since_us;
+static bool powered_down;
+static int64_t started_us;
+static int64_t last_report_us;
+static pollsched_stats_t stats;
+
+static const char* TAG = "POLLSCHED";
+
+/** FUNCTIONS **/
+
+// Override the Kconfig intervals, e.g. from the provisioned configuration; call before pollsched_init
+void pollsched_configure(uint32_t fast, uint32_t max)
+{
+    fast_ms = fast;
+    max_ms = max > fast ? max : fast;
+}
+
+esp_err_t pollsched_init(mfrc522_t* const* polled, uint8_t count)
+{
+    readers = polled;
+    reader_count = count;
+    int64_t now = esp_timer_get_time();
+    started_us = now;
+    last_report_us = now;
+    field_on_since_us = now;
+    poll_start_us = now;
+    // boot counts as activity, someone may be standing at the door
+    last_activity_us = now;
+    interval_ms = fast_ms;
+
+#if CONFIG_DOOR_POLL_LIGHT_SLEEP
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 40,
+        .light_sleep_enable = true,
+    };
+    return esp_pm_configure(&pm_config);
+#else
+    return ESP_OK;
+#endif
+}
+
+// Bring the reader back before a poll
+void pollsched_wake(void)
+{
+    if (powered_down) {
+        field_on_since_us = esp_timer_get_time();
+        for (uint8_t i = 0; i < reader_count; i++) {
+#if CONFIG_DOOR_POLL_IDLE_POWER_DOWN
+            mfrc522_power_up(readers[i]);
+#elif CONFIG_DOOR_POLL_IDLE_ANTENNA_OFF
+            mfrc522_antenna_on(readers[i]);
+#endif
+        }
+        // let cards in the field power up before REQA
+        vTaskDelay(pdMS_TO_TICKS(POLLSCHED_FIELD_SETTLE_MS) + 1);
+        powered_down = false;
+    }
+    poll_start_us = esp_timer_get_time();
+}
+
+static void report(int64_t now)
+{
+    pollsched_stats_t s;
+    pollsched_get_stats(&s);
+    uint32_t duty_permille = s.elapsed_us ? (uint32_t)(s.field_on_us * 1000 / s.elapsed_us) : 0;
+    uint32_t detect_ms = s.detections ? (uint32_t)(s.total_detect_us / s.detections / 1000) : 0;
+    ESP_LOGI(TAG, "interval %lu ms, field duty %lu.%lu%%, mean time-to-detect %lu ms over %lu taps",
+        s.interval_ms, duty_permille / 10, duty_permille % 10, detect_ms, s.detections);
+    last_report_us = now;
+}
+
+// Account for the poll that just ran, pick the next interval and put the
+// reader into its idle state if that interval is long enough and no card is
+// left on it.
+uint32_t pollsched_sleep(bool card_seen)
+{
+    int64_t now = esp_timer_get_time();
+    stats.polls++;
+
+    if (card_seen) {
+        // a card arriving at a random point in the last interval waits half of it on average
+        stats.detections++;
+        stats.total_detect_us += (uint64_t)interval_ms * 500 + (now - poll_start_us);
+        last_activity_us = now;
+        interval_ms = fast_ms;
+    }
+    else if (now - last_activity_us > (int64_t)CONFIG_DOOR_POLL_ACTIVE_WINDOW_MS * 1000) {
+        uint32_t next = interval_ms * CONFIG_DOOR_POLL_BACKOFF_PERCENT / 100;
+        interval_ms = next > interval_ms ? next : interval_ms + 1;
+        if (interval_ms > max_ms) {
+            interval_ms = max_ms;
+        }
+    }
+
+#if !CONFIG_DOOR_POLL_IDLE_FIELD_ON
+    // a card left on a reader stays halted only while the field stays up;
+    // cycling it would cost an anticollision every poll
+    bool card_held = false;
+    for (uint8_t i = 0; i < reader_count; i++) {
+        card_held |= mfrc522_card_tracked(readers[i]);
+    }
+    if (interval_ms >= CONFIG_DOOR_POLL_POWER_SAVE_MIN_MS && !powered_down && !card_held) {
+        for (uint8_t i = 0; i < reader_count; i++) {
+#if CONFIG_DOOR_POLL_IDLE_POWER_DOWN
+            mfrc522_power_down(readers[i]);
+#else
+            mfrc522_antenna_off(readers[i]);
+#endif
+        }
+        stats.field_on_us += now - field_on_since_us;
+        powered_down = true;
+    }
+#endif
+
+    if (now - last_report_us > (int64_t)POLLSCHED_REPORT_MS * 1000) {
+        report(now);
+    }
+    return interval_ms;
+}
+
+void pollsched_get_stats(pollsched_stats_t* out)
+{
+    int64_t now = esp_timer_get_time();
+    *out = stats;
+    out->interval_ms = interval_ms;
+    out->elapsed_us = now - started_us;
+    if (!powered_down) {
+        out->field_on_us += now - field_on_since_us;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef POLLSCHED_H
+#define POLLSCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mfrc522.h"
+
+// Power and detection figures since pollsched_init
+typedef struct {
+    uint32_t polls;
+    uint32_t detections;
+    uint32_t interval_ms;           // current poll interval
+    uint64_t field_on_us;           // time the RC522 was powered with the field on
+    uint64_t elapsed_us;
+    uint64_t total_detect_us;       // sum of expected arrival-to-detect times
+} pollsched_stats_t;
+
+void pollsched_configure(uint32_t fast_ms, uint32_t max_ms);
+esp_err_t pollsched_init(mfrc522_t* const* readers, uint8_t count);
+void pollsched_wake(void);
+uint32_t pollsched_sleep(bool card_seen);
+void pollsched_get_stats(pollsched_stats_t* out);
+
+#define POLLSCHED_FIELD_SETTLE_MS   5       // cards need the field for a few ms before REQA
+#define POLLSCHED_REPORT_MS         60000
+
+#endif
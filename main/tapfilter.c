@@ -0,0 +1,143 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "tapfilter.h"
+
+/** TYPES **/
+
+typedef struct {
+    uint8_t uid[10];
+    uint8_t uid_size;           // 0 = free slot
+    bool in_flight;             // queued for or under authorization
+    uint8_t denied;             // consecutive denied taps
+    int64_t last_seen_us;
+    int64_t blocked_until_us;
+} tapfilter_entry_t;
+
+/** GLOBALS **/
+
+static tapfilter_entry_t entries[TAPFILTER_SLOTS];
+static SemaphoreHandle_t filter_lock;
+static tapfilter_stats_t stats;
+
+/** FUNCTIONS **/
+
+static tapfilter_entry_t* find(const uint8_t* uid, uint8_t uid_size)
+{
+    for (int i = 0; i < TAPFILTER_SLOTS; i++) {
+        if (entries[i].uid_size == uid_size && memcmp(entries[i].uid, uid, uid_size) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Least recently seen slot, preferring ones without a lookup in flight
+static tapfilter_entry_t* evict(void)
+{
+    tapfilter_entry_t* victim = NULL;
+    for (int i = 0; i < TAPFILTER_SLOTS; i++) {
+        tapfilter_entry_t* e = &entries[i];
+        if (e->uid_size == 0) {
+            return e;
+        }
+        if (victim == NULL || (victim->in_flight && !e->in_flight)
+            || (victim->in_flight == e->in_flight && e->last_seen_us < victim->last_seen_us)) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+esp_err_t tapfilter_init(void)
+{
+    filter_lock = xSemaphoreCreateMutex();
+    return filter_lock != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Called by the reader for every UID read; only TAPFILTER_PASS should be authorized
+tapfilter_result_t tapfilter_check(const uint8_t* uid, uint8_t uid_size)
+{
+    int64_t now = esp_timer_get_time();
+    tapfilter_result_t result = TAPFILTER_PASS;
+
+    xSemaphoreTake(filter_lock, portMAX_DELAY);
+    tapfilter_entry_t* e = find(uid, uid_size);
+    if (e == NULL) {
+        e = evict();
+        memset(e, 0, sizeof(*e));
+        memcpy(e->uid, uid, uid_size);
+        e->uid_size = uid_size;
+    }
+    else if (now < e->blocked_until_us) {
+        result = TAPFILTER_RATE_LIMITED;
+    }
+    else if (e->in_flight) {
+        result = TAPFILTER_COALESCED;
+    }
+    else if (now - e->last_seen_us < (int64_t)CONFIG_DOOR_TAP_DEBOUNCE_MS * 1000) {
+        result = TAPFILTER_DUPLICATE;
+    }
+
+    e->last_seen_us = now;
+    switch (result) {
+    case TAPFILTER_PASS:
+        e->in_flight = true;
+        stats.passed++;
+        break;
+    case TAPFILTER_DUPLICATE:
+        stats.suppressed++;
+        break;
+    case TAPFILTER_COALESCED:
+        stats.coalesced++;
+        break;
+    case TAPFILTER_RATE_LIMITED:
+        stats.rate_limited++;
+        break;
+    }
+    xSemaphoreGive(filter_lock);
+
+    return result;
+}
+
+// Called with the decision for a UID that passed the filter
+void tapfilter_complete(const uint8_t* uid, uint8_t uid_size, bool granted)
+{
+    xSemaphoreTake(filter_lock, portMAX_DELAY);
+    tapfilter_entry_t* e = find(uid, uid_size);
+    if (e != NULL) {
+        e->in_flight = false;
+        if (granted) {
+            e->denied = 0;
+        }
+        else if (e->denied < UINT8_MAX && ++e->denied >= CONFIG_DOOR_TAP_DENY_LIMIT) {
+            // doubles with every further denial
+            int shift = e->denied - CONFIG_DOOR_TAP_DENY_LIMIT;
+            int64_t block_ms = shift < 16 ? (int64_t)CONFIG_DOOR_TAP_DENY_BLOCK_MS << shift : TAPFILTER_MAX_BLOCK_MS;
+            if (block_ms > TAPFILTER_MAX_BLOCK_MS) {
+                block_ms = TAPFILTER_MAX_BLOCK_MS;
+            }
+            e->blocked_until_us = esp_timer_get_time() + block_ms * 1000;
+        }
+    }
+    xSemaphoreGive(filter_lock);
+}
+
+// The tap never reached authorization (e.g. queue full), allow it again
+void tapfilter_abort(const uint8_t* uid, uint8_t uid_size)
+{
+    xSemaphoreTake(filter_lock, portMAX_DELAY);
+    tapfilter_entry_t* e = find(uid, uid_size);
+    if (e != NULL) {
+        e->in_flight = false;
+        e->last_seen_us = 0;
+    }
+    xSemaphoreGive(filter_lock);
+}
+
+void tapfilter_get_stats(tapfilter_stats_t* out)
+{
+    *out = stats;
+}
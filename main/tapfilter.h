@@ -0,0 +1,31 @@
+#ifndef TAPFILTER_H
+#define TAPFILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef enum {
+    TAPFILTER_PASS = 0,         // new tap, authorize it
+    TAPFILTER_DUPLICATE,        // same card seen within the debounce window
+    TAPFILTER_COALESCED,        // a lookup for this card is already in flight
+    TAPFILTER_RATE_LIMITED,     // card was denied too often, ignored for a while
+} tapfilter_result_t;
+
+typedef struct {
+    uint32_t passed;
+    uint32_t suppressed;        // TAPFILTER_DUPLICATE
+    uint32_t coalesced;         // TAPFILTER_COALESCED
+    uint32_t rate_limited;      // TAPFILTER_RATE_LIMITED
+} tapfilter_stats_t;
+
+esp_err_t tapfilter_init(void);
+tapfilter_result_t tapfilter_check(const uint8_t* uid, uint8_t uid_size);
+void tapfilter_complete(const uint8_t* uid, uint8_t uid_size, bool granted);
+void tapfilter_abort(const uint8_t* uid, uint8_t uid_size);
+void tapfilter_get_stats(tapfilter_stats_t* out);
+
+#define TAPFILTER_SLOTS             16      // recently seen UIDs tracked
+#define TAPFILTER_MAX_BLOCK_MS      (5 * 60 * 1000)
+
+#endif
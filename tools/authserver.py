@@ -0,0 +1,675 @@
+#!/usr/bin/env python3
+"""Local stand-in for the door authorization server.
+
+Serves the endpoints the firmware talks to:
+  GET  /uid/<HEX>          200 if allowed, 404 otherwise (keep-alive)
+  GET  /uids/snapshot      sorted accessdb records, X-Db-Version / ETag
+  GET  /uids/delta?since=  always 410, the door falls back to a snapshot
+  POST /audit              audit log batches, 204
+  GET  /ping               204, keeps the door's connection warm
+  GET  /firmware/<DIGEST>  204 when the door runs --firmware already, otherwise a
+                           delta update if DIGEST is a --firmware-base, else a
+                           full compressed update (see otadelta.py)
+  POST /acl/grant/<HEX>    allow a UID, 204; pushed to subscribed doors
+  POST /acl/revoke/<HEX>   refuse a UID, 204; pushed to subscribed doors
+  POST /acl/flush          tell the doors to drop cached decisions and resync, 204
+  UDP  binary protocol     see authproto_request_t in components/authclient/authclient.h
+  MQTT push channel        just enough of an MQTT 3.1.1 broker for doors to subscribe
+                           to door/acl; events are pushproto_event_t in
+                           components/wificonnection/pushchannel.h, signed with --key
+
+The HTTP endpoints are also served over TLS when --tls-cert is given; with
+--tls-ca the server requires a client certificate signed by that CA.
+
+Usage:
+  authserver.py serve --allow 04A1B2C3 --allow 04112233445566 --key secret
+  authserver.py bench --host 127.0.0.1 --key secret --seconds 5
+  authserver.py serve --key secret --tls-cert server.pem --tls-key server.key --tls-ca ca.pem
+  authserver.py tlsbench --ca ca.pem --cert door.pem --key door.key --count 200
+  authserver.py serve --key secret --firmware new.bin --firmware-base old.bin
+  authserver.py pushbench --key secret --doors 200 --count 100
+
+Many doors at once: fleetload in host_test/ (the firmware's own client code).
+
+Test certificates:
+  openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 365 \
+      -subj /CN=door-ca -keyout ca.key -out ca.pem
+  openssl req -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -subj /CN=localhost \
+      -keyout server.key -out server.csr
+  openssl x509 -req -in server.csr -CA ca.pem -CAkey ca.key -days 365 \
+      -extfile <(echo subjectAltName=DNS:localhost,IP:127.0.0.1) -out server.pem
+  (same for door.key / door.pem with /CN=door-1)
+"""
+
+import argparse
+import hashlib
+import hmac
+import http.client
+import os
+import socket
+import ssl
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import otadelta
+
+MAGIC = 0xDA
+VERSION = 1
+CHECK_REQUEST = 0x01
+CHECK_RESPONSE = 0x81
+MAC_LEN = 16
+MAX_UID_LEN = 10
+
+# magic, version, type, uid_len, request_id, uid[10], reserved[2]
+REQUEST = struct.Struct(">BBBBI10s2x")
+# magic, version, type, result, request_id
+RESPONSE = struct.Struct(">BBBBI")
+
+# magic, count, record size, door clock, uptime, boot
+AUDIT_HEADER = struct.Struct("<IHHIIH2x")
+# seq, timestamp, latency, uid, uid_len, granted, source, reader, boot, crc
+AUDIT_RECORD = struct.Struct("<III10sBBBBHI")
+AUDIT_MAGIC = 0x32445541
+CLOCK_VALID_AFTER = 1704067200  # WIFI_TIME_VALID_AFTER, older timestamps count from boot
+
+# magic, version, op, uid_len, seq, db_version, issued_at, uid[10], reserved[2]
+PUSH_EVENT = struct.Struct(">BBBBIII10s2x")
+PUSH_MAGIC = 0xDB
+PUSH_VERSION = 2
+PUSH_GRANT = 0x01
+PUSH_REVOKE = 0x02
+PUSH_FLUSH = 0x03
+PUSH_HEARTBEAT = 0x04
+PUSH_TOPIC = "door/acl"
+HEARTBEAT_S = 30
+
+MQTT_CONNECT = 0x10
+MQTT_CONNACK = 0x20
+MQTT_PUBLISH = 0x30
+MQTT_SUBSCRIBE = 0x80
+MQTT_SUBACK = 0x90
+MQTT_PINGREQ = 0xC0
+MQTT_PINGRESP = 0xD0
+MQTT_DISCONNECT = 0xE0
+
+
+def mac(key, data):
+    return hmac.new(key, data, hashlib.sha256).digest()[:MAC_LEN]
+
+
+def db_record(uid):
+    return bytes([len(uid)]) + uid.ljust(MAX_UID_LEN, b"\0")
+
+
+class AllowList:
+    def __init__(self, uids):
+        self.lock = threading.Lock()
+        self.uids = set(uids)
+        # doors keep pushed changes until they sync a version at least as new,
+        # so versions have to keep growing across restarts
+        self.version = int(time.time())
+
+    def allowed(self, uid):
+        with self.lock:
+            return uid in self.uids
+
+    def change(self, uid, allowed):
+        """The database version that first contains the change"""
+        with self.lock:
+            if allowed:
+                self.uids.add(uid)
+            else:
+                self.uids.discard(uid)
+            self.version += 1
+            return self.version
+
+    def snapshot(self):
+        with self.lock:
+            return self.version, b"".join(sorted(db_record(u) for u in self.uids))
+
+
+class Firmware:
+    """Update files for the doors, built on first request and kept"""
+
+    def __init__(self, image_path, base_paths):
+        self.lock = threading.Lock()
+        self.image = open(image_path, "rb").read() if image_path else None
+        self.digest = otadelta.image_digest(self.image).hex() if self.image else None
+        self.bases = {}
+        for path in base_paths:
+            base = open(path, "rb").read()
+            self.bases[otadelta.image_digest(base).hex()] = base
+        self.updates = {}
+
+    def update_for(self, running_digest):
+        """None when the door is up to date"""
+        if self.image is None or running_digest == self.digest:
+            return None
+        key = running_digest if running_digest in self.bases else "full"
+        with self.lock:
+            if key not in self.updates:
+                self.updates[key] = otadelta.make(self.image, self.bases.get(key))
+            return self.updates[key]
+
+
+def mqtt_packet(kind, body):
+    length = bytearray()
+    n = len(body)
+    while True:
+        n, digit = n >> 7, n & 0x7F
+        length.append(digit | (0x80 if n else 0))
+        if not n:
+            return bytes([kind]) + bytes(length) + body
+
+
+def recv_exact(conn, n):
+    data = b""
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("closed")
+        data += chunk
+    return data
+
+
+def mqtt_read(conn):
+    """(first byte, body) of the next packet"""
+    kind = recv_exact(conn, 1)[0]
+    length = shift = 0
+    while True:
+        digit = recv_exact(conn, 1)[0]
+        length |= (digit & 0x7F) << shift
+        shift += 7
+        if not digit & 0x80:
+            return kind, recv_exact(conn, length)
+
+
+def mqtt_string(s):
+    s = s.encode()
+    return struct.pack(">H", len(s)) + s
+
+
+class PushBroker:
+    """Sends ACL events to every door subscribed to door/acl
+
+    Only this server publishes; PUBLISH packets from clients are dropped.
+    Events go out at QoS 0, doors find lost ones through the sequence number.
+    """
+
+    def __init__(self, key, allow, stats):
+        self.key = key
+        self.allow = allow
+        self.stats = stats
+        self.lock = threading.RLock()
+        self.subscribers = set()
+        self.seq = 0
+
+    def serve(self, sock):
+        while True:
+            conn, _ = sock.accept()
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            threading.Thread(target=self.session, args=(conn,), daemon=True).start()
+
+    def send(self, conn, packet):
+        with self.lock:
+            conn.sendall(packet)
+
+    def session(self, conn):
+        try:
+            while True:
+                kind, body = mqtt_read(conn)
+                if kind & 0xF0 == MQTT_CONNECT:
+                    self.send(conn, mqtt_packet(MQTT_CONNACK, b"\0\0"))
+                elif kind & 0xF0 == MQTT_SUBSCRIBE:
+                    packet_id, pos, codes = body[:2], 2, b""
+                    while pos < len(body):
+                        n = struct.unpack_from(">H", body, pos)[0]
+                        topic = body[pos + 2:pos + 2 + n].decode(errors="replace")
+                        pos += 3 + n
+                        codes += b"\0"     # granted QoS 0
+                        if topic in (PUSH_TOPIC, "door/#", "#"):
+                            with self.lock:
+                                self.subscribers.add(conn)
+                    self.send(conn, mqtt_packet(MQTT_SUBACK, packet_id + codes))
+                elif kind & 0xF0 == MQTT_PINGREQ:
+                    self.send(conn, mqtt_packet(MQTT_PINGRESP, b""))
+                elif kind & 0xF0 == MQTT_DISCONNECT:
+                    break
+        except (ConnectionError, OSError):
+            pass
+        with self.lock:
+            self.subscribers.discard(conn)
+        conn.close()
+
+    def publish(self, op, uid=b"", db_version=0):
+        with self.lock:
+            if op != PUSH_HEARTBEAT:
+                self.seq += 1
+            body = PUSH_EVENT.pack(PUSH_MAGIC, PUSH_VERSION, op, len(uid), self.seq, db_version, int(time.time()), uid)
+            packet = mqtt_packet(MQTT_PUBLISH, mqtt_string(PUSH_TOPIC) + body + mac(self.key, body))
+            for conn in list(self.subscribers):
+                try:
+                    conn.sendall(packet)
+                except OSError:
+                    self.subscribers.discard(conn)
+            self.stats["pushed"] += op != PUSH_HEARTBEAT
+
+    def change(self, uid, allowed):
+        # one lock over both, so sequence numbers and versions grow together
+        with self.lock:
+            version = self.allow.change(uid, allowed)
+        self.publish(PUSH_GRANT if allowed else PUSH_REVOKE, uid, version)
+
+    def heartbeat(self):
+        while True:
+            time.sleep(HEARTBEAT_S)
+            self.publish(PUSH_HEARTBEAT)
+
+
+def audit_time(record, clock, uptime, boot):
+    """Wall-clock time of an audit record, None if the door cannot tell"""
+    timestamp, record_boot = record[1], record[8]
+    if timestamp >= CLOCK_VALID_AFTER:
+        return timestamp
+    # counted from boot: only the boot the door is in now can be rebased
+    if clock and record_boot == boot and timestamp <= uptime:
+        return clock - uptime + timestamp
+    return None
+
+
+def make_http_handler(allow, stats, firmware=None, push=None):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"   # keep-alive, like the real server
+        disable_nagle_algorithm = True  # headers and body go out as separate writes
+
+        def log_message(self, fmt, *args):
+            pass
+
+        def reply(self, status, body=b"", headers=None):
+            self.send_response(status)
+            for k, v in (headers or {}).items():
+                self.send_header(k, v)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_GET(self):
+            stats["http"] += 1
+            if self.path.startswith("/uid/"):
+                try:
+                    uid = bytes.fromhex(self.path[5:])
+                except ValueError:
+                    return self.reply(400)
+                return self.reply(200 if allow.allowed(uid) else 404)
+            if self.path.startswith("/uids/snapshot"):
+                version, body = allow.snapshot()
+                etag = '"v%d"' % version
+                if self.headers.get("If-None-Match") == etag:
+                    return self.reply(304)
+                return self.reply(200, body, {"X-Db-Version": str(version), "ETag": etag,
+                                              "Content-Type": "application/octet-stream"})
+            if self.path.startswith("/uids/delta"):
+                return self.reply(410)
+            if self.path == "/ping":
+                return self.reply(204)
+            if self.path.startswith("/firmware/"):
+                update = firmware.update_for(self.path[10:].lower()) if firmware else None
+                if update is None:
+                    return self.reply(204)
+                stats["firmware"] += 1
+                return self.reply(200, update, {"Content-Type": "application/octet-stream"})
+            self.reply(404)
+
+        def do_POST(self):
+            stats["http"] += 1
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            if self.path.startswith("/acl/") and push is not None:
+                return self.acl(self.path[5:])
+            if self.path != "/audit" or len(body) < AUDIT_HEADER.size:
+                return self.reply(400)
+            magic, count, size, clock, uptime, boot = AUDIT_HEADER.unpack_from(body)
+            if magic != AUDIT_MAGIC or size != AUDIT_RECORD.size or len(body) != AUDIT_HEADER.size + count * size:
+                return self.reply(400)
+            stats["audit"] += count
+            for i in range(count):
+                record = AUDIT_RECORD.unpack_from(body, AUDIT_HEADER.size + i * size)
+                if audit_time(record, clock, uptime, boot) is None:
+                    stats["audit_untimed"] += 1
+            self.reply(204)
+
+        def acl(self, path):
+            if path == "flush":
+                push.publish(PUSH_FLUSH)
+                return self.reply(204)
+            op, _, uid_hex = path.partition("/")
+            try:
+                uid = bytes.fromhex(uid_hex)
+            except ValueError:
+                return self.reply(400)
+            if op not in ("grant", "revoke") or not 0 < len(uid) <= MAX_UID_LEN:
+                return self.reply(400)
+            push.change(uid, op == "grant")
+            self.reply(204)
+
+    return Handler
+
+
+def serve_udp(sock, key, allow, stats):
+    while True:
+        data, addr = sock.recvfrom(64)
+        if len(data) != REQUEST.size + MAC_LEN:
+            continue
+        body, tag = data[:REQUEST.size], data[REQUEST.size:]
+        if not hmac.compare_digest(mac(key, body), tag):
+            continue
+        magic, version, kind, uid_len, request_id, uid = REQUEST.unpack(body)
+        if magic != MAGIC or version != VERSION or kind != CHECK_REQUEST or uid_len > MAX_UID_LEN:
+            continue
+        stats["udp"] += 1
+        result = 1 if allow.allowed(uid[:uid_len]) else 0
+        reply = RESPONSE.pack(MAGIC, VERSION, CHECK_RESPONSE, result, request_id)
+        sock.sendto(reply + mac(key, reply), addr)
+
+
+def cmd_serve(args):
+    uids = list(args.allow)
+    if args.allow_file:
+        with open(args.allow_file) as f:
+            uids += [line.strip() for line in f if line.strip() and not line.startswith("#")]
+    allow = AllowList(bytes.fromhex(u) for u in uids)
+    stats = {"http": 0, "udp": 0, "audit": 0, "audit_untimed": 0, "firmware": 0, "pushed": 0}
+    firmware = Firmware(args.firmware, args.firmware_base) if args.firmware else None
+    push = PushBroker(args.key.encode(), allow, stats)
+
+    httpd = ThreadingHTTPServer((args.bind, args.http_port), make_http_handler(allow, stats, firmware, push))
+    threading.Thread(target=httpd.serve_forever, daemon=True).start()
+
+    mqtt = socket.create_server((args.bind, args.mqtt_port))
+    threading.Thread(target=push.serve, args=(mqtt,), daemon=True).start()
+    threading.Thread(target=push.heartbeat, daemon=True).start()
+
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    udp.bind((args.bind, args.udp_port))
+    threading.Thread(target=serve_udp, args=(udp, args.key.encode(), allow, stats), daemon=True).start()
+
+    if args.tls_cert:
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(args.tls_cert, args.tls_key)
+        if args.tls_ca:
+            ctx.load_verify_locations(args.tls_ca)
+            ctx.verify_mode = ssl.CERT_REQUIRED
+        httpsd = ThreadingHTTPServer((args.bind, args.https_port), make_http_handler(allow, stats, firmware, push))
+        httpsd.socket = ctx.wrap_socket(httpsd.socket, server_side=True)
+        threading.Thread(target=httpsd.serve_forever, daemon=True).start()
+        print("HTTPS on %s:%d%s" % (args.bind, args.https_port, ", client certificate required" if args.tls_ca else ""))
+
+    print("HTTP on %s:%d, UDP on %s:%d, MQTT on %s:%d, %d UIDs allowed" %
+          (args.bind, args.http_port, args.bind, args.udp_port, args.bind, args.mqtt_port, len(allow.uids)))
+    try:
+        while True:
+            time.sleep(10)
+            print("requests: http %(http)d, udp %(udp)d, audit records %(audit)d (%(audit_untimed)d without time), firmware updates %(firmware)d, "
+                  "pushed events %(pushed)d to %(doors)d doors" % dict(stats, doors=len(push.subscribers)))
+    except KeyboardInterrupt:
+        httpd.shutdown()
+
+
+def bench_http(host, port, uid_hex, seconds):
+    conn = http.client.HTTPConnection(host, port, timeout=3)
+    latencies = []
+    end = time.perf_counter() + seconds
+    while time.perf_counter() < end:
+        start = time.perf_counter()
+        conn.request("GET", "/uid/" + uid_hex)
+        conn.getresponse().read()
+        latencies.append(time.perf_counter() - start)
+    conn.close()
+    return latencies
+
+
+def bench_udp(host, port, key, uid, seconds):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(0.3)
+    sock.connect((host, port))
+    request_id = struct.unpack(">I", os.urandom(4))[0]
+    latencies = []
+    end = time.perf_counter() + seconds
+    while time.perf_counter() < end:
+        request_id = (request_id + 1) & 0xFFFFFFFF
+        body = REQUEST.pack(MAGIC, VERSION, CHECK_REQUEST, len(uid), request_id, uid)
+        start = time.perf_counter()
+        sock.send(body + mac(key, body))
+        try:
+            reply = sock.recv(64)
+        except socket.timeout:
+            continue
+        if RESPONSE.unpack_from(reply)[4] == request_id:
+            latencies.append(time.perf_counter() - start)
+    sock.close()
+    return latencies
+
+
+def tls_context(args):
+    ctx = ssl.create_default_context(cafile=args.ca)
+    if args.cert:
+        ctx.load_cert_chain(args.cert, args.key)
+    if not args.tls13:
+        ctx.maximum_version = ssl.TLSVersion.TLSv1_2   # what the door's mbedTLS negotiates
+    return ctx
+
+
+def tls_get(sock, host, path):
+    sock.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path, host)).encode())
+    resp = http.client.HTTPResponse(sock)
+    resp.begin()
+    resp.read()
+    return resp.status
+
+
+# Fresh connection per lookup: returns (handshake, total) latencies and how
+# many handshakes the server resumed
+def bench_tls_connect(ctx, host, port, path, count, resume):
+    session = None
+    handshakes, totals, resumed = [], [], 0
+    for _ in range(count):
+        start = time.perf_counter()
+        raw = socket.create_connection((host, port), timeout=3)
+        raw.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        sock = ctx.wrap_socket(raw, server_hostname=host, session=session if resume else None)
+        handshakes.append(time.perf_counter() - start)
+        tls_get(sock, host, path)
+        totals.append(time.perf_counter() - start)
+        resumed += sock.session_reused
+        session = sock.session      # TLS 1.3 tickets arrive after the first response
+        sock.close()
+    return handshakes, totals, resumed
+
+
+def bench_tls_keepalive(ctx, host, port, path, count):
+    sock = ctx.wrap_socket(socket.create_connection((host, port), timeout=3), server_hostname=host)
+    tls_get(sock, host, path)
+    latencies = []
+    for _ in range(count):
+        start = time.perf_counter()
+        tls_get(sock, host, path)
+        latencies.append(time.perf_counter() - start)
+    sock.close()
+    return latencies
+
+
+def report_us(name, latencies):
+    latencies = sorted(latencies)
+    pct = lambda p: latencies[min(len(latencies) - 1, int(len(latencies) * p))] * 1e6
+    print("%-22s p50 %7.0f us   p99 %7.0f us" % (name, pct(0.5), pct(0.99)))
+
+
+def cmd_tlsbench(args):
+    ctx = tls_context(args)
+    path = "/uid/" + args.uid
+    for resume in (False, True):
+        handshakes, totals, resumed = bench_tls_connect(ctx, args.host, args.port, path, args.count, resume)
+        name = "resumed" if resume else "full"
+        report_us(name + " handshake", handshakes)
+        report_us(name + " lookup", totals)
+        if resume:
+            print("%d of %d handshakes resumed" % (resumed, args.count))
+    report_us("keep-alive lookup", bench_tls_keepalive(ctx, args.host, args.port, path, args.count))
+
+
+def report(name, latencies, seconds):
+    if not latencies:
+        print("%-5s no responses" % name)
+        return
+    latencies.sort()
+    pct = lambda p: latencies[min(len(latencies) - 1, int(len(latencies) * p))] * 1e6
+    print("%-5s %8.0f req/s   p50 %6.0f us   p99 %6.0f us" %
+          (name, len(latencies) / seconds, pct(0.5), pct(0.99)))
+
+
+class PushSubscriber:
+    """One door's subscription: checks every event and notes when it arrived"""
+
+    def __init__(self, host, port, key, client_id):
+        self.key = key
+        self.conn = socket.create_connection((host, port), timeout=5)
+        self.conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        connect = mqtt_string("MQTT") + bytes([4, 0x02]) + struct.pack(">H", 60) + mqtt_string(client_id)
+        self.conn.sendall(mqtt_packet(MQTT_CONNECT, connect))
+        if mqtt_read(self.conn)[0] != MQTT_CONNACK:
+            raise ConnectionError("no CONNACK")
+        self.conn.sendall(mqtt_packet(MQTT_SUBSCRIBE | 0x02, struct.pack(">H", 1) + mqtt_string(PUSH_TOPIC) + b"\1"))
+        if mqtt_read(self.conn)[0] != MQTT_SUBACK:
+            raise ConnectionError("no SUBACK")
+        self.arrivals = {}      # seq -> perf_counter
+        self.last_seq = None
+        self.gaps = self.rejected = 0
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def run(self):
+        try:
+            while True:
+                kind, body = mqtt_read(self.conn)
+                now = time.perf_counter()
+                if kind & 0xF0 != MQTT_PUBLISH:
+                    continue
+                n = struct.unpack_from(">H", body)[0]
+                event = body[2 + n:]
+                payload, tag = event[:PUSH_EVENT.size], event[PUSH_EVENT.size:]
+                if len(tag) != MAC_LEN or not hmac.compare_digest(mac(self.key, payload), tag):
+                    self.rejected += 1
+                    continue
+                magic, version, op, uid_len, seq, db_version, issued_at, uid = PUSH_EVENT.unpack(payload)
+                if op == PUSH_HEARTBEAT:
+                    continue
+                if self.last_seq is not None and seq != self.last_seq + 1:
+                    self.gaps += 1
+                self.last_seq = seq
+                self.arrivals[seq] = now
+        except (ConnectionError, OSError):
+            pass
+
+
+# Time from the admin request until every subscribed door has the event
+def cmd_pushbench(args):
+    key = args.key.encode()
+    doors = [PushSubscriber(args.host, args.mqtt_port, key, "bench-%d" % i) for i in range(args.doors)]
+    conn = http.client.HTTPConnection(args.host, args.http_port, timeout=3)
+    uid_hex = args.uid
+    sent = []
+    for i in range(args.count):
+        op = "revoke" if i % 2 == 0 else "grant"
+        start = time.perf_counter()
+        conn.request("POST", "/acl/%s/%s" % (op, uid_hex), body=b"")
+        conn.getresponse().read()
+        sent.append(start)
+        time.sleep(args.interval)
+    time.sleep(0.5)
+    conn.close()
+
+    # sequence numbers continue from earlier changes, the first one seen is sent[0]
+    seen = [min(d.arrivals) for d in doors if d.arrivals]
+    base = min(seen) if seen else 0
+    latencies, fanout = [], []
+    for i, start in enumerate(sent):
+        arrived = [d.arrivals[base + i] - start for d in doors if base + i in d.arrivals]
+        latencies += arrived
+        if len(arrived) == len(doors):
+            fanout.append(max(arrived))
+    missing = args.count * len(doors) - len(latencies)
+    print("%d doors, %d events, %d deliveries missing, %d gaps, %d rejected" %
+          (len(doors), args.count, missing, sum(d.gaps for d in doors), sum(d.rejected for d in doors)))
+    if not latencies:
+        return 1
+    report_us("per door delivery", latencies)
+    if fanout:
+        report_us("last door reached", fanout)
+    return 0
+
+
+def cmd_bench(args):
+    uid = bytes.fromhex(args.uid)
+    report("http", bench_http(args.host, args.http_port, args.uid, args.seconds), args.seconds)
+    report("udp", bench_udp(args.host, args.udp_port, args.key.encode(), uid, args.seconds), args.seconds)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    serve = sub.add_parser("serve", help="run the stand-in server")
+    serve.add_argument("--bind", default="0.0.0.0")
+    serve.add_argument("--allow", action="append", default=[], metavar="HEX", help="allowed UID, repeatable")
+    serve.add_argument("--allow-file", metavar="FILE", help="allowed UIDs, one hex UID per line")
+    serve.add_argument("--key", required=True, help="shared key of the binary protocol (auth_key)")
+    serve.add_argument("--http-port", type=int, default=8000)
+    serve.add_argument("--udp-port", type=int, default=8001)
+    serve.add_argument("--https-port", type=int, default=8443)
+    serve.add_argument("--mqtt-port", type=int, default=1883)
+    serve.add_argument("--tls-cert", help="server certificate chain (PEM), enables HTTPS")
+    serve.add_argument("--tls-key", help="server private key (PEM)")
+    serve.add_argument("--tls-ca", help="require client certificates signed by this CA")
+    serve.add_argument("--firmware", metavar="BIN", help="image the doors should run")
+    serve.add_argument("--firmware-base", action="append", default=[], metavar="BIN",
+                       help="image doors may run now, served a delta; repeatable")
+    serve.set_defaults(func=cmd_serve)
+
+    bench = sub.add_parser("bench", help="compare HTTP GET and binary UDP lookups")
+    bench.add_argument("--host", default="127.0.0.1")
+    bench.add_argument("--key", required=True)
+    bench.add_argument("--uid", default="04A1B2C3")
+    bench.add_argument("--seconds", type=float, default=5)
+    bench.add_argument("--http-port", type=int, default=8000)
+    bench.add_argument("--udp-port", type=int, default=8001)
+    bench.set_defaults(func=cmd_bench)
+
+    pushbench = sub.add_parser("pushbench", help="latency of pushed revocations to many subscribed doors")
+    pushbench.add_argument("--host", default="127.0.0.1")
+    pushbench.add_argument("--key", required=True)
+    pushbench.add_argument("--uid", default="04A1B2C3", help="revoked and granted in turn")
+    pushbench.add_argument("--doors", type=int, default=50)
+    pushbench.add_argument("--count", type=int, default=100)
+    pushbench.add_argument("--interval", type=float, default=0.01, help="seconds between changes")
+    pushbench.add_argument("--http-port", type=int, default=8000)
+    pushbench.add_argument("--mqtt-port", type=int, default=1883)
+    pushbench.set_defaults(func=cmd_pushbench)
+
+    tlsbench = sub.add_parser("tlsbench", help="full vs resumed TLS handshakes vs a kept-alive connection")
+    tlsbench.add_argument("--host", default="localhost")
+    tlsbench.add_argument("--port", type=int, default=8443)
+    tlsbench.add_argument("--ca", required=True, help="CA that signed the server certificate")
+    tlsbench.add_argument("--cert", help="client certificate (PEM) for mutual TLS")
+    tlsbench.add_argument("--key", help="client private key (PEM)")
+    tlsbench.add_argument("--uid", default="04A1B2C3")
+    tlsbench.add_argument("--count", type=int, default=200)
+    tlsbench.add_argument("--tls13", action="store_true", help="allow TLS 1.3 (the door uses 1.2)")
+    tlsbench.set_defaults(func=cmd_tlsbench)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
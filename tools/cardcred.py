@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Issue card credentials for the signed-credential access mode.
+
+Prints what an NFC writer has to put on a MIFARE Classic card: the two
+credential blocks and the sector trailer with the site-derived key A. The
+format matches cardcred_record_t in components/cardcred/cardcred.h.
+
+Usage:
+  cardcred.py issue --site-key secret --uid 04A1B2C3 --sak 08 --id 1001 --days 365
+  cardcred.py verify --site-key secret --uid 04A1B2C3 --blocks <64 hex chars>
+"""
+
+import argparse
+import hashlib
+import hmac
+import struct
+import sys
+import time
+
+MAGIC = b"DC"
+VERSION = 1
+MAC_LEN = 16
+LABEL_SECTOR_KEY = b"K"
+LABEL_MAC = b"C"
+# magic, version, flags, credential_id, not_before, not_after
+HEADER = struct.Struct("<2sBBIII")
+# transport access bits: key A reads/writes data, key B unused
+TRAILER_ACCESS = bytes.fromhex("FF078069")
+
+
+def site_hmac(key, label, data):
+    return hmac.new(key, label + data, hashlib.sha256).digest()
+
+
+def sector_key(key, sak):
+    return site_hmac(key, LABEL_SECTOR_KEY, bytes([sak]))[:6]
+
+
+def record(key, uid, credential_id, not_before, not_after):
+    header = HEADER.pack(MAGIC, VERSION, 0, credential_id, not_before, not_after)
+    return header + site_hmac(key, LABEL_MAC, uid + header)[:MAC_LEN]
+
+
+def cmd_issue(args):
+    key = args.site_key.encode()
+    uid = bytes.fromhex(args.uid)
+    sak = int(args.sak, 16)
+    now = int(time.time())
+    not_after = now + args.days * 86400 if args.days else 0
+    rec = record(key, uid, args.id, now, not_after)
+    key_a = sector_key(key, sak)
+
+    first = args.sector * 4
+    print("sector %d, key A %s" % (args.sector, key_a.hex().upper()))
+    print("block %d: %s" % (first, rec[:16].hex().upper()))
+    print("block %d: %s" % (first + 1, rec[16:].hex().upper()))
+    print("block %d: %s  (trailer, write last)" %
+          (first + 3, (key_a + TRAILER_ACCESS + bytes(6)).hex().upper()))
+
+
+def cmd_verify(args):
+    key = args.site_key.encode()
+    uid = bytes.fromhex(args.uid)
+    blocks = bytes.fromhex(args.blocks)
+    magic, version, _, credential_id, not_before, not_after = HEADER.unpack_from(blocks)
+    expected = site_hmac(key, LABEL_MAC, uid + blocks[:HEADER.size])[:MAC_LEN]
+    ok = magic == MAGIC and version == VERSION and hmac.compare_digest(expected, blocks[HEADER.size:HEADER.size + MAC_LEN])
+    print("credential %d valid %s..%s: %s" % (credential_id,
+          time.strftime("%Y-%m-%d", time.gmtime(not_before)),
+          time.strftime("%Y-%m-%d", time.gmtime(not_after)) if not_after else "never",
+          "MAC ok" if ok else "INVALID"))
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    issue = sub.add_parser("issue", help="credential blocks and trailer for one card")
+    issue.add_argument("--site-key", required=True, help="card_key of the site")
+    issue.add_argument("--uid", required=True, metavar="HEX")
+    issue.add_argument("--sak", default="08", help="SAK of the card, hex (08 = Classic 1K)")
+    issue.add_argument("--sector", type=int, default=1, choices=range(1, 16))
+    issue.add_argument("--id", type=int, required=True, help="credential serial")
+    issue.add_argument("--days", type=int, default=0, help="validity, 0 = no expiry")
+    issue.set_defaults(func=cmd_issue)
+
+    verify = sub.add_parser("verify", help="check two blocks read from a card")
+    verify.add_argument("--site-key", required=True)
+    verify.add_argument("--uid", required=True, metavar="HEX")
+    verify.add_argument("--blocks", required=True, help="the two credential blocks, hex")
+    verify.set_defaults(func=cmd_verify)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
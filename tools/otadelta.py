@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+"""Build, apply and measure door firmware update files.
+
+An update file is a header followed by a zlib stream (see otaupdate.h):
+  header   "DOTA", version, kind, image size, SHA-256 of the new image, and
+           for a delta the SHA-256 digest appended to the image it was made
+           against (what esp_partition_get_sha256 returns on the door)
+  full     the zlib stream is the image itself
+  delta    the zlib stream is a list of operations that rebuild the new image
+           from the running one, bsdiff style:
+             ADD  src, len, len bytes: new = old[src + i] + byte (mod 256)
+             DATA len, len bytes: new bytes
+           Code that only moved or had addresses shifted turns into ADD runs
+           of mostly zero bytes, which deflate shrinks to almost nothing.
+
+Usage:
+  otadelta.py make build/esp32card.bin -o full.dota
+  otadelta.py make new.bin --base old.bin -o delta.dota
+  otadelta.py apply delta.dota --base old.bin -o rebuilt.bin
+  otadelta.py bench build/esp32card.bin [new.bin]
+
+bench makes full and delta files, applies them and checks the result. With no
+second image it derives a synthetic next build from the first: code inserted
+in the middle, flash addresses behind it shifted, a word in every thousand
+bytes recompiled, a new app descriptor.
+"""
+
+import argparse
+import hashlib
+import random
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"DOTA"
+VERSION = 1
+KIND_FULL = 0
+KIND_DELTA = 1
+# magic, version, kind, reserved, image size, image SHA-256, source digest
+HEADER = struct.Struct("<4sBBHI32s32s")
+# op, source offset, length
+OP = struct.Struct("<BII")
+OP_ADD = 1
+OP_DATA = 2
+
+BLOCK = 16          # seed length of a match
+MIN_MATCH = 32      # shorter matches go out as DATA
+GIVE_UP = 256       # stop extending after this many bytes without improvement
+ESP_IMAGE_MAGIC = 0xE9
+
+
+def image_digest(image):
+    """The SHA-256 the bootloader appends to an image and the door reports"""
+    if image[0] != ESP_IMAGE_MAGIC:
+        raise ValueError("not an ESP app image")
+    digest = image[-32:]
+    if hashlib.sha256(image[:-32]).digest() != digest:
+        raise ValueError("image has no appended SHA-256")
+    return digest
+
+
+def extend(old, src, new, pos):
+    """Length of the approximate match old[src:] ~ new[pos:], bsdiff scoring"""
+    limit = min(len(old) - src, len(new) - pos)
+    matched = best_score = best_len = i = 0
+    while i < limit and i - best_len < GIVE_UP:
+        n = min(64, limit - i)
+        if old[src + i:src + i + n] == new[pos + i:pos + i + n]:
+            matched += n
+            i += n
+        else:
+            matched += old[src + i] == new[pos + i]
+            i += 1
+        # a byte more is worth it while at least half the bytes match
+        score = 2 * matched - i
+        if score > best_score:
+            best_score, best_len = score, i
+    return best_len
+
+
+def make_delta_ops(old, new):
+    index = {}
+    for i in range(len(old) - BLOCK, -1, -4):
+        index[old[i:i + BLOCK]] = i
+    ops = bytearray()
+    literal = bytearray()
+
+    def flush_literal():
+        if literal:
+            ops.extend(OP.pack(OP_DATA, 0, len(literal)) + literal)
+            literal.clear()
+
+    pos = 0
+    next_src = None     # where the previous match would continue
+    while pos < len(new):
+        src = None
+        length = 0
+        # the previous alignment often continues past a changed word
+        if next_src is not None and next_src < len(old):
+            length = extend(old, next_src, new, pos)
+            src = next_src if length >= MIN_MATCH else None
+        if src is None:
+            candidate = index.get(new[pos:pos + BLOCK])
+            if candidate is not None:
+                length = extend(old, candidate, new, pos)
+                src = candidate if length >= MIN_MATCH else None
+        if src is None:
+            literal.append(new[pos])
+            pos += 1
+            if next_src is not None:
+                next_src += 1
+            continue
+
+        flush_literal()
+        diff = bytes((new[pos + i] - old[src + i]) & 0xFF for i in range(length))
+        ops.extend(OP.pack(OP_ADD, src, length) + diff)
+        pos += length
+        next_src = src + length
+    flush_literal()
+    return bytes(ops)
+
+
+def apply_delta_ops(old, ops):
+    out = bytearray()
+    i = 0
+    while i < len(ops):
+        op, src, length = OP.unpack_from(ops, i)
+        i += OP.size
+        payload = ops[i:i + length]
+        i += length
+        if op == OP_ADD:
+            if src + length > len(old):
+                raise ValueError("ADD beyond the base image")
+            out.extend((old[src + k] + payload[k]) & 0xFF for k in range(length))
+        elif op == OP_DATA:
+            out.extend(payload)
+        else:
+            raise ValueError("unknown op %d" % op)
+    return bytes(out)
+
+
+def make(new, base=None, level=9):
+    if base is None:
+        header = HEADER.pack(MAGIC, VERSION, KIND_FULL, 0, len(new), hashlib.sha256(new).digest(), bytes(32))
+        return header + zlib.compress(new, level)
+    header = HEADER.pack(MAGIC, VERSION, KIND_DELTA, 0, len(new), hashlib.sha256(new).digest(), image_digest(base))
+    return header + zlib.compress(make_delta_ops(base, new), level)
+
+
+def apply(update, base=None):
+    magic, version, kind, _, size, sha, source = HEADER.unpack_from(update)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a door update file")
+    payload = zlib.decompress(update[HEADER.size:])
+    if kind == KIND_DELTA:
+        if base is None or image_digest(base) != source:
+            raise ValueError("delta was made against a different image")
+        payload = apply_delta_ops(base, payload)
+    if len(payload) != size or hashlib.sha256(payload).digest() != sha:
+        raise ValueError("rebuilt image does not match")
+    return payload
+
+
+def synthetic_next_build(image, inserted=1536, seed=7):
+    """A plausible next build: new code in the middle, pointers behind it moved"""
+    body = bytearray(image[:-32])
+    at = len(body) * 2 // 5 & ~3
+    filler = hashlib.sha256(bytes([seed])).digest()
+    body[at:at] = (filler * (inserted // 32 + 1))[:inserted]
+    # flash-mapped code (IROM) and constants (DROM) past the insertion point
+    for i in range(at + inserted, len(body) - 3, 4):
+        word = struct.unpack_from("<I", body, i)[0]
+        if 0x400D0000 + at <= word < 0x40400000 or 0x3F400000 + at <= word < 0x3F800000:
+            struct.pack_into("<I", body, i, word + inserted)
+    # scattered recompiled words: register allocation, literal pools
+    rng = random.Random(seed)
+    for _ in range(len(body) // 1000):
+        i = rng.randrange(0, len(body) - 4) & ~3
+        body[i:i + 4] = rng.randbytes(4)
+    # app descriptor: build time and ELF SHA-256
+    body[0x20 + 0x30:0x20 + 0x50] = hashlib.sha256(b"next build").digest()
+    # keep the image length a multiple of 16, as esptool pads it
+    body.extend(bytes(-len(body) % 16))
+    return bytes(body) + hashlib.sha256(body).digest()
+
+
+def cmd_make(args):
+    new = open(args.image, "rb").read()
+    base = open(args.base, "rb").read() if args.base else None
+    update = make(new, base)
+    open(args.output, "wb").write(update)
+    print("%s: %d bytes, %.1f%% of the %d byte image" % (args.output, len(update), 100 * len(update) / len(new), len(new)))
+
+
+def cmd_apply(args):
+    update = open(args.update, "rb").read()
+    base = open(args.base, "rb").read() if args.base else None
+    image = apply(update, base)
+    open(args.output, "wb").write(image)
+    print("%s: %d bytes, SHA-256 verified" % (args.output, len(image)))
+
+
+def cmd_bench(args):
+    old = open(args.old, "rb").read()
+    if args.new:
+        new = open(args.new, "rb").read()
+        label = args.new
+    else:
+        new = synthetic_next_build(old)
+        label = "synthetic next build"
+    image_digest(old)
+
+    print("base %s: %d bytes" % (args.old, len(old)))
+    print("new  %s: %d bytes" % (label, len(new)))
+    for name, base in (("full", None), ("delta", old)):
+        start = time.perf_counter()
+        update = make(new, base)
+        made = time.perf_counter() - start
+        if apply(update, base) != new:
+            print("%s: rebuilt image differs" % name)
+            return 1
+        print("%-5s %8d bytes  %5.1f%% of raw  made in %.1f s, applied and verified" %
+              (name, len(update), 100 * len(update) / len(new), made))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("make", help="build a full or delta update file")
+    p.add_argument("image")
+    p.add_argument("--base", help="image the doors run now; makes a delta")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(func=cmd_make)
+
+    p = sub.add_parser("apply", help="rebuild the image from an update file, as the door does")
+    p.add_argument("update")
+    p.add_argument("--base")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(func=cmd_apply)
+
+    p = sub.add_parser("bench", help="check round trips and compare update sizes")
+    p.add_argument("old")
+    p.add_argument("new", nargs="?")
+    p.set_defaults(func=cmd_bench)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())